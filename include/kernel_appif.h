@@ -69,14 +69,20 @@ enum kernel_appout_type {
   KERNEL_APPOUT_LISTEN_CLOSE,
   KERNEL_APPOUT_ACCEPT_CONN,
   KERNEL_APPOUT_REQ_SCALE,
+  KERNEL_APPOUT_SET_RATE,
+  KERNEL_APPOUT_CONN_PRIO,
+  KERNEL_APPOUT_CTX_PRIO,
+  KERNEL_APPOUT_CONN_RATE,
 };
 
-/** Open a new connection */
+#define KERNEL_APPOUT_OPEN_IP6 0x1
+/** Open a new connection, to remote_ip6 if KERNEL_APPOUT_OPEN_IP6 is set */
 struct kernel_appout_conn_open {
   uint64_t opaque;
   uint32_t remote_ip;
   uint32_t flags;
   uint16_t remote_port;
+  uint8_t remote_ip6[16];
 } __attribute__((packed));
 
 #define KERNEL_APPOUT_CLOSE_RESET 0x1
@@ -127,6 +133,42 @@ struct kernel_appout_req_scale {
   uint32_t num_cores;
 } __attribute__((packed));
 
+#define KERNEL_APPOUT_RATE_TENANT 0x1
+/** Set aggregate transmit rate limit (kbps, 0 for no limit) of the app and
+ * assign it to a tenant group, or with KERNEL_APPOUT_RATE_TENANT set the rate
+ * limit of the tenant group. Ignored unless the app runs as root. */
+struct kernel_appout_set_rate {
+  uint32_t rate;
+  uint16_t tenant;
+  uint8_t  flags;
+} __attribute__((packed));
+
+/** Set traffic class of connection, higher classes are served first */
+struct kernel_appout_conn_prio {
+  uint64_t opaque;
+  uint32_t remote_ip;
+  uint32_t local_ip;
+  uint16_t remote_port;
+  uint16_t local_port;
+  uint8_t  tc;
+} __attribute__((packed));
+
+/** Set traffic class of context and connections opened on it from now on */
+struct kernel_appout_ctx_prio {
+  uint8_t  tc;
+} __attribute__((packed));
+
+/** Cap transmit rate of connection (kbps, 0 for no cap), the connection is
+ * paced at the lower of this and its congestion control rate */
+struct kernel_appout_conn_rate {
+  uint64_t opaque;
+  uint32_t remote_ip;
+  uint32_t local_ip;
+  uint16_t remote_port;
+  uint16_t local_port;
+  uint32_t rate;
+} __attribute__((packed));
+
 /** Common struct for events on kernel -> app queue */
 struct kernel_appout {
   union {
@@ -139,6 +181,10 @@ struct kernel_appout {
     struct kernel_appout_accept_conn  accept_conn;
 
     struct kernel_appout_req_scale    req_scale;
+    struct kernel_appout_set_rate     set_rate;
+    struct kernel_appout_conn_prio    conn_prio;
+    struct kernel_appout_ctx_prio     ctx_prio;
+    struct kernel_appout_conn_rate    conn_rate;
 
     uint8_t raw[63];
   } __attribute__((packed)) data;
@@ -185,14 +231,19 @@ struct kernel_appin_conn_opened {
   uint16_t fn_core;
 } __attribute__((packed));
 
-/** New connection on listener received */
+#define KERNEL_APPIN_NEWCONN_IP6 0x1
+/** New connection on listener received, from remote_ip6 if
+ * KERNEL_APPIN_NEWCONN_IP6 is set */
 struct kernel_appin_listen_newconn {
   uint64_t opaque;
   uint32_t remote_ip;
   uint16_t remote_port;
+  uint8_t  flags;
+  uint8_t  remote_ip6[16];
 } __attribute__((packed));
 
-/** Accepted connection on listener */
+/** Accepted connection on listener, IPv6 connections have local_ip and
+ * remote_ip 0 (the peer address is reported in listen_newconn) */
 struct kernel_appin_accept_conn {
   uint64_t opaque;
   uint64_t rx_off;
@@ -36,6 +36,7 @@
 
 #define ETH_TYPE_IP   0x0800
 #define ETH_TYPE_ARP  0x0806
+#define ETH_TYPE_IPV6 0x86DD
 
 struct eth_addr {
   uint8_t addr[ETH_ADDR_LEN];
@@ -69,6 +70,7 @@ struct eth_hdr {
 #define IP_PROTO_UDPLITE 136
 #define IP_PROTO_TCP     6
 #define IP_PROTO_DCCP	 33
+#define IP_PROTO_ICMPV6  58
 
 #define IP_ECN_NONE      0x0
 #define IP_ECN_ECT0      0x2
@@ -99,6 +101,76 @@ struct ip_hdr {
   ip_addr_t dest;
 } __attribute__ ((packed));
 
+/******************************************************************************/
+/* IPv6 */
+
+#define IP6H_V(hdr)   (f_beui32((hdr)->vtc_flow) >> 28)
+#define IP6H_TC(hdr)  ((f_beui32((hdr)->vtc_flow) >> 20) & 0xff)
+#define IP6H_ECN(hdr) ((f_beui32((hdr)->vtc_flow) >> 20) & 0x3)
+
+#define IP6H_VTCFL_SET(hdr, v, tc, fl) \
+    (hdr)->vtc_flow = t_beui32(((v) << 28) | ((tc) << 20) | (fl))
+#define IP6H_ECN_SET(hdr, e) \
+    (hdr)->vtc_flow = t_beui32((f_beui32((hdr)->vtc_flow) & ~(0x3U << 20)) | \
+        ((e) << 20))
+
+#define IP6_HLEN 40
+
+#define IP6_ADDR_LEN 16
+
+typedef struct ip6_addr {
+  uint8_t addr[IP6_ADDR_LEN];
+} __attribute__ ((packed)) ip6_addr_t;
+
+struct ip6_hdr {
+  /* version / traffic class / flow label */
+  beui32_t vtc_flow;
+  /* payload length, excluding this header */
+  beui16_t len;
+  /* next header */
+  uint8_t next_hdr;
+  /* hop limit */
+  uint8_t hop_limit;
+  /* source and destination IP addresses */
+  ip6_addr_t src;
+  ip6_addr_t dest;
+} __attribute__ ((packed));
+
+/******************************************************************************/
+/* ICMPv6 neighbor discovery */
+
+#define ICMP6_TYPE_NS 135
+#define ICMP6_TYPE_NA 136
+
+#define ND_OPT_SRC_LLADDR 1
+#define ND_OPT_TGT_LLADDR 2
+
+#define ND_NA_FLAG_SOLICITED 0x40000000
+#define ND_NA_FLAG_OVERRIDE  0x20000000
+
+/* ND messages are only accepted with this hop limit (RFC 4861) */
+#define ND_HOP_LIMIT 255
+
+struct icmp6_hdr {
+  uint8_t type;
+  uint8_t code;
+  uint16_t chksum;
+} __attribute__ ((packed));
+
+/* neighbor solicitation or advertisement, flags are reserved for NS */
+struct nd_msg {
+  struct icmp6_hdr icmp;
+  beui32_t flags;
+  ip6_addr_t target;
+} __attribute__ ((packed));
+
+/* source or target link-layer address option, len in units of 8 bytes */
+struct nd_opt_lladdr {
+  uint8_t type;
+  uint8_t len;
+  struct eth_addr addr;
+} __attribute__ ((packed));
+
 /******************************************************************************/
 /* ARP */
 
@@ -169,6 +241,9 @@ struct tcp_hdr {
 #define TCP_OPT_END_OF_OPTIONS 0
 #define TCP_OPT_NO_OP 1
 #define TCP_OPT_MSS 2
+#define TCP_OPT_WSCALE 3
+#define TCP_OPT_SACK_PERM 4
+#define TCP_OPT_SACK 5
 #define TCP_OPT_TIMESTAMP 8
 struct tcp_mss_opt {
   uint8_t kind;
@@ -184,6 +259,31 @@ struct tcp_timestamp_opt {
   beui32_t ts_ecr;
 } __attribute__((packed));
 
+struct tcp_wscale_opt {
+  uint8_t kind;
+  uint8_t length;
+  uint8_t shift;
+} __attribute__((packed));
+
+/** Maximum window scale shift (RFC 7323) */
+#define TCP_WSCALE_MAX 14
+
+struct tcp_sack_perm_opt {
+  uint8_t kind;
+  uint8_t length;
+} __attribute__((packed));
+
+struct tcp_sack_block {
+  beui32_t left;
+  beui32_t right;
+} __attribute__((packed));
+
+struct tcp_sack_opt {
+  uint8_t kind;
+  uint8_t length;
+  struct tcp_sack_block blocks[];
+} __attribute__((packed));
+
 
 /******************************************************************************/
 /* Object framing */
@@ -218,4 +318,22 @@ struct pkt_tcp {
   struct tcp_hdr tcp;
 } __attribute__ ((packed));
 
+struct pkt_ip6 {
+  struct eth_hdr eth;
+  struct ip6_hdr ip6;
+} __attribute__ ((packed));
+
+struct pkt_tcp6 {
+  struct eth_hdr eth;
+  struct ip6_hdr ip6;
+  struct tcp_hdr tcp;
+} __attribute__ ((packed));
+
+struct pkt_nd {
+  struct eth_hdr eth;
+  struct ip6_hdr ip6;
+  struct nd_msg nd;
+  struct nd_opt_lladdr opt;
+} __attribute__ ((packed));
+
 #endif
@@ -25,6 +25,7 @@
 #ifndef FLEXTCP_PLIF_H_
 #define FLEXTCP_PLIF_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include <utils.h>
 #include <packet_defs.h>
@@ -104,6 +105,16 @@ STATIC_ASSERT(sizeof(struct flextcp_pl_krx) == 64, krx_size);
 #define FLEXTCP_PL_KTX_PACKET 0x1
 #define FLEXTCP_PL_KTX_CONNRETRAN 0x2
 #define FLEXTCP_PL_KTX_PACKET_NOTS 0x3
+#define FLEXTCP_PL_KTX_CONNSETRATE 0x4
+#define FLEXTCP_PL_KTX_CONNMOVE 0x5
+#define FLEXTCP_PL_KTX_CONNDISABLE 0x6
+#define FLEXTCP_PL_KTX_CONNSETTC 0x7
+/** Set while a flow request forwarded to the flow's owner core is in flight,
+ * the owner releases the entry */
+#define FLEXTCP_PL_KTX_FORWARDED 0x80
+
+#define FLEXTCP_PL_KTX_FLTXCLOSED 0x1
+#define FLEXTCP_PL_KTX_FLRXCLOSED 0x2
 
 /** Kernel TX queue entry */
 struct flextcp_pl_ktx {
@@ -115,6 +126,27 @@ struct flextcp_pl_ktx {
     struct {
       uint32_t flow_id;
     } connretran;
+    struct {
+      uint32_t flow_id;
+      /** Rate [kbps] */
+      uint32_t rate;
+    } connsetrate;
+    struct {
+      uint32_t flow_id;
+      uint16_t db_id;
+    } connmove;
+    struct {
+      uint32_t flow_id;
+      uint8_t tc;
+    } connsettc;
+    /** Stop fast path processing for flow, the owner core fills in the
+     * flow's sequence numbers and close flags before releasing the entry */
+    struct {
+      uint32_t flow_id;
+      uint32_t tx_seq;
+      uint32_t rx_seq;
+      uint8_t flags;
+    } conndisable;
     uint8_t raw[63];
   } __attribute__((packed)) msg;
   volatile uint8_t type;
@@ -155,6 +187,9 @@ STATIC_ASSERT(sizeof(struct flextcp_pl_arx) == 32, arx_size);
 /* App TX queue */
 
 #define FLEXTCP_PL_ATX_CONNUPDATE 0x1
+/** Set while a bump forwarded to the flow's owner core is in flight, the
+ * owner releases the entry */
+#define FLEXTCP_PL_ATX_FORWARDED 0x80
 
 #define FLEXTCP_PL_ATX_FLTXDONE  0x1
 
@@ -182,9 +217,14 @@ STATIC_ASSERT(sizeof(struct flextcp_pl_atx) == 16, atx_size);
 #define FLEXNIC_PL_APPST_CTX_NUM   31
 #define FLEXNIC_PL_APPST_CTX_MCS   16
 #define FLEXNIC_PL_APPCTX_NUM      16
+#define FLEXNIC_PL_TENANT_NUM       8
+/** Traffic classes, flows and contexts in higher classes are served first */
+#define FLEXNIC_PL_TC_NUM           4
 #define FLEXNIC_PL_FLOWST_NUM     (128 * 1024)
 #define FLEXNIC_PL_FLOWHT_ENTRIES (FLEXNIC_PL_FLOWST_NUM * 2)
-#define FLEXNIC_PL_FLOWHT_NBSZ      4
+#define FLEXNIC_PL_FLOWHT_SLOTS     8
+#define FLEXNIC_PL_FLOWHT_BUCKETS \
+    (FLEXNIC_PL_FLOWHT_ENTRIES / FLEXNIC_PL_FLOWHT_SLOTS)
 
 /** Application state */
 struct flextcp_pl_appst {
@@ -196,6 +236,19 @@ struct flextcp_pl_appst {
 
   /** IDs of contexts */
   uint16_t ctx_ids[FLEXNIC_PL_APPST_CTX_NUM];
+
+  /** Aggregate transmit rate limit for all flows of the app in kbps, 0 for
+   * no limit */
+  uint32_t tx_rate;
+  /** Tenant group of the app */
+  uint16_t tenant;
+} __attribute__((packed));
+
+/** Tenant group state */
+struct flextcp_pl_tenant {
+  /** Aggregate transmit rate limit for all apps in the group in kbps, 0 for
+   * no limit */
+  uint32_t tx_rate;
 } __attribute__((packed));
 
 
@@ -209,6 +262,8 @@ struct flextcp_pl_appctx {
   uint32_t tx_len;
   uint32_t appst_id;
   int	   evfd;
+  /** Traffic class of context and default for its connections */
+  uint8_t  tc;
 
   /********************************************************/
   /* read-write fields */
@@ -222,80 +277,83 @@ struct flextcp_pl_appctx {
 #define FLEXNIC_PL_OOO_RECV 1
 
 #define FLEXNIC_PL_FLOWST_SLOWPATH 1
+#define FLEXNIC_PL_FLOWST_SACK 2
+#define FLEXNIC_PL_FLOWST_SACKRTX 4
 #define FLEXNIC_PL_FLOWST_ECN 8
 #define FLEXNIC_PL_FLOWST_TXFIN 16
 #define FLEXNIC_PL_FLOWST_RXFIN 32
-#define FLEXNIC_PL_FLOWST_RX_MASK (~63ULL)
+/** Out of order intervals pending in flextcp_pl_flowooo */
+#define FLEXNIC_PL_FLOWST_RXOOO 64
+/** Zero-copy segments sent, tx_zc_core and tx_zc_head are valid */
+#define FLEXNIC_PL_FLOWST_TXZC 128
 
-/** Flow state registers */
+/**
+ * Flow state registers
+ *
+ * The first cache line holds everything needed to look up the flow, process
+ * acks, and generate app notifications and acks, so pure acks touch only this
+ * line. The second line holds buffer locations and the transmit position,
+ * only needed when payload is written to or read from the buffers. Rarely
+ * used state is kept in separate arrays (flowooo, flowsack, flowrtt,
+ * flowstats).
+ */
 struct flextcp_pl_flowst {
   /********************************************************/
-  /* read-only fields */
+  /* first cache line: lookup, ack processing, notifications */
 
   /** Opaque flow identifier from application */
   uint64_t opaque;
 
-  /** Base address of receive buffer */
-  uint64_t rx_base_sp;
-  /** Base address of transmit buffer */
-  uint64_t tx_base;
-
-  /** Length of receive buffer */
-  uint32_t rx_len;
-  /** Length of transmit buffer */
-  uint32_t tx_len;
-
+  /** IPv4 addresses, zero for IPv6 flows (see flextcp_pl_flowip6) */
   beui32_t local_ip;
   beui32_t remote_ip;
 
   beui16_t local_port;
   beui16_t remote_port;
 
-  /** Remote MAC address */
-  struct eth_addr remote_mac;
-
   /** Doorbell ID (identifying the app ctx to use) */
-  uint16_t db_id;
+  uint16_t db_id : 12;
+  /** Traffic class */
+  uint16_t tc : 4;
 
   /** Flow group for this connection (rss bucket) */
-  uint16_t flow_group;
-  /** Sequence number of queue pointer bumps */
-  uint16_t bump_seq;
-
-  // 56
+  uint16_t flow_group : 12;
+  /** IPv6 flow, addresses are in flextcp_pl_flowip6 */
+  uint16_t ip6 : 1;
+  /** Flow sends and echoes TCP timestamps, otherwise RTT is sampled with
+   * flextcp_pl_flowrtt */
+  uint16_t ts_opt : 1;
+  /** Duplicate ack count, reset when retransmitting after the third */
+  uint16_t rx_dupack_cnt : 2;
+
+  /** Maximum segment payload, negotiated MSS without timestamp option */
+  uint16_t mss;
+  /** Flags (FLEXNIC_PL_FLOWST_*) */
+  uint8_t flags;
+  /** Window scale shift for windows received from remote end */
+  uint8_t rx_wscale : 4;
+  /** Window scale shift for windows advertised to remote end */
+  uint8_t tx_wscale : 4;
 
-  /********************************************************/
-  /* read-write fields */
+  // 28
 
-  /** spin lock */
-  volatile uint32_t lock;
+  /* read-write fields below are only updated by the core owning the flow
+   * group */
 
   /** Bytes available for received segments at next position */
   uint32_t rx_avail;
-  // 64
   /** Offset in buffer to place next segment */
   uint32_t rx_next_pos;
   /** Next sequence number expected */
   uint32_t rx_next_seq;
   /** Bytes available in remote end for received segments */
   uint32_t rx_remote_avail;
-  /** Duplicate ack count */
-  uint32_t rx_dupack_cnt;
-
-#ifdef FLEXNIC_PL_OOO_RECV
-  /* Start of interval of out-of-order received data */
-  uint32_t rx_ooo_start;
-  /* Length of interval of out-of-order received data */
-  uint32_t rx_ooo_len;
-#endif
 
   /** Number of bytes available to be sent */
   uint32_t tx_avail;
   /** Number of bytes up to next pos in the buffer that were sent but not
    * acknowledged yet. */
   uint32_t tx_sent;
-  /** Offset in buffer for next segment to be sent */
-  uint32_t tx_next_pos;
   /** Sequence number of next segment to be sent */
   uint32_t tx_next_seq;
   /** Timestamp to echo in next packet */
@@ -303,6 +361,158 @@ struct flextcp_pl_flowst {
 
   /** Congestion control rate [kbps] */
   uint32_t tx_rate;
+
+  // 64
+
+  /********************************************************/
+  /* second cache line: buffers and transmit position */
+
+  /** Base address of receive buffer */
+  uint64_t rx_base;
+  /** Base address of transmit buffer */
+  uint64_t tx_base;
+
+  /** Length of receive buffer */
+  uint32_t rx_len;
+  /** Length of transmit buffer */
+  uint32_t tx_len;
+
+  /** Offset in buffer for next segment to be sent */
+  uint32_t tx_next_pos;
+
+  /** Sequence number of queue pointer bumps */
+  uint16_t bump_seq;
+
+  /** Remote MAC address */
+  struct eth_addr remote_mac;
+
+  /** Core that sent the last zero-copy segment */
+  uint16_t tx_zc_core;
+  /** Zero-copy segments that core has to complete before tx buffer space
+   * acked so far may be reused */
+  uint32_t tx_zc_head;
+
+  // 106
+} __attribute__((packed, aligned(64)));
+
+STATIC_ASSERT(sizeof(struct flextcp_pl_flowst) == 128, flowst_size);
+STATIC_ASSERT(offsetof(struct flextcp_pl_flowst, rx_base) == 64,
+    flowst_hot_line);
+
+/** Length of flow header template: Ethernet, IPv4, TCP, timestamp option */
+#define FLEXNIC_PL_FLOWHDR_LEN 66
+/** Length of flow header template for IPv6 flows */
+#define FLEXNIC_PL_FLOWHDR6_LEN 86
+
+/**
+ * Precomputed headers for segments sent on a flow, created by the slow path
+ * along with the flow state. Contains the Ethernet, IPv4 or IPv6 (for flows
+ * with ip6 set) and TCP headers and, for flows with ts_opt set, the timestamp
+ * option padded with two NOPs. Without timestamps the TCP header has no
+ * options and the rest is zero. IP length, TOS or traffic class, sequence and
+ * ack numbers, flags, window and timestamps are zero. The IPv4 checksum covers
+ * the remaining fields, the TCP checksum field holds the uncomplemented
+ * pseudo header sum without length.
+ */
+struct flextcp_pl_flowhdr {
+  uint8_t hdr[FLEXNIC_PL_FLOWHDR_LEN];
+  uint8_t _pad[128 - FLEXNIC_PL_FLOWHDR_LEN];
+} __attribute__((packed, aligned(64)));
+
+/** Tag for flow hash, 0 is reserved for empty slots */
+#define FLEXNIC_PL_FLOWHT_TAG(h) \
+    ((uint16_t) ((h) >> 16) != 0 ? (uint16_t) ((h) >> 16) : 1)
+/** Primary bucket for flow hash */
+#define FLEXNIC_PL_FLOWHT_BUCKET(h) ((h) & (FLEXNIC_PL_FLOWHT_BUCKETS - 1))
+/** Alternate bucket, given one of the two buckets and the tag */
+#define FLEXNIC_PL_FLOWHT_ALTBUCKET(b, tag) \
+    (((b) ^ ((uint32_t) (tag) * 0x5bd1e995)) & (FLEXNIC_PL_FLOWHT_BUCKETS - 1))
+
+/**
+ * Flow lookup table bucket (one cache line).
+ *
+ * Each flow is stored in one of two buckets: the primary bucket, or the
+ * alternate bucket derived from the primary and the tag. Slots are published
+ * by writing the flow id before the tag, and cleared by zeroing the tag. When
+ * the slow path moves an entry between buckets, it makes the version of both
+ * buckets odd for the duration of the move, readers retry if they observe an
+ * odd or changed version.
+ */
+struct flextcp_pl_flowhtb {
+  /** Tags for slots (upper 16 bits of hash), 0 if slot is empty */
+  volatile uint16_t tags[FLEXNIC_PL_FLOWHT_SLOTS];
+  /** Flow ids for slots */
+  volatile uint32_t flow_ids[FLEXNIC_PL_FLOWHT_SLOTS];
+  /** Version, odd while an entry is being moved in or out of the bucket */
+  volatile uint32_t version;
+  uint8_t pad[12];
+} __attribute__((packed, aligned(64)));
+
+STATIC_ASSERT(sizeof(struct flextcp_pl_flowhtb) == 64, flowhtb_size);
+STATIC_ASSERT((FLEXNIC_PL_FLOWHT_BUCKETS & (FLEXNIC_PL_FLOWHT_BUCKETS - 1)) == 0,
+    flowht_buckets_pow2);
+
+
+/** Interval of sequence numbers */
+struct flextcp_pl_seqiv {
+  /** Sequence number of first byte in interval */
+  uint32_t start;
+  /** Number of bytes in interval, 0 if unused */
+  uint32_t len;
+} __attribute__((packed));
+
+#ifdef FLEXNIC_PL_OOO_RECV
+#define FLEXNIC_PL_OOO_INTERVALS 4
+
+/**
+ * Out-of-order receive intervals for a flow, kept separate from flow state.
+ * Intervals are sorted by sequence number, do not overlap or touch, and used
+ * intervals are at the beginning of the array. FLEXNIC_PL_FLOWST_RXOOO is
+ * set in the flow state while the first interval is in use.
+ */
+struct flextcp_pl_flowooo {
+  struct flextcp_pl_seqiv iv[FLEXNIC_PL_OOO_INTERVALS];
+} __attribute__((packed));
+#endif
+
+#define FLEXNIC_PL_SACK_INTERVALS 3
+
+/**
+ * SACK scoreboard for a flow that negotiated SACK
+ * (FLEXNIC_PL_FLOWST_SACK). Holds intervals of sent data the receiver
+ * reported in SACK blocks, sorted like the out-of-order intervals. While
+ * FLEXNIC_PL_FLOWST_SACKRTX is set in the flow state, the holes below the
+ * last SACKed byte starting at rtx_next are retransmitted before new data.
+ */
+struct flextcp_pl_flowsack {
+  /** SACKed intervals beyond the cumulative ack */
+  struct flextcp_pl_seqiv iv[FLEXNIC_PL_SACK_INTERVALS];
+  /** Sequence number of next byte to check for selective retransmission */
+  uint32_t rtx_next;
+  /** Recovery point: tx_next_seq when loss recovery was last entered */
+  uint32_t rtx_end;
+} __attribute__((packed));
+
+/**
+ * RTT sample for a flow without timestamps (ts_opt not set): the time a
+ * segment was sent and the sequence number following it. The RTT is measured
+ * when an ACK covers the segment. Only one sample is outstanding at a time,
+ * retransmissions invalidate it (Karn's algorithm).
+ */
+struct flextcp_pl_flowrtt {
+  /** Sequence number after the sampled segment */
+  uint32_t seq;
+  /** Send time of the sampled segment [us] */
+  uint32_t ts;
+  /** 1 if a sample is outstanding */
+  uint32_t valid;
+} __attribute__((packed));
+
+/**
+ * Congestion control statistics for a flow. Written only by the core owning
+ * the flow, the slow path reads them without touching the flow state.
+ */
+struct flextcp_pl_flowstats {
   /** Counter drops */
   uint16_t cnt_tx_drops;
   /** Counter acks */
@@ -312,22 +522,23 @@ struct flextcp_pl_flowst {
   /** Counter acks marked */
   uint32_t cnt_rx_ecn_bytes;
   /** RTT estimate */
-  uint32_t rtt_est;
-
-// 128
-} __attribute__((packed, aligned(64)));
-
-#define FLEXNIC_PL_FLOWHTE_VALID  (1 << 31)
-#define FLEXNIC_PL_FLOWHTE_POSSHIFT 29
-
-/** Flow lookup table entry */
-struct flextcp_pl_flowhte {
-  uint32_t flow_id;
-  uint32_t flow_hash;
+  uint32_t rtt_est : 31;
+  /** Sent data not acknowledged yet */
+  uint32_t txp : 1;
 } __attribute__((packed));
 
+/** Addresses of an IPv6 flow (ip6 set in flow state) */
+struct flextcp_pl_flowip6 {
+  ip6_addr_t local_ip;
+  ip6_addr_t remote_ip;
+} __attribute__((packed));
 
 #define FLEXNIC_PL_MAX_FLOWGROUPS 4096
+/* flow_group field in flow state has 12 bits */
+STATIC_ASSERT(FLEXNIC_PL_MAX_FLOWGROUPS <= 4096, flowgroups_num);
+/* db_id and tc fields in flow state have 12 and 4 bits */
+STATIC_ASSERT(FLEXNIC_PL_APPCTX_NUM <= 4096, appctx_num);
+STATIC_ASSERT(FLEXNIC_PL_TC_NUM <= 16, tc_num);
 
 /** Layout of internal pipeline memory */
 struct flextcp_pl_mem {
@@ -337,8 +548,28 @@ struct flextcp_pl_mem {
   /* registers for flow state */
   struct flextcp_pl_flowst flowst[FLEXNIC_PL_FLOWST_NUM];
 
+  /* header templates for flows */
+  struct flextcp_pl_flowhdr flowhdr[FLEXNIC_PL_FLOWST_NUM];
+
   /* flow lookup table */
-  struct flextcp_pl_flowhte flowht[FLEXNIC_PL_FLOWHT_ENTRIES];
+  struct flextcp_pl_flowhtb flowht[FLEXNIC_PL_FLOWHT_BUCKETS];
+
+#ifdef FLEXNIC_PL_OOO_RECV
+  /* out of order intervals for flows */
+  struct flextcp_pl_flowooo flowooo[FLEXNIC_PL_FLOWST_NUM];
+#endif
+
+  /* SACK scoreboards for flows */
+  struct flextcp_pl_flowsack flowsack[FLEXNIC_PL_FLOWST_NUM];
+
+  /* RTT samples for flows without timestamps */
+  struct flextcp_pl_flowrtt flowrtt[FLEXNIC_PL_FLOWST_NUM];
+
+  /* addresses of IPv6 flows */
+  struct flextcp_pl_flowip6 flowip6[FLEXNIC_PL_FLOWST_NUM];
+
+  /* congestion control statistics for flows */
+  struct flextcp_pl_flowstats flowstats[FLEXNIC_PL_FLOWST_NUM];
 
   /* registers for kernel queues */
   struct flextcp_pl_appctx kctx[FLEXNIC_PL_APPST_CTX_MCS];
@@ -346,6 +577,11 @@ struct flextcp_pl_mem {
   /* registers for application state */
   struct flextcp_pl_appst appst[FLEXNIC_PL_APPST_NUM];
 
+  /* registers for tenant groups of applications */
+  struct flextcp_pl_tenant tenants[FLEXNIC_PL_TENANT_NUM];
+
+  /* core owning each flow group, only the owner processes the group's flows
+   * and hands the group to another core when rescaling */
   uint8_t flow_group_steering[FLEXNIC_PL_MAX_FLOWGROUPS];
 } __attribute__((packed));
 
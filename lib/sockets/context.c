@@ -229,6 +229,12 @@ static inline void ev_listen_accept(struct flextcp_context *ctx,
 
   if (ev->ev.listen_accept.status == 0) {
     s->data.connection.status = SOC_CONNECTED;
+    if (s->priority != 0) {
+      flextcp_connection_priority(ctx, c, s->priority);
+    }
+    if (s->max_pacing_rate != ~0ULL) {
+      flextcp_connection_ratelimit(ctx, c, socket_pacing_kbps(s));
+    }
     flextcp_epoll_set(s, EPOLLOUT);
   } else {
     s->data.connection.status = SOC_FAILED;
@@ -255,6 +261,12 @@ static inline void ev_conn_open(struct flextcp_context *ctx,
 
   if (ev->ev.conn_open.status == 0) {
     s->data.connection.status = SOC_CONNECTED;
+    if (s->priority != 0) {
+      flextcp_connection_priority(ctx, c, s->priority);
+    }
+    if (s->max_pacing_rate != ~0ULL) {
+      flextcp_connection_ratelimit(ctx, c, socket_pacing_kbps(s));
+    }
     flextcp_epoll_set(s, EPOLLOUT);
   } else {
     s->data.connection.status = SOC_FAILED;
@@ -82,6 +82,8 @@ int tas_socket(int domain, int type, int protocol)
 
   s->type = SOCK_SOCKET;
   s->flags = 0;
+  s->priority = 0;
+  s->max_pacing_rate = ~0ULL;
   flextcp_epoll_sockinit(s);
 
   if (nonblock) {
@@ -488,6 +490,8 @@ int tas_accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen,
 
     ns->type = SOCK_CONNECTION;
     ns->flags = (nonblock ? SOF_NONBLOCK : 0) | (cloexec ? SOF_CLOEXEC : 0);
+    ns->priority = s->priority;
+    ns->max_pacing_rate = s->max_pacing_rate;
     ns->data.connection.status = SOC_CONNECTING;
     ns->data.connection.listener = s;
     ns->data.connection.rx_len_1 = 0;
@@ -727,6 +731,16 @@ int tas_getsockopt(int sockfd, int level, int optname, void *optval,
   } else if (level == SOL_SOCKET && optname == SO_KEEPALIVE) {
     /* keepalive is always disabled */
     res = 0;
+  } else if (level == SOL_SOCKET && optname == SO_PRIORITY) {
+    res = s->priority;
+  } else if (level == SOL_SOCKET && optname == SO_MAX_PACING_RATE) {
+    /* 64-bit rate if there is room, otherwise saturated to 32 bits */
+    if (*optlen >= sizeof(uint64_t)) {
+      *optlen = sizeof(uint64_t);
+      memcpy(optval, &s->max_pacing_rate, sizeof(uint64_t));
+      goto out;
+    }
+    res = MIN(s->max_pacing_rate, UINT32_MAX);
   } else if (level == IPPROTO_TCP && (optname == TCP_KEEPIDLE ||
         optname == TCP_KEEPINTVL || optname == TCP_KEEPCNT)) {
     res = 0;
@@ -809,7 +823,46 @@ int tas_setsockopt(int sockfd, int level, int optname, const void *optval,
   } else if (level == SOL_SOCKET && optname == SO_KEEPALIVE) {
     /* ignore silently */
   } else if (level == SOL_SOCKET && optname == SO_PRIORITY) {
-    /* ignore silently */
+    if (optlen != sizeof(int) || *(int *) optval < 0) {
+      errno = EINVAL;
+      ret = -1;
+      goto out;
+    }
+
+    /* priorities map to traffic classes, higher ones share the top class */
+    s->priority = MIN(*(int *) optval, FLEXTCP_TC_NUM - 1);
+    if (s->type == SOCK_CONNECTION &&
+        s->data.connection.status == SOC_CONNECTED &&
+        flextcp_connection_priority(flextcp_sockctx_get(),
+          &s->data.connection.c, s->priority) != 0)
+    {
+      errno = ENOBUFS;
+      ret = -1;
+      goto out;
+    }
+  } else if (level == SOL_SOCKET && optname == SO_MAX_PACING_RATE) {
+    /* like linux, accept 64-bit rates and 32-bit rates with ~0U for none */
+    if (optlen == sizeof(uint64_t)) {
+      s->max_pacing_rate = *(uint64_t *) optval;
+    } else if (optlen >= sizeof(uint32_t)) {
+      s->max_pacing_rate = *(uint32_t *) optval;
+      if (s->max_pacing_rate == UINT32_MAX)
+        s->max_pacing_rate = ~0ULL;
+    } else {
+      errno = EINVAL;
+      ret = -1;
+      goto out;
+    }
+
+    if (s->type == SOCK_CONNECTION &&
+        s->data.connection.status == SOC_CONNECTED &&
+        flextcp_connection_ratelimit(flextcp_sockctx_get(),
+          &s->data.connection.c, socket_pacing_kbps(s)) != 0)
+    {
+      errno = ENOBUFS;
+      ret = -1;
+      goto out;
+    }
   } else if (level == IPPROTO_TCP && (optname == TCP_KEEPIDLE ||
        optname == TCP_KEEPINTVL || optname == TCP_KEEPCNT)) {
     /* ignore silently */
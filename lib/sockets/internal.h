@@ -106,7 +106,12 @@ struct socket {
   struct sockaddr_in addr;
   uint8_t flags;
   uint8_t type;
+  /** Traffic class set with SO_PRIORITY, applied once connected */
+  uint8_t priority;
   int refcnt;
+  /** Pacing rate cap set with SO_MAX_PACING_RATE in bytes per second,
+   * ~0 for none, applied once connected */
+  uint64_t max_pacing_rate;
   volatile uint32_t sp_lock;
 
   /** epoll events currently active on this socket */
@@ -232,5 +237,19 @@ static inline uint64_t get_msecs(void)
   return ts.tv_sec * 1000ULL + (ts.tv_nsec / 1000000ULL);
 }
 
+/** Pacing rate cap of socket in kbps as used by libtas, 0 for none */
+static inline uint32_t socket_pacing_kbps(struct socket *s)
+{
+  uint64_t kbps;
+
+  if (s->max_pacing_rate == ~0ULL)
+    return 0;
+
+  kbps = (s->max_pacing_rate + 124) / 125;
+  if (kbps == 0)
+    return 1;
+  return (kbps < UINT32_MAX ? kbps : UINT32_MAX);
+}
+
 
 #endif /* ndef INTERNAL_H_ */
@@ -120,8 +120,9 @@ int flextcp_listen_accept(struct flextcp_context *ctx,
   return 0;
 }
 
-int flextcp_connection_open(struct flextcp_context *ctx,
-    struct flextcp_connection *conn, uint32_t dst_ip, uint16_t dst_port)
+static int connection_open(struct flextcp_context *ctx,
+    struct flextcp_connection *conn, uint32_t dst_ip, const uint8_t *dst_ip6,
+    uint16_t dst_port)
 {
   uint32_t pos = ctx->kin_head, f = 0;
   struct kernel_appout *kin = ctx->kin_base;
@@ -142,6 +143,11 @@ int flextcp_connection_open(struct flextcp_context *ctx,
   kin->data.conn_open.opaque = OPAQUE(conn);
   kin->data.conn_open.remote_ip = dst_ip;
   kin->data.conn_open.remote_port = dst_port;
+  if (dst_ip6 != NULL) {
+    f |= KERNEL_APPOUT_OPEN_IP6;
+    memcpy(kin->data.conn_open.remote_ip6, dst_ip6,
+        sizeof(kin->data.conn_open.remote_ip6));
+  }
   kin->data.conn_open.flags = f;
   MEM_BARRIER();
   kin->type = KERNEL_APPOUT_CONN_OPEN;
@@ -154,8 +160,20 @@ int flextcp_connection_open(struct flextcp_context *ctx,
   ctx->kin_head = pos;
 
   return 0;
+}
 
+int flextcp_connection_open(struct flextcp_context *ctx,
+    struct flextcp_connection *conn, uint32_t dst_ip, uint16_t dst_port)
+{
+  return connection_open(ctx, conn, dst_ip, NULL, dst_port);
+}
 
+int flextcp_connection_open6(struct flextcp_context *ctx,
+    struct flextcp_connection *conn, const uint8_t dst_ip6[16],
+    uint16_t dst_port)
+{
+  /* IPv6 connections are identified with address 0 towards the kernel */
+  return connection_open(ctx, conn, 0, dst_ip6, dst_port);
 }
 
 int flextcp_connection_close(struct flextcp_context *ctx,
@@ -426,6 +444,75 @@ int flextcp_connection_move(struct flextcp_context *ctx,
   return 0;
 }
 
+int flextcp_connection_priority(struct flextcp_context *ctx,
+        struct flextcp_connection *conn, uint8_t tc)
+{
+  uint32_t pos = ctx->kin_head;
+  struct kernel_appout *kin = ctx->kin_base;
+
+  if (tc >= FLEXTCP_TC_NUM) {
+    fprintf(stderr, "flextcp_connection_priority: invalid traffic class\n");
+    return -1;
+  }
+
+  kin += pos;
+
+  if (kin->type != KERNEL_APPOUT_INVALID) {
+    fprintf(stderr, "flextcp_connection_priority: no queue space\n");
+    return -1;
+  }
+
+  kin->data.conn_prio.local_ip = conn->local_ip;
+  kin->data.conn_prio.remote_ip = conn->remote_ip;
+  kin->data.conn_prio.local_port = conn->local_port;
+  kin->data.conn_prio.remote_port = conn->remote_port;
+  kin->data.conn_prio.tc = tc;
+  kin->data.conn_prio.opaque = OPAQUE(conn);
+  MEM_BARRIER();
+  kin->type = KERNEL_APPOUT_CONN_PRIO;
+  flextcp_kernel_kick();
+
+  pos = pos + 1;
+  if (pos >= ctx->kin_len) {
+    pos = 0;
+  }
+  ctx->kin_head = pos;
+
+  return 0;
+}
+
+int flextcp_connection_ratelimit(struct flextcp_context *ctx,
+        struct flextcp_connection *conn, uint32_t rate)
+{
+  uint32_t pos = ctx->kin_head;
+  struct kernel_appout *kin = ctx->kin_base;
+
+  kin += pos;
+
+  if (kin->type != KERNEL_APPOUT_INVALID) {
+    fprintf(stderr, "flextcp_connection_ratelimit: no queue space\n");
+    return -1;
+  }
+
+  kin->data.conn_rate.local_ip = conn->local_ip;
+  kin->data.conn_rate.remote_ip = conn->remote_ip;
+  kin->data.conn_rate.local_port = conn->local_port;
+  kin->data.conn_rate.remote_port = conn->remote_port;
+  kin->data.conn_rate.rate = rate;
+  kin->data.conn_rate.opaque = OPAQUE(conn);
+  MEM_BARRIER();
+  kin->type = KERNEL_APPOUT_CONN_RATE;
+  flextcp_kernel_kick();
+
+  pos = pos + 1;
+  if (pos >= ctx->kin_len) {
+    pos = 0;
+  }
+  ctx->kin_head = pos;
+
+  return 0;
+}
+
 static void connection_init(struct flextcp_connection *conn)
 {
   memset(conn, 0, sizeof(*conn));
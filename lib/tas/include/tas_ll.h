@@ -39,6 +39,8 @@
 
 #define FLEXTCP_MAX_CONTEXTS 32
 #define FLEXTCP_MAX_FTCPCORES 16
+/** Number of traffic classes, see flextcp_context_priority() */
+#define FLEXTCP_TC_NUM 4
 
 /**
  * A flextcp context is per-thread state for the stack. (opaque)
@@ -175,13 +177,18 @@ struct flextcp_event {
       int16_t status;
       struct flextcp_listener *listener;
     } listen_open;
-    /** For #FLEXTCP_EV_LISTEN_NEWCONN */
+    /** For #FLEXTCP_EV_LISTEN_NEWCONN, remote_ip is 0 and remote_ip6 (network
+     * byte order) is set if ip6 is set */
     struct {
       uint16_t remote_port;
       uint32_t remote_ip;
       struct flextcp_listener *listener;
+      uint8_t ip6;
+      uint8_t remote_ip6[16];
     } listen_newconn;
-    /** For #FLEXTCP_EV_LISTEN_ACCEPT */
+    /** For #FLEXTCP_EV_LISTEN_ACCEPT, IPv6 connections have remote_ip and
+     * local_ip 0, the peer address is only reported with
+     * #FLEXTCP_EV_LISTEN_NEWCONN */
     struct {
       int16_t status;
       struct flextcp_connection *conn;
@@ -276,6 +283,32 @@ void flextcp_context_waitclear(struct flextcp_context *ctx);
  */
 int flextcp_context_wait(struct flextcp_context *ctx, int timeout_ms);
 
+/**
+ * Limit the aggregate transmit rate of all connections of this application
+ * and assign the application to tenant group `tenant'. Applications in a
+ * tenant group are additionally limited by the group's rate limit.
+ *
+ * Only takes effect for applications running as root, TAS ignores requests
+ * from other applications. Their limits are set with TAS parameters.
+ *
+ * @param rate Rate limit in kbps, 0 for no limit
+ *
+ * @return 0 on success, -1 otherwise.
+ */
+int flextcp_app_ratelimit(struct flextcp_context *ctx, uint16_t tenant,
+    uint32_t rate);
+
+/**
+ * Set the traffic class of this context, also used for connections opened or
+ * accepted on it from now on. Queues of contexts and transmissions of
+ * connections in higher classes are served first.
+ *
+ * @param tc Traffic class, 0 (default) to FLEXTCP_TC_NUM - 1
+ *
+ * @return 0 on success, -1 otherwise.
+ */
+int flextcp_context_priority(struct flextcp_context *ctx, uint8_t tc);
+
 /*****************************************************************************/
 /* Regular TCP connection management */
 
@@ -294,6 +327,12 @@ int flextcp_listen_accept(struct flextcp_context *ctx,
 int flextcp_connection_open(struct flextcp_context *ctx,
     struct flextcp_connection *conn, uint32_t dst_ip, uint16_t dst_port);
 
+/** Open a connection to an on-link IPv6 peer (asynchronous), dst_ip6 in
+ * network byte order. The connection's remote_ip and local_ip are 0. */
+int flextcp_connection_open6(struct flextcp_context *ctx,
+    struct flextcp_connection *conn, const uint8_t dst_ip6[16],
+    uint16_t dst_port);
+
 /** Close a connection (asynchronous). */
 int flextcp_connection_close(struct flextcp_context *ctx,
     struct flextcp_connection *conn);
@@ -333,6 +372,16 @@ int flextcp_connection_tx_possible(struct flextcp_context *ctx,
 int flextcp_connection_move(struct flextcp_context *ctx,
         struct flextcp_connection *conn);
 
+/** Set traffic class of connection, 0 (default) to FLEXTCP_TC_NUM - 1,
+ * higher classes are served first */
+int flextcp_connection_priority(struct flextcp_context *ctx,
+        struct flextcp_connection *conn, uint8_t tc);
+
+/** Cap transmit rate of connection (kbps, 0 for no cap), the connection is
+ * paced at the lower of this and its congestion control rate */
+int flextcp_connection_ratelimit(struct flextcp_context *ctx,
+        struct flextcp_connection *conn, uint32_t rate);
+
 /** @} */
 
 #endif /* ndef TAS_LL_H_ */
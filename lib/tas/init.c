@@ -596,6 +596,11 @@ static inline void event_kappin_listen_newconn(
   outev->event_type = FLEXTCP_EV_LISTEN_NEWCONN;
   outev->ev.listen_newconn.remote_ip = inev->remote_ip;
   outev->ev.listen_newconn.remote_port = inev->remote_port;
+  outev->ev.listen_newconn.ip6 = !!(inev->flags & KERNEL_APPIN_NEWCONN_IP6);
+  if (outev->ev.listen_newconn.ip6) {
+    memcpy(outev->ev.listen_newconn.remote_ip6, inev->remote_ip6,
+        sizeof(outev->ev.listen_newconn.remote_ip6));
+  }
   outev->ev.listen_open.listener = listener;
 }
 
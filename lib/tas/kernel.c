@@ -283,3 +283,75 @@ int flextcp_kernel_reqscale(struct flextcp_context *ctx, uint32_t cores)
 
   return 0;
 }
+
+static int kernel_setrate(struct flextcp_context *ctx, uint16_t tenant,
+    uint32_t rate, uint8_t flags)
+{
+  uint32_t pos = ctx->kin_head;
+  struct kernel_appout *kin = ctx->kin_base;
+
+  kin += pos;
+
+  if (kin->type != KERNEL_APPOUT_INVALID) {
+    fprintf(stderr, "kernel_setrate: no queue space\n");
+    return -1;
+  }
+
+  kin->data.set_rate.rate = rate;
+  kin->data.set_rate.tenant = tenant;
+  kin->data.set_rate.flags = flags;
+  MEM_BARRIER();
+  kin->type = KERNEL_APPOUT_SET_RATE;
+  flextcp_kernel_kick();
+
+  pos = pos + 1;
+  if (pos >= ctx->kin_len) {
+    pos = 0;
+  }
+  ctx->kin_head = pos;
+
+  return 0;
+}
+
+int flextcp_app_ratelimit(struct flextcp_context *ctx, uint16_t tenant,
+    uint32_t rate)
+{
+  return kernel_setrate(ctx, tenant, rate, 0);
+}
+
+int flextcp_kernel_tenantrate(struct flextcp_context *ctx, uint16_t tenant,
+    uint32_t rate)
+{
+  return kernel_setrate(ctx, tenant, rate, KERNEL_APPOUT_RATE_TENANT);
+}
+
+int flextcp_context_priority(struct flextcp_context *ctx, uint8_t tc)
+{
+  uint32_t pos = ctx->kin_head;
+  struct kernel_appout *kin = ctx->kin_base;
+
+  if (tc >= FLEXTCP_TC_NUM) {
+    fprintf(stderr, "flextcp_context_priority: invalid traffic class\n");
+    return -1;
+  }
+
+  kin += pos;
+
+  if (kin->type != KERNEL_APPOUT_INVALID) {
+    fprintf(stderr, "flextcp_context_priority: no queue space\n");
+    return -1;
+  }
+
+  kin->data.ctx_prio.tc = tc;
+  MEM_BARRIER();
+  kin->type = KERNEL_APPOUT_CTX_PRIO;
+  flextcp_kernel_kick();
+
+  pos = pos + 1;
+  if (pos >= ctx->kin_len) {
+    pos = 0;
+  }
+  ctx->kin_head = pos;
+
+  return 0;
+}
@@ -29,8 +29,10 @@
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#include <arpa/inet.h>
 
 #include <utils.h>
+#include <tas_memif.h>
 
 #include <config.h>
 
@@ -69,6 +71,11 @@ enum cfg_params {
   CP_CC_TIMELY_MINRATE,
   CP_IP_ROUTE,
   CP_IP_ADDR,
+  CP_IP6_ADDR,
+  CP_IP_MTU,
+  CP_APP_RATE,
+  CP_TENANT_RATE,
+  CP_TENANT_UID,
   CP_FP_CORES_MAX,
   CP_FP_NO_INTS,
   CP_FP_NO_XSUMOFFLOAD,
@@ -77,6 +84,16 @@ enum cfg_params {
   CP_FP_VLAN_STRIP,
   CP_FP_POLL_INTERVAL_TAS,
   CP_FP_POLL_INTERVAL_APP,
+  CP_FP_RSS_FLOWHASH,
+  CP_FP_DELACK_SEGS,
+  CP_FP_NO_GRO,
+  CP_FP_DMA_STREAM_MIN,
+  CP_FP_DMA_PREFETCH_MIN,
+  CP_FP_DMADEV_MIN,
+  CP_FP_TSO_MAX,
+  CP_FP_TX_ZEROCOPY,
+  CP_FP_NO_RX_XSUM,
+  CP_FP_QMAN,
   CP_KNI_NAME,
   CP_READY_FD,
   CP_DPDK_EXTRA,
@@ -186,6 +203,21 @@ static struct option opts[] = {
     { .name = "ip-addr",
       .has_arg = required_argument,
       .val = CP_IP_ADDR },
+    { .name = "ip6-addr",
+      .has_arg = required_argument,
+      .val = CP_IP6_ADDR },
+    { .name = "ip-mtu",
+      .has_arg = required_argument,
+      .val = CP_IP_MTU },
+    { .name = "app-rate",
+      .has_arg = required_argument,
+      .val = CP_APP_RATE },
+    { .name = "tenant-rate",
+      .has_arg = required_argument,
+      .val = CP_TENANT_RATE },
+    { .name = "tenant-uid",
+      .has_arg = required_argument,
+      .val = CP_TENANT_UID },
     { .name = "fp-cores-max",
       .has_arg = required_argument,
       .val = CP_FP_CORES_MAX },
@@ -210,6 +242,36 @@ static struct option opts[] = {
     { .name = "fp-poll-interval-app",
       .has_arg = required_argument,
       .val = CP_FP_POLL_INTERVAL_APP },
+    { .name = "fp-rss-flowhash",
+      .has_arg = no_argument,
+      .val = CP_FP_RSS_FLOWHASH },
+    { .name = "fp-delack-segs",
+      .has_arg = required_argument,
+      .val = CP_FP_DELACK_SEGS },
+    { .name = "fp-no-gro",
+      .has_arg = no_argument,
+      .val = CP_FP_NO_GRO },
+    { .name = "fp-dma-stream-min",
+      .has_arg = required_argument,
+      .val = CP_FP_DMA_STREAM_MIN },
+    { .name = "fp-dma-prefetch-min",
+      .has_arg = required_argument,
+      .val = CP_FP_DMA_PREFETCH_MIN },
+    { .name = "fp-dmadev-min",
+      .has_arg = required_argument,
+      .val = CP_FP_DMADEV_MIN },
+    { .name = "fp-tso-max",
+      .has_arg = required_argument,
+      .val = CP_FP_TSO_MAX },
+    { .name = "fp-tx-zerocopy",
+      .has_arg = no_argument,
+      .val = CP_FP_TX_ZEROCOPY },
+    { .name = "fp-no-rx-xsum",
+      .has_arg = no_argument,
+      .val = CP_FP_NO_RX_XSUM },
+    { .name = "fp-qman",
+      .has_arg = required_argument,
+      .val = CP_FP_QMAN },
     { .name = "kni-name",
       .has_arg = required_argument,
       .val = CP_KNI_NAME },
@@ -233,6 +295,8 @@ static inline int parse_int8(const char *s, uint8_t *pu8);
 static inline int parse_double(const char *s, double *pd);
 static inline int parse_cidr(char *s, uint32_t *ip, uint8_t *prefix);
 static inline int parse_route(char *s, struct configuration *c);
+static inline int parse_tenant_rate(char *s, struct configuration *c);
+static inline int parse_tenant_uid(char *s, struct configuration *c);
 static inline int parse_arg_append(char *s, struct configuration *c);
 
 int config_parse(struct configuration *c, int argc, char *argv[])
@@ -465,6 +529,38 @@ int config_parse(struct configuration *c, int argc, char *argv[])
           goto failed;
         }
         break;
+      case CP_IP6_ADDR:
+        if (inet_pton(AF_INET6, optarg, c->ip6) != 1) {
+          fprintf(stderr, "Parsing IPv6 address failed\n");
+          goto failed;
+        }
+        c->ip6_enabled = 1;
+        break;
+      case CP_IP_MTU:
+        if (parse_int32(optarg, &c->ip_mtu) != 0 ||
+            c->ip_mtu < CONFIG_IP_MTU_MIN || c->ip_mtu > CONFIG_IP_MTU_MAX)
+        {
+          fprintf(stderr, "ip mtu parsing failed (%u-%u)\n",
+              CONFIG_IP_MTU_MIN, CONFIG_IP_MTU_MAX);
+          goto failed;
+        }
+        break;
+      case CP_APP_RATE:
+        if (parse_int32(optarg, &c->app_rate) != 0) {
+          fprintf(stderr, "app rate parsing failed\n");
+          goto failed;
+        }
+        break;
+      case CP_TENANT_RATE:
+        if (parse_tenant_rate(optarg, c) != 0) {
+          goto failed;
+        }
+        break;
+      case CP_TENANT_UID:
+        if (parse_tenant_uid(optarg, c) != 0) {
+          goto failed;
+        }
+        break;
       case CP_FP_CORES_MAX:
         if (parse_int32(optarg, &c->fp_cores_max) != 0) {
           fprintf(stderr, "fp cores max parsing failed\n");
@@ -499,6 +595,60 @@ int config_parse(struct configuration *c, int argc, char *argv[])
         }
         break;
        break;
+      case CP_FP_RSS_FLOWHASH:
+        c->fp_rss_flowhash = 1;
+        break;
+      case CP_FP_DELACK_SEGS:
+        if (parse_int32(optarg, &c->fp_delack_segs) != 0 ||
+            c->fp_delack_segs == 0)
+        {
+          fprintf(stderr, "fp delayed ack segments parsing failed\n");
+          goto failed;
+        }
+        break;
+      case CP_FP_NO_GRO:
+        c->fp_gro = 0;
+        break;
+      case CP_FP_DMA_STREAM_MIN:
+        if (parse_int32(optarg, &c->fp_dma_stream_min) != 0) {
+          fprintf(stderr, "fp dma stream min parsing failed\n");
+          goto failed;
+        }
+        break;
+      case CP_FP_DMA_PREFETCH_MIN:
+        if (parse_int32(optarg, &c->fp_dma_prefetch_min) != 0) {
+          fprintf(stderr, "fp dma prefetch min parsing failed\n");
+          goto failed;
+        }
+        break;
+      case CP_FP_DMADEV_MIN:
+        if (parse_int32(optarg, &c->fp_dmadev_min) != 0) {
+          fprintf(stderr, "fp dmadev min parsing failed\n");
+          goto failed;
+        }
+        break;
+      case CP_FP_TSO_MAX:
+        if (parse_int32(optarg, &c->fp_tso_max) != 0) {
+          fprintf(stderr, "fp tso max parsing failed\n");
+          goto failed;
+        }
+        break;
+      case CP_FP_TX_ZEROCOPY:
+        c->fp_tx_zerocopy = 1;
+        break;
+      case CP_FP_NO_RX_XSUM:
+        c->fp_rx_xsum = 0;
+        break;
+      case CP_FP_QMAN:
+        if (!strcmp(optarg, "skiplist")) {
+          c->fp_qman = CONFIG_QMAN_SKIPLIST;
+        } else if (!strcmp(optarg, "wheel")) {
+          c->fp_qman = CONFIG_QMAN_WHEEL;
+        } else {
+          fprintf(stderr, "fp qman parsing failed\n");
+          goto failed;
+        }
+        break;
 
       case CP_KNI_NAME:
         if (!(c->kni_name = strdup(optarg))) {
@@ -552,6 +702,9 @@ failed:
 static int config_defaults(struct configuration *c, char *progname)
 {
   c->ip = 0;
+  memset(c->ip6, 0, sizeof(c->ip6));
+  c->ip6_enabled = 0;
+  c->ip_mtu = 1500;
   c->shm_len = 1024 * 1024 * 1024;
   c->nic_rx_len = 16 * 1024;
   c->nic_tx_len = 16 * 1024;
@@ -559,6 +712,7 @@ static int config_defaults(struct configuration *c, char *progname)
   c->app_kout_len = 1024 * 1024;
   c->arp_to = 500;
   c->arp_to_max = 10000000;
+  c->app_rate = 0;
   c->tcp_rtt_init = 50;
   c->tcp_link_bw = 10;
   c->tcp_rxbuf_len = 8192;
@@ -592,6 +746,16 @@ static int config_defaults(struct configuration *c, char *progname)
   c->fp_vlan_strip = 0;
   c->fp_poll_interval_tas = 10000;
   c->fp_poll_interval_app = 10000;
+  c->fp_rss_flowhash = 0;
+  c->fp_delack_segs = 2;
+  c->fp_gro = 1;
+  c->fp_dma_stream_min = 1024;
+  c->fp_dma_prefetch_min = 512;
+  c->fp_dmadev_min = 0;
+  c->fp_tso_max = 65160;
+  c->fp_tx_zerocopy = 0;
+  c->fp_rx_xsum = 1;
+  c->fp_qman = CONFIG_QMAN_SKIPLIST;
   c->kni_name = NULL;
   c->ready_fd = -1;
   c->quiet = 0;
@@ -674,6 +838,10 @@ static void print_usage(struct configuration *c, char *progname)
       "IP protocol parameters:\n"
       "  --ip-route=DEST[/PREFIX],NEXTHOP  Add route\n"
       "  --ip-addr=ADDR[/PREFIXLEN]        Set local IP address\n"
+      "  --ip6-addr=ADDR                   Set local IPv6 address, on-link "
+          "peers only [default: disabled]\n"
+      "  --ip-mtu=MTU                      IP MTU of the link "
+          "[default: %"PRIu32"]\n"
       "\n"
       "ARP protocol parameters:\n"
       "  --arp-timeout=TIMEOUT       ARP request timeout (us) "
@@ -681,6 +849,14 @@ static void print_usage(struct configuration *c, char *progname)
       "  --arp-timeout-max=TIMEOUT   ARP request max timeout (us) "
           "[default: %"PRIu32"]\n"
       "\n"
+      "Rate limits:\n"
+      "  --app-rate=RATE             Transmit rate limit of each app (kbps), "
+          "0 = none [default: %"PRIu32"]\n"
+      "  --tenant-rate=TENANT,RATE   Transmit rate limit of tenant group "
+          "(kbps)\n"
+      "  --tenant-uid=UID,TENANT     Put apps run by user UID in tenant "
+          "group [default: group 0]\n"
+      "\n"
       "Fast path:\n"
       "  --fp-cores-max=CORES        Max cores used for fast path "
           "[default: %"PRIu32"]\n"
@@ -696,6 +872,27 @@ static void print_usage(struct configuration *c, char *progname)
           "in us [default: %"PRIu32"]\n"
       "  --fp-poll-interval-app      App polling interval before blocking "
           "in us [default: %"PRIu32"]\n"
+      "  --fp-rss-flowhash           Use NIC RSS hash for flow lookup "
+          "[default: disabled]\n"
+      "  --fp-delack-segs=SEGS       ACK at least every SEGS full segments "
+          "[default: %"PRIu32"]\n"
+      "  --fp-no-gro                 Disable receive segment coalescing "
+          "[default: enabled]\n"
+      "  --fp-dma-stream-min=BYTES   Min. receive copy size for non-temporal "
+          "stores, 0 = never [default: %"PRIu32"]\n"
+      "  --fp-dma-prefetch-min=BYTES Min. transmit copy size for prefetching "
+          "ahead, 0 = never [default: %"PRIu32"]\n"
+      "  --fp-dmadev-min=BYTES       Min. payload copy size offloaded to dma "
+          "devices, 0 = never [default: %"PRIu32"]\n"
+      "  --fp-tso-max=BYTES          Max. payload per transmit super-segment, "
+          "0 = one segment [default: %"PRIu32"]\n"
+      "  --fp-tx-zerocopy            Transmit payload from socket buffers "
+          "without copying [default: disabled]\n"
+      "  --fp-no-rx-xsum             Disable receive checksum "
+          "verification [default: enabled]\n"
+      "  --fp-qman=QMAN              Queue manager for rate limited flows "
+          "[default: skiplist]\n"
+      "     Options: skiplist, wheel\n"
       "  --dpdk-extra=ARG            Add extra DPDK argument\n"
       "\n"
       "Host kernel interface:\n"
@@ -718,8 +915,11 @@ static void print_usage(struct configuration *c, char *progname)
       c->cc_timely_step, c->cc_timely_init,
       (double) c->cc_timely_alpha / UINT32_MAX,
       (double) c->cc_timely_beta / UINT32_MAX, c->cc_timely_min_rtt,
-      c->cc_timely_min_rate, c->arp_to, c->arp_to_max,
-      c->fp_cores_max, c->fp_poll_interval_tas, c->fp_poll_interval_app);
+      c->cc_timely_min_rate, c->ip_mtu, c->arp_to, c->arp_to_max,
+      c->app_rate,
+      c->fp_cores_max, c->fp_poll_interval_tas, c->fp_poll_interval_app,
+      c->fp_delack_segs, c->fp_dma_stream_min, c->fp_dma_prefetch_min,
+      c->fp_dmadev_min, c->fp_tso_max);
 }
 
 static inline int parse_int64(const char *s, uint64_t *pi)
@@ -823,6 +1023,106 @@ failed:
   return -1;
 }
 
+static inline int parse_tenant_rate(char *s, struct configuration *c)
+{
+  struct config_tenant_rate *t, *t_p;
+  uint32_t tenant;
+  char *comma;
+
+  if ((t = calloc(1, sizeof(*t))) == NULL) {
+    fprintf(stderr, "parse_tenant_rate: alloc failed\n");
+    return -1;
+  }
+
+  /* split tenant group from rate */
+  if ((comma = strchr(s, ',')) == NULL) {
+    fprintf(stderr, "parse_tenant_rate: no comma found (%s)\n", s);
+    goto failed;
+  }
+  *comma = 0;
+
+  if (parse_int32(s, &tenant) != 0) {
+    fprintf(stderr, "parse_tenant_rate: parsing tenant (%s) failed\n", s);
+    goto failed;
+  }
+  if (tenant >= FLEXNIC_PL_TENANT_NUM) {
+    fprintf(stderr, "parse_tenant_rate: tenant too high (%u, max=%u)\n",
+        tenant, FLEXNIC_PL_TENANT_NUM - 1);
+    goto failed;
+  }
+  t->tenant = tenant;
+
+  if (parse_int32(comma + 1, &t->rate) != 0) {
+    fprintf(stderr, "parse_tenant_rate: parsing rate (%s) failed\n",
+        comma + 1);
+    goto failed;
+  }
+
+  /* add to tenant rate list */
+  t->next = NULL;
+  if (c->tenant_rates == NULL) {
+    c->tenant_rates = t;
+  } else {
+    for (t_p = c->tenant_rates; t_p->next != NULL; t_p = t_p->next);
+    t_p->next = t;
+  }
+  return 0;
+
+failed:
+  free(t);
+  return -1;
+}
+
+static inline int parse_tenant_uid(char *s, struct configuration *c)
+{
+  struct config_tenant_uid *t, *t_p;
+  uint32_t tenant;
+  char *comma;
+
+  if ((t = calloc(1, sizeof(*t))) == NULL) {
+    fprintf(stderr, "parse_tenant_uid: alloc failed\n");
+    return -1;
+  }
+
+  /* split user id from tenant group */
+  if ((comma = strchr(s, ',')) == NULL) {
+    fprintf(stderr, "parse_tenant_uid: no comma found (%s)\n", s);
+    goto failed;
+  }
+  *comma = 0;
+
+  if (parse_int32(s, &t->uid) != 0) {
+    fprintf(stderr, "parse_tenant_uid: parsing uid (%s) failed\n", s);
+    goto failed;
+  }
+
+  if (parse_int32(comma + 1, &tenant) != 0) {
+    fprintf(stderr, "parse_tenant_uid: parsing tenant (%s) failed\n",
+        comma + 1);
+    goto failed;
+  }
+  if (tenant >= FLEXNIC_PL_TENANT_NUM) {
+    fprintf(stderr, "parse_tenant_uid: tenant too high (%u, max=%u)\n",
+        tenant, FLEXNIC_PL_TENANT_NUM - 1);
+    goto failed;
+  }
+  t->tenant = tenant;
+
+  /* add to tenant assignment list */
+  t->next = NULL;
+  if (c->tenant_uids == NULL) {
+    c->tenant_uids = t;
+  } else {
+    for (t_p = c->tenant_uids; t_p->next != NULL; t_p = t_p->next);
+    t_p->next = t;
+  }
+  return 0;
+
+failed:
+  free(t);
+  return -1;
+}
+
 static inline int parse_arg_append(char *s, struct configuration *c)
 {
   char **new;
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2019 University of Washington, Max Planck Institute for
+ * Software Systems, and The University of Texas at Austin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <rte_config.h>
+
+#include "internal.h"
+
+#ifdef FLEXNIC_DMADEV
+
+/* descriptors in dma engine rings */
+#define DMA_RING_DESC 1024
+
+__thread struct dma_engine dma_engine = { .dev = -1 };
+
+int dma_engine_init(uint16_t core)
+{
+  struct rte_dma_info info;
+  struct rte_dma_conf conf = { .nb_vchans = 1 };
+  struct rte_dma_vchan_conf vconf = { .direction = RTE_DMA_DIR_MEM_TO_MEM };
+  int16_t dev;
+  uint16_t i = 0;
+
+  if (config.fp_dmadev_min == 0)
+    return 0;
+
+  /* core n uses the n-th dma device */
+  RTE_DMA_FOREACH_DEV(dev) {
+    if (i++ == core)
+      break;
+  }
+  if (dev == -1) {
+    fprintf(stderr, "dma_engine_init: no dma device for core %u, using cpu "
+        "copies\n", core);
+    return 0;
+  }
+
+  if (rte_dma_info_get(dev, &info) != 0) {
+    fprintf(stderr, "dma_engine_init: rte_dma_info_get failed\n");
+    return -1;
+  }
+
+  /* copies are enqueued with virtual addresses, shared memory buffers are not
+   * registered with dpdk */
+  if ((info.dev_capa & RTE_DMA_CAPA_SVA) == 0) {
+    fprintf(stderr, "dma_engine_init: dma device %d does not support shared "
+        "virtual addressing\n", dev);
+    return -1;
+  }
+
+  vconf.nb_desc = MIN(MAX(DMA_RING_DESC, info.min_desc), info.max_desc);
+  if (rte_dma_configure(dev, &conf) != 0) {
+    fprintf(stderr, "dma_engine_init: rte_dma_configure failed\n");
+    return -1;
+  }
+  if (rte_dma_vchan_setup(dev, 0, &vconf) != 0) {
+    fprintf(stderr, "dma_engine_init: rte_dma_vchan_setup failed\n");
+    return -1;
+  }
+  if (rte_dma_start(dev) != 0) {
+    fprintf(stderr, "dma_engine_init: rte_dma_start failed\n");
+    return -1;
+  }
+
+  dma_engine.dev = dev;
+  return 0;
+}
+
+#endif /* def FLEXNIC_DMADEV */
@@ -27,20 +27,214 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <x86intrin.h>
 
 #include <rte_config.h>
 #include <rte_memcpy.h>
+#include <rte_prefetch.h>
+#ifdef FLEXNIC_DMADEV
+#include <rte_dmadev.h>
+#endif
 #include <tas.h>
 
+/* how far ahead of the copy position prefetching reads runs */
+#define DMA_PREFETCH_AHEAD 512
+#define DMA_PREFETCH_CHUNK 256
+
 #ifdef DATAPLANE_STATS
+/** Per core counters for copy policies used */
+struct dma_stats {
+  uint64_t rd_copy;
+  uint64_t rd_copy_bytes;
+  uint64_t rd_prefetch;
+  uint64_t rd_prefetch_bytes;
+  uint64_t rd_xsum;
+  uint64_t rd_xsum_bytes;
+  uint64_t wr_copy;
+  uint64_t wr_copy_bytes;
+  uint64_t wr_stream;
+  uint64_t wr_stream_bytes;
+  uint64_t rd_async;
+  uint64_t rd_async_bytes;
+  uint64_t wr_async;
+  uint64_t wr_async_bytes;
+};
+
+/** Counters of current fast path core, NULL on other threads */
+extern __thread struct dma_stats *dma_stats;
+
 void dma_dump_stats(void);
+
+#define DMA_STATS_ADD(f, len) \
+  do { \
+    if (dma_stats != NULL) { \
+      __sync_fetch_and_add(&dma_stats->f, 1); \
+      __sync_fetch_and_add(&dma_stats->f##_bytes, len); \
+    } \
+  } while (0)
+#else
+#define DMA_STATS_ADD(f, len) do { } while (0)
+#endif
+
+/* copy with non-temporal stores to keep the destination out of the cache */
+static inline void dma_copy_stream(void *dst, const void *src, size_t len)
+{
+  uint8_t *d = dst;
+  const uint8_t *s = src;
+  size_t head;
+  __m128i a, b, c, e;
+
+  /* align destination for streaming stores */
+  head = -(uintptr_t) d & 15;
+  if (head > len)
+    head = len;
+  rte_memcpy(d, s, head);
+  d += head;
+  s += head;
+  len -= head;
+
+  for (; len >= 64; len -= 64, d += 64, s += 64) {
+    a = _mm_loadu_si128((const __m128i *) s);
+    b = _mm_loadu_si128((const __m128i *) (s + 16));
+    c = _mm_loadu_si128((const __m128i *) (s + 32));
+    e = _mm_loadu_si128((const __m128i *) (s + 48));
+    _mm_stream_si128((__m128i *) d, a);
+    _mm_stream_si128((__m128i *) (d + 16), b);
+    _mm_stream_si128((__m128i *) (d + 32), c);
+    _mm_stream_si128((__m128i *) (d + 48), e);
+  }
+  for (; len >= 16; len -= 16, d += 16, s += 16) {
+    _mm_stream_si128((__m128i *) d, _mm_loadu_si128((const __m128i *) s));
+  }
+  rte_memcpy(d, s, len);
+
+  /* streaming stores are weakly ordered, make sure payload is visible before
+   * the application is notified */
+  _mm_sfence();
+}
+
+/* fold 64 bit ones complement sum to 16 bits */
+static inline uint16_t dma_xsum_fold(uint64_t sum)
+{
+  sum = (sum & 0xffffffff) + (sum >> 32);
+  sum = (sum & 0xffffffff) + (sum >> 32);
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  return sum;
+}
+
+/* copy and add ones complement sum of the 16 bit words copied (in the same
+ * byte order as rte_raw_cksum) to `sum`, returns the unfolded sum. If len is
+ * odd, the last byte is added as if followed by a zero byte. */
+static inline uint64_t dma_copy_xsum(void *dst, const void *src, size_t len,
+    uint64_t sum)
+{
+  uint8_t *d = dst;
+  const uint8_t *s = src;
+  uint64_t w;
+#ifdef __AVX2__
+  uint32_t lanes[8];
+  size_t n, i;
+  __m256i v, acc;
+  const __m256i mask = _mm256_set1_epi32(0xffff);
+
+  while (len >= 32) {
+    /* each iteration adds at most 2 * 0xffff to the 32 bit lanes, fold into
+     * sum before they could overflow */
+    acc = _mm256_setzero_si256();
+    n = (len / 32 < 16384 ? len / 32 : 16384);
+    for (; n > 0; n--, len -= 32, d += 32, s += 32) {
+      v = _mm256_loadu_si256((const __m256i *) s);
+      _mm256_storeu_si256((__m256i *) d, v);
+      acc = _mm256_add_epi32(acc, _mm256_and_si256(v, mask));
+      acc = _mm256_add_epi32(acc, _mm256_srli_epi32(v, 16));
+    }
+    _mm256_storeu_si256((__m256i *) lanes, acc);
+    for (i = 0; i < 8; i++)
+      sum += lanes[i];
+  }
+#endif
+
+  for (; len >= 8; len -= 8, d += 8, s += 8) {
+    memcpy(&w, s, 8);
+    memcpy(d, &w, 8);
+    sum += (w & 0xffffffff) + (w >> 32);
+  }
+  if (len > 0) {
+    w = 0;
+    memcpy(&w, s, len);
+    memcpy(d, &w, len);
+    sum += (w & 0xffffffff) + (w >> 32);
+  }
+  return sum;
+}
+
+/* checksum only variant of dma_copy_xsum, for data that is not copied */
+static inline uint64_t dma_xsum(const void *buf, size_t len, uint64_t sum)
+{
+  const uint8_t *s = buf;
+  uint64_t w;
+#ifdef __AVX2__
+  uint32_t lanes[8];
+  size_t n, i;
+  __m256i v, acc;
+  const __m256i mask = _mm256_set1_epi32(0xffff);
+
+  while (len >= 32) {
+    acc = _mm256_setzero_si256();
+    n = (len / 32 < 16384 ? len / 32 : 16384);
+    for (; n > 0; n--, len -= 32, s += 32) {
+      v = _mm256_loadu_si256((const __m256i *) s);
+      acc = _mm256_add_epi32(acc, _mm256_and_si256(v, mask));
+      acc = _mm256_add_epi32(acc, _mm256_srli_epi32(v, 16));
+    }
+    _mm256_storeu_si256((__m256i *) lanes, acc);
+    for (i = 0; i < 8; i++)
+      sum += lanes[i];
+  }
 #endif
 
+  for (; len >= 8; len -= 8, s += 8) {
+    memcpy(&w, s, 8);
+    sum += (w & 0xffffffff) + (w >> 32);
+  }
+  if (len > 0) {
+    w = 0;
+    memcpy(&w, s, len);
+    sum += (w & 0xffffffff) + (w >> 32);
+  }
+  return sum;
+}
+
+/* copy while prefetching the source ahead of the copy position */
+static inline void dma_copy_prefetch(void *dst, const void *src, size_t len)
+{
+  uint8_t *d = dst;
+  const uint8_t *s = src;
+  size_t off, pf, chunk;
+
+  for (pf = 0; pf < len && pf < DMA_PREFETCH_AHEAD; pf += 64)
+    rte_prefetch0(s + pf);
+
+  for (off = 0; off < len; off += chunk) {
+    chunk = (len - off < DMA_PREFETCH_CHUNK ? len - off : DMA_PREFETCH_CHUNK);
+    for (; pf < len && pf < off + chunk + DMA_PREFETCH_AHEAD; pf += 64)
+      rte_prefetch0(s + pf);
+    rte_memcpy(d + off, s + off, chunk);
+  }
+}
+
 static inline void dma_read(uintptr_t addr, size_t len, void *buf)
 {
   assert(addr + len >= addr && addr + len <= config.shm_len);
 
-  rte_memcpy(buf, (uint8_t *) tas_shm + addr, len);
+  if (config.fp_dma_prefetch_min != 0 && len >= config.fp_dma_prefetch_min) {
+    dma_copy_prefetch(buf, (uint8_t *) tas_shm + addr, len);
+    DMA_STATS_ADD(rd_prefetch, len);
+  } else {
+    rte_memcpy(buf, (uint8_t *) tas_shm + addr, len);
+    DMA_STATS_ADD(rd_copy, len);
+  }
 
 #ifdef FLEXNIC_TRACE_DMA
   struct flexnic_trace_entry_dma evt = {
@@ -52,11 +246,38 @@ static inline void dma_read(uintptr_t addr, size_t len, void *buf)
 #endif
 }
 
+/* synchronous read that also computes the checksum of the data, see
+ * dma_copy_xsum */
+static inline uint64_t dma_read_xsum(uintptr_t addr, size_t len, void *buf,
+    uint64_t sum)
+{
+  assert(addr + len >= addr && addr + len <= config.shm_len);
+
+  sum = dma_copy_xsum(buf, (uint8_t *) tas_shm + addr, len, sum);
+  DMA_STATS_ADD(rd_xsum, len);
+
+#ifdef FLEXNIC_TRACE_DMA
+  struct flexnic_trace_entry_dma evt = {
+      .addr = addr,
+      .len = len,
+    };
+  trace_event2(FLEXNIC_TRACE_EV_DMARD, sizeof(evt), &evt,
+      MIN(len, UINT16_MAX - sizeof(evt)), buf);
+#endif
+  return sum;
+}
+
 static inline void dma_write(uintptr_t addr, size_t len, const void *buf)
 {
   assert(addr + len >= addr && addr + len <= config.shm_len);
 
-  rte_memcpy((uint8_t *) tas_shm + addr, buf, len);
+  if (config.fp_dma_stream_min != 0 && len >= config.fp_dma_stream_min) {
+    dma_copy_stream((uint8_t *) tas_shm + addr, buf, len);
+    DMA_STATS_ADD(wr_stream, len);
+  } else {
+    rte_memcpy((uint8_t *) tas_shm + addr, buf, len);
+    DMA_STATS_ADD(wr_copy, len);
+  }
 
 #ifdef FLEXNIC_TRACE_DMA
   struct flexnic_trace_entry_dma evt = {
@@ -68,6 +289,187 @@ static inline void dma_write(uintptr_t addr, size_t len, const void *buf)
 #endif
 }
 
+#ifdef FLEXNIC_DMADEV
+/* copies enqueued before ringing the doorbell */
+#define DMA_ASYNC_SUBMIT_BATCH 8
+/* copies in flight at most, power of 2 */
+#define DMA_ASYNC_OPS 1024
+/* completion statuses fetched at once after an error */
+#define DMA_ASYNC_STATUS_BATCH 32
+
+/** Copy in flight, redone with the cpu if it fails */
+struct dma_async_op {
+  void *dst;
+  const void *src;
+  uint32_t len;
+};
+
+/** Per core dma engine state */
+struct dma_engine {
+  /** dmadev id, -1 if none assigned to this core */
+  int16_t dev;
+  /** copies enqueued but not yet submitted */
+  uint16_t pending;
+  /** copies enqueued so far, low 16 bits are the ring index of the next */
+  uint32_t enq;
+  /** copies completed so far, in order */
+  uint32_t done;
+  /** copies in flight by ring index */
+  struct dma_async_op ops[DMA_ASYNC_OPS];
+};
+
+extern __thread struct dma_engine dma_engine;
+
+int dma_engine_init(uint16_t core);
+
+/* reap completed copies without waiting, failed copies are redone with the
+ * cpu */
+static inline void dma_async_poll(void)
+{
+  enum rte_dma_status_code st[DMA_ASYNC_STATUS_BATCH];
+  struct dma_async_op *op;
+  uint16_t last, n, i;
+  bool error = false;
+
+  if (dma_engine.pending != 0) {
+    rte_dma_submit(dma_engine.dev, 0);
+    dma_engine.pending = 0;
+  }
+
+  if (dma_engine.enq == dma_engine.done)
+    return;
+
+  n = rte_dma_completed(dma_engine.dev, 0, dma_engine.enq - dma_engine.done,
+      &last, &error);
+  if (n > 0)
+    dma_engine.done += (uint16_t) (last + 1 - dma_engine.done);
+  if (LIKELY(!error))
+    return;
+
+  /* statuses from the failed copy on */
+  n = rte_dma_completed_status(dma_engine.dev, 0, DMA_ASYNC_STATUS_BATCH,
+      &last, st);
+  for (i = 0; i < n; i++) {
+    if (st[i] == RTE_DMA_STATUS_SUCCESSFUL)
+      continue;
+
+    op = &dma_engine.ops[(dma_engine.done + i) & (DMA_ASYNC_OPS - 1)];
+    rte_memcpy(op->dst, op->src, op->len);
+  }
+  if (n > 0)
+    dma_engine.done += (uint16_t) (last + 1 - dma_engine.done);
+}
+
+/* position in the stream of copies: work depending on the copies enqueued so
+ * far can go ahead once dma_async_done returns true for it */
+static inline uint32_t dma_async_mark(void)
+{
+  return dma_engine.enq;
+}
+
+/* check if the copies enqueued before `mark` completed */
+static inline int dma_async_done(uint32_t mark)
+{
+  if ((int32_t) (dma_engine.done - mark) >= 0)
+    return 1;
+
+  dma_async_poll();
+  return (int32_t) (dma_engine.done - mark) >= 0;
+}
+
+/* number of copies in flight */
+static inline unsigned dma_async_pending(void)
+{
+  return dma_engine.enq - dma_engine.done;
+}
+
+/* enqueue copy on dma engine, device supports virtual addresses (checked in
+ * dma_engine_init). If the engine is busy the cpu copies instead. */
+static inline void dma_async_copy(void *dst, const void *src, size_t len)
+{
+  rte_iova_t s = (uintptr_t) src, d = (uintptr_t) dst;
+  struct dma_async_op *op;
+  int ret = -1;
+
+  if (UNLIKELY(dma_async_pending() >= DMA_ASYNC_OPS))
+    dma_async_poll();
+  if (LIKELY(dma_async_pending() < DMA_ASYNC_OPS)) {
+    ret = rte_dma_copy(dma_engine.dev, 0, s, d, len, 0);
+    if (UNLIKELY(ret < 0)) {
+      /* ring full, reap completions and retry */
+      dma_async_poll();
+      ret = rte_dma_copy(dma_engine.dev, 0, s, d, len, 0);
+    }
+  }
+  if (UNLIKELY(ret < 0)) {
+    rte_memcpy(dst, src, len);
+    return;
+  }
+
+  op = &dma_engine.ops[ret & (DMA_ASYNC_OPS - 1)];
+  op->dst = dst;
+  op->src = src;
+  op->len = len;
+  dma_engine.enq += (uint16_t) (ret + 1 - dma_engine.enq);
+
+  if (++dma_engine.pending >= DMA_ASYNC_SUBMIT_BATCH) {
+    rte_dma_submit(dma_engine.dev, 0);
+    dma_engine.pending = 0;
+  }
+}
+
+static inline int dma_async_use(size_t len)
+{
+  return dma_engine.dev >= 0 && len >= config.fp_dmadev_min;
+}
+#else
+static inline uint32_t dma_async_mark(void)
+{
+  return 0;
+}
+
+static inline int dma_async_done(uint32_t mark)
+{
+  return 1;
+}
+
+static inline unsigned dma_async_pending(void)
+{
+  return 0;
+}
+#endif
+
+/* read from shared memory, possibly asynchronously: data in buf is only valid
+ * once dma_async_done returns true for a mark taken afterwards */
+static inline void dma_read_async(uintptr_t addr, size_t len, void *buf)
+{
+#ifdef FLEXNIC_DMADEV
+  if (dma_async_use(len)) {
+    assert(addr + len >= addr && addr + len <= config.shm_len);
+    dma_async_copy(buf, (uint8_t *) tas_shm + addr, len);
+    DMA_STATS_ADD(rd_async, len);
+    return;
+  }
+#endif
+  dma_read(addr, len, buf);
+}
+
+/* write to shared memory, possibly asynchronously: buf must not be modified
+ * and data at addr is only valid once dma_async_done returns true for a mark
+ * taken afterwards */
+static inline void dma_write_async(uintptr_t addr, size_t len, const void *buf)
+{
+#ifdef FLEXNIC_DMADEV
+  if (dma_async_use(len)) {
+    assert(addr + len >= addr && addr + len <= config.shm_len);
+    dma_async_copy((uint8_t *) tas_shm + addr, buf, len);
+    DMA_STATS_ADD(wr_async, len);
+    return;
+  }
+#endif
+  dma_write(addr, len, buf);
+}
+
 static inline void *dma_pointer(uintptr_t addr, size_t len)
 {
   /* validate address */
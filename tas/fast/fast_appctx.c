@@ -36,6 +36,23 @@ void fast_appctx_poll_pf(struct dataplane_context *ctx, uint32_t id)
   rte_prefetch0(dma_pointer(actx->tx_base + actx->tx_head, 1));
 }
 
+/* Forward bump to the owner core of its flow, which releases the queue entry.
+ * The entry is marked so polling does not pick it up again after the queue
+ * wrapped around. Returns -1 if the owner's ring is full. */
+static int bump_forward(uint16_t owner, struct flextcp_pl_atx *atx)
+{
+  uint8_t type = atx->type;
+
+  atx->type = FLEXTCP_PL_ATX_CONNUPDATE | FLEXTCP_PL_ATX_FORWARDED;
+  if (rte_ring_enqueue(ctxs[owner]->bump_fwd_ring, atx) != 0) {
+    atx->type = type;
+    return -1;
+  }
+
+  notify_fastpath_core(owner);
+  return 0;
+}
+
 int fast_appctx_poll_fetch(struct dataplane_context *ctx, uint32_t id,
     void **pqe)
 {
@@ -43,6 +60,8 @@ int fast_appctx_poll_fetch(struct dataplane_context *ctx, uint32_t id,
   struct flextcp_pl_atx *atx;
   uint8_t type;
   uint32_t flow_id  = -1;
+  uint16_t owner;
+  int ret = 0;
 
   /* stop if context is not in use */
   if (actx->tx_len == 0)
@@ -53,7 +72,8 @@ int fast_appctx_poll_fetch(struct dataplane_context *ctx, uint32_t id,
   type = atx->type;
   MEM_BARRIER();
 
-  if (type == 0) {
+  if (type == 0 || (type & FLEXTCP_PL_ATX_FORWARDED) != 0) {
+    /* empty, or the owner core has not released a forwarded entry yet */
     return -1;
   } else if (type != FLEXTCP_PL_ATX_CONNUPDATE) {
     fprintf(stderr, "fast_appctx_poll: unknown type: %u id=%u\n", type,
@@ -61,8 +81,6 @@ int fast_appctx_poll_fetch(struct dataplane_context *ctx, uint32_t id,
     abort();
   }
 
-  *pqe = atx;
-
   /* update RX/TX queue pointers for connection */
   flow_id = atx->msg.connupdate.flow_id;
   if (flow_id >= FLEXNIC_PL_FLOWST_NUM) {
@@ -74,20 +92,40 @@ int fast_appctx_poll_fetch(struct dataplane_context *ctx, uint32_t id,
   rte_prefetch0(fs);
   rte_prefetch0(fs + 64);
 
+  /* bumps for flows owned by other cores are applied there, if the owner's
+   * ring is full the entry stays in the queue */
+  owner = flow_owner(fs);
+  if (owner != ctx->id) {
+    if (bump_forward(owner, atx) != 0)
+      return -1;
+    ret = 1;
+  } else {
+    *pqe = atx;
+  }
+
   actx->tx_head += sizeof(*atx);
   if (actx->tx_head >= actx->tx_len)
     actx->tx_head -= actx->tx_len;
 
-  return 0;
+  return ret;
 }
 
 int fast_appctx_poll_bump(struct dataplane_context *ctx, void *pqe,
     struct network_buf_handle *nbh, uint32_t ts)
 {
   struct flextcp_pl_atx *atx = pqe;
+  uint32_t flow_id = atx->msg.connupdate.flow_id;
+  uint16_t owner = flow_owner(&fp_state->flowst[flow_id]);
   int ret;
 
-  ret = fast_flows_bump(ctx, atx->msg.connupdate.flow_id,
+  /* flow moved on since the bump was forwarded to us */
+  if (owner != ctx->id) {
+    if (bump_forward(owner, atx) != 0)
+      return -1;
+    return 1;
+  }
+
+  ret = fast_flows_bump(ctx, flow_id,
       atx->msg.connupdate.bump_seq, atx->msg.connupdate.rx_bump,
       atx->msg.connupdate.tx_bump, atx->msg.connupdate.flags, nbh, ts);
 
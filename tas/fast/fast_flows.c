@@ -23,22 +23,34 @@
  */
 
 #include <assert.h>
+#include <x86intrin.h>
 #include <rte_config.h>
 #include <rte_ip.h>
 #include <rte_hash_crc.h>
+#include <rte_thash.h>
 
 #include <tas_memif.h>
-#include <utils_sync.h>
 
 #include "internal.h"
 #include "fastemu.h"
 #include "tcp_common.h"
 
-#define TCP_MSS 1448
+/* payload limit for transmit super-segments, fits in one large mbuf */
+#define TCP_TSO_MAX 65160
+/* rate limited flows get super-segments of at most this many us at their
+ * rate, to keep pacing accurate */
+#define TCP_TSO_BURST_US 20
 #define TCP_MAX_RTT 100000
+/* SACK blocks that fit in an ACK next to the timestamp option */
+#define TCP_SACK_MAX_BLOCKS 3
+/* marks an unused slot in the delayed ack table */
+#define ACK_FLOW_INVAL (-1U)
 
 //#define SKIP_ACK 1
 
+/* packet parse tracks invalid packets in batch in a bitmap */
+STATIC_ASSERT(BATCH_SIZE <= 32, batch_size_parse_bitmap);
+
 struct flow_key {
   ip_addr_t local_ip;
   ip_addr_t remote_ip;
@@ -46,34 +58,69 @@ struct flow_key {
   beui16_t remote_port;
 } __attribute__((packed));
 
-#if 1
-#define fs_lock(fs) util_spin_lock(&fs->lock)
-#define fs_unlock(fs) util_spin_unlock(&fs->lock)
-#else
-#define fs_lock(fs) do {} while (0)
-#define fs_unlock(fs) do {} while (0)
-#endif
+struct flow_key6 {
+  ip6_addr_t local_ip;
+  ip6_addr_t remote_ip;
+  beui16_t local_port;
+  beui16_t remote_port;
+} __attribute__((packed));
 
 
 static void flow_tx_read(struct flextcp_pl_flowst *fs, uint32_t pos,
     uint16_t len, void *dst);
+static uint16_t flow_tx_read_xsum(struct flextcp_pl_flowst *fs, uint32_t pos,
+    uint16_t len, void *dst);
 static void flow_rx_write(struct flextcp_pl_flowst *fs, uint32_t pos,
-    uint16_t len, const void *src);
+    uint16_t len, const void *src, int sync);
+static void flow_rx_run_write(struct flextcp_pl_flowst *fs, uint32_t pos,
+    struct network_buf_handle **nbhs, uint16_t num, uint32_t off,
+    uint32_t len, int sync);
 #ifdef FLEXNIC_PL_OOO_RECV
 static void flow_rx_seq_write(struct flextcp_pl_flowst *fs, uint32_t seq,
-    uint16_t len, const void *src);
+    struct network_buf_handle **nbhs, uint16_t num, uint32_t off,
+    uint32_t len, int sync);
+static int flow_rx_ooo_add(struct flextcp_pl_flowst *fs, uint32_t seq,
+    uint32_t len);
+static uint32_t flow_rx_ooo_advance(struct flextcp_pl_flowst *fs);
 #endif
+static int seqiv_add(struct flextcp_pl_seqiv *iv, unsigned num, uint32_t base,
+    uint32_t seq, uint32_t len);
+static uint32_t seqiv_advance(struct flextcp_pl_seqiv *iv, unsigned num,
+    uint32_t base);
+static void flow_sack_update(struct flextcp_pl_flowst *fs,
+    const struct tcp_sack_opt *sack);
+static int flow_sack_retransmit(struct dataplane_context *ctx,
+    struct flextcp_pl_flowst *fs);
+static int flow_sack_next_hole(struct flextcp_pl_flowst *fs, uint32_t *seq,
+    uint32_t *len);
 static void flow_tx_segment(struct dataplane_context *ctx,
     struct network_buf_handle *nbh, struct flextcp_pl_flowst *fs,
     uint32_t seq, uint32_t ack, uint32_t rxwnd, uint16_t payload,
-    uint32_t payload_pos, uint32_t ts_echo, uint32_t ts_my, uint8_t fin);
-static void flow_tx_ack(struct dataplane_context *ctx, uint32_t seq,
-    uint32_t ack, uint32_t rxwnd, uint32_t echo_ts, uint32_t my_ts,
-    struct network_buf_handle *nbh, struct tcp_timestamp_opt *ts_opt);
+    uint32_t payload_pos, uint32_t ts_echo, uint32_t ts_my, uint8_t fin,
+    uint8_t zc);
+static void flow_tx_ack(struct dataplane_context *ctx,
+    struct flextcp_pl_flowst *fs, uint32_t seq, uint32_t ack, uint32_t rxwnd,
+    uint32_t echo_ts, uint32_t my_ts, struct network_buf_handle *nbh);
+static inline int flow_ack_overwrites(const struct flextcp_pl_flowst *fs,
+    const struct tcp_hdr *th);
 static void flow_reset_retransmit(struct flextcp_pl_flowst *fs);
+static inline void flow_rtt_update(struct flextcp_pl_flowst *fs, uint32_t rtt);
+static inline void flow_rtt_sent(struct flextcp_pl_flowst *fs, uint32_t seq,
+    uint32_t ts);
+static inline void flow_rtt_acked(struct flextcp_pl_flowst *fs, uint32_t ack,
+    uint32_t ts);
+static int flow_ack_delay(struct dataplane_context *ctx, uint32_t flow_id,
+    uint16_t full_segs);
+static void flow_ack_clear(struct dataplane_context *ctx, uint32_t flow_id);
 
 static inline void tcp_checksums(struct network_buf_handle *nbh,
     struct pkt_tcp *p, beui32_t ip_s, beui32_t ip_d, uint16_t l3_paylen);
+static inline uint16_t flow_hdrs_len(const struct flextcp_pl_flowst *fs);
+static inline void flow_hdr_copy(struct pkt_tcp *p,
+    const struct flextcp_pl_flowhdr *fh, int ip6);
+static inline void tcp_checksums_hdr(struct network_buf_handle *nbh,
+    struct pkt_tcp *p, uint8_t ecn, uint16_t paysum);
+static inline uint16_t flow_tx_chunk(const struct flextcp_pl_flowst *fs);
 
 void fast_flows_qman_pf(struct dataplane_context *ctx, uint32_t *queues,
     uint16_t n)
@@ -82,6 +129,8 @@ void fast_flows_qman_pf(struct dataplane_context *ctx, uint32_t *queues,
 
   for (i = 0; i < n; i++) {
     rte_prefetch0(&fp_state->flowst[queues[i]]);
+    rte_prefetch0((uint8_t *) &fp_state->flowst[queues[i]] + 64);
+    rte_prefetch0(&fp_state->flowhdr[queues[i]]);
   }
 }
 
@@ -106,37 +155,41 @@ int fast_flows_qman(struct dataplane_context *ctx, uint32_t queue,
 {
   uint32_t flow_id = queue;
   struct flextcp_pl_flowst *fs = &fp_state->flowst[flow_id];
-  uint32_t avail, len, tx_pos, tx_seq, ack, rx_wnd;
+  struct network_buf_handle *tso_nbh;
+  uint32_t avail, len, tx_pos, tx_seq, ack, rx_wnd, diff;
   uint16_t new_core;
-  uint8_t fin;
+  uint8_t fin, zc;
   int ret = 0;
 
-  fs_lock(fs);
-
-  /* if connection has been moved, add to forwarding queue and stop */
-  new_core = fp_state->flow_group_steering[fs->flow_group];
+  /* if connection has been moved, hand it over after the poll and stop */
+  new_core = flow_owner(fs);
   if (new_core != ctx->id) {
     /*fprintf(stderr, "fast_flows_qman: arrived on wrong core, forwarding "
         "%u -> %u (fs=%p, fg=%u)\n", ctx->id, new_core, fs, fs->flow_group);*/
+    ctx->qman_fwd_fss[ctx->qman_fwd_num++] = fs;
+    ret = -1;
+    goto out;
+  }
 
-    /* enqueue flo state on forwarding queue */
-    if (rte_ring_enqueue(ctxs[new_core]->qman_fwd_ring, fs) != 0) {
-      fprintf(stderr, "fast_flows_qman: rte_ring_enqueue failed\n");
-      abort();
+  /* retransmit holes reported in SACK blocks before sending new data */
+  if (UNLIKELY((fs->flags & FLEXNIC_PL_FLOWST_SACKRTX) != 0) &&
+      flow_sack_next_hole(fs, &tx_seq, &len) == 0)
+  {
+    diff = fs->tx_next_seq - tx_seq;
+    if (fs->tx_next_pos >= diff) {
+      tx_pos = fs->tx_next_pos - diff;
+    } else {
+      tx_pos = fs->tx_len - (diff - fs->tx_next_pos);
     }
 
-    /* clear queue manager queue */
-    if (qman_set(&ctx->qman, flow_id, 0, 0, 0,
-          QMAN_SET_RATE | QMAN_SET_MAXCHUNK | QMAN_SET_AVAIL) != 0)
-    {
-      fprintf(stderr, "flast_flows_qman: qman_set clear failed, UNEXPECTED\n");
-      abort();
+    /* no rtt samples from retransmitted segments */
+    if (UNLIKELY(!fs->ts_opt)) {
+      fp_state->flowrtt[flow_id].valid = 0;
     }
 
-    notify_fastpath_core(new_core);
-
-    ret = -1;
-    goto unlock;
+    flow_tx_segment(ctx, nbh, fs, tx_seq, fs->rx_next_seq, fs->rx_avail, len,
+        tx_pos, fs->tx_next_ts, ts, 0, 0);
+    goto out;
   }
 
   /* calculate how much is available to be sent */
@@ -165,9 +218,36 @@ int fast_flows_qman(struct dataplane_context *ctx, uint32_t queue,
   /* if there is no data available, stop */
   if (avail == 0) {
     ret = -1;
-    goto unlock;
+    goto out;
+  }
+  len = MIN(avail, flow_tx_chunk(fs));
+
+  /* let the NIC read the payload from the tx buffer unless it wraps around */
+  zc = config.fp_tx_zerocopy && fs->tx_next_pos + len <= fs->tx_len &&
+    tx_zc_usable(ctx, fs) && network_buf_extpayload(&ctx->net, nbh,
+        dma_pointer(fs->tx_base + fs->tx_next_pos, len), len) == 0;
+  if (zc) {
+    fs->flags |= FLEXNIC_PL_FLOWST_TXZC;
+    fs->tx_zc_core = ctx->id;
+    fs->tx_zc_head = ctx->net.zc_head;
+  }
+
+  /* more than one segment: build a super-segment in a large buffer and leave
+   * nbh unused, fall back to a single segment if none is available */
+  if (len > fs->mss && !zc) {
+    if ((tso_nbh = tx_tso_alloc(ctx)) != NULL) {
+      nbh = tso_nbh;
+      ret = 1;
+    } else {
+      if (qman_set(&ctx->qman, flow_id, 0, len - fs->mss, 0,
+            QMAN_ADD_AVAIL) != 0)
+      {
+        fprintf(stderr, "fast_flows_qman: qman_set failed, UNEXPECTED\n");
+        abort();
+      }
+      len = fs->mss;
+    }
   }
-  len = MIN(avail, TCP_MSS);
 
   /* state snapshot for creating segment */
   tx_seq = fs->tx_next_seq;
@@ -183,8 +263,11 @@ int fast_flows_qman(struct dataplane_context *ctx, uint32_t queue,
   }
   fs->tx_sent += len;
   fs->tx_avail -= len;
+  if (fs->tx_sent == len) {
+    fp_state->flowstats[flow_id].txp = 1;
+  }
 
-  fin = (fs->rx_base_sp & FLEXNIC_PL_FLOWST_TXFIN) == FLEXNIC_PL_FLOWST_TXFIN &&
+  fin = (fs->flags & FLEXNIC_PL_FLOWST_TXFIN) == FLEXNIC_PL_FLOWST_TXFIN &&
     !fs->tx_avail;
 
   /* make sure we don't send out dummy byte for FIN */
@@ -193,73 +276,337 @@ int fast_flows_qman(struct dataplane_context *ctx, uint32_t queue,
     len--;
   }
 
+  /* without timestamps the rtt is measured on sampled segments */
+  if (UNLIKELY(!fs->ts_opt)) {
+    flow_rtt_sent(fs, fs->tx_next_seq, ts);
+  }
+
   /* send out segment */
   flow_tx_segment(ctx, nbh, fs, tx_seq, ack, rx_wnd, len, tx_pos,
-      fs->tx_next_ts, ts, fin);
-unlock:
-  fs_unlock(fs);
+      fs->tx_next_ts, ts, fin, zc);
+out:
   return ret;
 }
 
+/* Keep a moved flow armed in this core's queue manager without rate limit,
+ * so it fires again right away and is handed to its owner then. */
+static inline void flow_qman_park(struct dataplane_context *ctx,
+    struct flextcp_pl_flowst *fs, uint32_t flow_id)
+{
+  if (qman_set(&ctx->qman, flow_id, 0, 1, flow_tx_chunk(fs),
+        QMAN_SET_RATE | QMAN_SET_MAXCHUNK | QMAN_ADD_AVAIL) != 0)
+  {
+    fprintf(stderr, "flow_qman_park: qman_set failed, UNEXPECTED\n");
+    abort();
+  }
+}
+
+/* Hand moved flows that fired in this core's queue manager to their owners,
+ * one burst per owner. Flows that do not fit on the owner's forwarding ring
+ * stay armed here and are retried on a later poll. */
+void fast_flows_qman_handoff(struct dataplane_context *ctx)
+{
+  struct flextcp_pl_flowst *fss[BATCH_SIZE], *fs;
+  uint32_t flow_id;
+  uint16_t i, n, num, rest, owner;
+  unsigned sent;
+
+  num = ctx->qman_fwd_num;
+  while (num > 0) {
+    /* collect flows with the same owner as the first one */
+    owner = flow_owner(ctx->qman_fwd_fss[0]);
+    for (i = 0, n = 0, rest = 0; i < num; i++) {
+      fs = ctx->qman_fwd_fss[i];
+      if (flow_owner(fs) == owner) {
+        fss[n++] = fs;
+      } else {
+        ctx->qman_fwd_fss[rest++] = fs;
+      }
+    }
+    num = rest;
+
+    sent = rte_ring_enqueue_burst(ctxs[owner]->qman_fwd_ring, (void **) fss,
+        n, NULL);
+    for (i = 0; i < n; i++) {
+      flow_id = fss[i] - fp_state->flowst;
+      if (i >= sent) {
+        flow_qman_park(ctx, fss[i], flow_id);
+        continue;
+      }
+
+      /* clear queue manager queue */
+      if (qman_set(&ctx->qman, flow_id, 0, 0, 0,
+            QMAN_SET_RATE | QMAN_SET_MAXCHUNK | QMAN_SET_AVAIL) != 0)
+      {
+        fprintf(stderr, "fast_flows_qman_handoff: qman_set clear failed, "
+            "UNEXPECTED\n");
+        abort();
+      }
+    }
+
+    ctx->qman_fwd += sent;
+    ctx->qman_fwd_retry += n - sent;
+    if (sent > 0)
+      notify_fastpath_core(owner);
+  }
+
+  ctx->qman_fwd_num = 0;
+}
+
 int fast_flows_qman_fwd(struct dataplane_context *ctx,
     struct flextcp_pl_flowst *fs)
 {
   unsigned avail;
-  uint16_t flow_id = fs - fp_state->flowst;
+  uint32_t flow_id = fs - fp_state->flowst;
+  uint16_t owner = flow_owner(fs);
 
   /*fprintf(stderr, "fast_flows_qman_fwd: fs=%p\n", fs);*/
 
-  fs_lock(fs);
+  /* moved again before we got to it, pass it on from our queue manager */
+  if (owner != ctx->id) {
+    flow_qman_park(ctx, fs, flow_id);
+    return 0;
+  }
 
   avail = tcp_txavail(fs, NULL);
 
   /* re-arm queue manager */
-  if (qman_set(&ctx->qman, flow_id, fs->tx_rate, avail, TCP_MSS,
+  if (qman_set(&ctx->qman, flow_id, fs->tx_rate, avail, flow_tx_chunk(fs),
         QMAN_SET_RATE | QMAN_SET_MAXCHUNK | QMAN_SET_AVAIL) != 0)
   {
     fprintf(stderr, "fast_flows_qman_fwd: qman_set failed, UNEXPECTED\n");
     abort();
   }
 
-  fs_unlock(fs);
   return 0;
 }
 
-void fast_flows_packet_parse(struct dataplane_context *ctx,
+/* check ethertype, IP version and header length, and protocol with a single
+ * masked compare of the 16 bytes starting at the ethertype */
+static inline int packet_hdr_valid(const struct pkt_tcp *p)
+{
+  __m128i h, mask, tmpl;
+
+  mask = _mm_setr_epi8(-1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0, -1, 0, 0, 0, 0);
+  tmpl = _mm_setr_epi8(ETH_TYPE_IP >> 8, ETH_TYPE_IP & 0xff, 0x45, 0, 0, 0, 0,
+      0, 0, 0, 0, IP_PROTO_TCP, 0, 0, 0, 0);
+
+  h = _mm_loadu_si128((const __m128i *) &p->eth.type);
+  h = _mm_and_si128(h, mask);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(h, tmpl)) == 0xffff;
+}
+
+/* same for IPv6: ethertype, IP version, and TCP as next header */
+static inline int packet_hdr6_valid(const struct pkt_tcp *p)
+{
+  __m128i h, mask, tmpl;
+
+  mask = _mm_setr_epi8(-1, -1, 0xf0, 0, 0, 0, 0, 0, -1, 0, 0, 0, 0, 0, 0, 0);
+  tmpl = _mm_setr_epi8(ETH_TYPE_IPV6 >> 8, ETH_TYPE_IPV6 & 0xff, 0x60, 0, 0,
+      0, 0, 0, IP_PROTO_TCP, 0, 0, 0, 0, 0, 0, 0);
+
+  h = _mm_loadu_si128((const __m128i *) &p->eth.type);
+  h = _mm_and_si128(h, mask);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(h, tmpl)) == 0xffff;
+}
+
+/* software checksum verification of received packet with valid headers,
+ * returns 0 if IP and TCP checksums are correct */
+static inline int packet_xsum_check(const struct pkt_tcp *p)
+{
+  const struct pkt_tcp6 *p6 = (const struct pkt_tcp6 *) p;
+  uint16_t l4len = pkt_l4len(p);
+  uint64_t sum;
+
+  if (pkt_ip6(p)) {
+    /* no header checksum in IPv6 */
+    sum = network_ip6_phdr_xsum(&p6->ip6.src, &p6->ip6.dest, IP_PROTO_TCP,
+        l4len);
+    sum = dma_xsum(&p6->tcp, l4len, sum);
+    return (dma_xsum_fold(sum) == 0xffff ? 0 : -1);
+  }
+
+  if (dma_xsum_fold(dma_xsum(&p->ip, sizeof(p->ip), 0)) != 0xffff) {
+    return -1;
+  }
+
+  sum = network_ip_phdr_xsum(p->ip.src, p->ip.dest, IP_PROTO_TCP, l4len);
+  sum = dma_xsum(&p->tcp, l4len, sum);
+  return (dma_xsum_fold(sum) == 0xffff ? 0 : -1);
+}
+
+/* returns bitmap of packets to be dropped */
+uint32_t fast_flows_packet_parse(struct dataplane_context *ctx,
     struct network_buf_handle **nbhs, void **fss, struct tcp_opts *tos,
     uint16_t n)
 {
   struct pkt_tcp *p;
-  uint16_t i, len;
+  struct tcp_hdr *th;
+  uint16_t i, len, hl;
+  uint32_t invalid = 0, drop = 0;
+  int xs;
 
+  /* validate fixed headers for the whole batch first, collecting one bit
+   * per invalid packet. IPv6 packets can only have matched IPv6 flows. */
   for (i = 0; i < n; i++) {
-    if (fss[i] == NULL)
-      continue;
-
     p = network_buf_bufoff(nbhs[i]);
     len = network_buf_len(nbhs[i]);
+    th = pkt_tcph(p);
+    hl = pkt_l3hdrs_len(p);
 
     int cond =
-        (len < sizeof(*p)) |
-        (f_beui16(p->eth.type) != ETH_TYPE_IP) |
-        (p->ip.proto != IP_PROTO_TCP) |
-        (IPH_V(&p->ip) != 4) |
-        (IPH_HL(&p->ip) != 5) |
-        (TCPH_HDRLEN(&p->tcp) < 5) |
-        (len < f_beui16(p->ip.len) + sizeof(p->eth)) |
-        (tcp_parse_options(p, len, &tos[i]) != 0) |
-        (tos[i].ts == NULL);
-
-    if (cond)
+        (fss[i] == NULL) |
+        (len < hl + sizeof(*th)) |
+        !(pkt_ip6(p) ? packet_hdr6_valid(p) : packet_hdr_valid(p)) |
+        (TCPH_HDRLEN(th) < 5) |
+        (pkt_l4len(p) < TCPH_HDRLEN(th) * 4) |
+        (len < hl + pkt_l4len(p));
+
+    invalid |= (uint32_t) cond << i;
+  }
+
+  /* drop packets with bad checksums before they touch flow state, verify in
+   * software what the NIC did not */
+  if (config.fp_rx_xsum) {
+    for (i = 0; i < n; i++) {
+      if ((invalid & (1 << i)) != 0)
+        continue;
+
+      p = network_buf_bufoff(nbhs[i]);
+      xs = network_buf_rxxsum(nbhs[i], pkt_ip6(p));
+      if (xs == 0) {
+        xs = (packet_xsum_check(p) == 0 ? 1 : -1);
+      }
+      if (UNLIKELY(xs < 0)) {
+        drop |= 1 << i;
+        ctx->rx_xsum_drop++;
+      }
+    }
+    invalid |= drop;
+  }
+
+  /* parse options of remaining packets */
+  for (i = 0; i < n; i++) {
+    if ((invalid & (1 << i)) != 0) {
+      fss[i] = NULL;
+      continue;
+    }
+
+    p = network_buf_bufoff(nbhs[i]);
+    len = network_buf_len(nbhs[i]);
+    if (tcp_parse_options_fast(p, len, &tos[i]) != 0)
       fss[i] = NULL;
   }
+
+  return drop;
+}
+
+static inline uint16_t packet_payload_len(const struct pkt_tcp *p)
+{
+  return pkt_l4len(p) - TCPH_HDRLEN(pkt_tcph(p)) * 4;
+}
+
+/* check whether received segment b can be processed together with a, the
+ * segment received right before it on the same flow: either contiguous
+ * payload, or pure acks advancing the cumulative ack. Anything that needs
+ * individual attention (other flags, CE marks, SACK blocks, duplicate acks)
+ * is not merged. */
+static inline int packet_gro_match(const struct pkt_tcp *a,
+    const struct pkt_tcp *b, const struct tcp_opts *tb)
+{
+  const struct tcp_hdr *ath = pkt_tcph(a), *bth = pkt_tcph(b);
+  uint16_t alen, blen;
+  int32_t ackdiff;
+
+  if ((TCPH_FLAGS(bth) & ~TCP_PSH) != TCP_ACK ||
+      pkt_ecn(b) == IP_ECN_CE || tb->sack != NULL)
+    return 0;
+
+  alen = packet_payload_len(a);
+  blen = packet_payload_len(b);
+  ackdiff = f_beui32(bth->ackno) - f_beui32(ath->ackno);
+  if (alen > 0 && blen > 0) {
+    return f_beui32(bth->seqno) == f_beui32(ath->seqno) + alen &&
+      ackdiff >= 0;
+  } else if (alen == 0 && blen == 0) {
+    return f_beui32(bth->seqno) == f_beui32(ath->seqno) && ackdiff > 0;
+  }
+  return 0;
+}
+
+/* Move bit `from` of a per-packet bitmap to `to`, shifting the bits in
+ * between up by one, the same way GRO moves packets in the batch. */
+static inline uint32_t gro_bitmap_move(uint32_t bm, uint16_t from, uint16_t to)
+{
+  uint32_t between = (uint32_t) ((2ULL << from) - (2ULL << to));
+  uint32_t bit = (bm >> from) & 1;
+
+  return (bm & ~(between | (1U << to))) | ((bm << 1) & between) |
+    (bit << to);
+}
+
+/* Coalesce runs of segments for the same flow in the batch. Packets are
+ * reordered so that each run is contiguous in the arrays, with the order of
+ * packets within one flow preserved, the `drop` and `fwd` bitmaps are
+ * reordered along with them. On return runs[i] holds the number of packets in the run
+ * starting at i, and 0 for the remaining packets of a run. */
+void fast_flows_packet_gro(struct dataplane_context *ctx,
+    struct network_buf_handle **nbhs, void **fss, struct tcp_opts *tos,
+    uint8_t *runs, uint32_t *drop, uint32_t *fwd, uint16_t n)
+{
+  struct network_buf_handle *nbh;
+  struct pkt_tcp *p, *q;
+  struct tcp_opts to;
+  uint16_t i, j, k, last;
+  void *fs;
+
+  for (i = 0; i < n; i = last + 1) {
+    runs[i] = 1;
+    last = i;
+
+    if (!config.fp_gro || fss[i] == NULL)
+      continue;
+
+    p = network_buf_bufoff(nbhs[i]);
+    if ((TCPH_FLAGS(pkt_tcph(p)) & ~TCP_PSH) != TCP_ACK ||
+        pkt_ecn(p) == IP_ECN_CE || tos[i].sack != NULL)
+      continue;
+
+    for (j = last + 1; j < n; j++) {
+      if (fss[j] != fss[i])
+        continue;
+
+      q = network_buf_bufoff(nbhs[j]);
+      if (!packet_gro_match(p, q, &tos[j]))
+        break;
+
+      /* move packet right behind the end of the run */
+      nbh = nbhs[j];
+      fs = fss[j];
+      to = tos[j];
+      for (k = j; k > last + 1; k--) {
+        nbhs[k] = nbhs[k - 1];
+        fss[k] = fss[k - 1];
+        tos[k] = tos[k - 1];
+      }
+      last++;
+      nbhs[last] = nbh;
+      fss[last] = fs;
+      tos[last] = to;
+      *drop = gro_bitmap_move(*drop, j, last);
+      *fwd = gro_bitmap_move(*fwd, j, last);
+
+      runs[last] = 0;
+      runs[i]++;
+      p = q;
+    }
+  }
 }
 
 void fast_flows_packet_pfbufs(struct dataplane_context *ctx,
     void **fss, uint16_t n)
 {
   uint16_t i;
-  uint64_t rx_base;
   void *p;
   struct flextcp_pl_flowst *fs;
 
@@ -268,55 +615,100 @@ void fast_flows_packet_pfbufs(struct dataplane_context *ctx,
       continue;
 
     fs = fss[i];
-    rx_base = fs->rx_base_sp & FLEXNIC_PL_FLOWST_RX_MASK;
-    p = dma_pointer(rx_base + fs->rx_next_pos, 1);
+    p = dma_pointer(fs->rx_base + fs->rx_next_pos, 1);
     rte_prefetch0(p);
   }
 }
 
-/* Received packet */
+/* Hand segments of flows owned by another core to the owner, these were
+ * queued here before the flow group was handed over. Returns bitmap of
+ * forwarded segments, segments that could not be forwarded are added to
+ * `drop`. */
+uint32_t fast_flows_packet_fwd(struct dataplane_context *ctx,
+    struct network_buf_handle **nbhs, void **fss, uint32_t *drop, uint16_t n)
+{
+  struct flextcp_pl_flowst *fs;
+  uint32_t fwd = 0;
+  uint16_t i, owner;
+
+  for (i = 0; i < n; i++) {
+    fs = fss[i];
+    if (fs == NULL || LIKELY((owner = flow_owner(fs)) == ctx->id))
+      continue;
+
+    fss[i] = NULL;
+    if (rte_ring_enqueue(ctxs[owner]->rx_fwd_ring, nbhs[i]) != 0) {
+      ctx->rx_fwd_drop++;
+      *drop |= 1 << i;
+      continue;
+    }
+
+    fwd |= 1 << i;
+    ctx->rx_fwd++;
+    notify_fastpath_core(owner);
+  }
+
+  return fwd;
+}
+
+/* Received packet, or run of `num` segments coalesced by
+ * fast_flows_packet_gro. Headers and options of the last segment are used
+ * for the run. Returns 1 if the buffer of the last segment was used for an
+ * ACK, 0 if all buffers can be freed, and -1 if the packets need to go to the
+ * slow path. */
 int fast_flows_packet(struct dataplane_context *ctx,
-    struct network_buf_handle *nbh, void *fsp, struct tcp_opts *opts,
-    uint32_t ts)
+    struct network_buf_handle **nbhs, uint16_t num, void *fsp,
+    struct tcp_opts *opts, uint32_t ts)
 {
+  struct network_buf_handle *nbh = nbhs[num - 1];
   struct pkt_tcp *p = network_buf_bufoff(nbh);
+  struct tcp_hdr *th = pkt_tcph(p);
   struct flextcp_pl_flowst *fs = fsp;
-  uint32_t payload_bytes, payload_off, seq, ack, old_avail, new_avail,
+  struct flextcp_pl_flowstats *st =
+    &fp_state->flowstats[fs - fp_state->flowst];
+  uint32_t payload_bytes, seq, first_seq, ack, old_avail, new_avail,
            orig_payload;
-  uint8_t *payload;
-  uint32_t rx_bump = 0, tx_bump = 0, rx_pos, rtt;
+  uint32_t rx_bump = 0, tx_bump = 0, rx_pos;
   int no_permanent_sp = 0;
-  uint16_t tcp_extra_hlen, trim_start, trim_end;
-  uint16_t flow_id = fs - fp_state->flowst;
-  int trigger_ack = 0, fin_bump = 0;
-
-  tcp_extra_hlen = (TCPH_HDRLEN(&p->tcp) - 5) * 4;
-  payload_off = sizeof(*p) + tcp_extra_hlen;
-  payload_bytes =
-      f_beui16(p->ip.len) - (sizeof(p->ip) + sizeof(p->tcp) + tcp_extra_hlen);
+  uint16_t trim_start, trim_end, i, seg_len, full_segs;
+  uint32_t flow_id = fs - fp_state->flowst;
+  int trigger_ack = 0, fin_bump = 0, ack_delay = 0;
+#ifdef FLEXNIC_PL_OOO_RECV
+  uint32_t ooo_bump;
+#endif
+
+  payload_bytes = packet_payload_len(p);
+  full_segs = payload_bytes >= fs->mss;
+  first_seq = f_beui32(th->seqno);
+  if (UNLIKELY(num > 1)) {
+    first_seq = f_beui32(pkt_tcph(network_buf_bufoff(nbhs[0]))->seqno);
+    for (i = 0; i < num - 1; i++) {
+      seg_len = packet_payload_len(network_buf_bufoff(nbhs[i]));
+      payload_bytes += seg_len;
+      full_segs += seg_len >= fs->mss;
+    }
+  }
   orig_payload = payload_bytes;
 
 #if PL_DEBUG_ARX
   fprintf(stderr, "FLOW local=%08x:%05u remote=%08x:%05u  RX: seq=%u ack=%u "
       "flags=%x payload=%u\n",
-      f_beui32(p->ip.dest), f_beui16(p->tcp.dest),
-      f_beui32(p->ip.src), f_beui16(p->tcp.src), f_beui32(p->tcp.seqno),
-      f_beui32(p->tcp.ackno), TCPH_FLAGS(&p->tcp), payload_bytes);
+      f_beui32(fs->local_ip), f_beui16(th->dest),
+      f_beui32(fs->remote_ip), f_beui16(th->src), f_beui32(th->seqno),
+      f_beui32(th->ackno), TCPH_FLAGS(th), payload_bytes);
 #endif
 
-  fs_lock(fs);
-
 #ifdef FLEXNIC_TRACING
   struct flextcp_pl_trev_rxfs te_rxfs = {
-      .local_ip = f_beui32(p->ip.dest),
-      .remote_ip = f_beui32(p->ip.src),
-      .local_port = f_beui16(p->tcp.dest),
-      .remote_port = f_beui16(p->tcp.src),
+      .local_ip = f_beui32(fs->local_ip),
+      .remote_ip = f_beui32(fs->remote_ip),
+      .local_port = f_beui16(th->dest),
+      .remote_port = f_beui16(th->src),
 
       .flow_id = flow_id,
-      .flow_seq = f_beui32(p->tcp.seqno),
-      .flow_ack = f_beui32(p->tcp.ackno),
-      .flow_flags = TCPH_FLAGS(&p->tcp),
+      .flow_seq = f_beui32(th->seqno),
+      .flow_ack = f_beui32(th->ackno),
+      .flow_flags = TCPH_FLAGS(th),
       .flow_len = payload_bytes,
 
       .fs_rx_nextpos = fs->rx_next_pos,
@@ -334,28 +726,28 @@ int fast_flows_packet(struct dataplane_context *ctx,
   fprintf(stderr, "FLOW local=%08x:%05u remote=%08x:%05u  ST: op=%"PRIx64
       " rx_pos=%x rx_next_seq=%u rx_avail=%x  tx_pos=%x tx_next_seq=%u"
       " tx_sent=%u sp=%u\n",
-      f_beui32(p->ip.dest), f_beui16(p->tcp.dest),
-      f_beui32(p->ip.src), f_beui16(p->tcp.src), fs->opaque, fs->rx_next_pos,
+      f_beui32(fs->local_ip), f_beui16(th->dest),
+      f_beui32(fs->remote_ip), f_beui16(th->src), fs->opaque, fs->rx_next_pos,
       fs->rx_next_seq, fs->rx_avail, fs->tx_next_pos, fs->tx_next_seq,
       fs->tx_sent, fs->slowpath);
 #endif
 
   /* state indicates slow path */
-  if (UNLIKELY((fs->rx_base_sp & FLEXNIC_PL_FLOWST_SLOWPATH) != 0)) {
+  if (UNLIKELY((fs->flags & FLEXNIC_PL_FLOWST_SLOWPATH) != 0)) {
     fprintf(stderr, "dma_krx_pkt_fastpath: slowpath because of state\n");
     goto slowpath;
   }
 
   /* if we get weird flags -> kernel */
-  if (UNLIKELY((TCPH_FLAGS(&p->tcp) & ~(TCP_ACK | TCP_PSH | TCP_ECE | TCP_CWR |
+  if (UNLIKELY((TCPH_FLAGS(th) & ~(TCP_ACK | TCP_PSH | TCP_ECE | TCP_CWR |
             TCP_FIN)) != 0))
   {
-    if ((TCPH_FLAGS(&p->tcp) & TCP_SYN) != 0) {
+    if ((TCPH_FLAGS(th) & TCP_SYN) != 0) {
       /* for SYN/SYN-ACK we'll let the kernel handle them out of band */
       no_permanent_sp = 1;
     } else {
       fprintf(stderr, "dma_krx_pkt_fastpath: slow path because of flags (%x)\n",
-          TCPH_FLAGS(&p->tcp));
+          TCPH_FLAGS(th));
     }
     goto slowpath;
   }
@@ -364,8 +756,8 @@ int fast_flows_packet(struct dataplane_context *ctx,
    * packet, to detect whether more data can be sent afterwards */
   old_avail = tcp_txavail(fs, NULL);
 
-  seq = f_beui32(p->tcp.seqno);
-  ack = f_beui32(p->tcp.ackno);
+  seq = first_seq;
+  ack = f_beui32(th->ackno);
   rx_pos = fs->rx_next_pos;
 
   /* trigger an ACK if there is payload (even if we discard it) */
@@ -375,17 +767,25 @@ int fast_flows_packet(struct dataplane_context *ctx,
 #endif
 
   /* Stats for CC */
-  if ((TCPH_FLAGS(&p->tcp) & TCP_ACK) == TCP_ACK) {
-    fs->cnt_rx_acks++;
+  if ((TCPH_FLAGS(th) & TCP_ACK) == TCP_ACK) {
+    st->cnt_rx_acks += num;
   }
 
   /* if there is a valid ack, process it */
-  if (LIKELY((TCPH_FLAGS(&p->tcp) & TCP_ACK) == TCP_ACK &&
+  if (LIKELY((TCPH_FLAGS(th) & TCP_ACK) == TCP_ACK &&
       tcp_valid_rxack(fs, ack, &tx_bump) == 0))
   {
-    fs->cnt_rx_ack_bytes += tx_bump;
-    if ((TCPH_FLAGS(&p->tcp) & TCP_ECE) == TCP_ECE) {
-      fs->cnt_rx_ecn_bytes += tx_bump;
+    /* zero-copy segments might still reference the acked tx buffer space, if
+     * it can't be held back drop the segment before touching the flow, a
+     * later ack or the retransmission covers it again */
+    if (UNLIKELY(tx_bump != 0 && tx_zc_room(ctx, fs) != 0)) {
+      ctx->rx_zc_drop++;
+      return 0;
+    }
+
+    st->cnt_rx_ack_bytes += tx_bump;
+    if ((TCPH_FLAGS(th) & TCP_ECE) == TCP_ECE) {
+      st->cnt_rx_ecn_bytes += tx_bump;
     }
 
     if (LIKELY(tx_bump <= fs->tx_sent)) {
@@ -404,14 +804,35 @@ int fast_flows_packet(struct dataplane_context *ctx,
       abort();
 #endif
     }
+    if (fs->tx_sent == 0) {
+      st->txp = 0;
+    }
+
+    /* rtt sample for flows without timestamps */
+    if (UNLIKELY(!fs->ts_opt) && tx_bump != 0) {
+      flow_rtt_acked(fs, ack, ts);
+    }
+
+    /* remember what the receiver got beyond the cumulative ack */
+    if (UNLIKELY(opts->sack != NULL) &&
+        (fs->flags & FLEXNIC_PL_FLOWST_SACK) != 0)
+    {
+      flow_sack_update(fs, opts->sack);
+    }
 
     /* duplicate ack */
     if (UNLIKELY(tx_bump != 0)) {
       fs->rx_dupack_cnt = 0;
     } else if (UNLIKELY(orig_payload == 0 && ++fs->rx_dupack_cnt >= 3)) {
-      /* reset to last acknowledged position */
-      flow_reset_retransmit(fs);
-      goto unlock;
+      /* only retransmit the holes if the receiver told us about them,
+       * otherwise reset to last acknowledged position */
+      if (opts->sack == NULL ||
+          (fs->flags & FLEXNIC_PL_FLOWST_SACK) == 0 ||
+          flow_sack_retransmit(ctx, fs) != 0)
+      {
+        flow_reset_retransmit(fs);
+      }
+      goto out;
     }
   }
 
@@ -420,13 +841,11 @@ int fast_flows_packet(struct dataplane_context *ctx,
   if (UNLIKELY(tcp_trim_rxbuf(fs, seq, payload_bytes, &trim_start, &trim_end) != 0)) {
     /* packet is completely outside of unused receive buffer */
     trigger_ack = 1;
-    goto unlock;
+    goto out;
   }
 
   /* trim payload to what we can actually use */
   payload_bytes -= trim_start + trim_end;
-  payload_off += trim_start;
-  payload = (uint8_t *) p + payload_off;
   seq += trim_start;
 
   /* handle out of order segment */
@@ -435,35 +854,16 @@ int fast_flows_packet(struct dataplane_context *ctx,
 
     /* if there is no payload abort immediately */
     if (payload_bytes == 0) {
-      goto unlock;
+      goto out;
     }
 
-    /* otherwise check if we can add it to the out of order interval */
-    if (fs->rx_ooo_len == 0) {
-      fs->rx_ooo_start = seq;
-      fs->rx_ooo_len = payload_bytes;
-      flow_rx_seq_write(fs, seq, payload_bytes, payload);
-      /*fprintf(stderr, "created OOO interval (%p start=%u len=%u)\n",
-          fs, fs->rx_ooo_start, fs->rx_ooo_len);*/
-    } else if (seq + payload_bytes == fs->rx_ooo_start) {
-      /* TODO: those two overlap checks should be more sophisticated */
-      fs->rx_ooo_start = seq;
-      fs->rx_ooo_len += payload_bytes;
-      flow_rx_seq_write(fs, seq, payload_bytes, payload);
-      /*fprintf(stderr, "extended OOO interval (%p start=%u len=%u)\n",
-          fs, fs->rx_ooo_start, fs->rx_ooo_len);*/
-    } else if (fs->rx_ooo_start + fs->rx_ooo_len == seq) {
-      /* TODO: those two overlap checks should be more sophisticated */
-      fs->rx_ooo_len += payload_bytes;
-      flow_rx_seq_write(fs, seq, payload_bytes, payload);
-      /*fprintf(stderr, "extended OOO interval (%p start=%u len=%u)\n",
-          fs, fs->rx_ooo_start, fs->rx_ooo_len);*/
-    } else {
-      /*fprintf(stderr, "Sad, no luck with OOO interval (%p ooo.start=%u "
-          "ooo.len=%u seq=%u bytes=%u)\n", fs, fs->rx_ooo_start,
-          fs->rx_ooo_len, seq, payload_bytes);*/
+    /* otherwise merge into out of order intervals, and only write payload to
+     * the buffer if it was not dropped for lack of intervals */
+    if (flow_rx_ooo_add(fs, seq, payload_bytes) == 0) {
+      flow_rx_seq_write(fs, seq, nbhs, num, trim_start, payload_bytes,
+          flow_ack_overwrites(fs, th));
     }
-    goto unlock;
+    goto out;
   }
 
 #else
@@ -475,43 +875,37 @@ int fast_flows_packet(struct dataplane_context *ctx,
         "(got %u, expect %u, avail %u, payload %u)\n", seq, fs->rx_next_seq,
         fs->rx_avail, payload_bytes);
 #endif
-    goto unlock;
+    goto out;
   }
 
   /* trim payload to what we can actually use */
   payload_bytes -= trim_start + trim_end;
-  payload_off += trim_start;
-  payload = (uint8_t *) p + payload_off;
 #endif
 
-  /* update rtt estimate */
-  fs->tx_next_ts = f_beui32(opts->ts->ts_val);
-  if (LIKELY((TCPH_FLAGS(&p->tcp) & TCP_ACK) == TCP_ACK &&
-      f_beui32(opts->ts->ts_ecr) != 0))
-  {
-    rtt = ts - f_beui32(opts->ts->ts_ecr);
-    if (rtt < TCP_MAX_RTT) {
-      if (LIKELY(fs->rtt_est != 0)) {
-        fs->rtt_est = (fs->rtt_est * 7 + rtt) / 8;
-      } else {
-        fs->rtt_est = rtt;
-      }
+  /* update rtt estimate from echoed timestamp */
+  if (LIKELY(fs->ts_opt && opts->ts != NULL)) {
+    fs->tx_next_ts = f_beui32(opts->ts->ts_val);
+    if (LIKELY((TCPH_FLAGS(th) & TCP_ACK) == TCP_ACK &&
+        f_beui32(opts->ts->ts_ecr) != 0))
+    {
+      flow_rtt_update(fs, ts - f_beui32(opts->ts->ts_ecr));
     }
   }
 
-  fs->rx_remote_avail = f_beui16(p->tcp.wnd);
+  fs->rx_remote_avail = (uint32_t) f_beui16(th->wnd) << fs->rx_wscale;
 
   /* make sure we don't receive anymore payload after FIN */
-  if ((fs->rx_base_sp & FLEXNIC_PL_FLOWST_RXFIN) == FLEXNIC_PL_FLOWST_RXFIN &&
+  if ((fs->flags & FLEXNIC_PL_FLOWST_RXFIN) == FLEXNIC_PL_FLOWST_RXFIN &&
       payload_bytes > 0)
   {
     fprintf(stderr, "fast_flows_packet: data after FIN dropped\n");
-    goto unlock;
+    goto out;
   }
 
   /* if there is payload, dma it to the receive buffer */
   if (payload_bytes > 0) {
-    flow_rx_write(fs, fs->rx_next_pos, payload_bytes, payload);
+    flow_rx_run_write(fs, fs->rx_next_pos, nbhs, num, trim_start,
+        payload_bytes, flow_ack_overwrites(fs, th));
 
     rx_bump = payload_bytes;
     fs->rx_avail -= payload_bytes;
@@ -524,52 +918,38 @@ int fast_flows_packet(struct dataplane_context *ctx,
 #ifndef SKIP_ACK
     trigger_ack = 1;
 #endif
+    ack_delay = 1;
 
 #ifdef FLEXNIC_PL_OOO_RECV
-    /* if we have out of order segments, check whether buffer is continuous
-     * or superfluous */
-    if (UNLIKELY(fs->rx_ooo_len != 0)) {
-      if (tcp_trim_rxbuf(fs, fs->rx_ooo_start, fs->rx_ooo_len, &trim_start,
-            &trim_end) != 0) {
-          /*fprintf(stderr, "dropping ooo (%p ooo.start=%u ooo.len=%u seq=%u "
-              "len=%u next_seq=%u)\n", fs, fs->rx_ooo_start, fs->rx_ooo_len, seq,
-              payload_bytes, fs->rx_next_seq);*/
-        /* completely superfluous: drop out of order interval */
-        fs->rx_ooo_len = 0;
-      } else {
-        /* adjust based on overlap */
-        fs->rx_ooo_start += trim_start;
-        fs->rx_ooo_len -= trim_start + trim_end;
-        /*fprintf(stderr, "adjusting ooo (%p ooo.start=%u ooo.len=%u seq=%u "
-            "len=%u next_seq=%u)\n", fs, fs->rx_ooo_start, fs->rx_ooo_len, seq,
-            payload_bytes, fs->rx_next_seq);*/
-        if (fs->rx_ooo_len > 0 && fs->rx_ooo_start == fs->rx_next_seq) {
-          /* yay, we caught up, make continuous and drop OOO interval */
-          /*fprintf(stderr, "caught up with ooo buffer (%p start=%u len=%u)\n",
-              fs, fs->rx_ooo_start, fs->rx_ooo_len);*/
-
-          rx_bump += fs->rx_ooo_len;
-          fs->rx_avail -= fs->rx_ooo_len;
-          fs->rx_next_pos += fs->rx_ooo_len;
-          if (fs->rx_next_pos >= fs->rx_len) {
-            fs->rx_next_pos -= fs->rx_len;
-          }
-          assert(fs->rx_next_pos < fs->rx_len);
-          fs->rx_next_seq += fs->rx_ooo_len;
-
-          fs->rx_ooo_len = 0;
+    /* if we have out of order segments, drop or trim superfluous intervals
+     * and check whether we caught up with the first one */
+    if (UNLIKELY((fs->flags & FLEXNIC_PL_FLOWST_RXOOO) != 0)) {
+      /* peer needs to see the (remaining) holes right away */
+      ack_delay = 0;
+      ooo_bump = flow_rx_ooo_advance(fs);
+      if (ooo_bump > 0) {
+        /* yay, we caught up, make continuous */
+        rx_bump += ooo_bump;
+        fs->rx_avail -= ooo_bump;
+        fs->rx_next_pos += ooo_bump;
+        if (fs->rx_next_pos >= fs->rx_len) {
+          fs->rx_next_pos -= fs->rx_len;
         }
+        assert(fs->rx_next_pos < fs->rx_len);
+        fs->rx_next_seq += ooo_bump;
       }
     }
 #endif
   }
 
-  if ((TCPH_FLAGS(&p->tcp) & TCP_FIN) == TCP_FIN &&
-      !(fs->rx_base_sp & FLEXNIC_PL_FLOWST_RXFIN))
+  if ((TCPH_FLAGS(th) & TCP_FIN) == TCP_FIN &&
+      !(fs->flags & FLEXNIC_PL_FLOWST_RXFIN))
   {
-    if (fs->rx_next_seq == f_beui32(p->tcp.seqno) + orig_payload && !fs->rx_ooo_len) {
+    if (fs->rx_next_seq == first_seq + orig_payload &&
+        !(fs->flags & FLEXNIC_PL_FLOWST_RXOOO))
+    {
       fin_bump = 1;
-      fs->rx_base_sp |= FLEXNIC_PL_FLOWST_RXFIN;
+      fs->flags |= FLEXNIC_PL_FLOWST_RXFIN;
       /* FIN takes up sequence number space */
       fs->rx_next_seq++;
       trigger_ack = 1;
@@ -578,7 +958,12 @@ int fast_flows_packet(struct dataplane_context *ctx,
     }
   }
 
-unlock:
+out:
+  /* zero-copy segments might still reference the acked tx buffer space */
+  if (tx_bump != 0 && tx_zc_defer(ctx, fs, tx_bump) == 0) {
+    tx_bump = 0;
+  }
+
   /* if we bumped at least one, then we need to add a notification to the
    * queue */
   if (LIKELY(rx_bump != 0 || tx_bump != 0 || fin_bump)) {
@@ -604,10 +989,10 @@ unlock:
         .flow_id = flow_id,
         .db_id = fs->db_id,
 
-        .local_ip = f_beui32(p->ip.dest),
-        .remote_ip = f_beui32(p->ip.src),
-        .local_port = f_beui16(p->tcp.dest),
-        .remote_port = f_beui16(p->tcp.src),
+        .local_ip = f_beui32(fs->local_ip),
+        .remote_ip = f_beui32(fs->remote_ip),
+        .local_port = f_beui16(th->dest),
+        .remote_port = f_beui16(th->src),
       };
     trace_event(FLEXNIC_PL_TREV_ARX, sizeof(te_arx), &te_arx);
 #endif
@@ -620,7 +1005,7 @@ unlock:
   if (new_avail > old_avail) {
     /* update qman queue */
     if (qman_set(&ctx->qman, flow_id, fs->tx_rate, new_avail -
-          old_avail, TCP_MSS, QMAN_SET_RATE | QMAN_SET_MAXCHUNK
+          old_avail, flow_tx_chunk(fs), QMAN_SET_RATE | QMAN_SET_MAXCHUNK
           | QMAN_ADD_AVAIL) != 0)
     {
       fprintf(stderr, "fast_flows_packet: qman_set 1 failed, UNEXPECTED\n");
@@ -628,25 +1013,60 @@ unlock:
     }
   }
 
+  /* in-order data without FIN or congestion mark: try to delay the ack, it
+   * is then either piggybacked on the next data segment or sent from
+   * poll_acks at the end of the loop iteration */
+  if (trigger_ack && ack_delay && !fin_bump &&
+      pkt_ecn(p) != IP_ECN_CE &&
+      flow_ack_delay(ctx, flow_id, full_segs) == 0)
+  {
+    trigger_ack = 0;
+  }
+
   /* if we need to send an ack, also send packet to TX pipeline to do so */
   if (trigger_ack) {
-    flow_tx_ack(ctx, fs->tx_next_seq, fs->rx_next_seq, fs->rx_avail,
-        fs->tx_next_ts, ts, nbh, opts->ts);
+    flow_tx_ack(ctx, fs, fs->tx_next_seq, fs->rx_next_seq, fs->rx_avail,
+        fs->tx_next_ts, ts, nbh);
   }
 
-  fs_unlock(fs);
   return trigger_ack;
 
 slowpath:
   if (!no_permanent_sp) {
-    fs->rx_base_sp |= FLEXNIC_PL_FLOWST_SLOWPATH;
+    fs->flags |= FLEXNIC_PL_FLOWST_SLOWPATH;
   }
 
-  fs_unlock(fs);
   /* TODO: should pass current flow state to kernel as well */
   return -1;
 }
 
+/* Send a pure ACK for a flow with a delayed ACK pending */
+int fast_flows_ack(struct dataplane_context *ctx, uint32_t flow_id,
+    struct network_buf_handle *nbh, uint32_t ts)
+{
+  struct flextcp_pl_flowst *fs;
+  int ret = -1;
+
+  /* already piggybacked on a data segment */
+  if (flow_id == ACK_FLOW_INVAL)
+    return -1;
+
+  fs = &fp_state->flowst[flow_id];
+
+  /* flow group was handed to another core since the ack was delayed, the
+   * new owner acks with the next segment it receives */
+  if (UNLIKELY(flow_owner(fs) != ctx->id))
+    return -1;
+
+  if ((fs->flags & FLEXNIC_PL_FLOWST_SLOWPATH) == 0) {
+    flow_tx_segment(ctx, nbh, fs, fs->tx_next_seq, fs->rx_next_seq,
+        fs->rx_avail, 0, 0, fs->tx_next_ts, ts, 0, 0);
+    ret = 0;
+  }
+
+  return ret;
+}
+
 /* Update receive and transmit queue pointers from application */
 int fast_flows_bump(struct dataplane_context *ctx, uint32_t flow_id,
     uint16_t bump_seq, uint32_t rx_bump, uint32_t tx_bump, uint8_t flags,
@@ -656,7 +1076,6 @@ int fast_flows_bump(struct dataplane_context *ctx, uint32_t flow_id,
   uint32_t rx_avail_prev, old_avail, new_avail, tx_avail;
   int ret = -1;
 
-  fs_lock(fs);
 #ifdef FLEXNIC_TRACING
   struct flextcp_pl_trev_atx te_atx = {
       .rx_bump = rx_bump,
@@ -694,23 +1113,23 @@ int fast_flows_bump(struct dataplane_context *ctx, uint32_t flow_id,
        (fs->bump_seq < ((UINT16_MAX / 4) * 3) ||
        bump_seq > (UINT16_MAX / 4))))
   {
-    goto unlock;
+    goto out;
   }
   fs->bump_seq = bump_seq;
 
-  if ((fs->rx_base_sp & FLEXNIC_PL_FLOWST_TXFIN) == FLEXNIC_PL_FLOWST_TXFIN &&
+  if ((fs->flags & FLEXNIC_PL_FLOWST_TXFIN) == FLEXNIC_PL_FLOWST_TXFIN &&
       tx_bump != 0)
   {
     /* TX already closed, don't accept anything for transmission */
     fprintf(stderr, "fast_flows_bump: tx bump while TX is already closed\n");
     tx_bump = 0;
   } else if ((flags & FLEXTCP_PL_ATX_FLTXDONE) == FLEXTCP_PL_ATX_FLTXDONE &&
-      !(fs->rx_base_sp & FLEXNIC_PL_FLOWST_TXFIN) &&
+      !(fs->flags & FLEXNIC_PL_FLOWST_TXFIN) &&
       !tx_bump)
   {
     /* Closing TX requires at least one byte (dummy) */
     fprintf(stderr, "fast_flows_bump: tx eos without dummy byte\n");
-    goto unlock;
+    goto out;
   }
 
   tx_avail = fs->tx_avail + tx_bump;
@@ -720,12 +1139,12 @@ int fast_flows_bump(struct dataplane_context *ctx, uint32_t flow_id,
       tx_avail + fs->tx_sent > fs->tx_len)
   {
     fprintf(stderr, "fast_flows_bump: tx bump too large\n");
-    goto unlock;
+    goto out;
   }
   /* validate rx bump */
   if (rx_bump > fs->rx_len || rx_bump + fs->rx_avail > fs->tx_len) {
     fprintf(stderr, "fast_flows_bump: rx bump too large\n");
-    goto unlock;
+    goto out;
   }
   /* calculate how many bytes can be sent before and after this bump */
   old_avail = tcp_txavail(fs, NULL);
@@ -733,15 +1152,15 @@ int fast_flows_bump(struct dataplane_context *ctx, uint32_t flow_id,
 
   /* mark connection as closed if requested */
   if ((flags & FLEXTCP_PL_ATX_FLTXDONE) == FLEXTCP_PL_ATX_FLTXDONE &&
-      !(fs->rx_base_sp & FLEXNIC_PL_FLOWST_TXFIN))
+      !(fs->flags & FLEXNIC_PL_FLOWST_TXFIN))
   {
-    fs->rx_base_sp |= FLEXNIC_PL_FLOWST_TXFIN;
+    fs->flags |= FLEXNIC_PL_FLOWST_TXFIN;
   }
 
   /* update queue manager queue */
   if (old_avail < new_avail) {
     if (qman_set(&ctx->qman, flow_id, fs->tx_rate, new_avail -
-          old_avail, TCP_MSS, QMAN_SET_RATE | QMAN_SET_MAXCHUNK
+          old_avail, flow_tx_chunk(fs), QMAN_SET_RATE | QMAN_SET_MAXCHUNK
           | QMAN_ADD_AVAIL) != 0)
     {
       fprintf(stderr, "flast_flows_bump: qman_set 1 failed, UNEXPECTED\n");
@@ -758,12 +1177,11 @@ int fast_flows_bump(struct dataplane_context *ctx, uint32_t flow_id,
    * we're not sending anyways. */
   if (new_avail == 0 && rx_avail_prev == 0 && fs->rx_avail != 0) {
     flow_tx_segment(ctx, nbh, fs, fs->tx_next_seq, fs->rx_next_seq,
-        fs->rx_avail, 0, 0, fs->tx_next_ts, ts, 0);
+        fs->rx_avail, 0, 0, fs->tx_next_ts, ts, 0, 0);
     ret = 0;
   }
 
-unlock:
-  fs_unlock(fs);
+out:
   return ret;
 }
 
@@ -773,8 +1191,6 @@ void fast_flows_retransmit(struct dataplane_context *ctx, uint32_t flow_id)
   struct flextcp_pl_flowst *fs = &fp_state->flowst[flow_id];
   uint32_t old_avail, new_avail = -1;
 
-  fs_lock(fs);
-
 #ifdef FLEXNIC_TRACING
     struct flextcp_pl_trev_rexmit te_rexmit = {
         .flow_id = flow_id,
@@ -818,7 +1234,8 @@ void fast_flows_retransmit(struct dataplane_context *ctx, uint32_t flow_id)
   /* update queue manager */
   if (new_avail > old_avail) {
     if (qman_set(&ctx->qman, flow_id, fs->tx_rate, new_avail - old_avail,
-          TCP_MSS, QMAN_SET_RATE | QMAN_SET_MAXCHUNK | QMAN_ADD_AVAIL) != 0)
+          flow_tx_chunk(fs), QMAN_SET_RATE | QMAN_SET_MAXCHUNK |
+          QMAN_ADD_AVAIL) != 0)
     {
       fprintf(stderr, "flast_flows_bump: qman_set 1 failed, UNEXPECTED\n");
       abort();
@@ -826,10 +1243,55 @@ void fast_flows_retransmit(struct dataplane_context *ctx, uint32_t flow_id)
   }
 
 out:
-  fs_unlock(fs);
   return;
 }
 
+/* set congestion control rate from slow path */
+void fast_flows_setrate(struct dataplane_context *ctx, uint32_t flow_id,
+    uint32_t rate)
+{
+  struct flextcp_pl_flowst *fs = &fp_state->flowst[flow_id];
+
+  fs->tx_rate = rate;
+  if (qman_set(&ctx->qman, flow_id, rate, 0, 0, QMAN_SET_RATE) != 0) {
+    fprintf(stderr, "fast_flows_setrate: qman_set failed, UNEXPECTED\n");
+    abort();
+  }
+}
+
+/* set traffic class from slow path */
+void fast_flows_settc(struct dataplane_context *ctx, uint32_t flow_id,
+    uint8_t tc)
+{
+  struct flextcp_pl_flowst *fs = &fp_state->flowst[flow_id];
+
+  fs->tc = tc;
+  if (qman_set(&ctx->qman, flow_id, 0, 0, 0, QMAN_SET_TC) != 0) {
+    fprintf(stderr, "fast_flows_settc: qman_set failed, UNEXPECTED\n");
+    abort();
+  }
+}
+
+/* hand flow over to slow path, returns sequence numbers and close flags
+ * (FLEXTCP_PL_KTX_FL*) */
+void fast_flows_disable(struct dataplane_context *ctx, uint32_t flow_id,
+    uint32_t *tx_seq, uint32_t *rx_seq, uint8_t *flags)
+{
+  struct flextcp_pl_flowst *fs = &fp_state->flowst[flow_id];
+
+  fs->flags |= FLEXNIC_PL_FLOWST_SLOWPATH;
+
+  *tx_seq = fs->tx_next_seq;
+  *rx_seq = fs->rx_next_seq;
+  *flags = 0;
+  if ((fs->flags & FLEXNIC_PL_FLOWST_RXFIN) != 0) {
+    *flags |= FLEXTCP_PL_KTX_FLRXCLOSED;
+  }
+  if ((fs->flags & FLEXNIC_PL_FLOWST_TXFIN) != 0 && fs->tx_sent == 0) {
+    *flags |= FLEXTCP_PL_KTX_FLTXCLOSED;
+  }
+}
+
 /* read `len` bytes from position `pos` in cirucular transmit buffer */
 static void flow_tx_read(struct flextcp_pl_flowst *fs, uint32_t pos,
     uint16_t len, void *dst)
@@ -837,204 +1299,625 @@ static void flow_tx_read(struct flextcp_pl_flowst *fs, uint32_t pos,
   uint32_t part;
 
   if (LIKELY(pos + len <= fs->tx_len)) {
-    dma_read(fs->tx_base + pos, len, dst);
+    dma_read_async(fs->tx_base + pos, len, dst);
   } else {
     part = fs->tx_len - pos;
-    dma_read(fs->tx_base + pos, part, dst);
-    dma_read(fs->tx_base, len - part, (uint8_t *) dst + part);
+    dma_read_async(fs->tx_base + pos, part, dst);
+    dma_read_async(fs->tx_base, len - part, (uint8_t *) dst + part);
   }
 }
 
-/* write `len` bytes to position `pos` in cirucular receive buffer */
+/* read `len` bytes from position `pos` in circular transmit buffer and
+ * return their folded ones complement sum, data is touched only once */
+static uint16_t flow_tx_read_xsum(struct flextcp_pl_flowst *fs, uint32_t pos,
+    uint16_t len, void *dst)
+{
+  uint32_t part;
+  uint16_t sum, sum2;
+
+  if (LIKELY(pos + len <= fs->tx_len)) {
+    return dma_xsum_fold(dma_read_xsum(fs->tx_base + pos, len, dst, 0));
+  }
+
+  part = fs->tx_len - pos;
+  sum = dma_xsum_fold(dma_read_xsum(fs->tx_base + pos, part, dst, 0));
+  sum2 = dma_xsum_fold(dma_read_xsum(fs->tx_base, len - part,
+        (uint8_t *) dst + part, 0));
+  /* second part starts at odd offset in the packet: its words are byte
+   * swapped */
+  if ((part & 1) != 0) {
+    sum2 = (sum2 << 8) | (sum2 >> 8);
+  }
+  return dma_xsum_fold((uint32_t) sum + sum2);
+}
+
+/* write `len` bytes to position `pos` in cirucular receive buffer, `sync`
+ * if src is overwritten right after */
 static void flow_rx_write(struct flextcp_pl_flowst *fs, uint32_t pos,
-    uint16_t len, const void *src)
+    uint16_t len, const void *src, int sync)
 {
   uint32_t part;
-  uint64_t rx_base = fs->rx_base_sp & FLEXNIC_PL_FLOWST_RX_MASK;
 
-  if (LIKELY(pos + len <= fs->rx_len)) {
-    dma_write(rx_base + pos, len, src);
+  if (UNLIKELY(sync)) {
+    if (pos + len <= fs->rx_len) {
+      dma_write(fs->rx_base + pos, len, src);
+    } else {
+      part = fs->rx_len - pos;
+      dma_write(fs->rx_base + pos, part, src);
+      dma_write(fs->rx_base, len - part, (const uint8_t *) src + part);
+    }
+  } else if (LIKELY(pos + len <= fs->rx_len)) {
+    dma_write_async(fs->rx_base + pos, len, src);
   } else {
     part = fs->rx_len - pos;
-    dma_write(rx_base + pos, part, src);
-    dma_write(rx_base, len - part, (const uint8_t *) src + part);
+    dma_write_async(fs->rx_base + pos, part, src);
+    dma_write_async(fs->rx_base, len - part, (const uint8_t *) src + part);
+  }
+}
+
+/* write `len` bytes of payload from a run of `num` received segments to
+ * position `pos` in circular receive buffer, skipping the first `off` bytes
+ * of payload */
+static void flow_rx_run_write(struct flextcp_pl_flowst *fs, uint32_t pos,
+    struct network_buf_handle **nbhs, uint16_t num, uint32_t off,
+    uint32_t len, int sync)
+{
+  struct pkt_tcp *p;
+  uint16_t i, seg_len;
+  uint8_t *payload;
+
+  for (i = 0; i < num && len > 0; i++) {
+    p = network_buf_bufoff(nbhs[i]);
+    seg_len = packet_payload_len(p);
+    if (off >= seg_len) {
+      off -= seg_len;
+      continue;
+    }
+
+    payload = (uint8_t *) p + pkt_l3hdrs_len(p) +
+      TCPH_HDRLEN(pkt_tcph(p)) * 4 + off;
+    seg_len = MIN(seg_len - off, len);
+    flow_rx_write(fs, pos, seg_len, payload, sync);
+
+    pos += seg_len;
+    if (pos >= fs->rx_len)
+      pos -= fs->rx_len;
+    len -= seg_len;
+    off = 0;
   }
 }
 
 #ifdef FLEXNIC_PL_OOO_RECV
 static void flow_rx_seq_write(struct flextcp_pl_flowst *fs, uint32_t seq,
-    uint16_t len, const void *src)
+    struct network_buf_handle **nbhs, uint16_t num, uint32_t off,
+    uint32_t len, int sync)
 {
   uint32_t diff = seq - fs->rx_next_seq;
   uint32_t pos = fs->rx_next_pos + diff;
   if (pos >= fs->rx_len)
     pos -= fs->rx_len;
   assert(pos < fs->rx_len);
-  flow_rx_write(fs, pos, len, src);
+  flow_rx_run_write(fs, pos, nbhs, num, off, len, sync);
+}
+
+/* flag pending out of order intervals in flow state */
+static inline void flow_rx_ooo_sync(struct flextcp_pl_flowst *fs,
+    const struct flextcp_pl_flowooo *ooo)
+{
+  if (ooo->iv[0].len != 0) {
+    fs->flags |= FLEXNIC_PL_FLOWST_RXOOO;
+  } else {
+    fs->flags &= ~FLEXNIC_PL_FLOWST_RXOOO;
+  }
+}
+
+/* merge out of order segment into the interval set, returns 0 if the segment
+ * was added, or -1 if it was dropped because all intervals are in use */
+static int flow_rx_ooo_add(struct flextcp_pl_flowst *fs, uint32_t seq,
+    uint32_t len)
+{
+  struct flextcp_pl_flowooo *ooo =
+      &fp_state->flowooo[fs - fp_state->flowst];
+
+  if (seqiv_add(ooo->iv, FLEXNIC_PL_OOO_INTERVALS, fs->rx_next_seq, seq,
+        len) != 0)
+  {
+    return -1;
+  }
+
+  flow_rx_ooo_sync(fs, ooo);
+  return 0;
+}
+
+/* drop or trim intervals after rx_next_seq moved forward, returns the number
+ * of bytes in an interval immediately following rx_next_seq (the interval is
+ * removed) */
+static uint32_t flow_rx_ooo_advance(struct flextcp_pl_flowst *fs)
+{
+  struct flextcp_pl_flowooo *ooo =
+      &fp_state->flowooo[fs - fp_state->flowst];
+  uint32_t bump;
+
+  bump = seqiv_advance(ooo->iv, FLEXNIC_PL_OOO_INTERVALS, fs->rx_next_seq);
+  flow_rx_ooo_sync(fs, ooo);
+  return bump;
 }
 #endif
 
+/* merge interval [seq, seq + len) into the sorted interval set `iv` with `num`
+ * entries, returns 0 if the interval was added, or -1 if it was dropped
+ * because all intervals are in use */
+static int seqiv_add(struct flextcp_pl_seqiv *iv, unsigned num, uint32_t base,
+    uint32_t seq, uint32_t len)
+{
+  uint32_t a = seq - base, b = a + len, ia;
+  unsigned i, j, k, n;
+
+  /* all offsets are relative to base to avoid wrap-around issues */
+  for (n = 0; n < num && iv[n].len != 0; n++);
+
+  /* skip intervals that end before the new one starts */
+  for (i = 0; i < n && iv[i].start - base + iv[i].len < a; i++);
+
+  /* merge with intervals that overlap or touch the new one */
+  for (j = i; j < n && (ia = iv[j].start - base) <= b; j++) {
+    a = MIN(a, ia);
+    b = MAX(b, ia + iv[j].len);
+  }
+
+  if (i == j) {
+    /* no overlap, new interval needed */
+    if (n == num) {
+      /* drop new interval if it would be the last one, otherwise drop the
+       * last interval which is the furthest from base */
+      if (i == n) {
+        return -1;
+      }
+      n--;
+    }
+
+    for (k = n; k > i; k--) {
+      iv[k] = iv[k - 1];
+    }
+    n++;
+  } else {
+    /* collapse intervals i..j-1 into i */
+    for (k = j; k < n; k++) {
+      iv[i + 1 + k - j] = iv[k];
+    }
+    for (k = n - (j - i - 1); k < n; k++) {
+      iv[k].len = 0;
+    }
+  }
+
+  iv[i].start = base + a;
+  iv[i].len = b - a;
+  return 0;
+}
+
+/* drop or trim intervals after base moved forward, returns the number of bytes
+ * in an interval immediately following base (the interval is removed) */
+static uint32_t seqiv_advance(struct flextcp_pl_seqiv *iv, unsigned num,
+    uint32_t base)
+{
+  uint32_t len, bump = 0;
+  int32_t off;
+  unsigned i, n = 0;
+
+  for (i = 0; i < num && iv[i].len != 0; i++) {
+    off = iv[i].start - base;
+    len = iv[i].len;
+
+    /* completely superfluous: drop interval */
+    if ((int64_t) off + len <= 0) {
+      continue;
+    }
+
+    /* continuous with base: remove and report */
+    if (off <= 0) {
+      bump = len + off;
+      continue;
+    }
+
+    iv[n++] = iv[i];
+  }
+
+  for (i = n; i < num; i++) {
+    iv[i].len = 0;
+  }
+
+  return bump;
+}
+
+/* merge SACK blocks from received ack into the flow's scoreboard, blocks are
+ * clipped to the sent but unacknowledged data */
+static void flow_sack_update(struct flextcp_pl_flowst *fs,
+    const struct tcp_sack_opt *sack)
+{
+  struct flextcp_pl_flowsack *sb = &fp_state->flowsack[fs - fp_state->flowst];
+  uint32_t una = fs->tx_next_seq - fs->tx_sent, a, b;
+  unsigned i, n;
+
+  seqiv_advance(sb->iv, FLEXNIC_PL_SACK_INTERVALS, una);
+
+  n = (sack->length - 2) / sizeof(struct tcp_sack_block);
+  for (i = 0; i < n; i++) {
+    a = f_beui32(sack->blocks[i].left) - una;
+    b = f_beui32(sack->blocks[i].right) - una;
+
+    /* ignore blocks that are not (partially) within sent data */
+    if ((int32_t) a < 0) {
+      a = 0;
+    }
+    b = MIN(b, fs->tx_sent);
+    if ((int32_t) b <= (int32_t) a) {
+      continue;
+    }
+
+    seqiv_add(sb->iv, FLEXNIC_PL_SACK_INTERVALS, una, una + a, b - a);
+  }
+}
+
+/* start (or continue) retransmitting the holes in the scoreboard after
+ * duplicate acks, returns -1 if there are no holes to retransmit */
+static int flow_sack_retransmit(struct dataplane_context *ctx,
+    struct flextcp_pl_flowst *fs)
+{
+  struct flextcp_pl_flowsack *sb = &fp_state->flowsack[fs - fp_state->flowst];
+  struct flextcp_pl_flowstats *st =
+    &fp_state->flowstats[fs - fp_state->flowst];
+  uint32_t una = fs->tx_next_seq - fs->tx_sent, pos, a, holes = 0;
+  uint32_t flow_id = fs - fp_state->flowst;
+  unsigned i;
+
+  /* new loss event if we are past the previous recovery point */
+  if ((int32_t) (sb->rtx_end - una) <= 0) {
+    sb->rtx_next = una;
+    sb->rtx_end = fs->tx_next_seq;
+
+    /* cut rate by half if first drop in control interval */
+    if (st->cnt_tx_drops == 0) {
+      fs->tx_rate /= 2;
+    }
+    st->cnt_tx_drops++;
+  }
+
+  /* count bytes in holes below the highest SACKed byte */
+  pos = sb->rtx_next - una;
+  if ((int32_t) pos < 0) {
+    pos = 0;
+  }
+  for (i = 0; i < FLEXNIC_PL_SACK_INTERVALS && sb->iv[i].len != 0; i++) {
+    a = sb->iv[i].start - una;
+    if (a > pos) {
+      holes += a - pos;
+    }
+    pos = MAX(pos, a + sb->iv[i].len);
+  }
+
+  fs->rx_dupack_cnt = 0;
+  if (holes == 0) {
+    return -1;
+  }
+
+  fs->flags |= FLEXNIC_PL_FLOWST_SACKRTX;
+
+  /* make queue manager schedule the retransmissions */
+  if (qman_set(&ctx->qman, flow_id, fs->tx_rate, holes, fs->mss,
+        QMAN_SET_RATE | QMAN_SET_MAXCHUNK | QMAN_ADD_AVAIL) != 0)
+  {
+    fprintf(stderr, "flow_sack_retransmit: qman_set failed, UNEXPECTED\n");
+    abort();
+  }
+  return 0;
+}
+
+/* find next segment to retransmit from the holes in the scoreboard, clears
+ * FLEXNIC_PL_FLOWST_SACKRTX and returns -1 if there is none */
+static int flow_sack_next_hole(struct flextcp_pl_flowst *fs, uint32_t *seq,
+    uint32_t *len)
+{
+  struct flextcp_pl_flowsack *sb = &fp_state->flowsack[fs - fp_state->flowst];
+  uint32_t una = fs->tx_next_seq - fs->tx_sent, pos, a;
+  unsigned i;
+
+  seqiv_advance(sb->iv, FLEXNIC_PL_SACK_INTERVALS, una);
+
+  pos = sb->rtx_next - una;
+  if ((int32_t) pos < 0) {
+    pos = 0;
+  }
+  for (i = 0; i < FLEXNIC_PL_SACK_INTERVALS && sb->iv[i].len != 0; i++) {
+    a = sb->iv[i].start - una;
+    if (a > pos) {
+      *seq = una + pos;
+      *len = MIN(a - pos, fs->mss);
+      sb->rtx_next = *seq + *len;
+      return 0;
+    }
+    pos = MAX(pos, a + sb->iv[i].len);
+  }
+
+  fs->flags &= ~FLEXNIC_PL_FLOWST_SACKRTX;
+  return -1;
+}
+
 static void flow_tx_segment(struct dataplane_context *ctx,
     struct network_buf_handle *nbh, struct flextcp_pl_flowst *fs,
     uint32_t seq, uint32_t ack, uint32_t rxwnd, uint16_t payload,
-    uint32_t payload_pos, uint32_t ts_echo, uint32_t ts_my, uint8_t fin)
+    uint32_t payload_pos, uint32_t ts_echo, uint32_t ts_my, uint8_t fin,
+    uint8_t zc)
 {
-  uint16_t hdrs_len, optlen, fin_fl;
+  uint16_t hdrs_len, l3hdrs_len, fin_fl, paysum = 0;
   struct pkt_tcp *p = network_buf_buf(nbh);
+  struct tcp_hdr *th;
   struct tcp_timestamp_opt *opt_ts;
+  uint8_t ecn;
 
-  /* calculate header length depending on options */
-  optlen = (sizeof(*opt_ts) + 3) & ~3;
-  hdrs_len = sizeof(*p) + optlen;
-
-  /* fill headers */
-  p->eth.dest = fs->remote_mac;
-  memcpy(&p->eth.src, &eth_addr, ETH_ADDR_LEN);
-  p->eth.type = t_beui16(ETH_TYPE_IP);
-
-  IPH_VHL_SET(&p->ip, 4, 5);
-  p->ip._tos = 0;
-  p->ip.len = t_beui16(hdrs_len - offsetof(struct pkt_tcp, ip) + payload);
-  p->ip.id = t_beui16(3); /* TODO: not sure why we have 3 here */
-  p->ip.offset = t_beui16(0);
-  p->ip.ttl = 0xff;
-  p->ip.proto = IP_PROTO_TCP;
-  p->ip.chksum = 0;
-  p->ip.src = fs->local_ip;
-  p->ip.dest = fs->remote_ip;
+  hdrs_len = flow_hdrs_len(fs);
+
+  /* copy headers from template, then fill in fields for this segment */
+  flow_hdr_copy(p, &fp_state->flowhdr[fs - fp_state->flowst], fs->ip6);
+  th = pkt_tcph(p);
+  l3hdrs_len = pkt_l3hdrs_len(p);
+  pkt_l4len_set(p, hdrs_len - l3hdrs_len + payload);
 
   /* mark as ECN capable if flow marked so */
-  if ((fs->rx_base_sp & FLEXNIC_PL_FLOWST_ECN) == FLEXNIC_PL_FLOWST_ECN) {
-    IPH_ECN_SET(&p->ip, IP_ECN_ECT0);
+  ecn = ((fs->flags & FLEXNIC_PL_FLOWST_ECN) == FLEXNIC_PL_FLOWST_ECN);
+  if (ecn) {
+    pkt_ecn_set(p, IP_ECN_ECT0);
   }
 
   fin_fl = (fin ? TCP_FIN : 0);
 
-  p->tcp.src = fs->local_port;
-  p->tcp.dest = fs->remote_port;
-  p->tcp.seqno = t_beui32(seq);
-  p->tcp.ackno = t_beui32(ack);
-  TCPH_HDRLEN_FLAGS_SET(&p->tcp, 5 + optlen / 4, TCP_PSH | TCP_ACK | fin_fl);
-  p->tcp.wnd = t_beui16(MIN(0xFFFF, rxwnd));
-  p->tcp.chksum = 0;
-  p->tcp.urgp = t_beui16(0);
+  th->seqno = t_beui32(seq);
+  th->ackno = t_beui32(ack);
+  TCPH_HDRLEN_FLAGS_SET(th, TCPH_HDRLEN(th), TCP_PSH | TCP_ACK | fin_fl);
+  th->wnd = t_beui16(MIN(0xFFFF, rxwnd >> fs->tx_wscale));
 
   /* fill in timestamp option */
-  memset(p + 1, 0, optlen);
-  opt_ts = (struct tcp_timestamp_opt *) (p + 1);
-  opt_ts->kind = TCP_OPT_TIMESTAMP;
-  opt_ts->length = sizeof(*opt_ts);
-  opt_ts->ts_val = t_beui32(ts_my);
-  opt_ts->ts_ecr = t_beui32(ts_echo);
+  if (LIKELY(fs->ts_opt)) {
+    opt_ts = (struct tcp_timestamp_opt *) (th + 1);
+    opt_ts->ts_val = t_beui32(ts_my);
+    opt_ts->ts_ecr = t_beui32(ts_echo);
+  }
 
-  /* add payload if requested */
-  if (payload > 0) {
-    flow_tx_read(fs, payload_pos, payload, (uint8_t *) p + hdrs_len);
+  /* add payload if requested, zero-copy payload is already chained. Without
+   * checksum offload the payload sum is computed while copying. */
+  if (payload > 0 && !zc) {
+    if (!config.fp_xsumoffload && payload <= fs->mss) {
+      paysum = flow_tx_read_xsum(fs, payload_pos, payload,
+          (uint8_t *) p + hdrs_len);
+    } else {
+      flow_tx_read(fs, payload_pos, payload, (uint8_t *) p + hdrs_len);
+    }
   }
 
-  /* checksums */
-  tcp_checksums(nbh, p, fs->local_ip, fs->remote_ip, hdrs_len - offsetof(struct
-        pkt_tcp, tcp) + payload);
+  /* checksums, super-segments are split and checksummed by the NIC or in
+   * network_send */
+  if (UNLIKELY(payload > fs->mss)) {
+    /* template already holds the pseudo header xsum without length */
+    if (!fs->ip6) {
+      p->ip.chksum = 0;
+    }
+    tx_tso_enable(nbh, hdrs_len - l3hdrs_len, fs->mss, fs->ip6);
+  } else {
+    tcp_checksums_hdr(nbh, p, ecn, paysum);
+  }
 
 #ifdef FLEXNIC_TRACING
   struct flextcp_pl_trev_txseg te_txseg = {
-      .local_ip = f_beui32(p->ip.src),
-      .remote_ip = f_beui32(p->ip.dest),
-      .local_port = f_beui16(p->tcp.src),
-      .remote_port = f_beui16(p->tcp.dest),
+      .local_ip = f_beui32(fs->local_ip),
+      .remote_ip = f_beui32(fs->remote_ip),
+      .local_port = f_beui16(th->src),
+      .remote_port = f_beui16(th->dest),
 
       .flow_seq = seq,
       .flow_ack = ack,
-      .flow_flags = TCPH_FLAGS(&p->tcp),
+      .flow_flags = TCPH_FLAGS(th),
       .flow_len = payload,
     };
   trace_event(FLEXNIC_PL_TREV_TXSEG, sizeof(te_txseg), &te_txseg);
 #endif
 
-  tx_send(ctx, nbh, 0, hdrs_len + payload);
+  /* segment carries the current ack */
+  flow_ack_clear(ctx, fs - fp_state->flowst);
+
+  if (zc) {
+    tx_send(ctx, nbh, 0, hdrs_len);
+    network_buf_extlen(nbh, payload);
+  } else {
+    tx_send(ctx, nbh, 0, hdrs_len + payload);
+  }
 }
 
-static void flow_tx_ack(struct dataplane_context *ctx, uint32_t seq,
-    uint32_t ack, uint32_t rxwnd, uint32_t echots, uint32_t myts,
-    struct network_buf_handle *nbh, struct tcp_timestamp_opt *ts_opt)
+static void flow_tx_ack(struct dataplane_context *ctx,
+    struct flextcp_pl_flowst *fs, uint32_t seq, uint32_t ack, uint32_t rxwnd,
+    uint32_t echots, uint32_t myts, struct network_buf_handle *nbh)
 {
   struct pkt_tcp *p;
-  struct eth_addr eth;
-  ip_addr_t ip;
-  beui16_t port;
+  struct tcp_hdr *th;
+  struct tcp_timestamp_opt *ts_opt;
   uint16_t hdrlen;
   uint16_t ecn_flags = 0;
+#ifdef FLEXNIC_PL_OOO_RECV
+  struct flextcp_pl_flowooo *ooo;
+  struct tcp_sack_opt *sack;
+  uint8_t *opt;
+  unsigned n, off;
+#endif
 
   p = network_buf_bufoff(nbh);
+  th = pkt_tcph(p);
 
 #if PL_DEBUG_TCPACK
   fprintf(stderr, "FLOW local=%08x:%05u remote=%08x:%05u ACK: seq=%u ack=%u\n",
-      f_beui32(p->ip.dest), f_beui16(p->tcp.dest),
-      f_beui32(p->ip.src), f_beui16(p->tcp.src), seq, ack);
+      f_beui32(fs->local_ip), f_beui16(th->dest),
+      f_beui32(fs->remote_ip), f_beui16(th->src), seq, ack);
 #endif
 
-  /* swap addresses */
-  eth = p->eth.src;
-  p->eth.src = p->eth.dest;
-  p->eth.dest = eth;
-  ip = p->ip.src;
-  p->ip.src = p->ip.dest;
-  p->ip.dest = ip;
-  port = p->tcp.src;
-  p->tcp.src = p->tcp.dest;
-  p->tcp.dest = port;
-
-  hdrlen = sizeof(*p) + (TCPH_HDRLEN(&p->tcp) - 5) * 4;
-
   /* If ECN flagged, set TCP response flag */
-  if (IPH_ECN(&p->ip) == IP_ECN_CE) {
+  if (pkt_ecn(p) == IP_ECN_CE) {
     ecn_flags = TCP_ECE;
   }
 
-  /* mark ACKs as ECN in-capable */
-  IPH_ECN_SET(&p->ip, IP_ECN_NONE);
+  /* replace received headers with the flow's template, ACKs are sent ECN
+   * in-capable. A received header including the timestamp option is at
+   * least as long as the template, so the payload is left intact. Shorter
+   * headers get the start of the payload overwritten, it was copied
+   * synchronously then (see flow_ack_overwrites). */
+  flow_hdr_copy(p, &fp_state->flowhdr[fs - fp_state->flowst], fs->ip6);
+  ts_opt = (struct tcp_timestamp_opt *) (th + 1);
 
-  /* change TCP header to ACK */
-  p->tcp.seqno = t_beui32(seq);
-  p->tcp.ackno = t_beui32(ack);
-  TCPH_HDRLEN_FLAGS_SET(&p->tcp, TCPH_HDRLEN(&p->tcp), TCP_ACK | ecn_flags);
-  p->tcp.wnd = t_beui16(MIN(0xFFFF, rxwnd));
-  p->tcp.urgp = t_beui16(0);
+#ifdef FLEXNIC_PL_OOO_RECV
+  /* report out of order intervals in SACK blocks: options become
+   * TS,NOP,NOP,NOP,NOP,SACK or NOP,NOP,SACK without timestamps */
+  if (UNLIKELY((fs->flags & FLEXNIC_PL_FLOWST_RXOOO) != 0) &&
+      (fs->flags & FLEXNIC_PL_FLOWST_SACK) != 0)
+  {
+    ooo = &fp_state->flowooo[fs - fp_state->flowst];
+    opt = (uint8_t *) (th + 1);
+    off = (fs->ts_opt ? FLEXNIC_PL_FLOWHDR_LEN - sizeof(*p) : 0);
+
+    opt[off] = opt[off + 1] = TCP_OPT_NO_OP;
+    sack = (struct tcp_sack_opt *) (opt + off + 2);
+    for (n = 0; n < MIN(TCP_SACK_MAX_BLOCKS, FLEXNIC_PL_OOO_INTERVALS) &&
+        ooo->iv[n].len != 0; n++)
+    {
+      sack->blocks[n].left = t_beui32(ooo->iv[n].start);
+      sack->blocks[n].right = t_beui32(ooo->iv[n].start + ooo->iv[n].len);
+    }
+    sack->kind = TCP_OPT_SACK;
+    sack->length = 2 + n * sizeof(struct tcp_sack_block);
+
+    TCPH_HDRLEN_SET(th,
+        5 + (off + 4 + n * sizeof(struct tcp_sack_block)) / 4);
+  }
+#endif
+
+  hdrlen = pkt_l3hdrs_len(p) + TCPH_HDRLEN(th) * 4;
+
+  /* fill in TCP header for ACK */
+  th->seqno = t_beui32(seq);
+  th->ackno = t_beui32(ack);
+  TCPH_HDRLEN_FLAGS_SET(th, TCPH_HDRLEN(th), TCP_ACK | ecn_flags);
+  th->wnd = t_beui16(MIN(0xFFFF, rxwnd >> fs->tx_wscale));
 
   /* fill in timestamp option */
-  ts_opt->ts_val = t_beui32(myts);
-  ts_opt->ts_ecr = t_beui32(echots);
+  if (LIKELY(fs->ts_opt)) {
+    ts_opt->ts_val = t_beui32(myts);
+    ts_opt->ts_ecr = t_beui32(echots);
+  }
 
-  p->ip.len = t_beui16(hdrlen - offsetof(struct pkt_tcp, ip));
-  p->ip.ttl = 0xff;
+  pkt_l4len_set(p, TCPH_HDRLEN(th) * 4);
 
   /* checksums */
-  tcp_checksums(nbh, p, p->ip.src, p->ip.dest, hdrlen - offsetof(struct
-        pkt_tcp, tcp));
+  tcp_checksums_hdr(nbh, p, 0, 0);
 
 #ifdef FLEXNIC_TRACING
   struct flextcp_pl_trev_txack te_txack = {
-      .local_ip = f_beui32(p->ip.src),
-      .remote_ip = f_beui32(p->ip.dest),
-      .local_port = f_beui16(p->tcp.src),
-      .remote_port = f_beui16(p->tcp.dest),
+      .local_ip = f_beui32(fs->local_ip),
+      .remote_ip = f_beui32(fs->remote_ip),
+      .local_port = f_beui16(th->src),
+      .remote_port = f_beui16(th->dest),
 
       .flow_seq = seq,
       .flow_ack = ack,
-      .flow_flags = TCPH_FLAGS(&p->tcp),
+      .flow_flags = TCPH_FLAGS(th),
     };
   trace_event(FLEXNIC_PL_TREV_TXACK, sizeof(te_txack), &te_txack);
 #endif
 
+  if (ctx->ack_num != 0)
+    flow_ack_clear(ctx, fs - fp_state->flowst);
+
   tx_send(ctx, nbh, network_buf_off(nbh), hdrlen);
 }
 
+/* check if an ACK built in the received segment with header `th` overwrites
+ * its payload: with a header shorter than the flow's template, or with SACK
+ * blocks. The payload is then copied synchronously. */
+static inline int flow_ack_overwrites(const struct flextcp_pl_flowst *fs,
+    const struct tcp_hdr *th)
+{
+  if (UNLIKELY(TCPH_HDRLEN(th) < 5 + (FLEXNIC_PL_FLOWHDR_LEN -
+          sizeof(struct pkt_tcp)) / 4))
+  {
+    return 1;
+  }
+
+#ifdef FLEXNIC_PL_OOO_RECV
+  return (fs->flags & FLEXNIC_PL_FLOWST_RXOOO) != 0 &&
+    (fs->flags & FLEXNIC_PL_FLOWST_SACK) != 0;
+#else
+  return 0;
+#endif
+}
+
+/* Returns 0 if the ack for in-order payload with `full_segs` full-sized
+ * segments on flow_id can be delayed, -1 if it has to be sent right away. */
+static int flow_ack_delay(struct dataplane_context *ctx, uint32_t flow_id,
+    uint16_t full_segs)
+{
+  uint16_t i, free = ctx->ack_num;
+
+  if (config.fp_delack_segs <= 1)
+    return -1;
+
+  for (i = 0; i < ctx->ack_num; i++) {
+    if (ctx->ack_flows[i] == flow_id)
+      break;
+    if (ctx->ack_flows[i] == ACK_FLOW_INVAL && free == ctx->ack_num)
+      free = i;
+  }
+
+  if (i == ctx->ack_num) {
+    /* not pending yet, allocate a slot */
+    if (free == ctx->ack_num) {
+      if (ctx->ack_num >= BATCH_SIZE)
+        return -1;
+      ctx->ack_num++;
+    }
+    i = free;
+    ctx->ack_flows[i] = flow_id;
+    ctx->ack_segs[i] = 0;
+  }
+
+  /* ack every fp_delack_segs full-sized segments */
+  ctx->ack_segs[i] += full_segs;
+  if (ctx->ack_segs[i] >= config.fp_delack_segs) {
+    ctx->ack_flows[i] = ACK_FLOW_INVAL;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Drop pending delayed ack for flow_id, since an ack was just sent. */
+static void flow_ack_clear(struct dataplane_context *ctx, uint32_t flow_id)
+{
+  uint16_t i;
+
+  for (i = 0; i < ctx->ack_num; i++) {
+    if (ctx->ack_flows[i] == flow_id) {
+      ctx->ack_flows[i] = ACK_FLOW_INVAL;
+      return;
+    }
+  }
+}
+
 static void flow_reset_retransmit(struct flextcp_pl_flowst *fs)
 {
+  struct flextcp_pl_flowstats *st =
+    &fp_state->flowstats[fs - fp_state->flowst];
+  struct flextcp_pl_flowsack *sb;
   uint32_t x;
 
   /* reset flow state as if we never transmitted those segments */
   fs->rx_dupack_cnt = 0;
+  if (!fs->ts_opt) {
+    fp_state->flowrtt[fs - fp_state->flowst].valid = 0;
+  }
 
   fs->tx_next_seq -= fs->tx_sent;
   if (fs->tx_next_pos >= fs->tx_sent) {
@@ -1047,12 +1930,66 @@ static void flow_reset_retransmit(struct flextcp_pl_flowst *fs)
   fs->rx_remote_avail += fs->tx_sent;
   fs->tx_sent = 0;
 
+  /* everything will be sent again, forget about SACKed data */
+  if ((fs->flags & FLEXNIC_PL_FLOWST_SACK) != 0) {
+    sb = &fp_state->flowsack[fs - fp_state->flowst];
+    memset(sb->iv, 0, sizeof(sb->iv));
+    sb->rtx_next = sb->rtx_end = fs->tx_next_seq;
+    fs->flags &= ~FLEXNIC_PL_FLOWST_SACKRTX;
+  }
+
   /* cut rate by half if first drop in control interval */
-  if (fs->cnt_tx_drops == 0) {
+  if (st->cnt_tx_drops == 0) {
     fs->tx_rate /= 2;
   }
 
-  fs->cnt_tx_drops++;
+  st->cnt_tx_drops++;
+  st->txp = 0;
+}
+
+/* add rtt measurement to the flow's estimate */
+static inline void flow_rtt_update(struct flextcp_pl_flowst *fs, uint32_t rtt)
+{
+  struct flextcp_pl_flowstats *st =
+    &fp_state->flowstats[fs - fp_state->flowst];
+
+  if (rtt >= TCP_MAX_RTT)
+    return;
+
+  if (LIKELY(st->rtt_est != 0)) {
+    st->rtt_est = (st->rtt_est * 7 + rtt) / 8;
+  } else {
+    st->rtt_est = rtt;
+  }
+}
+
+/* segment ending before `seq` sent at `ts` on a flow without timestamps,
+ * becomes the rtt sample unless one is outstanding */
+static inline void flow_rtt_sent(struct flextcp_pl_flowst *fs, uint32_t seq,
+    uint32_t ts)
+{
+  struct flextcp_pl_flowrtt *rs = &fp_state->flowrtt[fs - fp_state->flowst];
+
+  if (rs->valid)
+    return;
+
+  rs->seq = seq;
+  rs->ts = ts;
+  rs->valid = 1;
+}
+
+/* cumulative ack received on a flow without timestamps, completes the rtt
+ * sample if it covers the sampled segment */
+static inline void flow_rtt_acked(struct flextcp_pl_flowst *fs, uint32_t ack,
+    uint32_t ts)
+{
+  struct flextcp_pl_flowrtt *rs = &fp_state->flowrtt[fs - fp_state->flowst];
+
+  if (!rs->valid || (int32_t) (ack - rs->seq) < 0)
+    return;
+
+  rs->valid = 0;
+  flow_rtt_update(fs, ts - rs->ts);
 }
 
 static inline void tcp_checksums(struct network_buf_handle *nbh,
@@ -1068,96 +2005,348 @@ static inline void tcp_checksums(struct network_buf_handle *nbh,
   }
 }
 
+/* length of headers from the flow's template */
+static inline uint16_t flow_hdrs_len(const struct flextcp_pl_flowst *fs)
+{
+  uint16_t len = (fs->ip6 ? FLEXNIC_PL_FLOWHDR6_LEN : FLEXNIC_PL_FLOWHDR_LEN);
+
+  /* timestamp option with padding */
+  if (!fs->ts_opt) {
+    len -= FLEXNIC_PL_FLOWHDR_LEN - sizeof(struct pkt_tcp);
+  }
+  return len;
+}
+
+/* copy flow header template to packet buffer: 64 bytes in wide unaligned
+ * loads and stores, then the rest up to the end of the timestamp option
+ * padding, 2 bytes for IPv4 and 22 bytes for IPv6 */
+static inline void flow_hdr_copy(struct pkt_tcp *p,
+    const struct flextcp_pl_flowhdr *fh, int ip6)
+{
+  const uint8_t *s = fh->hdr;
+  uint8_t *d = (uint8_t *) p;
+
+#ifdef __AVX__
+  _mm256_storeu_si256((__m256i *) d,
+      _mm256_loadu_si256((const __m256i *) s));
+  _mm256_storeu_si256((__m256i *) (d + 32),
+      _mm256_loadu_si256((const __m256i *) (s + 32)));
+#else
+  _mm_storeu_si128((__m128i *) d, _mm_loadu_si128((const __m128i *) s));
+  _mm_storeu_si128((__m128i *) (d + 16),
+      _mm_loadu_si128((const __m128i *) (s + 16)));
+  _mm_storeu_si128((__m128i *) (d + 32),
+      _mm_loadu_si128((const __m128i *) (s + 32)));
+  _mm_storeu_si128((__m128i *) (d + 48),
+      _mm_loadu_si128((const __m128i *) (s + 48)));
+#endif
+  if (UNLIKELY(ip6)) {
+    _mm_storeu_si128((__m128i *) (d + 64),
+        _mm_loadu_si128((const __m128i *) (s + 64)));
+    _mm_storeu_si128((__m128i *) (d + FLEXNIC_PL_FLOWHDR6_LEN - 16),
+        _mm_loadu_si128((const __m128i *) (s + FLEXNIC_PL_FLOWHDR6_LEN - 16)));
+  } else {
+    *(uint16_t *) (d + 64) = *(const uint16_t *) (s + 64);
+  }
+}
+
+/* checksums for headers copied from the flow template, ip length must be
+ * set. The ip checksum is updated incrementally (RFC 1624) for length and
+ * ECT0 mark, the pseudo header xsum for length. IPv6 has no header checksum,
+ * and for lengths below 64K the pseudo header length sums up the same. Without
+ * offload, `paysum` is the folded sum of the payload, which is not read
+ * again. */
+static inline void tcp_checksums_hdr(struct network_buf_handle *nbh,
+    struct pkt_tcp *p, uint8_t ecn, uint16_t paysum)
+{
+  uint32_t sum;
+  uint16_t l4len = pkt_l4len(p);
+  struct tcp_hdr *th = pkt_tcph(p);
+  int ip6 = pkt_ip6(p);
+
+  if (config.fp_xsumoffload) {
+    if (!ip6) {
+      p->ip.chksum = 0;
+    }
+    sum = (uint32_t) th->chksum + t_beui16(l4len).x;
+    th->chksum = (sum & 0xffff) + (sum >> 16);
+    tx_xsum_offload(nbh, ip6);
+  } else {
+    if (!ip6) {
+      sum = (uint16_t) ~p->ip.chksum;
+      sum += p->ip.len.x;
+      if (ecn) {
+        sum += t_beui16(IP_ECN_ECT0).x;
+      }
+      sum = (sum & 0xffff) + (sum >> 16);
+      sum = (sum & 0xffff) + (sum >> 16);
+      p->ip.chksum = ~sum;
+    }
+
+    /* pseudo header from template, tcp header and options, payload */
+    sum = (uint32_t) th->chksum + t_beui16(l4len).x + paysum;
+    th->chksum = 0;
+    sum += rte_raw_cksum(th, TCPH_HDRLEN(th) * 4);
+    sum = dma_xsum_fold(sum);
+    th->chksum = (sum == 0xffff ? sum : ~sum);
+  }
+}
+
+/* bytes the queue manager hands out per transmit opportunity: unthrottled
+ * flows get full super-segments, rate limited flows as much as they send in
+ * TCP_TSO_BURST_US, rounded down to full segments */
+static inline uint16_t flow_tx_chunk(const struct flextcp_pl_flowst *fs)
+{
+  uint32_t chunk;
+
+  /* software GSO only splits IPv4 super-segments */
+  if (config.fp_tso_max <= fs->mss || (fs->ip6 && !network_tso_hw)) {
+    return fs->mss;
+  }
+
+  chunk = MIN(config.fp_tso_max, TCP_TSO_MAX);
+  if (!network_tso_hw) {
+    /* software GSO splits into a limited number of frames */
+    chunk = MIN(chunk, (uint32_t) NETWORK_GSO_MAX_SEGS * fs->mss);
+  }
+  if (fs->tx_rate != 0) {
+    /* rate is in kbps */
+    chunk = MIN(chunk, (uint64_t) fs->tx_rate * TCP_TSO_BURST_US / 8000);
+  }
+
+  chunk -= chunk % fs->mss;
+  return MAX(chunk, fs->mss);
+}
+
 void fast_flows_kernelxsums(struct network_buf_handle *nbh,
     struct pkt_tcp *p)
 {
+  struct pkt_tcp6 *p6 = (struct pkt_tcp6 *) p;
+
+  if (pkt_ip6(p)) {
+    if (config.fp_xsumoffload) {
+      p6->tcp.chksum = network_ip6_phdr_xsum(&p6->ip6.src, &p6->ip6.dest,
+          IP_PROTO_TCP, pkt_l4len(p));
+      tx_xsum_offload(nbh, 1);
+    } else {
+      p6->tcp.chksum = 0;
+      p6->tcp.chksum = rte_ipv6_udptcp_cksum((void *) &p6->ip6,
+          (void *) &p6->tcp);
+    }
+    return;
+  }
+
   tcp_checksums(nbh, p, p->ip.src, p->ip.dest,
       f_beui16(p->ip.len) - sizeof(p->ip));
 }
 
 static inline uint32_t flow_hash(struct flow_key *k)
 {
+  uint32_t tuple[3];
+
+  if (config.fp_rss_flowhash) {
+    /* same hash the NIC calculates for the received packet */
+    tuple[0] = f_beui32(k->remote_ip);
+    tuple[1] = f_beui32(k->local_ip);
+    tuple[2] = ((uint32_t) f_beui16(k->remote_port) << 16) |
+        f_beui16(k->local_port);
+    return rte_softrss(tuple, 3, rss_key);
+  }
+
   return crc32c_sse42_u32(k->local_port.x | (((uint32_t) k->remote_port.x) << 16),
       crc32c_sse42_u64(k->local_ip.x | (((uint64_t) k->remote_ip.x) << 32), 0));
 }
 
+static inline uint32_t flow_hash6(struct flow_key6 *k)
+{
+  uint32_t tuple[9];
+  beui32_t w;
+  unsigned i;
+
+  if (config.fp_rss_flowhash) {
+    /* same hash the NIC calculates for the received packet */
+    for (i = 0; i < 4; i++) {
+      memcpy(&w, k->remote_ip.addr + 4 * i, sizeof(w));
+      tuple[i] = f_beui32(w);
+      memcpy(&w, k->local_ip.addr + 4 * i, sizeof(w));
+      tuple[4 + i] = f_beui32(w);
+    }
+    tuple[8] = ((uint32_t) f_beui16(k->remote_port) << 16) |
+        f_beui16(k->local_port);
+    return rte_softrss(tuple, 9, rss_key);
+  }
+
+  return rte_hash_crc(k, sizeof(*k), 0);
+}
+
+/* bitmap of slots in bucket `b` with tag `tag`, one bit per slot */
+static inline unsigned flow_bucket_match(const struct flextcp_pl_flowhtb *b,
+    uint16_t tag)
+{
+  __m128i tags, cmp;
+
+  tags = _mm_loadu_si128((const __m128i *) b->tags);
+  cmp = _mm_cmpeq_epi16(tags, _mm_set1_epi16(tag));
+  return _mm_movemask_epi8(_mm_packs_epi16(cmp, _mm_setzero_si128()));
+}
+
+/* look for flow with matching 4-tuple among slots with matching tag */
+static inline struct flextcp_pl_flowst *flow_bucket_lookup(
+    const struct flextcp_pl_flowhtb *b, uint16_t tag, const struct pkt_tcp *p)
+{
+  unsigned m, slot;
+  uint32_t fid;
+  struct flextcp_pl_flowst *fs;
+
+  for (m = flow_bucket_match(b, tag); m != 0; m &= m - 1) {
+    slot = __builtin_ctz(m);
+    fid = b->flow_ids[slot];
+    MEM_BARRIER();
+    if (b->tags[slot] != tag)
+      continue;
+
+    fs = &fp_state->flowst[fid];
+    if ((fs->local_ip.x == p->ip.dest.x) &
+        (fs->remote_ip.x == p->ip.src.x) &
+        (fs->local_port.x == p->tcp.dest.x) &
+        (fs->remote_port.x == p->tcp.src.x) &
+        !fs->ip6)
+    {
+      return fs;
+    }
+  }
+  return NULL;
+}
+
+/* same for IPv6 packets, addresses are compared in the flow's side table */
+static inline struct flextcp_pl_flowst *flow_bucket_lookup6(
+    const struct flextcp_pl_flowhtb *b, uint16_t tag, const struct pkt_tcp6 *p)
+{
+  unsigned m, slot;
+  uint32_t fid;
+  struct flextcp_pl_flowst *fs;
+  const struct flextcp_pl_flowip6 *fa;
+
+  for (m = flow_bucket_match(b, tag); m != 0; m &= m - 1) {
+    slot = __builtin_ctz(m);
+    fid = b->flow_ids[slot];
+    MEM_BARRIER();
+    if (b->tags[slot] != tag)
+      continue;
+
+    fs = &fp_state->flowst[fid];
+    if (!fs->ip6 || fs->local_port.x != p->tcp.dest.x ||
+        fs->remote_port.x != p->tcp.src.x)
+      continue;
+
+    fa = &fp_state->flowip6[fid];
+    if (memcmp(&fa->local_ip, &p->ip6.dest, sizeof(fa->local_ip)) == 0 &&
+        memcmp(&fa->remote_ip, &p->ip6.src, sizeof(fa->remote_ip)) == 0)
+    {
+      return fs;
+    }
+  }
+  return NULL;
+}
+
 void fast_flows_packet_fss(struct dataplane_context *ctx,
     struct network_buf_handle **nbhs, void **fss, uint16_t n)
 {
   uint32_t hashes[n];
-  uint32_t h, k, j, eh, fid, ffid;
-  uint16_t i;
+  uint32_t h, b1, b2, v1, v2;
+  uint16_t i, tag;
+  unsigned m;
   struct pkt_tcp *p;
+  struct pkt_tcp6 *p6;
   struct flow_key key;
-  struct flextcp_pl_flowhte *e;
+  struct flow_key6 key6;
+  struct flextcp_pl_flowhtb *bs1, *bs2;
   struct flextcp_pl_flowst *fs;
 
-  /* calculate hashes and prefetch hash table buckets */
+  /* calculate hashes and prefetch both candidate buckets, if possible use
+   * the hash from the NIC to avoid touching the headers */
   for (i = 0; i < n; i++) {
-    p = network_buf_bufoff(nbhs[i]);
-
-    key.local_ip = p->ip.dest;
-    key.remote_ip = p->ip.src;
-    key.local_port = p->tcp.dest;
-    key.remote_port = p->tcp.src;
-    h = flow_hash(&key);
+    if (!config.fp_rss_flowhash || network_buf_rsshash(nbhs[i], &h) != 0) {
+      p = network_buf_bufoff(nbhs[i]);
+
+      if (UNLIKELY(pkt_ip6(p))) {
+        p6 = (struct pkt_tcp6 *) p;
+        key6.local_ip = p6->ip6.dest;
+        key6.remote_ip = p6->ip6.src;
+        key6.local_port = p6->tcp.dest;
+        key6.remote_port = p6->tcp.src;
+        h = flow_hash6(&key6);
+      } else {
+        key.local_ip = p->ip.dest;
+        key.remote_ip = p->ip.src;
+        key.local_port = p->tcp.dest;
+        key.remote_port = p->tcp.src;
+        h = flow_hash(&key);
+      }
+    }
 
-    rte_prefetch0(&fp_state->flowht[h % FLEXNIC_PL_FLOWHT_ENTRIES]);
-    rte_prefetch0(&fp_state->flowht[(h + 3) % FLEXNIC_PL_FLOWHT_ENTRIES]);
+    b1 = FLEXNIC_PL_FLOWHT_BUCKET(h);
+    b2 = FLEXNIC_PL_FLOWHT_ALTBUCKET(b1, FLEXNIC_PL_FLOWHT_TAG(h));
+    rte_prefetch0(&fp_state->flowht[b1]);
+    rte_prefetch0(&fp_state->flowht[b2]);
     hashes[i] = h;
   }
 
-  /* prefetch flow state for buckets with matching hashes
+  /* prefetch flow state for slots with matching tags
    * (usually 1 per packet, except in case of collisions) */
   for (i = 0; i < n; i++) {
     h = hashes[i];
-    for (j = 0; j < FLEXNIC_PL_FLOWHT_NBSZ; j++) {
-      k = (h + j) % FLEXNIC_PL_FLOWHT_ENTRIES;
-      e = &fp_state->flowht[k];
-
-      ffid = e->flow_id;
-      MEM_BARRIER();
-      eh = e->flow_hash;
-
-      fid = ffid & ((1 << FLEXNIC_PL_FLOWHTE_POSSHIFT) - 1);
-      if ((ffid & FLEXNIC_PL_FLOWHTE_VALID) == 0 || eh != h) {
-        continue;
-      }
-
-      rte_prefetch0(&fp_state->flowst[fid]);
+    tag = FLEXNIC_PL_FLOWHT_TAG(h);
+    b1 = FLEXNIC_PL_FLOWHT_BUCKET(h);
+    b2 = FLEXNIC_PL_FLOWHT_ALTBUCKET(b1, tag);
+    bs1 = &fp_state->flowht[b1];
+    bs2 = &fp_state->flowht[b2];
+
+    for (m = flow_bucket_match(bs1, tag); m != 0; m &= m - 1) {
+      rte_prefetch0(&fp_state->flowst[bs1->flow_ids[__builtin_ctz(m)]]);
+    }
+    for (m = flow_bucket_match(bs2, tag); m != 0; m &= m - 1) {
+      rte_prefetch0(&fp_state->flowst[bs2->flow_ids[__builtin_ctz(m)]]);
     }
   }
 
-  /* finish hash table lookup by checking 5-tuple in flow state */
+  /* finish hash table lookup by checking 4-tuple in flow state, retry if
+   * the slow path concurrently moved entries in one of the buckets */
   for (i = 0; i < n; i++) {
     p = network_buf_bufoff(nbhs[i]);
-    fss[i] = NULL;
     h = hashes[i];
-
-    for (j = 0; j < FLEXNIC_PL_FLOWHT_NBSZ; j++) {
-      k = (h + j) % FLEXNIC_PL_FLOWHT_ENTRIES;
-      e = &fp_state->flowht[k];
-
-      ffid = e->flow_id;
+    tag = FLEXNIC_PL_FLOWHT_TAG(h);
+    b1 = FLEXNIC_PL_FLOWHT_BUCKET(h);
+    b2 = FLEXNIC_PL_FLOWHT_ALTBUCKET(b1, tag);
+    bs1 = &fp_state->flowht[b1];
+    bs2 = &fp_state->flowht[b2];
+
+    do {
+      fs = NULL;
+      v1 = bs1->version;
+      v2 = bs2->version;
       MEM_BARRIER();
-      eh = e->flow_hash;
-
-      fid = ffid & ((1 << FLEXNIC_PL_FLOWHTE_POSSHIFT) - 1);
-      if ((ffid & FLEXNIC_PL_FLOWHTE_VALID) == 0 || eh != h) {
+      if (UNLIKELY(((v1 | v2) & 1) != 0))
         continue;
-      }
 
-      MEM_BARRIER();
-      fs = &fp_state->flowst[fid];
-      if ((fs->local_ip.x == p->ip.dest.x) &
-          (fs->remote_ip.x == p->ip.src.x) &
-          (fs->local_port.x == p->tcp.dest.x) &
-          (fs->remote_port.x == p->tcp.src.x))
-      {
-        rte_prefetch0((uint8_t *) fs + 64);
-        fss[i] = &fp_state->flowst[fid];
-        break;
+      if (UNLIKELY(pkt_ip6(p))) {
+        p6 = (struct pkt_tcp6 *) p;
+        fs = flow_bucket_lookup6(bs1, tag, p6);
+        if (fs == NULL)
+          fs = flow_bucket_lookup6(bs2, tag, p6);
+      } else {
+        fs = flow_bucket_lookup(bs1, tag, p);
+        if (fs == NULL)
+          fs = flow_bucket_lookup(bs2, tag, p);
       }
-    }
+      MEM_BARRIER();
+    } while (UNLIKELY(((v1 | v2) & 1) != 0 || bs1->version != v1 ||
+          bs2->version != v2));
+
+    /* acks only need the first cache line of the flow state, segments with
+     * payload also the buffer locations in the second */
+    if (fs != NULL && packet_payload_len(p) != 0)
+      rte_prefetch0((uint8_t *) fs + 64);
+    fss[i] = fs;
   }
 }
@@ -42,7 +42,7 @@ int fast_kernel_poll(struct dataplane_context *ctx,
   void *buf = network_buf_buf(nbh);
   struct flextcp_pl_appctx *kctx = &fp_state->kctx[ctx->id];
   struct flextcp_pl_ktx *ktx;
-  uint32_t flow_id, len;
+  uint32_t len;
   int ret = -1;
 
   /* stop if context is not in use */
@@ -51,7 +51,8 @@ int fast_kernel_poll(struct dataplane_context *ctx,
 
   ktx = dma_pointer(kctx->tx_base + kctx->tx_head, sizeof(*ktx));
 
-  if (ktx->type == 0) {
+  if (ktx->type == 0 || (ktx->type & FLEXTCP_PL_KTX_FORWARDED) != 0) {
+    /* empty, or the owner core has not released a forwarded entry yet */
     return -1;
   } else if (ktx->type == FLEXTCP_PL_KTX_PACKET) {
     len = ktx->msg.packet.len;
@@ -71,14 +72,20 @@ int fast_kernel_poll(struct dataplane_context *ctx,
 
     ret = 0;
     tx_send(ctx, nbh, 0, len);
-  } else if (ktx->type == FLEXTCP_PL_KTX_CONNRETRAN) {
-    flow_id = ktx->msg.connretran.flow_id;
-    if (flow_id >= FLEXNIC_PL_FLOWST_NUM) {
-      fprintf(stderr, "fast_kernel_qman: invalid flow id=%u\n", flow_id);
-      abort();
+  } else if (ktx->type == FLEXTCP_PL_KTX_CONNRETRAN ||
+      ktx->type == FLEXTCP_PL_KTX_CONNSETRATE ||
+      ktx->type == FLEXTCP_PL_KTX_CONNSETTC ||
+      ktx->type == FLEXTCP_PL_KTX_CONNMOVE ||
+      ktx->type == FLEXTCP_PL_KTX_CONNDISABLE)
+  {
+    /* forwarded to the flow's owner core, which releases the entry, or left
+     * in the queue if the owner's ring is full */
+    ret = fast_kernel_flowmsg(ctx, ktx);
+    if (ret < 0) {
+      return -1;
+    } else if (ret > 0) {
+      goto next;
     }
-
-    fast_flows_retransmit(ctx, flow_id);
     ret = 1;
   } else {
     fprintf(stderr, "fast_appctx_poll: unknown type: %u\n", ktx->type);
@@ -88,6 +95,7 @@ int fast_kernel_poll(struct dataplane_context *ctx,
   MEM_BARRIER();
   ktx->type = 0;
 
+next:
   kctx->tx_head += sizeof(*ktx);
   if (kctx->tx_head >= kctx->tx_len)
     kctx->tx_head -= kctx->tx_len;
@@ -95,6 +103,71 @@ int fast_kernel_poll(struct dataplane_context *ctx,
   return ret;
 }
 
+/* Process kernel request for a flow if this core owns it, otherwise forward
+ * the queue entry to the owner. The entry is marked while forwarded, so
+ * polling does not pick it up again after the queue wrapped around. Returns 0
+ * if processed and the entry can be released, 1 if forwarded, -1 if the
+ * owner's ring is full. */
+int fast_kernel_flowmsg(struct dataplane_context *ctx,
+    struct flextcp_pl_ktx *ktx)
+{
+  struct flextcp_pl_flowst *fs;
+  uint32_t flow_id, tx_seq, rx_seq;
+  uint16_t owner;
+  uint8_t flags, type;
+
+  /* flow id is at the same offset for all flow requests */
+  flow_id = ktx->msg.connretran.flow_id;
+  if (flow_id >= FLEXNIC_PL_FLOWST_NUM) {
+    fprintf(stderr, "fast_kernel_flowmsg: invalid flow id=%u\n", flow_id);
+    abort();
+  }
+
+  fs = &fp_state->flowst[flow_id];
+  owner = flow_owner(fs);
+  type = ktx->type;
+  if (owner != ctx->id) {
+    ktx->type = type | FLEXTCP_PL_KTX_FORWARDED;
+    if (rte_ring_enqueue(ctxs[owner]->kernel_fwd_ring, ktx) != 0) {
+      ktx->type = type;
+      return -1;
+    }
+    notify_fastpath_core(owner);
+    return 1;
+  }
+
+  switch (type & ~FLEXTCP_PL_KTX_FORWARDED) {
+    case FLEXTCP_PL_KTX_CONNRETRAN:
+      fast_flows_retransmit(ctx, flow_id);
+      break;
+
+    case FLEXTCP_PL_KTX_CONNSETRATE:
+      fast_flows_setrate(ctx, flow_id, ktx->msg.connsetrate.rate);
+      break;
+
+    case FLEXTCP_PL_KTX_CONNSETTC:
+      fast_flows_settc(ctx, flow_id, ktx->msg.connsettc.tc);
+      break;
+
+    case FLEXTCP_PL_KTX_CONNMOVE:
+      fs->db_id = ktx->msg.connmove.db_id;
+      break;
+
+    case FLEXTCP_PL_KTX_CONNDISABLE:
+      fast_flows_disable(ctx, flow_id, &tx_seq, &rx_seq, &flags);
+      ktx->msg.conndisable.tx_seq = tx_seq;
+      ktx->msg.conndisable.rx_seq = rx_seq;
+      ktx->msg.conndisable.flags = flags;
+      break;
+
+    default:
+      fprintf(stderr, "fast_kernel_flowmsg: unknown type: %u\n", ktx->type);
+      abort();
+  }
+
+  return 0;
+}
+
 void fast_kernel_packet(struct dataplane_context *ctx,
     struct network_buf_handle *nbh)
 {
@@ -141,9 +214,14 @@ static inline void inject_tcp_ts(void *buf, uint16_t len, uint32_t ts,
     struct network_buf_handle *nbh)
 {
   struct pkt_tcp *p = buf;
+  struct pkt_tcp6 *p6 = buf;
   struct tcp_opts opts;
 
-  if (len < sizeof(*p) || f_beui16(p->eth.type) != ETH_TYPE_IP ||
+  if (pkt_ip6(p)) {
+    if (len < sizeof(*p6) || p6->ip6.next_hdr != IP_PROTO_TCP) {
+      return;
+    }
+  } else if (len < sizeof(*p) || f_beui16(p->eth.type) != ETH_TYPE_IP ||
       p->ip.proto != IP_PROTO_TCP)
   {
     return;
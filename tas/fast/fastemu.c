@@ -23,6 +23,7 @@
  */
 
 #include <assert.h>
+#include <inttypes.h>
 #include <signal.h>
 #include <unistd.h>
 #include <sys/epoll.h>
@@ -61,6 +62,16 @@ static unsigned poll_queues(struct dataplane_context *ctx, uint32_t ts)  __attri
 static unsigned poll_kernel(struct dataplane_context *ctx, uint32_t ts) __attribute__((noinline));
 static unsigned poll_qman(struct dataplane_context *ctx, uint32_t ts) __attribute__((noinline));
 static unsigned poll_qman_fwd(struct dataplane_context *ctx, uint32_t ts) __attribute__((noinline));
+static unsigned poll_rx_fwd(struct dataplane_context *ctx, uint32_t ts,
+    uint64_t tsc) __attribute__((noinline));
+static unsigned poll_bump_fwd(struct dataplane_context *ctx, uint32_t ts) __attribute__((noinline));
+static unsigned poll_kernel_fwd(struct dataplane_context *ctx) __attribute__((noinline));
+static void rx_process(struct dataplane_context *ctx,
+    struct network_buf_handle **bhs, unsigned n, uint32_t ts, uint64_t tsc);
+static unsigned poll_handoff(struct dataplane_context *ctx);
+static unsigned poll_acks(struct dataplane_context *ctx, uint32_t ts);
+static unsigned poll_tx_zc(struct dataplane_context *ctx, uint64_t tsc);
+static unsigned poll_dma(struct dataplane_context *ctx, uint64_t tsc);
 static void poll_scale(struct dataplane_context *ctx);
 
 static inline uint8_t bufcache_prealloc(struct dataplane_context *ctx, uint16_t num,
@@ -68,6 +79,9 @@ static inline uint8_t bufcache_prealloc(struct dataplane_context *ctx, uint16_t
 static inline void bufcache_alloc(struct dataplane_context *ctx, uint16_t num);
 static inline void bufcache_free(struct dataplane_context *ctx,
     struct network_buf_handle *handle);
+static inline void rx_buf_free(struct dataplane_context *ctx,
+    struct network_buf_handle *nbh);
+static void rx_bufs_release(struct dataplane_context *ctx);
 
 static inline void tx_flush(struct dataplane_context *ctx);
 static inline void tx_send(struct dataplane_context *ctx,
@@ -75,6 +89,18 @@ static inline void tx_send(struct dataplane_context *ctx,
 
 static void arx_cache_flush(struct dataplane_context *ctx, uint64_t tsc) __attribute__((noinline));
 
+/* Flow group handoff for rescaling: core 0 records the new owner of moved
+ * groups and bumps the generation, each core then hands over the groups it
+ * owns in between loop iterations, when it is not processing any flow, and
+ * after it processed the segments queued before the NIC was reconfigured. */
+static uint8_t handoff_steering[FLEXNIC_PL_MAX_FLOWGROUPS];
+static volatile uint32_t handoff_gen = 0;
+
+#ifdef DATAPLANE_STATS
+__thread struct dma_stats *dma_stats = NULL;
+static struct dma_stats dma_core_stats[FLEXNIC_PL_APPST_CTX_MCS];
+#endif
+
 int dataplane_init(void)
 {
   if (FLEXNIC_INTERNAL_MEM_SIZE < sizeof(struct flextcp_pl_mem)) {
@@ -101,6 +127,7 @@ int dataplane_init(void)
 int dataplane_context_init(struct dataplane_context *ctx)
 {
   char name[32];
+  unsigned i;
 
   /* initialize forwarding queue */
   sprintf(name, "qman_fwd_ring_%u", ctx->id);
@@ -111,6 +138,30 @@ int dataplane_context_init(struct dataplane_context *ctx)
     return -1;
   }
 
+  /* initialize rings for work forwarded to the owner core */
+  sprintf(name, "rx_fwd_ring_%u", ctx->id);
+  if ((ctx->rx_fwd_ring = rte_ring_create(name, 4 * 1024, rte_socket_id(),
+          RING_F_SC_DEQ)) == NULL)
+  {
+    fprintf(stderr, "initializing rx forwarding ring failed\n");
+    return -1;
+  }
+  sprintf(name, "bump_fwd_ring_%u", ctx->id);
+  if ((ctx->bump_fwd_ring = rte_ring_create(name, 32 * 1024, rte_socket_id(),
+          RING_F_SC_DEQ)) == NULL)
+  {
+    fprintf(stderr, "initializing bump forwarding ring failed\n");
+    return -1;
+  }
+  sprintf(name, "kernel_fwd_ring_%u", ctx->id);
+  if ((ctx->kernel_fwd_ring = rte_ring_create(name, 32 * 1024,
+          rte_socket_id(), RING_F_SC_DEQ)) == NULL)
+  {
+    fprintf(stderr, "initializing kernel forwarding ring failed\n");
+    return -1;
+  }
+  ctx->handoff_gen = ctx->handoff_drain_gen = handoff_gen;
+
   /* initialize queue manager */
   if (qman_thread_init(ctx) != 0) {
     fprintf(stderr, "initializing qman thread failed\n");
@@ -123,7 +174,19 @@ int dataplane_context_init(struct dataplane_context *ctx)
     return -1;
   }
 
-  ctx->poll_next_ctx = ctx->id;
+  for (i = 0; i < FLEXNIC_PL_TC_NUM; i++)
+    ctx->poll_next_ctx[i] = ctx->id;
+
+#ifdef DATAPLANE_STATS
+  dma_stats = &dma_core_stats[ctx->id];
+#endif
+
+#ifdef FLEXNIC_DMADEV
+  if (dma_engine_init(ctx->id) != 0) {
+    fprintf(stderr, "initializing dma engine failed\n");
+    return -1;
+  }
+#endif
 
   ctx->evfd = eventfd(0, EFD_NONBLOCK);
   assert(ctx->evfd != -1);
@@ -159,8 +222,11 @@ void dataplane_loop(struct dataplane_context *ctx)
 
     ts = qman_timestamp(cyc);
 
+    n += poll_handoff(ctx);
+
     STATS_TS(start);
     n += poll_rx(ctx, ts, cyc);
+    n += poll_rx_fwd(ctx, ts, cyc);
     STATS_TS(rx);
     tx_flush(ctx);
 
@@ -170,13 +236,21 @@ void dataplane_loop(struct dataplane_context *ctx)
     n += poll_qman(ctx, ts);
     STATS_TS(qm);
     STATS_TSADD(ctx, cyc_qm, qm - rx);
+    n += poll_acks(ctx, ts);
     n += poll_queues(ctx, ts);
+    n += poll_bump_fwd(ctx, ts);
     STATS_TS(qs);
     STATS_TSADD(ctx, cyc_qs, qs - qm);
     n += poll_kernel(ctx, ts);
+    n += poll_kernel_fwd(ctx);
 
-    /* flush transmit buffer */
+    /* flush transmit buffer, keep polling while frames of split
+     * super-segments wait for room in the tx queue */
     tx_flush(ctx);
+    n += network_tx_pending(&ctx->net);
+
+    n += poll_tx_zc(ctx, cyc);
+    n += poll_dma(ctx, cyc);
 
     if (ctx->id == 0)
       poll_scale(ctx);
@@ -238,39 +312,85 @@ void dataplane_dump_stats(void)
     ctx = ctxs[i];
     fprintf(stderr, "dp stats %u: "
         "qm=(%"PRIu64",%"PRIu64",%"PRIu64")  "
-        "rx=(%"PRIu64",%"PRIu64",%"PRIu64")  "
+        "rx=(%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64")  "
         "qs=(%"PRIu64",%"PRIu64",%"PRIu64")  "
         "cyc=(%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64")\n", i,
         read_stat(&ctx->stat_qm_poll), read_stat(&ctx->stat_qm_empty),
         read_stat(&ctx->stat_qm_total),
         read_stat(&ctx->stat_rx_poll), read_stat(&ctx->stat_rx_empty),
-        read_stat(&ctx->stat_rx_total),
+        read_stat(&ctx->stat_rx_total), read_stat(&ctx->rx_xsum_drop),
+        read_stat(&ctx->rx_fwd_drop), read_stat(&ctx->rx_zc_drop),
         read_stat(&ctx->stat_qs_poll), read_stat(&ctx->stat_qs_empty),
         read_stat(&ctx->stat_qs_total),
         read_stat(&ctx->stat_cyc_db), read_stat(&ctx->stat_cyc_qm),
         read_stat(&ctx->stat_cyc_rx), read_stat(&ctx->stat_cyc_qs));
   }
 }
+
+void dma_dump_stats(void)
+{
+  struct dma_stats *s;
+  unsigned i;
+
+  for (i = 0; i < fp_cores_max; i++) {
+    s = &dma_core_stats[i];
+    fprintf(stderr, "dma stats %u: "
+        "rd=(copy %"PRIu64"/%"PRIu64"B, prefetch %"PRIu64"/%"PRIu64"B, "
+        "xsum %"PRIu64"/%"PRIu64"B)  "
+        "wr=(copy %"PRIu64"/%"PRIu64"B, stream %"PRIu64"/%"PRIu64"B)  "
+        "async=(rd %"PRIu64"/%"PRIu64"B, wr %"PRIu64"/%"PRIu64"B)\n", i,
+        read_stat(&s->rd_copy), read_stat(&s->rd_copy_bytes),
+        read_stat(&s->rd_prefetch), read_stat(&s->rd_prefetch_bytes),
+        read_stat(&s->rd_xsum), read_stat(&s->rd_xsum_bytes),
+        read_stat(&s->wr_copy), read_stat(&s->wr_copy_bytes),
+        read_stat(&s->wr_stream), read_stat(&s->wr_stream_bytes),
+        read_stat(&s->rd_async), read_stat(&s->rd_async_bytes),
+        read_stat(&s->wr_async), read_stat(&s->wr_async_bytes));
+  }
+}
 #endif
 
+/* count segments received while draining the rx queue for a handoff, the
+ * queue is drained once it ran empty or we got as many segments as it held
+ * when the NIC was reconfigured. Segments forwarded to us until then are
+ * drained next. */
+static inline void rx_drain_account(struct dataplane_context *ctx, int ret,
+    unsigned max)
+{
+  if (ret > 0)
+    ctx->handoff_drained += ret;
+
+  if (ret > 0 && (unsigned) ret == max && ret < ctx->handoff_drain) {
+    ctx->handoff_drain -= ret;
+    return;
+  }
+
+  ctx->handoff_drain = 0;
+  ctx->handoff_fwd_drain = rte_ring_count(ctx->rx_fwd_ring);
+}
+
 static unsigned poll_rx(struct dataplane_context *ctx, uint32_t ts,
     uint64_t tsc)
 {
   int ret;
-  unsigned i, n;
-  uint8_t freebuf[BATCH_SIZE] = { 0 };
-  void *fss[BATCH_SIZE];
-  struct tcp_opts tcpopts[BATCH_SIZE];
+  unsigned n;
   struct network_buf_handle *bhs[BATCH_SIZE];
 
   n = BATCH_SIZE;
   if (TXBUF_SIZE - ctx->tx_num < n)
     n = TXBUF_SIZE - ctx->tx_num;
+  /* room for notifications and buffers waiting for payload copies */
+  if (ARX_CACHE_SIZE - ctx->arx_num < n)
+    n = ARX_CACHE_SIZE - ctx->arx_num;
+  if (RX_DMA_BUFS - ctx->rx_dma_num < n)
+    n = RX_DMA_BUFS - ctx->rx_dma_num;
 
   STATS_ADD(ctx, rx_poll, 1);
 
   /* receive packets */
   ret = network_poll(&ctx->net, n, bhs);
+  if (UNLIKELY(ctx->handoff_drain > 0) && n > 0)
+    rx_drain_account(ctx, ret, n);
   if (ret <= 0) {
     STATS_ADD(ctx, rx_empty, 1);
     return 0;
@@ -278,6 +398,55 @@ static unsigned poll_rx(struct dataplane_context *ctx, uint32_t ts,
   STATS_ADD(ctx, rx_total, n);
   n = ret;
 
+  rx_process(ctx, bhs, n, ts, tsc);
+  return n;
+}
+
+/* segments of flows owned by this core that arrived on other cores */
+static unsigned poll_rx_fwd(struct dataplane_context *ctx, uint32_t ts,
+    uint64_t tsc)
+{
+  unsigned n, ret;
+  struct network_buf_handle *bhs[BATCH_SIZE];
+
+  /* segments forwarded during a handoff arrived after the ones still in our
+   * rx queue, keep them back until that is drained */
+  if (UNLIKELY(ctx->handoff_drain > 0))
+    return 0;
+
+  n = BATCH_SIZE;
+  if (TXBUF_SIZE - ctx->tx_num < n)
+    n = TXBUF_SIZE - ctx->tx_num;
+  /* room for notifications and buffers waiting for payload copies */
+  if (ARX_CACHE_SIZE - ctx->arx_num < n)
+    n = ARX_CACHE_SIZE - ctx->arx_num;
+  if (RX_DMA_BUFS - ctx->rx_dma_num < n)
+    n = RX_DMA_BUFS - ctx->rx_dma_num;
+
+  ret = rte_ring_dequeue_burst(ctx->rx_fwd_ring, (void **) bhs, n, NULL);
+  if (UNLIKELY(ctx->handoff_fwd_drain > 0)) {
+    ctx->handoff_fwd_drain = (ret < n || ret >= ctx->handoff_fwd_drain ? 0 :
+        ctx->handoff_fwd_drain - ret);
+  }
+  n = ret;
+  if (n == 0)
+    return 0;
+
+  rx_process(ctx, bhs, n, ts, tsc);
+  return n;
+}
+
+static void rx_process(struct dataplane_context *ctx,
+    struct network_buf_handle **bhs, unsigned n, uint32_t ts, uint64_t tsc)
+{
+  int ret;
+  unsigned i, j;
+  uint8_t freebuf[BATCH_SIZE] = { 0 };
+  uint8_t runs[BATCH_SIZE];
+  uint32_t drop, fwd;
+  void *fss[BATCH_SIZE];
+  struct tcp_opts tcpopts[BATCH_SIZE];
+
   /* prefetch packet contents (1st cache line) */
   for (i = 0; i < n; i++) {
     rte_prefetch0(network_buf_bufoff(bhs[i]));
@@ -291,33 +460,46 @@ static unsigned poll_rx(struct dataplane_context *ctx, uint32_t ts,
     rte_prefetch0(network_buf_bufoff(bhs[i]) + 64);
   }
 
-  /* parse packets */
-  fast_flows_packet_parse(ctx, bhs, fss, tcpopts, n);
+  /* parse packets, drop those with bad checksums */
+  drop = fast_flows_packet_parse(ctx, bhs, fss, tcpopts, n);
 
-  for (i = 0; i < n; i++) {
-    /* run fast-path for flows with flow state */
+  /* hand segments of flows owned by other cores to their owner */
+  fwd = fast_flows_packet_fwd(ctx, bhs, fss, &drop, n);
+
+  /* coalesce segments of the same flow */
+  fast_flows_packet_gro(ctx, bhs, fss, tcpopts, runs, &drop, &fwd, n);
+
+  for (i = 0; i < n; i += runs[i]) {
+    /* run fast-path for flows with flow state, options of the last segment
+     * in a run apply to the run */
     if (fss[i] != NULL) {
-      ret = fast_flows_packet(ctx, bhs[i], fss[i], &tcpopts[i], ts);
+      ret = fast_flows_packet(ctx, &bhs[i], runs[i], fss[i],
+          &tcpopts[i + runs[i] - 1], ts);
+    } else if ((fwd & (1 << i)) != 0) {
+      /* buffer now belongs to the owner core */
+      freebuf[i] = 1;
+      ret = 0;
+    } else if ((drop & (1 << i)) != 0) {
+      ret = 0;
     } else {
       ret = -1;
     }
 
     if (ret > 0) {
-      freebuf[i] = 1;
+      freebuf[i + runs[i] - 1] = 1;
     } else if (ret < 0) {
-      fast_kernel_packet(ctx, bhs[i]);
+      for (j = i; j < i + runs[i]; j++)
+        fast_kernel_packet(ctx, bhs[j]);
     }
   }
 
   arx_cache_flush(ctx, tsc);
 
-  /* free received buffers */
+  /* free received buffers, once payload copies from them completed */
   for (i = 0; i < n; i++) {
     if (freebuf[i] == 0)
-      bufcache_free(ctx, bhs[i]);
+      rx_buf_free(ctx, bhs[i]);
   }
-
-  return n;
 }
 
 static unsigned poll_queues(struct dataplane_context *ctx, uint32_t ts)
@@ -325,8 +507,9 @@ static unsigned poll_queues(struct dataplane_context *ctx, uint32_t ts)
   struct network_buf_handle **handles;
   void *aqes[BATCH_SIZE];
   unsigned n, i, total = 0;
+  uint32_t id;
   uint16_t max, k = 0, num_bufs = 0, j;
-  int ret;
+  int ret, tc;
 
   STATS_ADD(ctx, qs_poll, 1);
 
@@ -338,22 +521,27 @@ static unsigned poll_queues(struct dataplane_context *ctx, uint32_t ts)
   max = bufcache_prealloc(ctx, max, &handles);
 
   for (n = 0; n < FLEXNIC_PL_APPCTX_NUM; n++) {
-    fast_appctx_poll_pf(ctx, (ctx->poll_next_ctx + n) % FLEXNIC_PL_APPCTX_NUM);
+    fast_appctx_poll_pf(ctx, n);
   }
 
-  for (n = 0; n < FLEXNIC_PL_APPCTX_NUM && k < max; n++) {
-    for (i = 0; i < BATCH_SIZE && k < max; i++) {
-      ret = fast_appctx_poll_fetch(ctx, ctx->poll_next_ctx, &aqes[k]);
-      if (ret == 0)
-        k++;
-      else
-        break;
-
-      total++;
+  /* contexts in higher traffic classes first, round robin within a class */
+  for (tc = FLEXNIC_PL_TC_NUM - 1; tc >= 0 && k < max; tc--) {
+    for (n = 0; n < FLEXNIC_PL_APPCTX_NUM && k < max; n++) {
+      id = ctx->poll_next_ctx[tc];
+      ctx->poll_next_ctx[tc] = (id + 1) % FLEXNIC_PL_APPCTX_NUM;
+      if (fp_state->appctx[ctx->id][id].tc != tc)
+        continue;
+
+      for (i = 0; i < BATCH_SIZE && k < max; i++) {
+        ret = fast_appctx_poll_fetch(ctx, id, &aqes[k]);
+        if (ret < 0)
+          break;
+        else if (ret == 0)
+          k++;
+
+        total++;
+      }
     }
-
-    ctx->poll_next_ctx = (ctx->poll_next_ctx + 1) %
-      FLEXNIC_PL_APPCTX_NUM;
   }
 
   for (j = 0; j < k; j++) {
@@ -460,9 +648,50 @@ static unsigned poll_qman(struct dataplane_context *ctx, uint32_t ts)
   /* apply buffer reservations */
   bufcache_alloc(ctx, off);
 
+  /* hand over queues of flows moved to other cores */
+  if (UNLIKELY(ctx->qman_fwd_num > 0))
+    fast_flows_qman_handoff(ctx);
+
   return ret;
 }
 
+/* send delayed ACKs that were not piggybacked on a data segment */
+static unsigned poll_acks(struct dataplane_context *ctx, uint32_t ts)
+{
+  struct network_buf_handle **handles;
+  uint16_t i, n, off = 0, max;
+
+  if (ctx->ack_num == 0)
+    return 0;
+
+  if (TXBUF_SIZE - ctx->tx_num < ctx->ack_num)
+    tx_flush(ctx);
+
+  max = ctx->ack_num;
+  if (TXBUF_SIZE - ctx->tx_num < max)
+    max = TXBUF_SIZE - ctx->tx_num;
+
+  /* allocate buffers contents */
+  max = bufcache_prealloc(ctx, max, &handles);
+
+  for (i = 0; i < ctx->ack_num && off < max; i++) {
+    if (fast_flows_ack(ctx, ctx->ack_flows[i], handles[off], ts) == 0)
+      off++;
+  }
+
+  /* apply buffer reservations */
+  bufcache_alloc(ctx, off);
+
+  /* keep ACKs we could not send for the next round */
+  for (n = 0; i < ctx->ack_num; i++, n++) {
+    ctx->ack_flows[n] = ctx->ack_flows[i];
+    ctx->ack_segs[n] = ctx->ack_segs[i];
+  }
+  ctx->ack_num = n;
+
+  return off;
+}
+
 static unsigned poll_qman_fwd(struct dataplane_context *ctx, uint32_t ts)
 {
   void *flow_states[4 * BATCH_SIZE];
@@ -477,6 +706,122 @@ static unsigned poll_qman_fwd(struct dataplane_context *ctx, uint32_t ts)
   return ret;
 }
 
+/* app queue bumps for flows owned by this core polled by other cores */
+static unsigned poll_bump_fwd(struct dataplane_context *ctx, uint32_t ts)
+{
+  struct network_buf_handle **handles;
+  void *aqes[BATCH_SIZE];
+  uint16_t max, num_bufs = 0, held, rest;
+  int ret, i, n;
+
+  max = BATCH_SIZE;
+  if (TXBUF_SIZE - ctx->tx_num < max)
+    max = TXBUF_SIZE - ctx->tx_num;
+
+  /* allocate buffers contents */
+  max = bufcache_prealloc(ctx, max, &handles);
+
+  /* held entries go first to keep the bumps of a flow in order */
+  held = MIN(ctx->bump_fwd_held, max);
+  rest = ctx->bump_fwd_held - held;
+  memcpy(aqes, ctx->bump_fwd_hold, held * sizeof(aqes[0]));
+  n = held + rte_ring_dequeue_burst(ctx->bump_fwd_ring, aqes + held,
+      max - held, NULL);
+  for (i = 0; i < n; i++) {
+    ret = fast_appctx_poll_bump(ctx, aqes[i], handles[num_bufs], ts);
+    if (ret < 0)
+      break;
+    else if (ret == 0)
+      num_bufs++;
+  }
+
+  /* ring of a flow's new owner is full, hold the rest */
+  memmove(ctx->bump_fwd_hold + (n - i), ctx->bump_fwd_hold + held,
+      rest * sizeof(aqes[0]));
+  memcpy(ctx->bump_fwd_hold, aqes + i, (n - i) * sizeof(aqes[0]));
+  ctx->bump_fwd_held = n - i + rest;
+
+  /* apply buffer reservations */
+  bufcache_alloc(ctx, num_bufs);
+
+  return n;
+}
+
+/* kernel flow requests for flows owned by this core polled by other cores */
+static unsigned poll_kernel_fwd(struct dataplane_context *ctx)
+{
+  struct flextcp_pl_ktx *ktxs[BATCH_SIZE];
+  int ret, i, n;
+
+  /* held entries go first to keep the requests of a flow in order */
+  n = ctx->kernel_fwd_held;
+  memcpy(ktxs, ctx->kernel_fwd_hold, n * sizeof(ktxs[0]));
+  n += rte_ring_dequeue_burst(ctx->kernel_fwd_ring, (void **) ktxs + n,
+      BATCH_SIZE - n, NULL);
+  for (i = 0; i < n; i++) {
+    ret = fast_kernel_flowmsg(ctx, ktxs[i]);
+    if (ret < 0) {
+      break;
+    } else if (ret == 0) {
+      MEM_BARRIER();
+      ktxs[i]->type = 0;
+    }
+  }
+
+  /* ring of a flow's new owner is full, hold the rest */
+  memcpy(ctx->kernel_fwd_hold, ktxs + i, (n - i) * sizeof(ktxs[0]));
+  ctx->kernel_fwd_held = n - i;
+
+  return n;
+}
+
+/* hand flow groups this core owns to their new owner after rescaling, once
+ * the segments for them already in our rx queue are processed. Returns 1
+ * while the handoff is in progress. */
+static unsigned poll_handoff(struct dataplane_context *ctx)
+{
+  uint32_t gen = handoff_gen;
+  unsigned i, moved = 0;
+
+  if (LIKELY(ctx->handoff_gen == gen))
+    return 0;
+
+  /* still draining the rx queue or segments forwarded to us */
+  if (ctx->handoff_drain > 0 || ctx->handoff_fwd_drain > 0)
+    return 1;
+
+  MEM_BARRIER();
+  if (ctx->handoff_drain_gen != gen) {
+    ctx->handoff_drain_gen = gen;
+    for (i = 0; i < FLEXNIC_PL_MAX_FLOWGROUPS && !moved; i++) {
+      moved = fp_state->flow_group_steering[i] == ctx->id &&
+        handoff_steering[i] != ctx->id;
+    }
+
+    /* the NIC steers new segments of moved groups to their new owner, which
+     * forwards them to us until the handoff, process older ones first */
+    if (moved) {
+      ctx->handoff_drain = network_rx_pending(&ctx->net);
+      if (ctx->handoff_drain == 0)
+        ctx->handoff_fwd_drain = rte_ring_count(ctx->rx_fwd_ring);
+      if (ctx->handoff_drain > 0 || ctx->handoff_fwd_drain > 0)
+        return 1;
+    }
+  }
+
+  for (i = 0; i < FLEXNIC_PL_MAX_FLOWGROUPS; i++) {
+    if (fp_state->flow_group_steering[i] == ctx->id &&
+        handoff_steering[i] != ctx->id)
+    {
+      fp_state->flow_group_steering[i] = handoff_steering[i];
+    }
+  }
+
+  MEM_BARRIER();
+  ctx->handoff_gen = gen;
+  return 1;
+}
+
 static inline uint8_t bufcache_prealloc(struct dataplane_context *ctx, uint16_t num,
     struct network_buf_handle ***handles)
 {
@@ -541,17 +886,104 @@ static inline void bufcache_free(struct dataplane_context *ctx,
   }
 }
 
+/* release deferred tx buffer space whose zero-copy segments completed, keeping
+ * the other entries in order, returns number of bumps released */
+static unsigned tx_zc_release(struct dataplane_context *ctx, uint64_t tsc)
+{
+  struct tx_zc_bump *b;
+  uint16_t i, kept = 0, first = ctx->tx_zc_bump_first;
+  unsigned n = 0;
+
+  for (i = 0; i < ctx->tx_zc_bump_num; i++) {
+    b = &ctx->tx_zc_bumps[(first + i) % TX_ZC_BUMPS];
+    if ((int32_t) (tx_zc_tail(ctx, b->core) - b->zc_head) < 0) {
+      ctx->tx_zc_bumps[(first + kept++) % TX_ZC_BUMPS] = *b;
+      continue;
+    }
+
+    arx_cache_add(ctx, b->db_id, b->opaque, 0, 0, b->tx_bump,
+        FLEXTCP_PL_ARX_CONNUPDATE);
+    n++;
+  }
+  ctx->tx_zc_bump_num = kept;
+
+  if (n > 0) {
+    arx_cache_flush(ctx, tsc);
+  }
+
+  return n;
+}
+
+/* release deferred tx buffer space once the zero-copy segments sent before it
+ * was acked completed, returns number of bumps still pending or released, and
+ * keeps the core polling while its own segments are in flight, as deferred
+ * bumps on other cores might wait for them */
+static unsigned poll_tx_zc(struct dataplane_context *ctx, uint64_t tsc)
+{
+  unsigned n = 0;
+
+  if (ctx->net.zc_head != ctx->net.zc_tail) {
+    n = (network_zc_reclaim(&ctx->net) != ctx->net.zc_head);
+  }
+
+  if (ctx->tx_zc_bump_num == 0) {
+    return n;
+  }
+
+  n += tx_zc_release(ctx, tsc);
+  return n + ctx->tx_zc_bump_num;
+}
+
+/* hand out notifications and free received buffers held back for payload
+ * copies, returns number of copies in flight to keep the core polling until
+ * they completed */
+static unsigned poll_dma(struct dataplane_context *ctx, uint64_t tsc)
+{
+  if (ctx->arx_num > 0) {
+    arx_cache_flush(ctx, tsc);
+  }
+  if (ctx->rx_dma_num > 0) {
+    rx_bufs_release(ctx);
+  }
+  return dma_async_pending();
+}
+
+/* make room in the full deferred bump queue: release entries whose segments
+ * completed, if there are none send out pending segments and give the NIC a
+ * few rounds to complete them. Returns 0 if there is room, -1 otherwise.
+ * Rarely needed, zero-copy is only used while the queue is at most half
+ * full. */
+int tx_zc_drain(struct dataplane_context *ctx)
+{
+  uint64_t tsc = rte_get_tsc_cycles();
+  unsigned i;
+
+  for (i = 0; i < TX_ZC_DRAIN_ROUNDS; i++) {
+    network_zc_reclaim(&ctx->net);
+    if (tx_zc_release(ctx, tsc) > 0) {
+      return 0;
+    }
+    tx_flush(ctx);
+  }
+  return -1;
+}
+
 static inline void tx_flush(struct dataplane_context *ctx)
 {
   int ret;
-  unsigned i;
+  unsigned i, num;
 
-  if (ctx->tx_num == 0) {
+  if (ctx->tx_num == 0 && LIKELY(network_tx_pending(&ctx->net) == 0)) {
     return;
   }
 
+  /* payload copies need to be done before the NIC reads the buffers, frames
+   * after the first one with copies in flight wait in order */
+  for (num = 0; num < ctx->tx_num && dma_async_done(ctx->tx_dma[num]);
+      num++);
+
   /* try to send out packets */
-  ret = network_send(&ctx->net, ctx->tx_num, ctx->tx_handles);
+  ret = network_send(&ctx->net, num, ctx->tx_handles);
 
   if (ret == ctx->tx_num) {
     /* everything sent */
@@ -560,26 +992,85 @@ static inline void tx_flush(struct dataplane_context *ctx)
     /* move unsent packets to front */
     for (i = ret; i < ctx->tx_num; i++) {
       ctx->tx_handles[i - ret] = ctx->tx_handles[i];
+      ctx->tx_dma[i - ret] = ctx->tx_dma[i];
     }
     ctx->tx_num -= ret;
   }
 }
 
+/* migration counters summed over all cores */
+struct handoff_stats {
+  uint64_t drained;
+  uint64_t rx_fwd;
+  uint64_t rx_fwd_drop;
+  uint64_t qman_fwd;
+  uint64_t qman_fwd_retry;
+};
+
+static void handoff_stats_read(struct handoff_stats *hs)
+{
+  struct dataplane_context *c;
+  unsigned i;
+
+  memset(hs, 0, sizeof(*hs));
+  for (i = 0; i < fp_cores_max; i++) {
+    c = ctxs[i];
+    hs->drained += c->handoff_drained;
+    hs->rx_fwd += c->rx_fwd;
+    hs->rx_fwd_drop += c->rx_fwd_drop;
+    hs->qman_fwd += c->qman_fwd;
+    hs->qman_fwd_retry += c->qman_fwd_retry;
+  }
+}
+
 static void poll_scale(struct dataplane_context *ctx)
 {
-  unsigned st = fp_scale_to;
+  static int handoff_pending = 0;
+  static uint64_t handoff_start;
+  static struct handoff_stats hs_start;
+  struct handoff_stats hs;
+  unsigned st = fp_scale_to, i;
 
   if (st == 0)
     return;
 
+  /* done once all cores handed over the moved flow groups they owned */
+  if (handoff_pending) {
+    for (i = 0; i < fp_cores_max; i++) {
+      if (ctxs[i]->handoff_gen != handoff_gen)
+        return;
+    }
+
+    /* queues of moved flows are still handed over when they fire next,
+     * counts only include those handed over until now */
+    handoff_stats_read(&hs);
+    fprintf(stderr, "Scaled fast path from %u to %u in %"PRIu64"us: "
+        "drained=%"PRIu64" reprocessed=%"PRIu64" dropped=%"PRIu64" "
+        "qman_fwd=%"PRIu64" qman_retry=%"PRIu64"\n", fp_cores_cur, st,
+        (rte_get_tsc_cycles() - handoff_start) * 1000000 / rte_get_tsc_hz(),
+        hs.drained - hs_start.drained, hs.rx_fwd - hs_start.rx_fwd,
+        hs.rx_fwd_drop - hs_start.rx_fwd_drop,
+        hs.qman_fwd - hs_start.qman_fwd,
+        hs.qman_fwd_retry - hs_start.qman_fwd_retry);
+
+    handoff_pending = 0;
+    fp_cores_cur = st;
+    fp_scale_to = 0;
+    return;
+  }
+
   fprintf(stderr, "Scaling fast path from %u to %u\n", fp_cores_cur, st);
+  handoff_start = rte_get_tsc_cycles();
+  handoff_stats_read(&hs_start);
+  memcpy(handoff_steering, fp_state->flow_group_steering,
+      sizeof(handoff_steering));
   if (st < fp_cores_cur) {
-    if (network_scale_down(fp_cores_cur, st) != 0) {
+    if (network_scale_down(fp_cores_cur, st, handoff_steering) != 0) {
       fprintf(stderr, "network_scale_down failed\n");
       abort();
     }
   } else if (st > fp_cores_cur) {
-    if (network_scale_up(fp_cores_cur, st) != 0) {
+    if (network_scale_up(fp_cores_cur, st, handoff_steering) != 0) {
       fprintf(stderr, "network_scale_up failed\n");
       abort();
     }
@@ -587,17 +1078,31 @@ static void poll_scale(struct dataplane_context *ctx)
     fprintf(stderr, "poll_scale: warning core number didn't change\n");
   }
 
-  fp_cores_cur = st;
-  fp_scale_to = 0;
+  /* current owners hand over moved groups between their loop iterations
+   * once they processed the segments already queued for them, segments the
+   * NIC already steers to the new core are forwarded to the current owner
+   * until then */
+  MEM_BARRIER();
+  handoff_gen++;
+  handoff_pending = 1;
+  for (i = 0; i < fp_cores_max; i++) {
+    if (i != ctx->id)
+      notify_fastpath_core(i);
+  }
 }
 
 static void arx_cache_flush(struct dataplane_context *ctx, uint64_t tsc)
 {
-  uint16_t i;
+  uint16_t i, num;
   struct flextcp_pl_appctx *actx;
-  struct flextcp_pl_arx *parx[BATCH_SIZE];
+  struct flextcp_pl_arx *parx[ARX_CACHE_SIZE];
+
+  /* only notify applications once the payload is in the socket buffers,
+   * entries after the first one with copies in flight are kept in order */
+  for (num = 0; num < ctx->arx_num && dma_async_done(ctx->arx_dma[num]);
+      num++);
 
-  for (i = 0; i < ctx->arx_num; i++) {
+  for (i = 0; i < num; i++) {
     actx = &fp_state->appctx[ctx->id][ctx->arx_ctx[i]];
     if (fast_actx_rxq_alloc(ctx, actx, &parx[i]) != 0) {
       /* TODO: how do we handle this? */
@@ -606,18 +1111,76 @@ static void arx_cache_flush(struct dataplane_context *ctx, uint64_t tsc)
     }
   }
 
-  for (i = 0; i < ctx->arx_num; i++) {
+  for (i = 0; i < num; i++) {
     rte_prefetch0(parx[i]);
   }
 
-  for (i = 0; i < ctx->arx_num; i++) {
+  for (i = 0; i < num; i++) {
     *parx[i] = ctx->arx_cache[i];
   }
 
-  for (i = 0; i < ctx->arx_num; i++) {
+  for (i = 0; i < num; i++) {
     actx = &fp_state->appctx[ctx->id][ctx->arx_ctx[i]];
     notify_appctx(actx, tsc);
   }
 
-  ctx->arx_num = 0;
+  /* move entries still waiting to front */
+  for (i = num; i < ctx->arx_num; i++) {
+    ctx->arx_cache[i - num] = ctx->arx_cache[i];
+    ctx->arx_ctx[i - num] = ctx->arx_ctx[i];
+    ctx->arx_dma[i - num] = ctx->arx_dma[i];
+  }
+  ctx->arx_num -= num;
+}
+
+/* make room in the full arx cache: wait for the payload copies of the oldest
+ * entry. Rarely needed, receive batches are limited to the room left. */
+void arx_cache_drain(struct dataplane_context *ctx)
+{
+  uint64_t tsc = rte_get_tsc_cycles();
+
+  while (!dma_async_done(ctx->arx_dma[0]));
+  arx_cache_flush(ctx, tsc);
+}
+
+/* free held back received buffers whose payload copies completed */
+static void rx_bufs_release(struct dataplane_context *ctx)
+{
+  uint16_t i;
+
+  while (ctx->rx_dma_num > 0) {
+    i = ctx->rx_dma_first;
+    if (!dma_async_done(ctx->rx_dma_marks[i]))
+      break;
+
+    bufcache_free(ctx, ctx->rx_dma_bufs[i]);
+    ctx->rx_dma_first = (i + 1) % RX_DMA_BUFS;
+    ctx->rx_dma_num--;
+  }
+}
+
+/* free received buffer once the payload copies enqueued until now completed */
+static inline void rx_buf_free(struct dataplane_context *ctx,
+    struct network_buf_handle *nbh)
+{
+  uint32_t mark = dma_async_mark();
+  uint16_t i;
+
+  if (LIKELY(dma_async_done(mark))) {
+    if (UNLIKELY(ctx->rx_dma_num > 0))
+      rx_bufs_release(ctx);
+    bufcache_free(ctx, nbh);
+    return;
+  }
+
+  /* rarely needed, receive batches are limited to the room left */
+  if (UNLIKELY(ctx->rx_dma_num == RX_DMA_BUFS)) {
+    while (!dma_async_done(ctx->rx_dma_marks[ctx->rx_dma_first]));
+    rx_bufs_release(ctx);
+  }
+
+  i = (ctx->rx_dma_first + ctx->rx_dma_num) % RX_DMA_BUFS;
+  ctx->rx_dma_bufs[i] = nbh;
+  ctx->rx_dma_marks[i] = mark;
+  ctx->rx_dma_num++;
 }
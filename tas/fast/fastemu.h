@@ -29,11 +29,17 @@
 #include "tcp_common.h"
 
 /*****************************************************************************/
+/* fastemu.c */
+int tx_zc_drain(struct dataplane_context *ctx);
+void arx_cache_drain(struct dataplane_context *ctx);
+
 /* fast_kernel.c */
 int fast_kernel_poll(struct dataplane_context *ctx,
     struct network_buf_handle *nbh, uint32_t ts);
 void fast_kernel_packet(struct dataplane_context *ctx,
     struct network_buf_handle *nbh);
+int fast_kernel_flowmsg(struct dataplane_context *ctx,
+    struct flextcp_pl_ktx *ktx);
 
 /* fast_appctx.c */
 void fast_appctx_poll_pf(struct dataplane_context *ctx, uint32_t id);
@@ -55,16 +61,24 @@ void fast_flows_qman_pfbufs(struct dataplane_context *ctx, uint32_t *queues,
     uint16_t n);
 int fast_flows_qman(struct dataplane_context *ctx, uint32_t queue,
     struct network_buf_handle *nbh, uint32_t ts);
+void fast_flows_qman_handoff(struct dataplane_context *ctx);
 int fast_flows_qman_fwd(struct dataplane_context *ctx,
     struct flextcp_pl_flowst *fs);
 int fast_flows_packet(struct dataplane_context *ctx,
-    struct network_buf_handle *nbh, void *fs, struct tcp_opts *opts,
-    uint32_t ts);
+    struct network_buf_handle **nbhs, uint16_t num, void *fs,
+    struct tcp_opts *opts, uint32_t ts);
+int fast_flows_ack(struct dataplane_context *ctx, uint32_t flow_id,
+    struct network_buf_handle *nbh, uint32_t ts);
+uint32_t fast_flows_packet_fwd(struct dataplane_context *ctx,
+    struct network_buf_handle **nbhs, void **fss, uint32_t *drop, uint16_t n);
 void fast_flows_packet_fss(struct dataplane_context *ctx,
     struct network_buf_handle **nbhs, void **fss, uint16_t n);
-void fast_flows_packet_parse(struct dataplane_context *ctx,
+uint32_t fast_flows_packet_parse(struct dataplane_context *ctx,
     struct network_buf_handle **nbhs, void **fss, struct tcp_opts *tos,
     uint16_t n);
+void fast_flows_packet_gro(struct dataplane_context *ctx,
+    struct network_buf_handle **nbhs, void **fss, struct tcp_opts *tos,
+    uint8_t *runs, uint32_t *drop, uint32_t *fwd, uint16_t n);
 void fast_flows_packet_pfbufs(struct dataplane_context *ctx,
     void **fss, uint16_t n);
 void fast_flows_kernelxsums(struct network_buf_handle *nbh,
@@ -74,10 +88,23 @@ int fast_flows_bump(struct dataplane_context *ctx, uint32_t flow_id,
     uint16_t bump_seq, uint32_t rx_tail, uint32_t tx_head, uint8_t flags,
     struct network_buf_handle *nbh, uint32_t ts);
 void fast_flows_retransmit(struct dataplane_context *ctx, uint32_t flow_id);
+void fast_flows_setrate(struct dataplane_context *ctx, uint32_t flow_id,
+    uint32_t rate);
+void fast_flows_settc(struct dataplane_context *ctx, uint32_t flow_id,
+    uint8_t tc);
+void fast_flows_disable(struct dataplane_context *ctx, uint32_t flow_id,
+    uint32_t *tx_seq, uint32_t *rx_seq, uint8_t *flags);
 
 /*****************************************************************************/
 /* Helpers */
 
+/* Core owning the flow's group: the only core processing packets, queue
+ * bumps, and kernel requests for the flow, others forward them there. */
+static inline uint16_t flow_owner(const struct flextcp_pl_flowst *fs)
+{
+  return fp_state->flow_group_steering[fs->flow_group];
+}
+
 static inline void tx_send(struct dataplane_context *ctx,
     struct network_buf_handle *nbh, uint16_t off, uint16_t len)
 {
@@ -91,6 +118,7 @@ static inline void tx_send(struct dataplane_context *ctx,
   network_buf_setoff(nbh, off);
   network_buf_setlen(nbh, len);
   ctx->tx_handles[i] = nbh;
+  ctx->tx_dma[i] = dma_async_mark();
   ctx->tx_num = i + 1;
 }
 
@@ -101,13 +129,135 @@ static inline uint16_t tx_xsum_enable(struct network_buf_handle *nbh,
       ip_s, ip_d, IP_PROTO_TCP, l3_paylen);
 }
 
+static inline void tx_xsum_offload(struct network_buf_handle *nbh, int ip6)
+{
+  network_buf_xsumoffload(nbh, sizeof(struct eth_hdr),
+      (ip6 ? sizeof(struct ip6_hdr) : sizeof(struct ip_hdr)), ip6);
+}
+
+static inline void tx_tso_enable(struct network_buf_handle *nbh,
+    uint16_t l4_len, uint16_t mss, int ip6)
+{
+  network_buf_tcptso(nbh, sizeof(struct eth_hdr),
+      (ip6 ? sizeof(struct ip6_hdr) : sizeof(struct ip_hdr)), l4_len, mss,
+      ip6);
+}
+
+/* allocate buffer for a transmit super-segment, NULL if none available */
+static inline struct network_buf_handle *tx_tso_alloc(
+    struct dataplane_context *ctx)
+{
+  return network_buf_alloc_tso(&ctx->net);
+}
+
+/* zero-copy segments completed by a core so far */
+static inline uint32_t tx_zc_tail(struct dataplane_context *ctx, uint16_t core)
+{
+  if (core == ctx->id) {
+    return ctx->net.zc_tail;
+  }
+
+  /* advanced by the other core when it reclaims its segments */
+  return *(volatile uint32_t *) &ctxs[core]->net.zc_tail;
+}
+
+/* check if the zero-copy segments the flow sent last are still in flight */
+static inline int tx_zc_inflight(struct dataplane_context *ctx,
+    const struct flextcp_pl_flowst *fs)
+{
+  return (fs->flags & FLEXNIC_PL_FLOWST_TXZC) != 0 &&
+    (int32_t) (tx_zc_tail(ctx, fs->tx_zc_core) - fs->tx_zc_head) < 0;
+}
+
+/* check if the flow may send a zero-copy segment: copy while the deferred bump
+ * queue drains, and until segments sent from a previous owner core completed,
+ * so a flow only has zero-copy segments in flight on one core */
+static inline int tx_zc_usable(struct dataplane_context *ctx,
+    const struct flextcp_pl_flowst *fs)
+{
+  return ctx->tx_zc_bump_num < TX_ZC_BUMPS / 2 &&
+    (fs->tx_zc_core == ctx->id || !tx_zc_inflight(ctx, fs));
+}
+
+/* find the newest of the last n deferred bumps for the flow */
+static inline struct tx_zc_bump *tx_zc_find(struct dataplane_context *ctx,
+    const struct flextcp_pl_flowst *fs, uint16_t n)
+{
+  struct tx_zc_bump *b;
+  uint16_t i, num = ctx->tx_zc_bump_num;
+
+  for (i = 1; i <= n; i++) {
+    b = &ctx->tx_zc_bumps[(ctx->tx_zc_bump_first + num - i) % TX_ZC_BUMPS];
+    if (b->opaque == fs->opaque && b->db_id == fs->db_id) {
+      return b;
+    }
+  }
+  return NULL;
+}
+
+/* check if tx buffer space acked for the flow can be held back, with a full
+ * deferred bump queue only if there is an entry for the flow to merge with or
+ * draining made room, returns 0 if so */
+static inline int tx_zc_room(struct dataplane_context *ctx,
+    const struct flextcp_pl_flowst *fs)
+{
+  if (LIKELY(ctx->tx_zc_bump_num < TX_ZC_BUMPS) || !tx_zc_inflight(ctx, fs) ||
+      tx_zc_find(ctx, fs, TX_ZC_BUMPS) != NULL)
+  {
+    return 0;
+  }
+  return tx_zc_drain(ctx);
+}
+
+/* hold back tx buffer space released by an ack while zero-copy segments of the
+ * flow are in flight, returns -1 if it can be released right away. Once the
+ * flow's last segments completed all its earlier ones did, so held back space
+ * of other entries for the flow is not referenced anymore either. The caller
+ * makes sure there is room with tx_zc_room. */
+static inline int tx_zc_defer(struct dataplane_context *ctx,
+    const struct flextcp_pl_flowst *fs, uint32_t tx_bump)
+{
+  struct tx_zc_bump *b;
+  uint16_t num = ctx->tx_zc_bump_num;
+
+  if (!tx_zc_inflight(ctx, fs)) {
+    return -1;
+  }
+
+  /* merge with the last entry if it is for the same flow, if the queue is
+   * full with any entry for it, that only delays releasing earlier space */
+  b = tx_zc_find(ctx, fs, (num == TX_ZC_BUMPS ? num : MIN(num, 1)));
+  if (b != NULL) {
+    b->tx_bump += tx_bump;
+    b->zc_head = fs->tx_zc_head;
+    b->core = fs->tx_zc_core;
+    return 0;
+  }
+
+  b = &ctx->tx_zc_bumps[(ctx->tx_zc_bump_first + num) % TX_ZC_BUMPS];
+  b->opaque = fs->opaque;
+  b->tx_bump = tx_bump;
+  b->zc_head = fs->tx_zc_head;
+  b->db_id = fs->db_id;
+  b->core = fs->tx_zc_core;
+  ctx->tx_zc_bump_num = num + 1;
+  return 0;
+}
+
 static inline void arx_cache_add(struct dataplane_context *ctx, uint16_t ctx_id,
     uint64_t opaque, uint32_t rx_bump, uint32_t rx_pos, uint32_t tx_bump,
     uint16_t type_flags)
 {
-  uint16_t id = ctx->arx_num++;
+  uint16_t id;
+
+  /* cache only fills up while entries wait for payload copies */
+  if (UNLIKELY(ctx->arx_num == ARX_CACHE_SIZE)) {
+    arx_cache_drain(ctx);
+  }
 
+  id = ctx->arx_num++;
   ctx->arx_ctx[id] = ctx_id;
+  ctx->arx_dma[id] = dma_async_mark();
   ctx->arx_cache[id].type = type_flags & 0xff;
   ctx->arx_cache[id].msg.connupdate.opaque = opaque;
   ctx->arx_cache[id].msg.connupdate.rx_bump = rx_bump;
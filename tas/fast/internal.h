@@ -31,6 +31,7 @@
 #include <rte_config.h>
 #include <rte_ether.h>
 
+/* minimal packet buffer size, larger for jumbo frames */
 #define BUFFER_SIZE 2048
 
 //#define FLEXNIC_TRACING
@@ -61,6 +62,7 @@ extern volatile unsigned fp_scale_to;
 #define QMAN_SET_MAXCHUNK (1 << 1)
 #define QMAN_SET_AVAIL    (1 << 3)
 #define QMAN_ADD_AVAIL    (1 << 4)
+#define QMAN_SET_TC       (1 << 5)
 
 int qman_thread_init(struct dataplane_context *ctx);
 uint32_t qman_timestamp(uint64_t tsc);
@@ -24,6 +24,7 @@
 
 #include <stdio.h>
 #include <assert.h>
+#include <unistd.h>
 
 #include <rte_config.h>
 #include <rte_memcpy.h>
@@ -34,16 +35,26 @@
 #include <rte_mempool.h>
 #include <rte_mbuf.h>
 #include <rte_ip.h>
+#include <rte_gso.h>
 #include <rte_version.h>
 #include <rte_spinlock.h>
 
 #include <utils.h>
 #include <utils_rng.h>
 #include <tas_memif.h>
+#include <packet_defs.h>
 #include "internal.h"
 
 #define PERTHREAD_MBUFS 2048
-#define MBUF_SIZE (BUFFER_SIZE + sizeof(struct rte_mbuf) + RTE_PKTMBUF_HEADROOM)
+#define MBUF_SIZE(len) ((len) + sizeof(struct rte_mbuf) + RTE_PKTMBUF_HEADROOM)
+/* super-segment buffers use the largest possible mbuf data room */
+#define PERTHREAD_TSO_MBUFS 64
+#define TSO_MBUF_SIZE (UINT16_MAX + sizeof(struct rte_mbuf))
+/* indirect mbufs referencing super-segment payload after software GSO */
+#define PERTHREAD_GSO_MBUFS 1024
+#define GSO_MBUF_SIZE (sizeof(struct rte_mbuf))
+/* page size of shared memory backed by huge pages */
+#define HUGE_PGSIZE (2 * 1024 * 1024)
 #define RX_DESCRIPTORS 256
 #define TX_DESCRIPTORS 128
 
@@ -62,7 +73,7 @@ static struct rte_eth_conf port_conf = {
     },
     .rx_adv_conf = {
       .rss_conf = {
-        .rss_hf = ETH_RSS_NONFRAG_IPV4_TCP,
+        .rss_hf = ETH_RSS_NONFRAG_IPV4_TCP | ETH_RSS_NONFRAG_IPV6_TCP,
       },
     },
     .intr_conf = {
@@ -81,13 +92,26 @@ static struct rte_eth_dev_info eth_devinfo;
 #endif
 
 uint16_t rss_reta_size;
+uint8_t rss_key[TAS_RSS_KEY_LEN] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+  };
 static struct rte_eth_rss_reta_entry64 *rss_reta = NULL;
 static uint16_t *rss_core_buckets = NULL;
 
-static struct rte_mempool *mempool_alloc(void);
+static struct rte_mempool *mempool_alloc(unsigned num, size_t size);
 static int reta_setup(void);
+static int zc_init(void);
+static void zc_free_cb(void *addr, void *opaque);
 static int reta_mlx5_resize(void);
 static rte_spinlock_t initlock = RTE_SPINLOCK_INITIALIZER;
+/* super-segments are split by the NIC */
+int network_tso_hw = 0;
+/* data room of packet buffers, fits a frame of the link MTU */
+static size_t buf_size = BUFFER_SIZE;
 
 int network_init(unsigned n_threads)
 {
@@ -144,11 +168,77 @@ int network_init(unsigned n_threads)
     port_conf.rx_adv_conf.rss_conf.rss_hf &= eth_devinfo.flow_type_rss_offloads;
   }
 
+  /* flow lookup on RSS hash requires TCP hashing with a known key, for IPv4
+   * and IPv6 */
+  if (config.fp_rss_flowhash) {
+    if ((port_conf.rx_adv_conf.rss_conf.rss_hf &
+          (ETH_RSS_NONFRAG_IPV4_TCP | ETH_RSS_NONFRAG_IPV6_TCP)) !=
+        (ETH_RSS_NONFRAG_IPV4_TCP | ETH_RSS_NONFRAG_IPV6_TCP) ||
+        (eth_devinfo.hash_key_size != 0 &&
+         eth_devinfo.hash_key_size != TAS_RSS_KEY_LEN))
+    {
+      fprintf(stderr, "Warning: NIC does not support TCP RSS hash with "
+          "%u byte key, disabling RSS flow hash.\n", TAS_RSS_KEY_LEN);
+      config.fp_rss_flowhash = 0;
+    } else {
+      port_conf.rx_adv_conf.rss_conf.rss_key = rss_key;
+      port_conf.rx_adv_conf.rss_conf.rss_key_len = TAS_RSS_KEY_LEN;
+    }
+  }
+
   /* enable per port checksum offload if requested */
   if (config.fp_xsumoffload)
     port_conf.txmode.offloads =
       DEV_TX_OFFLOAD_IPV4_CKSUM | DEV_TX_OFFLOAD_TCP_CKSUM;
 
+  /* let the NIC verify receive checksums if it can, otherwise the fast path
+   * verifies them in software */
+  if (config.fp_rx_xsum &&
+      (eth_devinfo.rx_offload_capa & (DEV_RX_OFFLOAD_IPV4_CKSUM |
+        DEV_RX_OFFLOAD_TCP_CKSUM)) ==
+      (DEV_RX_OFFLOAD_IPV4_CKSUM | DEV_RX_OFFLOAD_TCP_CKSUM))
+  {
+    port_conf.rxmode.offloads |=
+      DEV_RX_OFFLOAD_IPV4_CKSUM | DEV_RX_OFFLOAD_TCP_CKSUM;
+  }
+
+  /* super-segments are split with TSO if available, otherwise in software
+   * into multi-segment mbufs */
+  if (config.fp_tso_max > 0) {
+    if ((eth_devinfo.tx_offload_capa & DEV_TX_OFFLOAD_TCP_TSO)) {
+      network_tso_hw = 1;
+      port_conf.txmode.offloads |= DEV_TX_OFFLOAD_TCP_TSO |
+        DEV_TX_OFFLOAD_IPV4_CKSUM | DEV_TX_OFFLOAD_TCP_CKSUM;
+    } else if ((eth_devinfo.tx_offload_capa & DEV_TX_OFFLOAD_MULTI_SEGS)) {
+      port_conf.txmode.offloads |= DEV_TX_OFFLOAD_MULTI_SEGS;
+    } else {
+      fprintf(stderr, "Warning: NIC supports neither TSO nor multi-segment "
+          "transmits, disabling super-segments.\n");
+      config.fp_tso_max = 0;
+    }
+  }
+
+  /* frames for the link MTU with ethernet and vlan header (and CRC for the
+   * NIC) have to fit in a packet buffer */
+  buf_size = MAX(BUFFER_SIZE, (config.ip_mtu + 18 + 63) & ~63U);
+  if (config.ip_mtu > 1500) {
+    if (eth_devinfo.max_rx_pktlen < config.ip_mtu + 18) {
+      fprintf(stderr, "Error: NIC does not support %u byte MTU (max frame "
+          "%u)\n", config.ip_mtu, eth_devinfo.max_rx_pktlen);
+      goto error_exit;
+    }
+#if RTE_VER_YEAR < 21 || (RTE_VER_YEAR == 21 && RTE_VER_MONTH < 11)
+    port_conf.rxmode.offloads |= DEV_RX_OFFLOAD_JUMBO_FRAME;
+    port_conf.rxmode.max_rx_pkt_len = config.ip_mtu + 18;
+#endif
+  }
+
+  /* zero-copy transmit needs the NIC to access shared memory directly */
+  if (config.fp_tx_zerocopy && zc_init() != 0) {
+    fprintf(stderr, "Warning: disabling zero-copy transmit.\n");
+    config.fp_tx_zerocopy = 0;
+  }
+
   /* disable rx interrupts if requested */
   if (!config.fp_interrupts)
     port_conf.intr_conf.rxq = 0;
@@ -161,6 +251,13 @@ int network_init(unsigned n_threads)
   }
 
 
+  if (config.ip_mtu != 1500 &&
+      rte_eth_dev_set_mtu(net_port_id, config.ip_mtu) != 0)
+  {
+    fprintf(stderr, "rte_eth_dev_set_mtu failed\n");
+    goto error_exit;
+  }
+
   /* workaround for mlx5. */
   if (config.fp_autoscale) {
     if (reta_mlx5_resize() != 0) {
@@ -171,13 +268,20 @@ int network_init(unsigned n_threads)
 #if RTE_VER_YEAR < 18
   eth_devinfo.default_txconf.txq_flags = ETH_TXQ_FLAGS_IGNORE;
 #endif
-  eth_devinfo.default_rxconf.offloads = 0;
+  eth_devinfo.default_rxconf.offloads = port_conf.rxmode.offloads &
+    (DEV_RX_OFFLOAD_IPV4_CKSUM | DEV_RX_OFFLOAD_TCP_CKSUM);
 
   /* enable per-queue checksum offload if requested */
   eth_devinfo.default_txconf.offloads = 0;
   if (config.fp_xsumoffload)
     eth_devinfo.default_txconf.offloads =
       DEV_TX_OFFLOAD_IPV4_CKSUM | DEV_TX_OFFLOAD_TCP_CKSUM;
+  eth_devinfo.default_txconf.offloads |= port_conf.txmode.offloads &
+    (DEV_TX_OFFLOAD_TCP_TSO | DEV_TX_OFFLOAD_MULTI_SEGS);
+
+  /* zero-copy payload is in shared memory, not in mbufs */
+  if (config.fp_tx_zerocopy)
+    eth_devinfo.default_txconf.offloads |= DEV_TX_OFFLOAD_MULTI_SEGS;
 
   memcpy(&tas_info->mac_address, &eth_addr, 6);
 
@@ -215,13 +319,67 @@ int network_thread_init(struct dataplane_context *ctx)
   static volatile uint32_t start_done = 0;
 
   struct network_thread *t = &ctx->net;
+  unsigned i;
   int ret;
 
   /* allocate mempool */
-  if ((t->pool = mempool_alloc()) == NULL) {
+  if ((t->pool = mempool_alloc(PERTHREAD_MBUFS, MBUF_SIZE(buf_size))) == NULL) {
     goto error_mpool;
   }
 
+  /* allocate super-segment buffers and software segmentation state */
+  t->tso_pool = NULL;
+  t->gso = NULL;
+  t->gso_segs = NULL;
+  t->gso_first = t->gso_num = 0;
+  if (config.fp_tso_max > 0) {
+    if ((t->tso_pool = mempool_alloc(PERTHREAD_TSO_MBUFS, TSO_MBUF_SIZE)) ==
+        NULL)
+    {
+      fprintf(stderr, "network_thread_init: allocating tso pool failed\n");
+      goto error_mpool;
+    }
+
+    if (!network_tso_hw) {
+      if ((t->gso = rte_zmalloc("gso ctx", sizeof(*t->gso), 0)) == NULL) {
+        fprintf(stderr, "network_thread_init: allocating gso ctx failed\n");
+        goto error_mpool;
+      }
+      if ((t->gso_segs = rte_zmalloc("gso segs", NETWORK_GSO_MAX_SEGS *
+              sizeof(*t->gso_segs), 0)) == NULL)
+      {
+        fprintf(stderr, "network_thread_init: allocating gso segs failed\n");
+        goto error_mpool;
+      }
+      t->gso->direct_pool = t->pool;
+      t->gso->indirect_pool = mempool_alloc(PERTHREAD_GSO_MBUFS,
+          GSO_MBUF_SIZE);
+      t->gso->gso_types = DEV_TX_OFFLOAD_TCP_TSO;
+      /* we do not increment the ip id */
+      t->gso->flag = RTE_GSO_FLAG_IPID_FIXED;
+      if (t->gso->indirect_pool == NULL) {
+        fprintf(stderr, "network_thread_init: allocating gso pool failed\n");
+        goto error_mpool;
+      }
+    }
+  }
+
+  /* allocate zero-copy segment state */
+  t->zc_slots = NULL;
+  t->zc_head = t->zc_tail = 0;
+  if (config.fp_tx_zerocopy) {
+    if ((t->zc_slots = rte_zmalloc("zc slots", NETWORK_ZC_SLOTS *
+            sizeof(*t->zc_slots), 0)) == NULL)
+    {
+      fprintf(stderr, "network_thread_init: allocating zc slots failed\n");
+      goto error_mpool;
+    }
+    for (i = 0; i < NETWORK_ZC_SLOTS; i++) {
+      t->zc_slots[i].shinfo.free_cb = zc_free_cb;
+      t->zc_slots[i].shinfo.fcb_opaque = &t->zc_slots[i];
+    }
+  }
+
   /* initialize tx queue */
   t->queue_id = ctx->id;
   rte_spinlock_lock(&initlock);
@@ -259,6 +417,12 @@ int network_thread_init(struct dataplane_context *ctx)
       goto error_tx_queue;
     }
 
+    /* neighbor solicitations for the local IPv6 address are sent to its
+     * solicited-node multicast group */
+    if (config.ip6_enabled) {
+      rte_eth_allmulticast_enable(net_port_id);
+    }
+
     /* enable vlan stripping if configured */
     if (config.fp_vlan_strip) {
       ret = rte_eth_dev_get_vlan_offload(net_port_id);
@@ -276,6 +440,16 @@ int network_thread_init(struct dataplane_context *ctx)
         goto error_tx_queue;
       }
     }
+
+    /* without explicit cleanup, drivers keep sent mbufs until the queue
+     * fills up, and acked tx buffer space would never be released */
+    if (config.fp_tx_zerocopy &&
+        rte_eth_tx_done_cleanup(net_port_id, t->queue_id, 0) == -ENOTSUP)
+    {
+      fprintf(stderr, "Warning: NIC does not support tx done cleanup, "
+          "disabling zero-copy transmit.\n");
+      config.fp_tx_zerocopy = 0;
+    }
     start_done = 1;
   }
 
@@ -308,6 +482,18 @@ error_mpool:
   return -1;
 }
 
+unsigned network_rx_pending(struct network_thread *t)
+{
+  int ret;
+
+  /* not all drivers report the rx queue fill level */
+  ret = rte_eth_rx_queue_count(net_port_id, t->queue_id);
+  if (ret < 0 || ret > RX_DESCRIPTORS) {
+    return RX_DESCRIPTORS;
+  }
+  return ret;
+}
+
 int network_rx_interrupt_ctl(struct network_thread *t, int turnon)
 {
   if(turnon) {
@@ -317,14 +503,189 @@ int network_rx_interrupt_ctl(struct network_thread *t, int turnon)
   }
 }
 
-static struct rte_mempool *mempool_alloc(void)
+/* fix up checksums for a segment produced by GSO, the headers are copied
+ * from the super-segment. Only IPv4, IPv6 flows send super-segments only
+ * with TSO in the NIC. */
+static inline void gso_seg_xsums(struct rte_mbuf *mb)
+{
+  struct pkt_tcp *p = rte_pktmbuf_mtod(mb, struct pkt_tcp *);
+  uint16_t l3_paylen = f_beui16(p->ip.len) - sizeof(p->ip);
+  uint16_t phdr, xsum;
+  uint32_t sum;
+
+  phdr = network_ip_phdr_xsum(p->ip.src, p->ip.dest, IP_PROTO_TCP, l3_paylen);
+  p->ip.chksum = 0;
+  if (config.fp_xsumoffload) {
+    mb->ol_flags = PKT_TX_IPV4 | PKT_TX_IP_CKSUM | PKT_TX_TCP_CKSUM;
+    p->tcp.chksum = phdr;
+    return;
+  }
+
+  /* payload is spread over the chain */
+  mb->ol_flags = 0;
+  p->ip.chksum = rte_ipv4_cksum((void *) &p->ip);
+  p->tcp.chksum = 0;
+  rte_raw_cksum_mbuf(mb, offsetof(struct pkt_tcp, tcp), l3_paylen, &xsum);
+  sum = (uint32_t) xsum + phdr;
+  sum = (sum & 0xffff) + (sum >> 16);
+  xsum = ~sum;
+  p->tcp.chksum = (xsum == 0 ? 0xffff : xsum);
+}
+
+/* send frames of the last split super-segment, returns 0 once all are out */
+static inline int gso_flush(struct network_thread *t)
+{
+  uint16_t ret;
+
+  ret = rte_eth_tx_burst(net_port_id, t->queue_id,
+      t->gso_segs + t->gso_first, t->gso_num);
+  t->gso_first += ret;
+  t->gso_num -= ret;
+  return (t->gso_num == 0 ? 0 : -1);
+}
+
+int network_send_gso(struct network_thread *t, unsigned num,
+    struct network_buf_handle **bhs)
+{
+  struct rte_mbuf **mbs = (struct rte_mbuf **) bhs;
+  struct rte_mbuf **segs = t->gso_segs;
+  unsigned i = 0, j;
+  int n, k, ret;
+
+  /* frames of a previous super-segment go out first */
+  if (t->gso_num > 0 && gso_flush(t) != 0) {
+    return 0;
+  }
+
+  while (i < num) {
+    /* send run of regular packets as is */
+    for (j = i; j < num && !(mbs[j]->ol_flags & PKT_TX_TCP_SEG); j++);
+    if (j > i) {
+      ret = rte_eth_tx_burst(net_port_id, t->queue_id, mbs + i, j - i);
+      i += ret;
+      if (i < j) {
+        break;
+      }
+      continue;
+    }
+
+    /* split super-segment into frames of the flow's mss */
+    t->gso->gso_size = mbs[i]->l2_len + mbs[i]->l3_len + mbs[i]->l4_len +
+      mbs[i]->tso_segsz;
+    n = rte_gso_segment(mbs[i], t->gso, segs, NETWORK_GSO_MAX_SEGS);
+    if (n < 0) {
+      fprintf(stderr, "network_send_gso: rte_gso_segment failed\n");
+      rte_pktmbuf_free(mbs[i++]);
+      continue;
+    } else if (n == 0) {
+      /* too small to split */
+      segs[0] = mbs[i];
+      n = 1;
+    } else {
+#if RTE_VER_YEAR > 21 || (RTE_VER_YEAR == 21 && RTE_VER_MONTH >= 2)
+      /* segments hold references to the payload */
+      rte_pktmbuf_free(mbs[i]);
+#endif
+    }
+    i++;
+
+    for (k = 0; k < n; k++) {
+      gso_seg_xsums(segs[k]);
+    }
+
+    /* the super-segment is consumed, frames that do not fit into the tx
+     * queue stay queued here for the next send */
+    t->gso_first = 0;
+    t->gso_num = n;
+    if (gso_flush(t) != 0) {
+      break;
+    }
+  }
+
+  return i;
+}
+
+static void zc_free_cb(void *addr, void *opaque)
+{
+  struct network_zc_slot *s = opaque;
+  s->done = 1;
+}
+
+uint32_t network_zc_reclaim(struct network_thread *t)
+{
+  struct network_zc_slot *s;
+
+  if (t->zc_tail == t->zc_head) {
+    return t->zc_tail;
+  }
+
+  /* free mbufs of segments the NIC is done with, segments can complete out of
+   * order if they were freed before being sent */
+  rte_eth_tx_done_cleanup(net_port_id, t->queue_id, 0);
+  while (t->zc_tail != t->zc_head) {
+    s = &t->zc_slots[t->zc_tail % NETWORK_ZC_SLOTS];
+    if (!s->done) {
+      break;
+    }
+    t->zc_tail++;
+  }
+
+  return t->zc_tail;
+}
+
+static int zc_init(void)
+{
+#if RTE_VER_YEAR > 19 || (RTE_VER_YEAR == 19 && RTE_VER_MONTH >= 5)
+  size_t pgsz;
+
+  if (!config.fp_xsumoffload) {
+    fprintf(stderr, "zc_init: zero-copy transmit requires checksum "
+        "offload\n");
+    return -1;
+  }
+
+  if (!(eth_devinfo.tx_offload_capa & DEV_TX_OFFLOAD_MULTI_SEGS)) {
+    fprintf(stderr, "zc_init: NIC does not support multi-segment "
+        "transmits\n");
+    return -1;
+  }
+
+  /* buffer addresses are used as iovas */
+  if (rte_eal_iova_mode() != RTE_IOVA_VA) {
+    fprintf(stderr, "zc_init: zero-copy transmit requires iova va mode\n");
+    return -1;
+  }
+
+  pgsz = (config.fp_hugepages ? HUGE_PGSIZE : sysconf(_SC_PAGESIZE));
+  if (rte_extmem_register(tas_shm, config.shm_len, NULL, 0, pgsz) != 0) {
+    fprintf(stderr, "zc_init: rte_extmem_register failed (%d)\n", rte_errno);
+    return -1;
+  }
+
+  if (rte_dev_dma_map(eth_devinfo.device, tas_shm, (uintptr_t) tas_shm,
+        config.shm_len) != 0)
+  {
+    fprintf(stderr, "zc_init: rte_dev_dma_map failed (%d)\n", rte_errno);
+    return -1;
+  }
+
+  port_conf.txmode.offloads |= DEV_TX_OFFLOAD_MULTI_SEGS;
+  return 0;
+#else
+  fprintf(stderr, "zc_init: zero-copy transmit requires DPDK 19.05 or "
+      "newer\n");
+  return -1;
+#endif
+}
+
+static struct rte_mempool *mempool_alloc(unsigned num, size_t size)
 {
   static unsigned pool_id = 0;
   unsigned n;
   char name[32];
   n = __sync_fetch_and_add(&pool_id, 1);
   snprintf(name, 32, "mbuf_pool_%u\n", n);
-  return rte_mempool_create(name, PERTHREAD_MBUFS, MBUF_SIZE, 32,
+  return rte_mempool_create(name, num, size, 32,
           sizeof(struct rte_pktmbuf_pool_private), rte_pktmbuf_pool_init, NULL,
           rte_pktmbuf_init, NULL, rte_socket_id(), 0);
 
@@ -358,7 +719,7 @@ static inline uint16_t core_max(uint16_t num)
   return i_max;
 }
 
-int network_scale_up(uint16_t old, uint16_t new)
+int network_scale_up(uint16_t old, uint16_t new, uint8_t *steering)
 {
   uint16_t i, j, k, c, share = rss_reta_size / new;
   uint16_t outer, inner;
@@ -379,7 +740,7 @@ int network_scale_up(uint16_t old, uint16_t new)
         if (rss_reta[outer].reta[inner] == c) {
           rss_reta[outer].mask |= 1ULL << inner;
           rss_reta[outer].reta[inner] = j;
-          fp_state->flow_group_steering[k] = j;
+          steering[k] = j;
           break;
         }
       }
@@ -397,7 +758,7 @@ int network_scale_up(uint16_t old, uint16_t new)
   return 0;
 }
 
-int network_scale_down(uint16_t old, uint16_t new)
+int network_scale_down(uint16_t old, uint16_t new, uint8_t *steering)
 {
   uint16_t i, o_c, n_c, outer, inner;
 
@@ -417,7 +778,7 @@ int network_scale_down(uint16_t old, uint16_t new)
       rss_reta[outer].reta[inner] = n_c;
       rss_reta[outer].mask |= 1ULL << inner;
 
-      fp_state->flow_group_steering[i] = n_c;
+      steering[i] = n_c;
 
       rss_core_buckets[o_c]--;
       rss_core_buckets[n_c]++;
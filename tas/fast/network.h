@@ -32,18 +32,39 @@
 #include <rte_mbuf.h>
 #include <rte_ip.h>
 
+#include <utils.h>
 #include <fastpath.h>
 
 struct network_buf_handle;
 
+/** Zero-copy payload segments per thread */
+#define NETWORK_ZC_SLOTS 1024
+/** Maximum number of frames a super-segment is split into in software */
+#define NETWORK_GSO_MAX_SEGS 64
+
+struct network_zc_slot {
+  /** Shared info of the external buffer, free callback marks slot done */
+  struct rte_mbuf_ext_shared_info shinfo;
+  volatile uint8_t done;
+};
+
 extern uint8_t net_port_id;
 extern uint16_t rss_reta_size;
+/** NIC splits super-segments (TSO), otherwise GSO in software (IPv4 only) */
+extern int network_tso_hw;
 
 int network_thread_init(struct dataplane_context *ctx);
 int network_rx_interrupt_ctl(struct network_thread *t, int turnon);
+int network_send_gso(struct network_thread *t, unsigned num,
+    struct network_buf_handle **bhs);
+uint32_t network_zc_reclaim(struct network_thread *t);
+/* Upper bound on packets currently queued in the thread's rx queue. */
+unsigned network_rx_pending(struct network_thread *t);
 
-int network_scale_up(uint16_t old, uint16_t new);
-int network_scale_down(uint16_t old, uint16_t new);
+/* Move flow groups to cores [0, new), updates the NIC's redirection table and
+ * records the new core for moved groups in `steering`. */
+int network_scale_up(uint16_t old, uint16_t new, uint8_t *steering);
+int network_scale_down(uint16_t old, uint16_t new, uint8_t *steering);
 
 
 static inline void network_buf_reset(struct network_buf_handle *bh)
@@ -108,6 +129,13 @@ static inline int network_poll(struct network_thread *t, unsigned num,
   return num;
 }
 
+/* Number of frames of a split super-segment still waiting for room in the
+ * tx queue, these go out before anything passed to network_send. */
+static inline unsigned network_tx_pending(struct network_thread *t)
+{
+  return t->gso_num;
+}
+
 static inline int network_send(struct network_thread *t, unsigned num,
     struct network_buf_handle **bhs)
 {
@@ -121,6 +149,11 @@ static inline int network_send(struct network_thread *t, unsigned num,
   }
 #endif
 
+  /* super-segments need to be split in software */
+  if (UNLIKELY(t->gso != NULL)) {
+    return network_send_gso(t, num, bhs);
+  }
+
   return rte_eth_tx_burst(net_port_id, t->queue_id, mbs, num);
 }
 
@@ -145,6 +178,61 @@ static inline int network_buf_alloc(struct network_thread *t, unsigned num,
   return i;
 }
 
+static inline struct network_buf_handle *network_buf_alloc_tso(
+    struct network_thread *t)
+{
+  return (struct network_buf_handle *) rte_pktmbuf_alloc(t->tso_pool);
+}
+
+/** chain segment pointing to len bytes at buf to bh instead of copying, buf
+ * has to be in the registered shared memory region. fails if out of
+ * zero-copy segments or mbufs. */
+static inline int network_buf_extpayload(struct network_thread *t,
+    struct network_buf_handle *bh, void *buf, uint16_t len)
+{
+  struct rte_mbuf *mb = (struct rte_mbuf *) bh, *pl;
+  struct network_zc_slot *s;
+
+  if (t->zc_head - t->zc_tail >= NETWORK_ZC_SLOTS &&
+      t->zc_head - network_zc_reclaim(t) >= NETWORK_ZC_SLOTS)
+  {
+    return -1;
+  }
+
+  if ((pl = rte_pktmbuf_alloc(t->pool)) == NULL) {
+    return -1;
+  }
+
+  s = &t->zc_slots[t->zc_head++ % NETWORK_ZC_SLOTS];
+  s->done = 0;
+  rte_mbuf_ext_refcnt_set(&s->shinfo, 1);
+  rte_pktmbuf_attach_extbuf(pl, buf, (rte_iova_t) (uintptr_t) buf, len,
+      &s->shinfo);
+  pl->data_len = pl->pkt_len = len;
+
+  mb->next = pl;
+  mb->nb_segs = 2;
+  return 0;
+}
+
+/** set length of chained payload segment, header length has to be set */
+static inline void network_buf_extlen(struct network_buf_handle *bh,
+    uint16_t len)
+{
+  struct rte_mbuf *mb = (struct rte_mbuf *) bh;
+
+  if (len == 0) {
+    /* drivers do not like empty segments */
+    rte_pktmbuf_free_seg(mb->next);
+    mb->next = NULL;
+    mb->nb_segs = 1;
+    return;
+  }
+
+  mb->next->data_len = mb->next->pkt_len = len;
+  mb->pkt_len = mb->data_len + len;
+}
+
 static inline void network_free(unsigned num, struct network_buf_handle **bufs)
 {
   unsigned i;
@@ -172,20 +260,90 @@ static inline uint16_t network_ip_phdr_xsum(beui32_t ip_src, beui32_t ip_dst,
   return (uint16_t) sum;
 }
 
-static inline uint16_t network_buf_tcpxsums(struct network_buf_handle *bh, uint8_t l2l,
-    uint8_t l3l, void *ip_hdr, beui32_t ip_s, beui32_t ip_d, uint8_t ip_proto,
-    uint16_t l3_paylen)
+/** calculate IPv6 pseudo header xsum */
+static inline uint16_t network_ip6_phdr_xsum(const ip6_addr_t *ip_src,
+    const ip6_addr_t *ip_dst, uint8_t proto, uint32_t l3_paylen)
+{
+  uint32_t sum = 0;
+  unsigned i;
+
+  for (i = 0; i < IP6_ADDR_LEN; i += 2) {
+    sum += ip_src->addr[i] | (ip_src->addr[i + 1] << 8);
+    sum += ip_dst->addr[i] | (ip_dst->addr[i + 1] << 8);
+  }
+  sum += ((uint16_t) proto) << 8;
+  sum += t_beui16(l3_paylen >> 16).x;
+  sum += t_beui16(l3_paylen & 0xffff).x;
+
+  sum = ((sum & 0xffff0000) >> 16) + (sum & 0xffff);
+  sum = ((sum & 0xffff0000) >> 16) + (sum & 0xffff);
+
+  return (uint16_t) sum;
+}
+
+/** request IP (IPv4 only) and TCP checksum offload for buffer, TCP checksum
+ * field must hold the pseudo header xsum */
+static inline void network_buf_xsumoffload(struct network_buf_handle *bh,
+    uint8_t l2l, uint8_t l3l, int ip6)
 {
   struct rte_mbuf * restrict mb = (struct rte_mbuf *) bh;
   mb->tx_offload = l2l | ((uint32_t) l3l << 7);
   /*mb->l2_len = l2l;
   mb->l3_len = l3l;
   mb->l4_len = 0;*/
-  mb->ol_flags = PKT_TX_IPV4 | PKT_TX_IP_CKSUM | PKT_TX_TCP_CKSUM;
+  mb->ol_flags = (ip6 ? PKT_TX_IPV6 : PKT_TX_IPV4 | PKT_TX_IP_CKSUM) |
+    PKT_TX_TCP_CKSUM;
+}
 
+static inline uint16_t network_buf_tcpxsums(struct network_buf_handle *bh, uint8_t l2l,
+    uint8_t l3l, void *ip_hdr, beui32_t ip_s, beui32_t ip_d, uint8_t ip_proto,
+    uint16_t l3_paylen)
+{
+  network_buf_xsumoffload(bh, l2l, l3l, 0);
   return network_ip_phdr_xsum(ip_s, ip_d, ip_proto, l3_paylen);
 }
 
+/** mark buffer as TCP super-segment to be split into mss sized segments, TCP
+ * checksum field must hold the pseudo header xsum without length */
+static inline void network_buf_tcptso(struct network_buf_handle *bh,
+    uint8_t l2l, uint8_t l3l, uint8_t l4l, uint16_t mss, int ip6)
+{
+  struct rte_mbuf * restrict mb = (struct rte_mbuf *) bh;
+  mb->l2_len = l2l;
+  mb->l3_len = l3l;
+  mb->l4_len = l4l;
+  mb->tso_segsz = mss;
+  mb->ol_flags = (ip6 ? PKT_TX_IPV6 : PKT_TX_IPV4 | PKT_TX_IP_CKSUM) |
+    PKT_TX_TCP_CKSUM | PKT_TX_TCP_SEG;
+}
+
+/* checksum verification by NIC for received buffer: 1 if IP (IPv4 only) and
+ * TCP checksums are good, -1 if either is bad, 0 if not verified */
+static inline int network_buf_rxxsum(struct network_buf_handle *bh, int ip6)
+{
+  struct rte_mbuf *mb = (struct rte_mbuf *) bh;
+  uint64_t ip = mb->ol_flags & PKT_RX_IP_CKSUM_MASK;
+  uint64_t l4 = mb->ol_flags & PKT_RX_L4_CKSUM_MASK;
+
+  if ((!ip6 && ip == PKT_RX_IP_CKSUM_BAD) || l4 == PKT_RX_L4_CKSUM_BAD) {
+    return -1;
+  }
+  return ((ip6 || ip == PKT_RX_IP_CKSUM_GOOD) && l4 == PKT_RX_L4_CKSUM_GOOD);
+}
+
+/* get RSS hash calculated by NIC, returns -1 if not available */
+static inline int network_buf_rsshash(struct network_buf_handle *bh,
+    uint32_t *hash)
+{
+  struct rte_mbuf *mb = (struct rte_mbuf *) bh;
+  if (!(mb->ol_flags & PKT_RX_RSS_HASH)) {
+    return -1;
+  }
+
+  *hash = mb->hash.rss;
+  return 0;
+}
+
 static inline int network_buf_flowgroup(struct network_buf_handle *bh,
     uint16_t *fg)
 {
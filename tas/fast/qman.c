@@ -36,6 +36,7 @@
 #include <rte_cycles.h>
 
 #include <utils.h>
+#include <tas.h>
 
 #include "internal.h"
 
@@ -43,6 +44,8 @@
 
 #define FLAG_INSKIPLIST 1
 #define FLAG_INNOLIMITL 2
+#define FLAG_INWHEEL 4
+#define FLAGS_ACTIVE (FLAG_INSKIPLIST | FLAG_INNOLIMITL | FLAG_INWHEEL)
 
 /** Skiplist: bits per level */
 #define SKIPLIST_BITS 3
@@ -53,6 +56,10 @@
 #define TIMESTAMP_BITS 32
 #define TIMESTAMP_MASK 0xFFFFFFFF
 
+/** Timing wheel: ticks wrap around with timestamps */
+#define WHEEL_TICK_MASK ((1U << (TIMESTAMP_BITS - QMAN_WHEEL_GRAN_SHIFT)) - 1)
+#define WHEEL_SLOT_MASK (QMAN_WHEEL_SLOTS - 1)
+
 /** Queue state */
 struct queue {
   /** Next pointers for levels in skip list */
@@ -65,11 +72,24 @@ struct queue {
   uint32_t avail;
   /** Maximum chunk size when de-queueing */
   uint16_t max_chunk;
-  /** Flags: FLAG_INSKIPLIST, FLAG_INNOLIMITL */
-  uint16_t flags;
+  /** Flags: FLAG_INSKIPLIST, FLAG_INNOLIMITL, FLAG_INWHEEL */
+  uint8_t flags : 4;
+  /** Traffic class, determines the queues of the thread the queue is in */
+  uint8_t tc : 4;
+  /** Application of the flow, for app and tenant rate limits */
+  uint8_t app;
 } __attribute__((packed));
 STATIC_ASSERT((sizeof(struct queue) == 32), queue_size);
 
+/** Transmit budget of an app or tenant group rate limit, shared by all cores */
+struct qman_class {
+  /** Real time stamp from which the class may send again */
+  volatile uint32_t next_ts;
+} __attribute__((aligned(64)));
+
+static struct qman_class app_classes[FLEXNIC_PL_APPST_NUM];
+static struct qman_class tenant_classes[FLEXNIC_PL_TENANT_NUM];
+
 
 /** Actually update queue state: must run on queue's home core */
 static inline void set_impl(struct qman_thread *t, uint32_t id, uint32_t rate,
@@ -77,17 +97,36 @@ static inline void set_impl(struct qman_thread *t, uint32_t id, uint32_t rate,
 
 /** Add queue to the no limit list */
 static inline void queue_activate_nolimit(struct qman_thread *t,
-    struct queue *q, uint32_t idx);
-static inline unsigned poll_nolimit(struct qman_thread *t, uint32_t cur_ts,
-    unsigned num, unsigned *q_ids, uint16_t *q_bytes);
+    struct qman_tc *c, struct queue *q, uint32_t idx);
+static inline unsigned poll_nolimit(struct qman_thread *t, struct qman_tc *c,
+    uint32_t cur_ts, unsigned num, unsigned *q_ids, uint16_t *q_bytes);
 
 /** Add queue to the skip list list */
 static inline void queue_activate_skiplist(struct qman_thread *t,
-    struct queue *q, uint32_t idx);
-static inline unsigned poll_skiplist(struct qman_thread *t, uint32_t cur_ts,
-    unsigned num, unsigned *q_ids, uint16_t *q_bytes);
+    struct qman_tc *c, struct queue *q, uint32_t idx);
+static inline unsigned poll_skiplist(struct qman_thread *t, struct qman_tc *c,
+    uint32_t cur_ts, unsigned num, unsigned *q_ids, uint16_t *q_bytes);
 static inline uint8_t queue_level(struct qman_thread *t);
 
+/** Add queue to the timing wheel */
+static inline void queue_activate_wheel(struct qman_thread *t,
+    struct qman_tc *c, struct queue *q, uint32_t idx);
+static inline unsigned poll_wheel(struct qman_thread *t, struct qman_tc *c,
+    uint32_t cur_ts, unsigned num, unsigned *q_ids, uint16_t *q_bytes);
+static inline int wheel_next_ts(struct qman_tc *c, uint32_t *ts);
+
+/** Poll queues of one traffic class */
+static inline unsigned poll_tc(struct qman_thread *t, struct qman_tc *c,
+    uint32_t cur_ts, unsigned num, unsigned *q_ids, uint16_t *q_bytes);
+
+/** App and tenant group rate limits */
+static inline void queue_flow_lookup(struct queue *q, uint32_t idx);
+static inline int queue_class_limited(struct queue *q);
+static inline void queue_class_charge(struct qman_thread *t, struct queue *q,
+    uint32_t bytes);
+static inline void queue_class_ts(struct qman_thread *t, struct queue *q);
+
+static inline void queue_clamp_ts(struct qman_thread *t, struct queue *q);
 static inline void queue_fire(struct qman_thread *t,
     struct queue *q, uint32_t idx, unsigned *q_id, uint16_t *q_bytes);
 static inline void queue_activate(struct qman_thread *t, struct queue *q,
@@ -101,7 +140,8 @@ static inline int64_t rel_time(uint32_t cur_ts, uint32_t ts_in);
 int qman_thread_init(struct dataplane_context *ctx)
 {
   struct qman_thread *t = &ctx->qman;
-  unsigned i;
+  struct qman_tc *c;
+  unsigned i, j, k;
 
   if ((t->queues = calloc(1, sizeof(*t->queues) * FLEXNIC_NUM_QMQUEUES))
       == NULL)
@@ -110,11 +150,28 @@ int qman_thread_init(struct dataplane_context *ctx)
     return -1;
   }
 
-  for (i = 0; i < QMAN_SKIPLIST_LEVELS; i++) {
-    t->head_idx[i] = IDXLIST_INVAL;
-  }
-  t->nolimit_head_idx = t->nolimit_tail_idx = IDXLIST_INVAL;
   utils_rng_init(&t->rng, RNG_SEED * ctx->id + ctx->id);
+  t->wheel = (config.fp_qman == CONFIG_QMAN_WHEEL);
+
+  for (k = 0; k < FLEXNIC_PL_TC_NUM; k++) {
+    c = &t->tcs[k];
+    for (i = 0; i < QMAN_SKIPLIST_LEVELS; i++) {
+      c->head_idx[i] = IDXLIST_INVAL;
+    }
+    c->nolimit_head_idx = c->nolimit_tail_idx = IDXLIST_INVAL;
+
+    c->wheel_tick = 0;
+    c->wheel_num = 0;
+    for (i = 0; i < QMAN_WHEEL_LEVELS; i++) {
+      for (j = 0; j < QMAN_WHEEL_SLOTS; j++) {
+        c->wheel_slots[i][j].head_idx = IDXLIST_INVAL;
+        c->wheel_slots[i][j].tail_idx = IDXLIST_INVAL;
+      }
+      for (j = 0; j < QMAN_WHEEL_SLOTS / 64; j++) {
+        c->wheel_bitmap[i][j] = 0;
+      }
+    }
+  }
 
   t->ts_virtual = 0;
   t->ts_real = timestamp();
@@ -138,47 +195,67 @@ uint32_t qman_next_ts(struct qman_thread *t, uint32_t cur_ts)
 {
   uint32_t ts = timestamp();
   uint32_t ret_ts = t->ts_virtual + (ts - t->ts_real);
-
-  if(t->nolimit_head_idx != IDXLIST_INVAL) {
-    // Nolimit queue has work - immediate timeout
-    fprintf(stderr, "QMan nolimit has work\n");
-    return 0;
-  }
-
-  uint32_t idx = t->head_idx[0];
-  if(idx != IDXLIST_INVAL) {
-    struct queue *q = &t->queues[idx];
-
-    if(timestamp_lessthaneq(t, q->next_ts, ret_ts)) {
-      // Fired in the past - immediate timeout
+  uint32_t next_ts, min_ts = 0;
+  struct qman_tc *c;
+  int found = 0;
+  unsigned k;
+
+  for (k = 0; k < FLEXNIC_PL_TC_NUM; k++) {
+    c = &t->tcs[k];
+    if(c->nolimit_head_idx != IDXLIST_INVAL) {
+      // Nolimit queue has work - immediate timeout
+      fprintf(stderr, "QMan nolimit has work\n");
       return 0;
+    }
+
+    if (t->wheel) {
+      if (wheel_next_ts(c, &next_ts) != 0) {
+        // Wheel empty
+        continue;
+      }
     } else {
-      // Timeout in the future - return difference
-      return rel_time(ret_ts, q->next_ts) / 1000;
+      uint32_t idx = c->head_idx[0];
+      if (idx == IDXLIST_INVAL) {
+        // List empty
+        continue;
+      }
+      next_ts = t->queues[idx].next_ts;
+    }
+
+    if (!found || timestamp_lessthaneq(t, next_ts, min_ts)) {
+      min_ts = next_ts;
+      found = 1;
     }
   }
 
-  // List empty - no timeout
-  return -1;
+  if (!found) {
+    // All classes empty - no timeout
+    return -1;
+  }
+
+  if(timestamp_lessthaneq(t, min_ts, ret_ts)) {
+    // Fired in the past - immediate timeout
+    return 0;
+  } else {
+    // Timeout in the future - return difference
+    return rel_time(ret_ts, min_ts) / 1000;
+  }
 }
 
 int qman_poll(struct qman_thread *t, unsigned num, unsigned *q_ids,
     uint16_t *q_bytes)
 {
-  unsigned x, y;
+  unsigned x = 0;
+  int k;
   uint32_t ts = timestamp();
 
-  /* poll nolimit list and skiplist alternating the order between */
-  if (t->nolimit_first) {
-    x = poll_nolimit(t, ts, num, q_ids, q_bytes);
-    y = poll_skiplist(t, ts, num - x, q_ids + x, q_bytes + x);
-  } else {
-    x = poll_skiplist(t, ts, num, q_ids, q_bytes);
-    y = poll_nolimit(t, ts, num - x, q_ids + x, q_bytes + x);
+  /* strict priority: lower classes only get what higher classes leave */
+  for (k = FLEXNIC_PL_TC_NUM - 1; k >= 0 && x < num; k--) {
+    x += poll_tc(t, &t->tcs[k], ts, num - x, q_ids + x, q_bytes + x);
   }
   t->nolimit_first = !t->nolimit_first;
 
-  return x + y;
+  return x;
 }
 
 int qman_set(struct qman_thread *t, uint32_t id, uint32_t rate, uint32_t avail,
@@ -231,52 +308,81 @@ static void inline set_impl(struct qman_thread *t, uint32_t idx, uint32_t rate,
 
   dprintf("set_impl: t=%p q=%p idx=%u avail=%u rate=%u qflags=%x flags=%x\n", t, q, idx, q->avail, q->rate, q->flags, flags);
 
-  if (new_avail && q->avail > 0
-      && ((q->flags & (FLAG_INSKIPLIST | FLAG_INNOLIMITL)) == 0)) {
+  /* an active queue moves to its new class when it is dequeued next */
+  if ((flags & QMAN_SET_TC) != 0) {
+    queue_flow_lookup(q, idx);
+  }
+
+  if (new_avail && q->avail > 0 && (q->flags & FLAGS_ACTIVE) == 0) {
+    queue_flow_lookup(q, idx);
     queue_activate(t, q, idx);
   }
 }
 
+/** Poll queues of one traffic class: nolimit list and skiplist or wheel
+ * alternating the order between */
+static inline unsigned poll_tc(struct qman_thread *t, struct qman_tc *c,
+    uint32_t cur_ts, unsigned num, unsigned *q_ids, uint16_t *q_bytes)
+{
+  unsigned x, y;
+
+  if (t->nolimit_first) {
+    x = poll_nolimit(t, c, cur_ts, num, q_ids, q_bytes);
+    if (t->wheel)
+      y = poll_wheel(t, c, cur_ts, num - x, q_ids + x, q_bytes + x);
+    else
+      y = poll_skiplist(t, c, cur_ts, num - x, q_ids + x, q_bytes + x);
+  } else {
+    if (t->wheel)
+      x = poll_wheel(t, c, cur_ts, num, q_ids, q_bytes);
+    else
+      x = poll_skiplist(t, c, cur_ts, num, q_ids, q_bytes);
+    y = poll_nolimit(t, c, cur_ts, num - x, q_ids + x, q_bytes + x);
+  }
+
+  return x + y;
+}
+
 /*****************************************************************************/
 /* Managing no-limit queues */
 
 /** Add queue to the no limit list */
 static inline void queue_activate_nolimit(struct qman_thread *t,
-    struct queue *q, uint32_t idx)
+    struct qman_tc *c, struct queue *q, uint32_t idx)
 {
   struct queue *q_tail;
 
-  assert((q->flags & (FLAG_INSKIPLIST | FLAG_INNOLIMITL)) == 0);
+  assert((q->flags & FLAGS_ACTIVE) == 0);
 
   dprintf("queue_activate_nolimit: t=%p q=%p avail=%u rate=%u flags=%x\n", t, q, q->avail, q->rate, q->flags);
 
   q->flags |= FLAG_INNOLIMITL;
   q->next_idxs[0] = IDXLIST_INVAL;
-  if (t->nolimit_tail_idx == IDXLIST_INVAL) {
-    t->nolimit_head_idx = t->nolimit_tail_idx = idx;
+  if (c->nolimit_tail_idx == IDXLIST_INVAL) {
+    c->nolimit_head_idx = c->nolimit_tail_idx = idx;
     return;
   }
 
-  q_tail = &t->queues[t->nolimit_tail_idx];
+  q_tail = &t->queues[c->nolimit_tail_idx];
   q_tail->next_idxs[0] = idx;
-  t->nolimit_tail_idx = idx;
+  c->nolimit_tail_idx = idx;
 }
 
 /** Poll no-limit queues */
-static inline unsigned poll_nolimit(struct qman_thread *t, uint32_t cur_ts,
-    unsigned num, unsigned *q_ids, uint16_t *q_bytes)
+static inline unsigned poll_nolimit(struct qman_thread *t, struct qman_tc *c,
+    uint32_t cur_ts, unsigned num, unsigned *q_ids, uint16_t *q_bytes)
 {
   unsigned cnt;
   struct queue *q;
   uint32_t idx;
 
-  for (cnt = 0; cnt < num && t->nolimit_head_idx != IDXLIST_INVAL;) {
-    idx = t->nolimit_head_idx;
+  for (cnt = 0; cnt < num && c->nolimit_head_idx != IDXLIST_INVAL;) {
+    idx = c->nolimit_head_idx;
     q = t->queues + idx;
 
-    t->nolimit_head_idx = q->next_idxs[0];
+    c->nolimit_head_idx = q->next_idxs[0];
     if (q->next_idxs[0] == IDXLIST_INVAL)
-      t->nolimit_tail_idx = IDXLIST_INVAL;
+      c->nolimit_tail_idx = IDXLIST_INVAL;
 
     q->flags &= ~FLAG_INNOLIMITL;
     dprintf("poll_nolimit: t=%p q=%p idx=%u avail=%u rate=%u flags=%x\n", t, q, idx, q->avail, q->rate, q->flags);
@@ -300,35 +406,25 @@ static inline uint32_t queue_new_ts(struct qman_thread *t, struct queue *q,
 
 /** Add queue to the skip list list */
 static inline void queue_activate_skiplist(struct qman_thread *t,
-    struct queue *q, uint32_t q_idx)
+    struct qman_tc *c, struct queue *q, uint32_t q_idx)
 {
   uint8_t level;
   int8_t l;
   uint32_t preds[QMAN_SKIPLIST_LEVELS];
-  uint32_t pred, idx, ts, max_ts;
+  uint32_t pred, idx, ts;
 
-  assert((q->flags & (FLAG_INSKIPLIST | FLAG_INNOLIMITL)) == 0);
+  assert((q->flags & FLAGS_ACTIVE) == 0);
 
   dprintf("queue_activate_skiplist: t=%p q=%p idx=%u avail=%u rate=%u flags=%x ts_virt=%u next_ts=%u\n", t, q, q_idx, q->avail, q->rate, q->flags,
       t->ts_virtual, q->next_ts);
 
-  /* make sure queue has a reasonable next_ts:
-   *  - not in the past
-   *  - not more than if it just sent max_chunk at the current rate
-   */
+  queue_clamp_ts(t, q);
   ts = q->next_ts;
-  max_ts = queue_new_ts(t, q, q->max_chunk);
-  if (timestamp_lessthaneq(t, ts, t->ts_virtual)) {
-    ts = q->next_ts = t->ts_virtual;
-  } else if (!timestamp_lessthaneq(t, ts, max_ts)) {
-    ts = q->next_ts = max_ts;
-  }
-  q->next_ts = ts;
 
   /* find predecessors at all levels top-down */
   pred = IDXLIST_INVAL;
   for (l = QMAN_SKIPLIST_LEVELS - 1; l >= 0; l--) {
-    idx = (pred != IDXLIST_INVAL ? pred : t->head_idx[l]);
+    idx = (pred != IDXLIST_INVAL ? pred : c->head_idx[l]);
     while (idx != IDXLIST_INVAL &&
         timestamp_lessthaneq(t, t->queues[idx].next_ts, ts))
     {
@@ -353,8 +449,8 @@ static inline void queue_activate_skiplist(struct qman_thread *t,
         q->next_idxs[l] = t->queues[idx].next_idxs[l];
         t->queues[idx].next_idxs[l] = q_idx;
       } else {
-        q->next_idxs[l] = t->head_idx[l];
-        t->head_idx[l] = q_idx;
+        q->next_idxs[l] = c->head_idx[l];
+        c->head_idx[l] = q_idx;
       }
     }
   }
@@ -363,8 +459,8 @@ static inline void queue_activate_skiplist(struct qman_thread *t,
 }
 
 /** Poll skiplist queues */
-static inline unsigned poll_skiplist(struct qman_thread *t, uint32_t cur_ts,
-    unsigned num, unsigned *q_ids, uint16_t *q_bytes)
+static inline unsigned poll_skiplist(struct qman_thread *t, struct qman_tc *c,
+    uint32_t cur_ts, unsigned num, unsigned *q_ids, uint16_t *q_bytes)
 {
   unsigned cnt;
   uint32_t idx, max_vts;
@@ -375,7 +471,7 @@ static inline unsigned poll_skiplist(struct qman_thread *t, uint32_t cur_ts,
   max_vts = t->ts_virtual + (cur_ts - t->ts_real);
 
   for (cnt = 0; cnt < num;) {
-    idx = t->head_idx[0];
+    idx = c->head_idx[0];
 
     /* no more queues */
     if (idx == IDXLIST_INVAL) {
@@ -394,14 +490,16 @@ static inline unsigned poll_skiplist(struct qman_thread *t, uint32_t cur_ts,
     }
 
     /* remove queue from skiplist */
-    for (l = 0; l < QMAN_SKIPLIST_LEVELS && t->head_idx[l] == idx; l++) {
-      t->head_idx[l] = q->next_idxs[l];
+    for (l = 0; l < QMAN_SKIPLIST_LEVELS && c->head_idx[l] == idx; l++) {
+      c->head_idx[l] = q->next_idxs[l];
     }
     assert((q->flags & FLAG_INSKIPLIST) != 0);
     q->flags &= ~FLAG_INSKIPLIST;
 
-    /* advance virtual timestamp */
-    t->ts_virtual = q->next_ts;
+    /* advance virtual timestamp, a lower class polled after a higher one
+     * may have queues due before the current virtual time */
+    if (timestamp_lessthaneq(t, t->ts_virtual, q->next_ts))
+      t->ts_virtual = q->next_ts;
 
     dprintf("poll_skiplist: t=%p q=%p idx=%u avail=%u rate=%u flags=%x\n", t, q, idx, q->avail, q->rate, q->flags);
 
@@ -413,11 +511,12 @@ static inline unsigned poll_skiplist(struct qman_thread *t, uint32_t cur_ts,
 
   /* if we reached the limit, update the virtual timestamp correctly */
   if (cnt == num) {
-    idx = t->head_idx[0];
+    idx = c->head_idx[0];
     if (idx != IDXLIST_INVAL &&
         timestamp_lessthaneq(t, t->queues[idx].next_ts, max_vts))
     {
-      t->ts_virtual = t->queues[idx].next_ts;
+      if (timestamp_lessthaneq(t, t->ts_virtual, t->queues[idx].next_ts))
+        t->ts_virtual = t->queues[idx].next_ts;
     } else {
       t->ts_virtual = max_vts;
     }
@@ -435,6 +534,354 @@ static inline uint8_t queue_level(struct qman_thread *t)
 }
 
 /*****************************************************************************/
+/* Managing timing wheel queues */
+
+/*
+ * Hierarchical timing wheel keyed on next_ts: level 0 has one slot per tick
+ * for the next QMAN_WHEEL_SLOTS ticks, each higher level one slot per round of
+ * the level below. Queues in higher levels are moved down when the current
+ * tick reaches the start of their slot's round. Queues in one level 0 slot
+ * are served in FIFO order, so rate limits are enforced at tick granularity.
+ */
+
+static inline uint32_t wheel_tick(uint32_t ts)
+{
+  return ts >> QMAN_WHEEL_GRAN_SHIFT;
+}
+
+/** Append queue to slot list */
+static inline void wheel_slot_push(struct qman_thread *t, struct qman_tc *c,
+    unsigned l, unsigned s, struct queue *q, uint32_t idx)
+{
+  struct qman_wheel_slot *ws = &c->wheel_slots[l][s];
+
+  q->next_idxs[0] = IDXLIST_INVAL;
+  if (ws->head_idx == IDXLIST_INVAL) {
+    ws->head_idx = ws->tail_idx = idx;
+    c->wheel_bitmap[l][s / 64] |= 1ULL << (s % 64);
+  } else {
+    t->queues[ws->tail_idx].next_idxs[0] = idx;
+    ws->tail_idx = idx;
+  }
+}
+
+/** Insert queue in the lowest level covering its next_ts, queues due at or
+ * before the current tick go into the current level 0 slot */
+static inline void wheel_insert(struct qman_thread *t, struct qman_tc *c,
+    struct queue *q, uint32_t idx)
+{
+  uint32_t expires = wheel_tick(q->next_ts);
+  uint32_t delta = (expires - c->wheel_tick) & WHEEL_TICK_MASK;
+  unsigned l = 0, sh;
+
+  /* next_ts clamped to a virtual time behind the current tick */
+  if (delta > (WHEEL_TICK_MASK >> 1)) {
+    expires = c->wheel_tick;
+    delta = 0;
+  }
+
+  /* level l > 0 only holds queues due in one of the next QMAN_WHEEL_SLOTS - 1
+   * rounds of level l - 1, so the slot is reached before it wraps around */
+  if (delta >= QMAN_WHEEL_SLOTS) {
+    for (l = 1; l < QMAN_WHEEL_LEVELS - 1; l++) {
+      sh = QMAN_WHEEL_BITS * l;
+      if ((((expires >> sh) - (c->wheel_tick >> sh)) & (WHEEL_TICK_MASK >> sh))
+          < QMAN_WHEEL_SLOTS)
+        break;
+    }
+  }
+
+  wheel_slot_push(t, c, l, (expires >> (QMAN_WHEEL_BITS * l)) & WHEEL_SLOT_MASK,
+      q, idx);
+}
+
+/** Re-insert queues in slot `s` of level `l` into lower levels */
+static inline void wheel_cascade(struct qman_thread *t, struct qman_tc *c,
+    unsigned l, unsigned s)
+{
+  struct qman_wheel_slot *ws = &c->wheel_slots[l][s];
+  uint32_t idx, next;
+
+  if (ws->head_idx == IDXLIST_INVAL)
+    return;
+
+  idx = ws->head_idx;
+  ws->head_idx = ws->tail_idx = IDXLIST_INVAL;
+  c->wheel_bitmap[l][s / 64] &= ~(1ULL << (s % 64));
+
+  for (; idx != IDXLIST_INVAL; idx = next) {
+    next = t->queues[idx].next_idxs[0];
+    wheel_insert(t, c, &t->queues[idx], idx);
+  }
+}
+
+/** Advance current tick by `n` ticks, without crossing the end of the
+ * current level 0 round except with the last tick */
+static inline void wheel_advance(struct qman_thread *t, struct qman_tc *c,
+    uint32_t n)
+{
+  uint32_t tick;
+  unsigned l;
+
+  tick = c->wheel_tick = (c->wheel_tick + n) & WHEEL_TICK_MASK;
+
+  /* at the start of a round, move queues down from higher levels */
+  for (l = 1; l < QMAN_WHEEL_LEVELS &&
+      (tick & ((1U << (QMAN_WHEEL_BITS * l)) - 1)) == 0; l++);
+  while (--l > 0) {
+    wheel_cascade(t, c, l, (tick >> (QMAN_WHEEL_BITS * l)) & WHEEL_SLOT_MASK);
+  }
+}
+
+/** First non-empty level 0 slot from `s` to the end of the round, or -1 */
+static inline int wheel_next_slot(struct qman_tc *c, unsigned s)
+{
+  unsigned w = s / 64;
+  uint64_t m;
+
+  if (s >= QMAN_WHEEL_SLOTS)
+    return -1;
+
+  m = c->wheel_bitmap[0][w] & (~0ULL << (s % 64));
+  while (m == 0) {
+    if (++w == QMAN_WHEEL_SLOTS / 64)
+      return -1;
+    m = c->wheel_bitmap[0][w];
+  }
+  return w * 64 + __builtin_ctzll(m);
+}
+
+/** Earliest time a queue in the wheel might be due, returns -1 if empty */
+static inline int wheel_next_ts(struct qman_tc *c, uint32_t *ts)
+{
+  unsigned l, w, s = c->wheel_tick & WHEEL_SLOT_MASK;
+  int next;
+
+  next = wheel_next_slot(c, s);
+  if (next >= 0) {
+    *ts = ((c->wheel_tick + next - s) & WHEEL_TICK_MASK) <<
+      QMAN_WHEEL_GRAN_SHIFT;
+    return 0;
+  }
+
+  /* everything else is due in the next round or later */
+  for (l = 0; l < QMAN_WHEEL_LEVELS; l++) {
+    for (w = 0; w < QMAN_WHEEL_SLOTS / 64; w++) {
+      if (c->wheel_bitmap[l][w] != 0) {
+        *ts = ((c->wheel_tick + QMAN_WHEEL_SLOTS - s) & WHEEL_TICK_MASK) <<
+          QMAN_WHEEL_GRAN_SHIFT;
+        return 0;
+      }
+    }
+  }
+  return -1;
+}
+
+/** Add queue to the timing wheel */
+static inline void queue_activate_wheel(struct qman_thread *t,
+    struct qman_tc *c, struct queue *q, uint32_t idx)
+{
+  assert((q->flags & FLAGS_ACTIVE) == 0);
+
+  dprintf("queue_activate_wheel: t=%p q=%p idx=%u avail=%u rate=%u flags=%x ts_virt=%u next_ts=%u\n", t, q, idx, q->avail, q->rate, q->flags,
+      t->ts_virtual, q->next_ts);
+
+  queue_clamp_ts(t, q);
+  wheel_insert(t, c, q, idx);
+  c->wheel_num++;
+  q->flags |= FLAG_INWHEEL;
+}
+
+/** Poll timing wheel queues */
+static inline unsigned poll_wheel(struct qman_thread *t, struct qman_tc *c,
+    uint32_t cur_ts, unsigned num, unsigned *q_ids, uint16_t *q_bytes)
+{
+  unsigned cnt = 0, s;
+  uint32_t idx, vts, max_vts, target, rem, n;
+  int next;
+  struct qman_wheel_slot *ws;
+  struct queue *q;
+
+  /* maximum virtual time stamp that can be reached */
+  max_vts = t->ts_virtual + (cur_ts - t->ts_real);
+  target = wheel_tick(max_vts);
+
+  /* nothing to cascade in an empty wheel, e.g. for a class that was not
+   * polled while higher classes used up the budget */
+  if (c->wheel_num == 0) {
+    c->wheel_tick = target;
+  }
+
+  while (1) {
+    s = c->wheel_tick & WHEEL_SLOT_MASK;
+    ws = &c->wheel_slots[0][s];
+
+    /* fire queues due in the current tick, queues re-inserted into the
+     * current tick are fired again */
+    while (cnt < num && ws->head_idx != IDXLIST_INVAL) {
+      idx = ws->head_idx;
+      q = &t->queues[idx];
+      ws->head_idx = q->next_idxs[0];
+      if (ws->head_idx == IDXLIST_INVAL) {
+        ws->tail_idx = IDXLIST_INVAL;
+        c->wheel_bitmap[0][s / 64] &= ~(1ULL << (s % 64));
+      }
+
+      assert((q->flags & FLAG_INWHEEL) != 0);
+      q->flags &= ~FLAG_INWHEEL;
+      c->wheel_num--;
+
+      /* advance virtual timestamp, but not beyond max_vts for queues due
+       * later in the current tick */
+      vts = (timestamp_lessthaneq(t, q->next_ts, max_vts) ? q->next_ts :
+          max_vts);
+      if (timestamp_lessthaneq(t, t->ts_virtual, vts))
+        t->ts_virtual = vts;
+
+      dprintf("poll_wheel: t=%p q=%p idx=%u avail=%u rate=%u flags=%x\n", t, q, idx, q->avail, q->rate, q->flags);
+
+      if (q->avail > 0) {
+        queue_fire(t, q, idx, q_ids + cnt, q_bytes + cnt);
+        cnt++;
+      }
+    }
+
+    /* stop at queues left in the current tick, even without budget move
+     * the wheel over empty slots up to them */
+    if (ws->head_idx != IDXLIST_INVAL || c->wheel_tick == target)
+      break;
+
+    /* skip empty slots, but stop at the end of the round to move down queues
+     * from higher levels */
+    rem = (target - c->wheel_tick) & WHEEL_TICK_MASK;
+    next = wheel_next_slot(c, s + 1);
+    n = (next >= 0 ? next - s : QMAN_WHEEL_SLOTS - s);
+    wheel_advance(t, c, MIN(n, rem));
+  }
+
+  /* advance virtual timestamp up to the queues left in the current tick, or
+   * catch up with real time, also if higher classes used up the budget. The
+   * virtual time never stays behind the current tick. */
+  if (ws->head_idx != IDXLIST_INVAL) {
+    vts = c->wheel_tick << QMAN_WHEEL_GRAN_SHIFT;
+  } else {
+    vts = max_vts;
+  }
+  if (timestamp_lessthaneq(t, t->ts_virtual, vts))
+    t->ts_virtual = vts;
+
+  t->ts_real = cur_ts;
+  return cnt;
+}
+
+/*****************************************************************************/
+
+/** Make sure queue has a reasonable next_ts:
+ *  - not in the past
+ *  - not more than if it just sent max_chunk at the current rate
+ *  - not before app and tenant group rate limits allow
+ */
+static inline void queue_clamp_ts(struct qman_thread *t, struct queue *q)
+{
+  uint32_t max_ts;
+
+  if (q->rate == 0) {
+    /* only limited by app or tenant group */
+    q->next_ts = t->ts_virtual;
+  } else {
+    max_ts = queue_new_ts(t, q, q->max_chunk);
+    if (timestamp_lessthaneq(t, q->next_ts, t->ts_virtual)) {
+      q->next_ts = t->ts_virtual;
+    } else if (!timestamp_lessthaneq(t, q->next_ts, max_ts)) {
+      q->next_ts = max_ts;
+    }
+  }
+
+  queue_class_ts(t, q);
+}
+
+/*****************************************************************************/
+/* App and tenant group rate limits */
+
+/*
+ * Each app and tenant group with a rate limit has a real time stamp shared by
+ * all cores, advanced by the transmit time at the limit for every chunk sent
+ * by one of its queues. Queues are not scheduled before the time stamps of
+ * their app and tenant group, in addition to their own rate.
+ */
+
+/** Look up app and traffic class of the flow of a queue */
+static inline void queue_flow_lookup(struct queue *q, uint32_t idx)
+{
+  q->app = fp_state->appctx[0][fp_state->flowst[idx].db_id].appst_id;
+  q->tc = fp_state->flowst[idx].tc;
+}
+
+/** Check whether app or tenant group of queue are rate limited */
+static inline int queue_class_limited(struct queue *q)
+{
+  struct flextcp_pl_appst *ast = &fp_state->appst[q->app];
+  return ast->tx_rate != 0 || fp_state->tenants[ast->tenant].tx_rate != 0;
+}
+
+/** Charge `bytes' sent at real time `now' to class */
+static inline void class_charge(struct qman_class *c, uint32_t rate,
+    uint32_t now, uint32_t bytes)
+{
+  uint32_t old, next;
+
+  do {
+    old = c->next_ts;
+    next = (rel_time(now, old) <= 0 ? now : old) +
+      ((uint64_t) bytes * 8 * 1000000) / rate;
+  } while (!__sync_bool_compare_and_swap(&c->next_ts, old, next));
+}
+
+/** Charge bytes sent by queue to its app and tenant group */
+static inline void queue_class_charge(struct qman_thread *t, struct queue *q,
+    uint32_t bytes)
+{
+  struct flextcp_pl_appst *ast = &fp_state->appst[q->app];
+  uint16_t tenant = ast->tenant;
+  uint32_t rate;
+
+  if ((rate = ast->tx_rate) != 0) {
+    class_charge(&app_classes[q->app], rate, t->ts_real, bytes);
+  }
+  if ((rate = fp_state->tenants[tenant].tx_rate) != 0) {
+    class_charge(&tenant_classes[tenant], rate, t->ts_real, bytes);
+  }
+}
+
+/** Delay queue until real time stamp `ts' */
+static inline void queue_delay(struct qman_thread *t, struct queue *q,
+    uint32_t ts)
+{
+  int64_t delay = rel_time(t->ts_real, ts);
+  uint32_t vts;
+
+  if (delay <= 0)
+    return;
+
+  vts = t->ts_virtual + delay;
+  if (timestamp_lessthaneq(t, q->next_ts, vts)) {
+    q->next_ts = vts;
+  }
+}
+
+/** Delay queue until its app and tenant group may send again */
+static inline void queue_class_ts(struct qman_thread *t, struct queue *q)
+{
+  struct flextcp_pl_appst *ast = &fp_state->appst[q->app];
+  uint16_t tenant = ast->tenant;
+
+  if (ast->tx_rate != 0) {
+    queue_delay(t, q, app_classes[q->app].next_ts);
+  }
+  if (fp_state->tenants[tenant].tx_rate != 0) {
+    queue_delay(t, q, tenant_classes[tenant].next_ts);
+  }
+}
 
 static inline void queue_fire(struct qman_thread *t,
     struct queue *q, uint32_t idx, unsigned *q_id, uint16_t *q_bytes)
@@ -450,6 +897,7 @@ static inline void queue_fire(struct qman_thread *t,
   if (q->rate > 0) {
     q->next_ts = queue_new_ts(t, q, bytes);
   }
+  queue_class_charge(t, q, bytes);
 
   if (q->avail > 0) {
     queue_activate(t, q, idx);
@@ -469,10 +917,14 @@ static inline void queue_fire(struct qman_thread *t,
 static inline void queue_activate(struct qman_thread *t, struct queue *q,
     uint32_t idx)
 {
-  if (q->rate == 0) {
-    queue_activate_nolimit(t, q, idx);
+  struct qman_tc *c = &t->tcs[q->tc];
+
+  if (q->rate == 0 && !queue_class_limited(q)) {
+    queue_activate_nolimit(t, c, q, idx);
+  } else if (t->wheel) {
+    queue_activate_wheel(t, c, q, idx);
   } else {
-    queue_activate_skiplist(t, q, idx);
+    queue_activate_skiplist(t, c, q, idx);
   }
 }
 
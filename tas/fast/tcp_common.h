@@ -30,6 +30,69 @@
 
 #define ALLOW_FUTURE_ACKS 1
 
+/**
+ * Received TCP packets are IPv4 (struct pkt_tcp) or IPv6 (struct pkt_tcp6)
+ * without IP options or extension headers. The following helpers access them
+ * through a struct pkt_tcp pointer.
+ */
+
+/** Check if packet is IPv6, based on the ethertype */
+static inline int pkt_ip6(const struct pkt_tcp *p)
+{
+  return f_beui16(p->eth.type) == ETH_TYPE_IPV6;
+}
+
+/** Length of Ethernet and IP headers */
+static inline uint16_t pkt_l3hdrs_len(const struct pkt_tcp *p)
+{
+  return (pkt_ip6(p) ? offsetof(struct pkt_tcp6, tcp) :
+      offsetof(struct pkt_tcp, tcp));
+}
+
+/** TCP header of packet */
+static inline struct tcp_hdr *pkt_tcph(const struct pkt_tcp *p)
+{
+  return (struct tcp_hdr *) ((uint8_t *) p + pkt_l3hdrs_len(p));
+}
+
+/** Length of TCP header and payload, from IP header */
+static inline uint16_t pkt_l4len(const struct pkt_tcp *p)
+{
+  if (pkt_ip6(p)) {
+    return f_beui16(((const struct pkt_tcp6 *) p)->ip6.len);
+  }
+  return f_beui16(p->ip.len) - sizeof(p->ip);
+}
+
+/** ECN codepoint from IP header */
+static inline uint8_t pkt_ecn(const struct pkt_tcp *p)
+{
+  if (pkt_ip6(p)) {
+    return IP6H_ECN(&((const struct pkt_tcp6 *) p)->ip6);
+  }
+  return IPH_ECN(&p->ip);
+}
+
+/** Set IP length field for `l4len` bytes of TCP header and payload */
+static inline void pkt_l4len_set(struct pkt_tcp *p, uint16_t l4len)
+{
+  if (pkt_ip6(p)) {
+    ((struct pkt_tcp6 *) p)->ip6.len = t_beui16(l4len);
+  } else {
+    p->ip.len = t_beui16(l4len + sizeof(p->ip));
+  }
+}
+
+/** Set ECN codepoint in IP header, does not update the IPv4 checksum */
+static inline void pkt_ecn_set(struct pkt_tcp *p, uint8_t ecn)
+{
+  if (pkt_ip6(p)) {
+    IP6H_ECN_SET(&((struct pkt_tcp6 *) p)->ip6, ecn);
+  } else {
+    IPH_ECN_SET(&p->ip, ecn);
+  }
+}
+
 /**
  * Check if received packet with sequence number #pkt_seq and #pkt_bytes bytes
  * of payload should be processed or dropped.
@@ -228,6 +291,8 @@ static inline uint32_t tcp_txavail(const struct flextcp_pl_flowst *fs,
 struct tcp_opts {
   /** Timestamp option */
   struct tcp_timestamp_opt *ts;
+  /** SACK option */
+  struct tcp_sack_opt *sack;
 };
 
 /**
@@ -243,16 +308,19 @@ struct tcp_opts {
 static inline int tcp_parse_options(const struct pkt_tcp *p, uint16_t len,
     struct tcp_opts *opts)
 {
-  uint8_t *opt = (uint8_t *) (p + 1);
-  uint16_t opts_len = TCPH_HDRLEN(&p->tcp) * 4 - 20;
+  const struct tcp_hdr *th = pkt_tcph(p);
+  uint8_t *opt = (uint8_t *) (th + 1);
+  uint16_t opts_len = TCPH_HDRLEN(th) * 4 - 20;
+  uint16_t hdrs_len = pkt_l3hdrs_len(p) + sizeof(*th);
   uint16_t off = 0;
   uint8_t opt_kind, opt_len, opt_avail;
 
   opts->ts = NULL;
+  opts->sack = NULL;
 
   /* whole header not in buf */
-  if (TCPH_HDRLEN(&p->tcp) < 5 || opts_len > (len - sizeof(*p))) {
-    fprintf(stderr, "hlen=%u opts_len=%u len=%u so=%zu\n", TCPH_HDRLEN(&p->tcp), opts_len, len, sizeof(*p));
+  if (TCPH_HDRLEN(th) < 5 || len < hdrs_len || opts_len > len - hdrs_len) {
+    fprintf(stderr, "hlen=%u opts_len=%u len=%u so=%u\n", TCPH_HDRLEN(th), opts_len, len, hdrs_len);
     return -1;
   }
 
@@ -280,6 +348,15 @@ static inline int tcp_parse_options(const struct pkt_tcp *p, uint16_t len,
         }
 
         opts->ts = (struct tcp_timestamp_opt *) (opt + off);
+      } else if (opt_kind == TCP_OPT_SACK) {
+        if (opt_len > opt_avail || opt_len < 2 + sizeof(struct tcp_sack_block)
+            || (opt_len - 2) % sizeof(struct tcp_sack_block) != 0)
+        {
+          fprintf(stderr, "parse_options: sack opt_len=%u\n", opt_len);
+          return -1;
+        }
+
+        opts->sack = (struct tcp_sack_opt *) (opt + off);
       }
     }
     off += opt_len;
@@ -288,4 +365,60 @@ static inline int tcp_parse_options(const struct pkt_tcp *p, uint16_t len,
   return 0;
 }
 
+/**
+ * Parse TCP options, with a fast path for the common option layouts that only
+ * contain a timestamp: NOP,NOP,TS as sent by Linux, and TS followed by two
+ * bytes of padding as sent by TAS. Everything else is handed off to
+ * tcp_parse_options().
+ *
+ * @param p Pointer to packet
+ * @param len Packet length
+ * @param [out] opts Pointers to parsed options
+ *
+ * @return 0 if parsed successful, -1 otherwise.
+ */
+static inline int tcp_parse_options_fast(const struct pkt_tcp *p, uint16_t len,
+    struct tcp_opts *opts)
+{
+  const struct tcp_hdr *th = pkt_tcph(p);
+  const uint8_t *opt = (const uint8_t *) (th + 1);
+  uint32_t head, tail;
+
+  /* no options, flows without timestamps */
+  if (TCPH_HDRLEN(th) == 5) {
+    opts->ts = NULL;
+    opts->sack = NULL;
+    return 0;
+  }
+
+  if (LIKELY(TCPH_HDRLEN(th) == 8 &&
+        len >= pkt_l3hdrs_len(p) + sizeof(*th) + 12))
+  {
+    /* compare option kinds and lengths, ignore timestamp values */
+    memcpy(&head, opt, sizeof(head));
+    memcpy(&tail, opt + 8, sizeof(tail));
+
+    if (head == (TCP_OPT_NO_OP | (TCP_OPT_NO_OP << 8) |
+          (TCP_OPT_TIMESTAMP << 16) |
+          (sizeof(struct tcp_timestamp_opt) << 24)))
+    {
+      opts->ts = (struct tcp_timestamp_opt *) (opt + 2);
+      opts->sack = NULL;
+      return 0;
+    }
+
+    if ((head & 0xffff) == (TCP_OPT_TIMESTAMP |
+          (sizeof(struct tcp_timestamp_opt) << 8)) &&
+        ((tail >> 16) == 0 || (tail >> 16) ==
+         (TCP_OPT_NO_OP | (TCP_OPT_NO_OP << 8))))
+    {
+      opts->ts = (struct tcp_timestamp_opt *) opt;
+      opts->sack = NULL;
+      return 0;
+    }
+  }
+
+  return tcp_parse_options(p, len, opts);
+}
+
 #endif /* ndef TCP_COMMON_H_ */
@@ -27,6 +27,11 @@
 
 #include <stdint.h>
 
+/** Smallest IP MTU that can be configured */
+#define CONFIG_IP_MTU_MIN 576
+/** Largest IP MTU that can be configured (jumbo frames) */
+#define CONFIG_IP_MTU_MAX 9000
+
 /** Supported congestion control algorithms. */
 enum config_cc_algorithm {
   /** Window-based DCTCP */
@@ -39,6 +44,14 @@ enum config_cc_algorithm {
   CONFIG_CC_CONST_RATE,
 };
 
+/** Queue manager implementations for rate limited flows. */
+enum config_qman {
+  /** Skiplist ordered by transmit time */
+  CONFIG_QMAN_SKIPLIST,
+  /** Hierarchical timing wheel */
+  CONFIG_QMAN_WHEEL,
+};
+
 /** Struct containing the parsed configuration parameters */
 struct configuration {
   /* shared memory size */
@@ -67,12 +80,24 @@ struct configuration {
   uint32_t ip;
   /** IP prefix length for this host */
   uint8_t ip_prefix;
+  /** IPv6 address for this host, used if ip6_enabled is set */
+  uint8_t ip6[16];
+  /** IPv6 enabled (ip6 configured) */
+  uint8_t ip6_enabled;
+  /** IP MTU of the link, determines local MSS and buffer sizes */
+  uint32_t ip_mtu;
   /** List of routes */
   struct config_route *routes;
   /** Initial ARP timeout in [us] */
   uint32_t arp_to;
   /** Maximum ARP timeout [us] */
   uint32_t arp_to_max;
+  /** Default aggregate transmit rate limit of each app [kbps] (0 = none) */
+  uint32_t app_rate;
+  /** List of tenant group rate limits */
+  struct config_tenant_rate *tenant_rates;
+  /** List of tenant group assignments of apps by user id */
+  struct config_tenant_uid *tenant_uids;
   /** Congestion control algorithm */
   enum config_cc_algorithm cc_algorithm;
   /** CC: minimum delay between running control loop [us] */
@@ -127,6 +152,29 @@ struct configuration {
   uint32_t fp_poll_interval_tas;
   /** FP: polling interval for app */
   uint32_t fp_poll_interval_app;
+  /** FP: key flow lookup table on NIC RSS (toeplitz) hash */
+  uint32_t fp_rss_flowhash;
+  /** FP: full segments received before an ACK is sent (1 = no delay) */
+  uint32_t fp_delack_segs;
+  /** FP: coalesce contiguous segments of a flow within a receive batch */
+  uint32_t fp_gro;
+  /** FP: minimal payload copy size to socket buffers using non-temporal
+   * stores (0 = never) */
+  uint32_t fp_dma_stream_min;
+  /** FP: minimal payload copy size from socket buffers to prefetch ahead
+   * (0 = never) */
+  uint32_t fp_dma_prefetch_min;
+  /** FP: minimal payload copy size offloaded to a dma device (0 = never) */
+  uint32_t fp_dmadev_min;
+  /** FP: maximum payload sent as one super-segment, split by TSO or GSO
+   * (0 = single segments) */
+  uint32_t fp_tso_max;
+  /** FP: send payload straight from socket transmit buffers */
+  uint32_t fp_tx_zerocopy;
+  /** FP: verify checksums of received packets */
+  uint32_t fp_rx_xsum;
+  /** FP: queue manager for rate limited flows */
+  enum config_qman fp_qman;
   /** SP: kni interface name */
   char *kni_name;
   /** Ready signal fd */
@@ -151,6 +199,24 @@ struct config_route {
   struct config_route *next;
 };
 
+struct config_tenant_rate {
+  /** Tenant group */
+  uint16_t tenant;
+  /** Aggregate transmit rate limit [kbps] */
+  uint32_t rate;
+  /** Next pointer for tenant rate list */
+  struct config_tenant_rate *next;
+};
+
+struct config_tenant_uid {
+  /** User id apps run as */
+  uint32_t uid;
+  /** Tenant group for apps of this user */
+  uint16_t tenant;
+  /** Next pointer for tenant assignment list */
+  struct config_tenant_uid *next;
+};
+
 /**
  * Parse command line parameters to fill in configuration struct.
  *
@@ -36,30 +36,93 @@
 #define BATCH_SIZE 16
 #define BUFCACHE_SIZE 128
 #define TXBUF_SIZE (2 * BATCH_SIZE)
+#define ARX_CACHE_SIZE (2 * BATCH_SIZE)
+#define RX_DMA_BUFS (4 * BATCH_SIZE)
+#define TX_ZC_BUMPS 1024
+#define TX_ZC_DRAIN_ROUNDS 32
 
 
+struct rte_gso_ctx;
+struct network_zc_slot;
+
 struct network_thread {
   struct rte_mempool *pool;
+  /** Large buffers for transmit super-segments (NULL if disabled) */
+  struct rte_mempool *tso_pool;
+  /** Software segmentation context (NULL if NIC does TSO) */
+  struct rte_gso_ctx *gso;
+  /** Segments of the last split super-segment, not all sent yet */
+  struct rte_mbuf **gso_segs;
+  uint16_t gso_first;
+  uint16_t gso_num;
+  /** Zero-copy payload segments (NULL if disabled) */
+  struct network_zc_slot *zc_slots;
+  /** Zero-copy segments handed out */
+  uint32_t zc_head;
+  /** Zero-copy segments completed by the NIC, in order */
+  uint32_t zc_tail;
   uint16_t queue_id;
 };
 
+/** Transmit buffer space acked while zero-copy segments were in flight */
+struct tx_zc_bump {
+  uint64_t opaque;
+  uint32_t tx_bump;
+  /** Release once this many zero-copy segments completed on core */
+  uint32_t zc_head;
+  uint16_t db_id;
+  uint16_t core;
+};
+
 /** Skiplist: #levels */
 #define QMAN_SKIPLIST_LEVELS 4
 
+/** Timing wheel: number of levels, covering the 32-bit timestamp range */
+#define QMAN_WHEEL_LEVELS 3
+/** Timing wheel: bits per level */
+#define QMAN_WHEEL_BITS 8
+#define QMAN_WHEEL_SLOTS (1 << QMAN_WHEEL_BITS)
+/** Timing wheel: tick length in ns (log2) */
+#define QMAN_WHEEL_GRAN_SHIFT 10
+
+/** Timing wheel slot: list of queues */
+struct qman_wheel_slot {
+  uint32_t head_idx;
+  uint32_t tail_idx;
+};
+
+/** Queues of one traffic class */
+struct qman_tc {
+  uint32_t head_idx[QMAN_SKIPLIST_LEVELS];
+  uint32_t nolimit_head_idx;
+  uint32_t nolimit_tail_idx;
+
+  /** Timing wheel: tick up to which level 0 has been processed */
+  uint32_t wheel_tick;
+  /** Timing wheel: number of queues in wheel */
+  uint32_t wheel_num;
+  /** Timing wheel: bitmap of non-empty slots per level */
+  uint64_t wheel_bitmap[QMAN_WHEEL_LEVELS][QMAN_WHEEL_SLOTS / 64];
+  /** Timing wheel: slots per level */
+  struct qman_wheel_slot wheel_slots[QMAN_WHEEL_LEVELS][QMAN_WHEEL_SLOTS];
+};
+
 struct qman_thread {
   /************************************/
   /* read-only */
   struct queue *queues;
+  /** Rate limited queues are kept in timing wheel instead of skiplist */
+  bool wheel;
 
   /************************************/
   /* modified by owner thread */
-  uint32_t head_idx[QMAN_SKIPLIST_LEVELS];
-  uint32_t nolimit_head_idx;
-  uint32_t nolimit_tail_idx;
   uint32_t ts_real;
   uint32_t ts_virtual;
   struct utils_rng rng;
   bool nolimit_first;
+
+  /** Queues per traffic class, higher classes are polled first */
+  struct qman_tc tcs[FLEXNIC_PL_TC_NUM];
 };
 
 
@@ -67,24 +130,74 @@ struct dataplane_context {
   struct network_thread net;
   struct qman_thread qman;
   struct rte_ring *qman_fwd_ring;
+  /** Received segments of flows owned by this core, from other cores */
+  struct rte_ring *rx_fwd_ring;
+  /** App queue bumps for flows owned by this core, from other cores */
+  struct rte_ring *bump_fwd_ring;
+  /** Kernel flow requests for flows owned by this core, from other cores */
+  struct rte_ring *kernel_fwd_ring;
+  /** Last flow group handoff generation applied by this core */
+  volatile uint32_t handoff_gen;
+  /** Handoff generation this core started draining its rx queue for */
+  uint32_t handoff_drain_gen;
+  /** Received segments left to process before handing over moved groups */
+  uint16_t handoff_drain;
+  /** Forwarded segments left to process before handing over moved groups */
+  uint16_t handoff_fwd_drain;
   uint16_t id;
   int evfd;
   struct rte_epoll_event ev;
 
   /********************************************************/
-  /* arx cache */
-  struct flextcp_pl_arx arx_cache[BATCH_SIZE];
-  uint16_t arx_ctx[BATCH_SIZE];
+  /* arx cache, entries wait for the payload copies before them */
+  struct flextcp_pl_arx arx_cache[ARX_CACHE_SIZE];
+  uint16_t arx_ctx[ARX_CACHE_SIZE];
+  uint32_t arx_dma[ARX_CACHE_SIZE];
   uint16_t arx_num;
 
   /********************************************************/
-  /* send buffer */
+  /* received buffers freed once payload copies from them completed */
+  struct network_buf_handle *rx_dma_bufs[RX_DMA_BUFS];
+  uint32_t rx_dma_marks[RX_DMA_BUFS];
+  uint16_t rx_dma_first;
+  uint16_t rx_dma_num;
+
+  /********************************************************/
+  /* delayed acks: flows with pending ACK, and full segments received */
+  uint32_t ack_flows[BATCH_SIZE];
+  uint16_t ack_segs[BATCH_SIZE];
+  uint16_t ack_num;
+
+  /********************************************************/
+  /* tx buffer space released to applications once zero-copy segments
+   * referencing it completed */
+  struct tx_zc_bump tx_zc_bumps[TX_ZC_BUMPS];
+  uint16_t tx_zc_bump_first;
+  uint16_t tx_zc_bump_num;
+
+  /********************************************************/
+  /* forwarded queue entries of flows that moved on again, held in order
+   * until the ring of the new owner has room */
+  void *bump_fwd_hold[BATCH_SIZE];
+  uint16_t bump_fwd_held;
+  struct flextcp_pl_ktx *kernel_fwd_hold[BATCH_SIZE];
+  uint16_t kernel_fwd_held;
+
+  /********************************************************/
+  /* moved flows fired in queue manager, handed to owner after the poll */
+  struct flextcp_pl_flowst *qman_fwd_fss[BATCH_SIZE];
+  uint16_t qman_fwd_num;
+
+  /********************************************************/
+  /* send buffer, frames wait for the payload copies before them */
   struct network_buf_handle *tx_handles[TXBUF_SIZE];
+  uint32_t tx_dma[TXBUF_SIZE];
   uint16_t tx_num;
 
   /********************************************************/
   /* polling queues */
-  uint32_t poll_next_ctx;
+  /** Next context to poll per traffic class */
+  uint32_t poll_next_ctx[FLEXNIC_PL_TC_NUM];
 
   /********************************************************/
   /* pre-allocated buffers for polling doorbells and queue manager */
@@ -95,6 +208,20 @@ struct dataplane_context {
   uint64_t loadmon_cyc_busy;
 
   uint64_t kernel_drop;
+  /** received packets dropped for bad checksums */
+  uint64_t rx_xsum_drop;
+  /** received acks dropped because the deferred bump queue stayed full */
+  uint64_t rx_zc_drop;
+  /** received packets dropped because the owner's forwarding ring was full */
+  uint64_t rx_fwd_drop;
+  /** received packets forwarded to the owner of their flow */
+  uint64_t rx_fwd;
+  /** received packets processed while draining rx queue for a handoff */
+  uint64_t handoff_drained;
+  /** queue manager queues of moved flows handed to their owner */
+  uint64_t qman_fwd;
+  /** queue manager handoffs postponed because the owner's ring was full */
+  uint64_t qman_fwd_retry;
 #ifdef DATAPLANE_STATS
   /********************************************************/
   /* Stats */
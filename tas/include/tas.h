@@ -45,6 +45,11 @@ extern struct flexnic_info *tas_info;
 #endif
 extern unsigned fp_cores_max;
 
+/** Length of RSS key configured on the NIC */
+#define TAS_RSS_KEY_LEN 40
+/** RSS key used if flow lookup is keyed on the RSS hash */
+extern uint8_t rss_key[TAS_RSS_KEY_LEN];
+
 
 int slowpath_main(void);
 
@@ -73,7 +78,7 @@ int notify_canblock(struct notify_blockstate *nbs, int had_data, uint64_t tsc);
 void notify_canblock_reset(struct notify_blockstate *nbs);
 
 /* should become config options */
-#define FLEXNIC_INTERNAL_MEM_SIZE (1024 * 1024 * 32)
+#define FLEXNIC_INTERNAL_MEM_SIZE (1024 * 1024 * 64)
 #define FLEXNIC_NUM_QMQUEUES (128 * 1024)
 
 #endif /* ndef TAS_H_ */
@@ -42,6 +42,7 @@
  * #poll_to_ux to communicate with the main thread. The main thread then calls
  * into other modules to register the context with flexnic etc.
  */
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
@@ -73,6 +74,7 @@ static void uxsocket_notify(void);
 static void uxsocket_error(struct application *app);
 static void uxsocket_receive(struct application *app);
 static void uxsocket_notify_app(struct application *app);
+static int app_limit(struct application *app);
 
 /** Listening UX socket for applications to connect to */
 static int uxfd = -1;
@@ -143,13 +145,22 @@ unsigned appif_poll(void)
     app = (struct application *) (p - offsetof(struct application, nqe));
     app->next = applications;
     applications = app;
+
+    /* refuse applications we can not limit */
+    if (app_limit(app) != 0) {
+      fprintf(stderr, "appif_poll: applying rate limit failed\n");
+      uxsocket_error(app);
+    }
   }
 
   for (app = applications; app != NULL; app = app->next) {
-    /* register context with NIC */
+    /* register context with NIC, refused applications get none */
     if (app->need_reg_ctx != NULL) {
       ctx = app->need_reg_ctx;
       app->need_reg_ctx = NULL;
+      if (app->closed) {
+        continue;
+      }
 
       for (i = 0; i < tas_info->cores_num; i++) {
         rxq_offs[i] = app->resp->flexnic_qs[i].rxq_off;
@@ -288,6 +299,8 @@ static void uxsocket_accept(void)
   int cfd, *pfd;
   struct application *app;
   struct epoll_event ev;
+  struct ucred cred;
+  socklen_t cred_len = sizeof(cred);
   size_t sz;
   ssize_t tx;
   uint32_t off, j, n;
@@ -299,6 +312,13 @@ static void uxsocket_accept(void)
     return;
   }
 
+  /* rate limits are only changeable by privileged applications */
+  if (getsockopt(cfd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) != 0) {
+    perror("uxsocket_accept: getting peer credentials failed");
+    close(cfd);
+    return;
+  }
+
   struct iovec iov = {
     .iov_base = &tas_info->cores_num,
     .iov_len = sizeof(uint32_t),
@@ -401,6 +421,8 @@ static void uxsocket_accept(void)
   app->conns = NULL;
   app->listeners = NULL;
   app->id = app_id_next++;
+  app->uid = cred.uid;
+  app->privileged = (cred.uid == 0);
   nbqueue_enq(&ux_to_poll, &app->nqe);
 }
 
@@ -647,3 +669,24 @@ error_status:
 error_send:
     uxsocket_error(app);
 }
+
+/** Apply configured tenant group and rate limit to a new application,
+ * returns 0 on success and -1 on failure */
+static int app_limit(struct application *app)
+{
+  struct config_tenant_uid *tu;
+  uint16_t tenant = 0;
+
+  for (tu = config.tenant_uids; tu != NULL; tu = tu->next) {
+    if (tu->uid == app->uid) {
+      tenant = tu->tenant;
+      break;
+    }
+  }
+
+  if (tenant == 0 && config.app_rate == 0) {
+    return 0;
+  }
+
+  return nicif_app_setrate(app->id, tenant, config.app_rate);
+}
@@ -27,6 +27,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/types.h>
 
 #include "internal.h"
 #include <kernel_appif.h>
@@ -81,6 +82,10 @@ struct application {
 
   uint16_t id;
   volatile bool closed;
+  /** User id the application runs as */
+  uid_t uid;
+  /** Application may change rate limits (runs as root) */
+  bool privileged;
 };
 
 /**
@@ -29,6 +29,7 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <tas.h>
@@ -47,6 +48,14 @@ static int kin_accept_conn(struct application *app, struct app_context *ctx,
     volatile struct kernel_appout *kin, volatile struct kernel_appin *kout);
 static int kin_req_scale(struct application *app, struct app_context *ctx,
     volatile struct kernel_appout *kin, volatile struct kernel_appin *kout);
+static int kin_set_rate(struct application *app, struct app_context *ctx,
+    volatile struct kernel_appout *kin, volatile struct kernel_appin *kout);
+static int kin_conn_prio(struct application *app, struct app_context *ctx,
+    volatile struct kernel_appout *kin, volatile struct kernel_appin *kout);
+static int kin_ctx_prio(struct application *app, struct app_context *ctx,
+    volatile struct kernel_appout *kin, volatile struct kernel_appin *kout);
+static int kin_conn_rate(struct application *app, struct app_context *ctx,
+    volatile struct kernel_appout *kin, volatile struct kernel_appin *kout);
 
 static void appif_ctx_kick(struct app_context *ctx)
 {
@@ -78,7 +87,7 @@ void appif_conn_opened(struct connection *c, int status)
 
     kout->data.conn_opened.seq_rx = c->remote_seq;
     kout->data.conn_opened.seq_tx = c->local_seq;
-    kout->data.conn_opened.local_ip = config.ip;
+    kout->data.conn_opened.local_ip = c->local_ip;
     kout->data.conn_opened.local_port = c->local_port;
     kout->data.conn_opened.flow_id = c->flow_id;
     kout->data.conn_opened.fn_core = c->fn_core;
@@ -141,7 +150,7 @@ void appif_conn_closed(struct connection *c, int status)
 }
 
 void appif_listen_newconn(struct listener *l, uint32_t remote_ip,
-    uint16_t remote_port)
+    const ip6_addr_t *remote_ip6, uint16_t remote_port)
 {
   struct app_context *ctx = l->ctx;
   volatile struct kernel_appin *kout = ctx->kout_base;
@@ -158,6 +167,13 @@ void appif_listen_newconn(struct listener *l, uint32_t remote_ip,
   kout->data.listen_newconn.opaque = l->opaque;
   kout->data.listen_newconn.remote_ip = remote_ip;
   kout->data.listen_newconn.remote_port = remote_port;
+  if (remote_ip6 != NULL) {
+    kout->data.listen_newconn.flags = KERNEL_APPIN_NEWCONN_IP6;
+    memcpy((void *) kout->data.listen_newconn.remote_ip6, remote_ip6,
+        sizeof(kout->data.listen_newconn.remote_ip6));
+  } else {
+    kout->data.listen_newconn.flags = 0;
+  }
   MEM_BARRIER();
   kout->type = KERNEL_APPIN_LISTEN_NEWCONN;
   appif_ctx_kick(ctx);
@@ -195,7 +211,7 @@ void appif_accept_conn(struct connection *c, int status)
 
     kout->data.accept_connection.seq_rx = c->remote_seq;
     kout->data.accept_connection.seq_tx = c->local_seq;
-    kout->data.accept_connection.local_ip = config.ip;
+    kout->data.accept_connection.local_ip = c->local_ip;
     kout->data.accept_connection.remote_ip = c->remote_ip;
     kout->data.accept_connection.remote_port = c->remote_port;
     kout->data.accept_connection.flow_id = c->flow_id;
@@ -274,6 +290,26 @@ unsigned appif_ctx_poll(struct application *app, struct app_context *ctx)
       kout_inc += kin_req_scale(app, ctx, kin, kout);
       break;
 
+    case KERNEL_APPOUT_SET_RATE:
+      /* rate limit request */
+      kout_inc += kin_set_rate(app, ctx, kin, kout);
+      break;
+
+    case KERNEL_APPOUT_CONN_PRIO:
+      /* connection traffic class request */
+      kout_inc += kin_conn_prio(app, ctx, kin, kout);
+      break;
+
+    case KERNEL_APPOUT_CTX_PRIO:
+      /* context traffic class request */
+      kout_inc += kin_ctx_prio(app, ctx, kin, kout);
+      break;
+
+    case KERNEL_APPOUT_CONN_RATE:
+      /* connection pacing rate request */
+      kout_inc += kin_conn_rate(app, ctx, kin, kout);
+      break;
+
     case KERNEL_APPOUT_LISTEN_CLOSE:
     default:
       fprintf(stderr, "kin_poll: unsupported request type %u\n", kin->type);
@@ -306,9 +342,17 @@ static int kin_conn_open(struct application *app, struct app_context *ctx,
     volatile struct kernel_appout *kin, volatile struct kernel_appin *kout)
 {
   struct connection *conn;
+  ip6_addr_t ip6;
+  const ip6_addr_t *remote_ip6 = NULL;
+
+  if ((kin->data.conn_open.flags & KERNEL_APPOUT_OPEN_IP6) != 0) {
+    memcpy(&ip6, (const void *) kin->data.conn_open.remote_ip6, sizeof(ip6));
+    remote_ip6 = &ip6;
+  }
 
   if (tcp_open(ctx, kin->data.conn_open.opaque, kin->data.conn_open.remote_ip,
-      kin->data.conn_open.remote_port, ctx->doorbell->id, &conn) != 0)
+      remote_ip6, kin->data.conn_open.remote_port, ctx->doorbell->id,
+      &conn) != 0)
   {
     fprintf(stderr, "kin_conn_open: tcp_open failed\n");
     goto error;
@@ -364,7 +408,9 @@ static int kin_conn_move(struct application *app, struct app_context *ctx,
     goto error;
   }
 
-  if (nicif_connection_move(new_ctx->doorbell->id, conn->flow_id) != 0) {
+  if (nicif_connection_move(new_ctx->doorbell->id, conn->flow_id,
+        conn->flow_group) != 0)
+  {
     fprintf(stderr, "kin_conn_move: nicif_connection_move failed\n");
     goto error;
   }
@@ -498,3 +544,96 @@ static int kin_req_scale(struct application *app, struct app_context *ctx,
 
   return 0;
 }
+
+static int kin_set_rate(struct application *app, struct app_context *ctx,
+    volatile struct kernel_appout *kin, volatile struct kernel_appin *kout)
+{
+  uint32_t rate = kin->data.set_rate.rate;
+  uint16_t tenant = kin->data.set_rate.tenant;
+
+  /* otherwise any app could lift its own limits or starve other tenants */
+  if (!app->privileged) {
+    fprintf(stderr, "kin_set_rate: rate change from unprivileged app (%u) "
+        "rejected\n", app->id);
+    return 0;
+  }
+
+  if ((kin->data.set_rate.flags & KERNEL_APPOUT_RATE_TENANT) != 0) {
+    nicif_tenant_setrate(tenant, rate);
+  } else {
+    nicif_app_setrate(app->id, tenant, rate);
+  }
+
+  return 0;
+}
+
+static int kin_conn_prio(struct application *app, struct app_context *ctx,
+    volatile struct kernel_appout *kin, volatile struct kernel_appin *kout)
+{
+  struct connection *conn;
+
+  for (conn = app->conns; conn != NULL; conn = conn->app_next) {
+    if (conn->local_ip == kin->data.conn_prio.local_ip &&
+        conn->remote_ip == kin->data.conn_prio.remote_ip &&
+        conn->local_port == kin->data.conn_prio.local_port &&
+        conn->remote_port == kin->data.conn_prio.remote_port &&
+        conn->opaque == kin->data.conn_prio.opaque)
+    {
+      break;
+    }
+  }
+  if (conn == NULL) {
+    fprintf(stderr, "kin_conn_prio: connection not found\n");
+    return 0;
+  }
+
+  if (conn->status != CONN_OPEN) {
+    fprintf(stderr, "kin_conn_prio: connection not open\n");
+    return 0;
+  }
+
+  if (nicif_connection_settc(conn->flow_id, conn->flow_group,
+        kin->data.conn_prio.tc) != 0)
+  {
+    fprintf(stderr, "kin_conn_prio: nicif_connection_settc failed\n");
+  }
+
+  return 0;
+}
+
+static int kin_ctx_prio(struct application *app, struct app_context *ctx,
+    volatile struct kernel_appout *kin, volatile struct kernel_appin *kout)
+{
+  if (nicif_appctx_settc(ctx->doorbell->id, kin->data.ctx_prio.tc) != 0) {
+    fprintf(stderr, "kin_ctx_prio: nicif_appctx_settc failed\n");
+  }
+
+  return 0;
+}
+
+static int kin_conn_rate(struct application *app, struct app_context *ctx,
+    volatile struct kernel_appout *kin, volatile struct kernel_appin *kout)
+{
+  struct connection *conn;
+
+  for (conn = app->conns; conn != NULL; conn = conn->app_next) {
+    if (conn->local_ip == kin->data.conn_rate.local_ip &&
+        conn->remote_ip == kin->data.conn_rate.remote_ip &&
+        conn->local_port == kin->data.conn_rate.local_port &&
+        conn->remote_port == kin->data.conn_rate.remote_port &&
+        conn->opaque == kin->data.conn_rate.opaque)
+    {
+      break;
+    }
+  }
+  if (conn == NULL) {
+    fprintf(stderr, "kin_conn_rate: connection not found\n");
+    return 0;
+  }
+
+  if (cc_conn_setcap(conn, kin->data.conn_rate.rate) != 0) {
+    fprintf(stderr, "kin_conn_rate: cc_conn_setcap failed\n");
+  }
+
+  return 0;
+}
@@ -72,6 +72,12 @@ uint32_t cc_next_ts(uint32_t cur_ts)
     if (c->status != CONN_OPEN)
       continue;
 
+    /* rate update still needs to be sent */
+    if (c->cc_rate_dirty) {
+      ts = 0;
+      continue;
+    }
+
     int32_t next_ts = (c->cc_rtt * config.cc_control_interval) - (cur_ts - c->cc_last_ts);
     if(next_ts >= 0) {
       ts = MIN(ts, next_ts);
@@ -107,6 +113,13 @@ unsigned cc_poll(uint32_t cur_ts)
     if (c->status != CONN_OPEN)
       continue;
 
+    /* retry rate update that did not fit into the fast path queue */
+    if (c->cc_rate_dirty && nicif_connection_setrate(c->flow_id,
+          c->flow_group, cc_conn_rate(c)) == 0)
+    {
+      c->cc_rate_dirty = 0;
+    }
+
     if (cur_ts - c->cc_last_ts < c->cc_rtt * config.cc_control_interval)
       continue;
 
@@ -161,7 +174,8 @@ unsigned cc_poll(uint32_t cur_ts)
     }
 
     issue_retransmits(c, &stats, cur_ts);
-    nicif_connection_setrate(c->flow_id, c->cc_rate);
+    c->cc_rate_dirty = (nicif_connection_setrate(c->flow_id, c->flow_group,
+          cc_conn_rate(c)) != 0);
 
     c->cc_last_ts = cur_ts;
 
@@ -228,6 +242,31 @@ void cc_conn_remove(struct connection *conn)
   }
 }
 
+uint32_t cc_conn_rate(struct connection *conn)
+{
+  /* congestion rate 0 is unlimited */
+  if (conn->cc_rate_cap != 0 &&
+      (conn->cc_rate == 0 || conn->cc_rate_cap < conn->cc_rate))
+  {
+    return conn->cc_rate_cap;
+  }
+  return conn->cc_rate;
+}
+
+int cc_conn_setcap(struct connection *conn, uint32_t rate)
+{
+  conn->cc_rate_cap = rate;
+
+  /* otherwise applied when the flow is registered with the fast path */
+  if (conn->status != CONN_OPEN)
+    return 0;
+
+  /* fast path queue full: retried from cc_poll */
+  conn->cc_rate_dirty = (nicif_connection_setrate(conn->flow_id,
+        conn->flow_group, cc_conn_rate(conn)) != 0);
+  return 0;
+}
+
 static inline void issue_retransmits(struct connection *c,
     struct nicif_connection_stats *stats, uint32_t cur_ts)
 {
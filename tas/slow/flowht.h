@@ -0,0 +1,175 @@
+/*
+ * Copyright 2019 University of Washington, Max Planck Institute for
+ * Software Systems, and The University of Texas at Austin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FLOWHT_H_
+#define FLOWHT_H_
+
+/* Slow path side of the flow lookup table in fast path memory (see struct
+ * flextcp_pl_flowhtb), the fast path only reads it. */
+
+#include <assert.h>
+#include <stdio.h>
+
+#include <tas.h>
+#include <tas_memif.h>
+#include <utils.h>
+
+/** Maximal number of displacements when inserting into the flow table */
+#define FLOWHT_MAX_PATH 8
+/** Number of attempts to find a displacement path */
+#define FLOWHT_PATH_TRIES 16
+
+/* find empty slot in bucket, returns -1 if bucket is full */
+static inline int flow_bucket_free(struct flextcp_pl_flowhtb *bucket)
+{
+  uint32_t s;
+
+  for (s = 0; s < FLEXNIC_PL_FLOWHT_SLOTS; s++) {
+    if (bucket->tags[s] == 0) {
+      return s;
+    }
+  }
+  return -1;
+}
+
+/* move table entry to empty slot in its other bucket */
+static inline void flow_slot_move(uint32_t src_b, uint32_t src_s,
+    uint32_t dst_b, uint32_t dst_s)
+{
+  struct flextcp_pl_flowhtb *src = &fp_state->flowht[src_b],
+                            *dst = &fp_state->flowht[dst_b];
+
+  assert(dst->tags[dst_s] == 0);
+
+  /* mark both buckets as being modified */
+  src->version++;
+  if (src != dst)
+    dst->version++;
+  MEM_BARRIER();
+
+  /* write to empty entry first */
+  dst->flow_ids[dst_s] = src->flow_ids[src_s];
+  MEM_BARRIER();
+  dst->tags[dst_s] = src->tags[src_s];
+  MEM_BARRIER();
+
+  /* empty original position */
+  src->tags[src_s] = 0;
+  MEM_BARRIER();
+
+  src->version++;
+  if (src != dst)
+    dst->version++;
+}
+
+static inline int flow_slot_alloc(uint32_t h, uint32_t *pb, uint32_t *ps)
+{
+  uint32_t path_b[FLOWHT_MAX_PATH], path_s[FLOWHT_MAX_PATH];
+  uint32_t b, b_prim, b_alt, n, k, t, dst_b, dst_s;
+  uint16_t tag = FLEXNIC_PL_FLOWHT_TAG(h);
+  struct flextcp_pl_flowhtb *hte = fp_state->flowht;
+  static uint32_t victim = 0;
+  int s;
+
+  b_prim = FLEXNIC_PL_FLOWHT_BUCKET(h);
+  b_alt = FLEXNIC_PL_FLOWHT_ALTBUCKET(b_prim, tag);
+
+  /* look for empty slot in one of the two buckets */
+  if ((s = flow_bucket_free(&hte[b_prim])) >= 0) {
+    *pb = b_prim;
+    *ps = s;
+    return 0;
+  }
+  if ((s = flow_bucket_free(&hte[b_alt])) >= 0) {
+    *pb = b_alt;
+    *ps = s;
+    return 0;
+  }
+
+  /* both full: look for path of displacements ending in a bucket with an
+   * empty slot, without modifying the table yet */
+  for (t = 0; t < FLOWHT_PATH_TRIES; t++) {
+    b = (t % 2 == 0 ? b_prim : b_alt);
+
+    for (n = 0; n < FLOWHT_MAX_PATH; n++) {
+      path_b[n] = b;
+      path_s[n] = victim++ % FLEXNIC_PL_FLOWHT_SLOTS;
+
+      /* paths must not visit the same slot twice */
+      for (k = 0; k < n; k++) {
+        if (path_b[k] == path_b[n] && path_s[k] == path_s[n])
+          break;
+      }
+      if (k != n)
+        break;
+
+      b = FLEXNIC_PL_FLOWHT_ALTBUCKET(b, hte[b].tags[path_s[n]]);
+      if ((s = flow_bucket_free(&hte[b])) < 0)
+        continue;
+
+      /* found a path, move entries starting at the end so every entry is
+       * always reachable through one of its buckets */
+      dst_b = b;
+      dst_s = s;
+      for (k = n + 1; k > 0; k--) {
+        flow_slot_move(path_b[k - 1], path_s[k - 1], dst_b, dst_s);
+        dst_b = path_b[k - 1];
+        dst_s = path_s[k - 1];
+      }
+
+      *pb = dst_b;
+      *ps = dst_s;
+      return 0;
+    }
+  }
+
+  fprintf(stderr, "flow_slot_alloc: no empty slot found\n");
+  return -1;
+}
+
+static inline int flow_slot_clear(uint32_t f_id, uint32_t h)
+{
+  uint32_t b, i, s;
+  uint16_t tag;
+  struct flextcp_pl_flowhtb *bucket;
+
+  tag = FLEXNIC_PL_FLOWHT_TAG(h);
+  b = FLEXNIC_PL_FLOWHT_BUCKET(h);
+
+  for (i = 0; i < 2; i++) {
+    bucket = &fp_state->flowht[b];
+    for (s = 0; s < FLEXNIC_PL_FLOWHT_SLOTS; s++) {
+      if (bucket->tags[s] == tag && bucket->flow_ids[s] == f_id) {
+        bucket->tags[s] = 0;
+        return 0;
+      }
+    }
+    b = FLEXNIC_PL_FLOWHT_ALTBUCKET(b, tag);
+  }
+
+  fprintf(stderr, "flow_slot_clear: table entry not found\n");
+  return -1;
+}
+
+#endif // ndef FLOWHT_H_
@@ -71,6 +71,8 @@ struct kernel_statistics {
 enum timeout_type {
   /** ARP request */
   TO_ARP_REQ,
+  /** IPv6 neighbor solicitation */
+  TO_ND_REQ,
   /** TCP handshake sent */
   TO_TCP_HANDSHAKE,
   /** TCP retransmission timeout */
@@ -108,10 +110,47 @@ unsigned nicif_poll(void);
 int nicif_appctx_add(uint16_t appid, uint32_t db, uint64_t *rxq_base,
     uint32_t rxq_len, uint64_t *txq_base, uint32_t txq_len, int evfd);
 
+/**
+ * Set aggregate transmit rate limit of an application and assign it to a
+ * tenant group.
+ *
+ * @param appid  Application ID
+ * @param tenant Tenant group
+ * @param rate   Rate limit in kbps, 0 for no limit
+ *
+ * @return 0 on success, <0 else
+ */
+int nicif_app_setrate(uint16_t appid, uint16_t tenant, uint32_t rate);
+
+/**
+ * Set aggregate transmit rate limit of a tenant group.
+ *
+ * @param tenant Tenant group
+ * @param rate   Rate limit in kbps, 0 for no limit
+ *
+ * @return 0 on success, <0 else
+ */
+int nicif_tenant_setrate(uint16_t tenant, uint32_t rate);
+
+/**
+ * Set traffic class of an application context, also used for connections
+ * registered on the context from then on.
+ *
+ * @param db Doorbell ID of the context
+ * @param tc Traffic class, higher classes are served first
+ *
+ * @return 0 on success, <0 else
+ */
+int nicif_appctx_settc(uint32_t db, uint8_t tc);
+
 /** Flags for connections (used in nicif_connection_add()) */
 enum nicif_connection_flags {
   /** Enable ECN for connection. */
   NICIF_CONN_ECN        = (1 <<  2),
+  /** Enable SACK for connection. */
+  NICIF_CONN_SACK       = (1 <<  3),
+  /** Send and echo TCP timestamps on connection. */
+  NICIF_CONN_TS         = (1 <<  4),
 };
 
 /**
@@ -123,6 +162,8 @@ enum nicif_connection_flags {
  * @param port_local  Local port number
  * @param ip_remote   Remote IP address
  * @param port_remote Remote port number
+ * @param ip6         Addresses of an IPv6 flow, NULL for IPv4 (ip_local and
+ *                    ip_remote are ignored for IPv6)
  * @param rx_base     Base address of circular receive buffer
  * @param rx_len      Length of circular receive buffer
  * @param tx_base     Base address of circular transmit buffer
@@ -131,6 +172,9 @@ enum nicif_connection_flags {
  * @param local_seq   Next sequence number for transmission
  * @param app_opaque  Opaque value to pass in notificaitions
  * @param flags       See #nicif_connection_flags.
+ * @param rx_wscale   Window scale shift for windows received from remote host
+ * @param tx_wscale   Window scale shift for windows sent to remote host
+ * @param mss         Maximum segment payload (without TCP options)
  * @param rate        Congestion rate to set [Kbps]
  * @param fn_core     FlexNIC emulator core for the connection
  * @param flow_group  Flow group
@@ -140,15 +184,16 @@ enum nicif_connection_flags {
  */
 int nicif_connection_add(uint32_t db, uint64_t mac_remote, uint32_t ip_local,
     uint16_t port_local, uint32_t ip_remote, uint16_t port_remote,
-    uint64_t rx_base, uint32_t rx_len, uint64_t tx_base, uint32_t tx_len,
+    const struct flextcp_pl_flowip6 *ip6, uint64_t rx_base, uint32_t rx_len, uint64_t tx_base, uint32_t tx_len,
     uint32_t remote_seq, uint32_t local_seq, uint64_t app_opaque,
-    uint32_t flags, uint32_t rate, uint32_t fn_core, uint16_t flow_group,
-    uint32_t *pf_id);
+    uint32_t flags, uint8_t rx_wscale, uint8_t tx_wscale, uint16_t mss,
+    uint32_t rate, uint32_t fn_core, uint16_t flow_group, uint32_t *pf_id);
 
 /**
  * Disable connection fast path (mark as sp'd and remove from hash table).
  *
  * @param f_id      Flow state ID
+ * @param flow_group FlexNIC flow group
  * @param tx_seq    Pointer to return last transmit sequence number
  * @param rx_seq    Pointer to return last receive sequence number
  * @param tx_closed Pointer to return flag that tx stream is closed
@@ -156,8 +201,8 @@ int nicif_connection_add(uint32_t db, uint64_t mac_remote, uint32_t ip_local,
  *
  * @return 0 on success, <0 else
  */
-int nicif_connection_disable(uint32_t f_id, uint32_t *tx_seq, uint32_t *rx_seq,
-    int *tx_closed, int *rx_closed);
+int nicif_connection_disable(uint32_t f_id, uint16_t flow_group,
+    uint32_t *tx_seq, uint32_t *rx_seq, int *tx_closed, int *rx_closed);
 
 /**
  * Free flow state.
@@ -171,10 +216,12 @@ void nicif_connection_free(uint32_t f_id);
  *
  * @param dst_db  New doorbell ID
  * @param f_id    ID of flow to be moved
+ * @param flow_group FlexNIC flow group
  *
  * @return 0 on success, <0 else
  */
-int nicif_connection_move(uint32_t dst_db, uint32_t f_id);
+int nicif_connection_move(uint32_t dst_db, uint32_t f_id,
+    uint16_t flow_group);
 
 /**
  * Connection statistics for congestion control
@@ -210,11 +257,25 @@ int nicif_connection_stats(uint32_t f_id,
  * Set rate for flow.
  *
  * @param f_id  ID of flow
+ * @param flow_group FlexNIC flow group
  * @param rate  Rate to set [Kbps]
  *
  * @return 0 on success, <0 else
  */
-int nicif_connection_setrate(uint32_t f_id, uint32_t rate);
+int nicif_connection_setrate(uint32_t f_id, uint16_t flow_group,
+    uint32_t rate);
+
+/**
+ * Set traffic class for flow, takes effect the next time the flow is
+ * scheduled for transmission.
+ *
+ * @param f_id  ID of flow
+ * @param flow_group FlexNIC flow group
+ * @param tc    Traffic class, higher classes are served first
+ *
+ * @return 0 on success, <0 else
+ */
+int nicif_connection_settc(uint32_t f_id, uint16_t flow_group, uint8_t tc);
 
 /**
  * Mark flow for retransmit after timeout.
@@ -326,11 +387,12 @@ void appif_conn_closed(struct connection *c, int status);
  * Callback from TCP module: New connection request received on listener.
  *
  * @param l           Listener that received new connection
- * @param remote_ip   Remote IP address
+ * @param remote_ip   Remote IP address (0 for IPv6)
+ * @param remote_ip6  Remote IPv6 address, NULL for IPv4
  * @param remote_port Remote port
  */
 void appif_listen_newconn(struct listener *l, uint32_t remote_ip,
-    uint16_t remote_port);
+    const ip6_addr_t *remote_ip6, uint16_t remote_port);
 
 /**
  * Callback from tcp_accept(): Connection accepted.
@@ -353,7 +415,7 @@ void appif_accept_conn(struct connection *c, int status);
 enum connection_status {
   /** Accepted: waiting for a SYN. */
   CONN_SYN_WAIT,
-  /** Opening: waiting for ARP request. */
+  /** Opening: waiting for ARP or neighbor solicitation. */
   CONN_ARP_PENDING,
   /** Opening: SYN request sent. */
   CONN_SYN_SENT,
@@ -454,10 +516,14 @@ struct connection {
    */
     /** Peer MAC address for connection. */
     uint64_t remote_mac;
-    /** Peer IP address. */
+    /** Peer IP address, 0 for IPv6 connections. */
     uint32_t remote_ip;
-    /** Local IP to be used. */
+    /** Local IP to be used, 0 for IPv6 connections. */
     uint32_t local_ip;
+    /** Local and peer address of IPv6 connections. */
+    struct flextcp_pl_flowip6 ip6_addrs;
+    /** 1 for IPv6 connections. */
+    uint8_t ip6;
     /** Peer port number. */
     uint16_t remote_port;
     /** Local port number. */
@@ -476,6 +542,12 @@ struct connection {
     uint32_t local_seq;
     /** Timestamp received with SYN/SYN-ACK packet */
     uint32_t syn_ts;
+    /** Window scale shift received from peer, -1 if not offered. */
+    int8_t remote_wscale;
+    /** Window scale shift for our receive window. */
+    uint8_t local_wscale;
+    /** MSS received from peer, default if not offered. */
+    uint16_t remote_mss;
   /**@}*/
 
   /**
@@ -511,6 +583,10 @@ struct connection {
 
     /** Congestion rate limit. */
     uint32_t cc_rate;
+    /** Pacing rate cap set by application (kbps), 0 for none. */
+    uint32_t cc_rate_cap;
+    /** Rate update could not be sent to the fast path yet. */
+    uint8_t cc_rate_dirty;
     /** Had retransmits. */
     uint32_t cc_rexmits;
     /** Data for CC algorithm. */
@@ -604,6 +680,8 @@ void tcp_poll(void);
  * @param ctx         Application context
  * @param opaque      Opaque value passed from application
  * @param remote_ip   Remote IP address
+ * @param remote_ip6  Remote IPv6 address (on-link), NULL to connect to
+ *                    remote_ip
  * @param remote_port Remote port number
  * @param db_id       Doorbell ID to use for connection
  * @param conn        Pointer to location for storing pointer of created conn
@@ -612,7 +690,8 @@ void tcp_poll(void);
  * @return 0 on success, <0 else
  */
 int tcp_open(struct app_context *ctx, uint64_t opaque, uint32_t remote_ip,
-    uint16_t remote_port, uint32_t db_id, struct connection **conn);
+    const ip6_addr_t *remote_ip6, uint16_t remote_port, uint32_t db_id,
+    struct connection **conn);
 
 /**
  * Open a listener.
@@ -714,6 +793,28 @@ void cc_conn_init(struct connection *conn);
  */
 void cc_conn_remove(struct connection *conn);
 
+/**
+ * Rate to enforce for flow: congestion rate limited to the application's
+ * pacing rate cap. A congestion rate of 0 means unlimited, the cap still
+ * applies then.
+ *
+ * @param conn Connection
+ *
+ * @return Rate in kbps
+ */
+uint32_t cc_conn_rate(struct connection *conn);
+
+/**
+ * Set pacing rate cap for flow, takes effect immediately if the connection is
+ * open. If the fast path queue is full, the update is retried from cc_poll.
+ *
+ * @param conn Connection
+ * @param rate Rate cap in kbps, 0 for none
+ *
+ * @return 0 on success, <0 else
+ */
+int cc_conn_setcap(struct connection *conn, uint32_t rate);
+
 /** @} */
 
 /*****************************************************************************/
@@ -760,6 +861,55 @@ void arp_timeout(struct timeout *to, enum timeout_type type);
 
 /** @} */
 
+/*****************************************************************************/
+/**
+ * @addtogroup tas-sp-nd
+ * @brief IPv6 Neighbor Discovery
+ * @ingroup tas-sp
+ *
+ * Address resolution for on-link IPv6 peers, and answering solicitations for
+ * the local IPv6 address.
+ * @{ */
+
+/** Initialize neighbor discovery */
+int nd_init(void);
+
+/**
+ * Resolve IPv6 address to MAC address using neighbor solicitations.
+ *
+ * Like arp_request(), returns immediately on a cache hit, asynchronously
+ * otherwise.
+ *
+ * @param comp  Context for asynchronous return
+ * @param ip    IPv6 address to be resolved
+ * @param mac   Pointer of memory location where destination MAC should be
+ *              stored.
+ *
+ * @return 0 on success, < 0 on error, and > 0 if request was sent but response
+ *    is still pending.
+ */
+int nd_request(struct nicif_completion *comp, const ip6_addr_t *ip,
+    uint64_t *mac);
+
+/**
+ * RX processing for an ICMPv6 packet, ignores other than neighbor discovery
+ * messages.
+ *
+ * @param pkt Pointer to packet
+ * @param len Length of packet
+ */
+void nd_packet(const void *pkt, uint16_t len);
+
+/**
+ * Neighbor solicitation timeout triggered.
+ *
+ * @param to    Timeout that triggered
+ * @param type  Timeout type
+ */
+void nd_timeout(struct timeout *to, enum timeout_type type);
+
+/** @} */
+
 /*****************************************************************************/
 /**
  * @addtogroup tas-sp-routing
@@ -107,6 +107,11 @@ int slowpath_main(void)
     return EXIT_FAILURE;
   }
 
+  if (nd_init()) {
+    fprintf(stderr, "nd_init failed\n");
+    return EXIT_FAILURE;
+  }
+
 
   if (tcp_init()) {
     fprintf(stderr, "tcp_init failed\n");
@@ -207,6 +212,10 @@ static void timeout_trigger(struct timeout *to, uint8_t type, void *opaque)
       arp_timeout(to, type);
       break;
 
+    case TO_ND_REQ:
+      nd_timeout(to, type);
+      break;
+
     case TO_TCP_HANDSHAKE:
     case TO_TCP_RETRANSMIT:
     case TO_TCP_CLOSED:
@@ -36,9 +36,10 @@
 #include <tas.h>
 #include "internal.h"
 
-#define MBUF_SIZE (1500  + sizeof(struct rte_mbuf) + RTE_PKTMBUF_HEADROOM)
+/* frame of the link MTU with ethernet and vlan header */
+#define MBUF_SIZE (config.ip_mtu + 18 + sizeof(struct rte_mbuf) + \
+    RTE_PKTMBUF_HEADROOM)
 #define POOL_SIZE (4 * 4096)
-#define KNI_MTU 1500
 
 enum change_linkstate {
   LST_NOOP = 0,
@@ -94,7 +95,7 @@ int kni_init(void)
   conf.mbuf_size = MBUF_SIZE;
 #if RTE_VER_YEAR >= 18
   memcpy(conf.mac_addr, &eth_addr, sizeof(eth_addr));
-  conf.mtu = KNI_MTU;
+  conf.mtu = config.ip_mtu;
 #endif
 
   /* allocate kni */
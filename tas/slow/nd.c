@@ -0,0 +1,405 @@
+/*
+ * Copyright 2019 University of Washington, Max Planck Institute for
+ * Software Systems, and The University of Texas at Austin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <rte_config.h>
+#include <rte_ip.h>
+
+#include <tas.h>
+#include <packet_defs.h>
+#include <utils.h>
+#include "internal.h"
+
+#define ND_DEBUG(x...) do { } while (0)
+/*#define ND_DEBUG(x...) fprintf(stderr, "nd: " x)*/
+
+/* Neighbor cache entry, same life cycle as ARP entries: status 1 while the
+ * solicitation is pending, 0 once resolved. */
+struct nd_entry {
+    int status;
+    ip6_addr_t ip;
+    uint8_t mac[ETH_ADDR_LEN];
+    struct nicif_completion *compl;
+
+    uint32_t timeout;
+    struct timeout to;
+
+    struct nd_entry *prev;
+    struct nd_entry *next;
+};
+
+static inline int advert_tx(const void *dst_mac, const ip6_addr_t *dst_ip,
+    int solicited);
+static inline int solicit_tx(const ip6_addr_t *target);
+static inline const struct nd_opt_lladdr *opt_lladdr(const struct nd_msg *nd,
+    uint16_t nd_len, uint8_t type);
+static inline void nd_tx_fill(struct pkt_nd *p, const void *dst_mac,
+    const ip6_addr_t *dst_ip, const ip6_addr_t *target, uint8_t type,
+    uint32_t flags, uint8_t opt_type);
+static inline struct nd_entry *ne_lookup(const ip6_addr_t *ip);
+
+static struct nd_entry *nd_table = NULL;
+static ip6_addr_t local_ip6;
+static const ip6_addr_t ip6_unspec = { .addr = { 0 } };
+
+int nd_init(void)
+{
+  if (!config.ip6_enabled)
+    return 0;
+
+  memcpy(&local_ip6, config.ip6, sizeof(local_ip6));
+  return 0;
+}
+
+int nd_request(struct nicif_completion *comp, const ip6_addr_t *ip,
+    uint64_t *mac)
+{
+  struct nd_entry *ne;
+
+  *mac = 0;
+
+  if (!config.ip6_enabled) {
+    fprintf(stderr, "nd_request: no local IPv6 address configured\n");
+    return -1;
+  }
+
+  /* found entry */
+  if ((ne = ne_lookup(ip)) != NULL) {
+    if (ne->status == 0) {
+      ND_DEBUG("lookup succeeded\n");
+      memcpy(mac, ne->mac, ETH_ADDR_LEN);
+      return 0;
+    } else {
+      /* request still pending */
+      ND_DEBUG("request still pending\n");
+      comp->ptr = mac;
+      comp->el.next = (void *) ne->compl;
+      ne->compl = comp;
+      return 1;
+    }
+  }
+
+  /* allocate cache entry */
+  if ((ne = malloc(sizeof(*ne))) == NULL) {
+    fprintf(stderr, "nd_request: malloc failed\n");
+    return -1;
+  }
+
+  ne->status = 1;
+  ne->ip = *ip;
+  ne->compl = comp;
+  comp->el.next = NULL;
+  comp->ptr = mac;
+
+  /* send out solicitation */
+  if (solicit_tx(ip) != 0) {
+    /* timeout will take care of re-trying */
+    fprintf(stderr, "nd_request: sending out solicitation failed\n");
+  }
+
+  /* arm timeout */
+  ne->timeout = config.arp_to;
+  util_timeout_arm(&timeout_mgr, &ne->to, ne->timeout, TO_ND_REQ);
+
+  /* insert into list */
+  ne->prev = NULL;
+  ne->next = nd_table;
+  if (nd_table != NULL) {
+    nd_table->prev = ne;
+  }
+  nd_table = ne;
+
+  ND_DEBUG("solicitation sent\n");
+
+  return 1;
+}
+
+void nd_packet(const void *pkt, uint16_t len)
+{
+  const struct pkt_ip6 *p = pkt;
+  const struct nd_msg *nd = (const struct nd_msg *) (p + 1);
+  const struct nd_opt_lladdr *opt;
+  const void *mac;
+  uint16_t nd_len = f_beui16(p->ip6.len);
+  uint64_t cnt = 1;
+  int fd, ret;
+  struct nd_entry *ne;
+  struct nicif_completion *comp, *comp_next;
+
+  /* filter out other ICMPv6 and bad packets, ND messages must not have been
+   * forwarded by a router */
+  if (len < sizeof(*p) + sizeof(*nd) || nd_len < sizeof(*nd) ||
+      len < sizeof(*p) + nd_len ||
+      (nd->icmp.type != ICMP6_TYPE_NS && nd->icmp.type != ICMP6_TYPE_NA))
+  {
+    return;
+  }
+  if (p->ip6.hop_limit != ND_HOP_LIMIT || nd->icmp.code != 0 ||
+      rte_ipv6_udptcp_cksum((void *) &p->ip6, nd) != 0xffff)
+  {
+    fprintf(stderr, "nd_packet: Invalid packet received type=%u code=%u "
+        "hop_limit=%u\n", nd->icmp.type, nd->icmp.code, p->ip6.hop_limit);
+    return;
+  }
+
+  if (nd->icmp.type == ICMP6_TYPE_NS) {
+    /* handle solicitation */
+    ND_DEBUG("solicitation received\n");
+    if (memcmp(&nd->target, &local_ip6, sizeof(local_ip6)) != 0) {
+      /* solicitation not for me */
+      return;
+    }
+
+    /* answer duplicate address detection probes to all nodes */
+    if (memcmp(&p->ip6.src, &ip6_unspec, sizeof(p->ip6.src)) == 0) {
+      if (advert_tx(NULL, NULL, 0) != 0) {
+        fprintf(stderr, "nd_packet: sending advertisement failed\n");
+      }
+      return;
+    }
+
+    opt = opt_lladdr(nd, nd_len, ND_OPT_SRC_LLADDR);
+    mac = (opt != NULL ? (const void *) &opt->addr : &p->eth.src);
+    if (advert_tx(mac, &p->ip6.src, 1) != 0) {
+      fprintf(stderr, "nd_packet: sending advertisement failed\n");
+      return;
+    }
+  } else {
+    ND_DEBUG("advertisement received\n");
+
+    /* handle advertisement */
+    if ((ne = ne_lookup(&nd->target)) == NULL) {
+      ND_DEBUG("nd_packet: advertisement has no entry\n");
+      return;
+    }
+
+    if (ne->status == 1) {
+      /* disarm timeout */
+      util_timeout_disarm(&timeout_mgr, &ne->to);
+    }
+
+    /* fill in information on cache entry */
+    opt = opt_lladdr(nd, nd_len, ND_OPT_TGT_LLADDR);
+    mac = (opt != NULL ? (const void *) &opt->addr : &p->eth.src);
+    memcpy(ne->mac, mac, ETH_ADDR_LEN);
+    ne->status = 0;
+
+    /* notify waiting connections */
+    for (comp = ne->compl; comp != NULL; comp = comp_next) {
+      comp_next = (void *) comp->el.next;
+
+      memcpy(comp->ptr, ne->mac, ETH_ADDR_LEN);
+      comp->status = 0;
+      fd = comp->notify_fd;
+      nbqueue_enq(comp->q, &comp->el);
+      if (fd != -1) {
+        ret = write(fd, &cnt, sizeof(cnt));
+        if (ret <= 0) {
+          perror("nd_packet: error writing to notify fd");
+        }
+      }
+    }
+    ne->compl = NULL;
+  }
+}
+
+void nd_timeout(struct timeout *to, enum timeout_type type)
+{
+  int fd;
+  ssize_t ret;
+  uint64_t cnt = 1;
+  struct nicif_completion *comp, *comp_next;
+  struct nd_entry *ne = (struct nd_entry *)
+    ((uintptr_t) to - offsetof(struct nd_entry, to));
+
+  ND_DEBUG("nd_timeout: timeout=%uus\n", ne->timeout);
+
+  /* the entry should not be ready or the timeout would have been cancelled */
+  if (ne->status == 0) {
+    fprintf(stderr, "nd_timeout: nd entry marked as ready\n");
+    abort();
+  }
+
+  /* if we received the maximum timeout, abort */
+  if (ne->timeout * 2 >= config.arp_to_max) {
+    ND_DEBUG("nd_timeout: solicitation timed out\n");
+
+    /* notify waiting connections */
+    for (comp = ne->compl; comp != NULL; comp = comp_next) {
+      comp_next = (void *) comp->el.next;
+
+      comp->status = -1;
+      fd = comp->notify_fd;
+      nbqueue_enq(comp->q, &comp->el);
+      if (fd != -1) {
+        ret = write(fd, &cnt, sizeof(cnt));
+        if (ret <= 0) {
+          perror("nd_timeout: error writing to notify fd");
+        }
+      }
+    }
+
+    /* remove entry from cache */
+    if (ne->prev != NULL) {
+      ne->prev->next = ne->next;
+    } else {
+      nd_table = ne->next;
+    }
+    if (ne->next != NULL) {
+      ne->next->prev = ne->prev;
+    }
+
+    /* free entry */
+    free(ne);
+    return;
+  }
+
+  /* send out another solicitation */
+  if (solicit_tx(&ne->ip) != 0) {
+    fprintf(stderr, "nd_timeout: sending out solicitation failed\n");
+  }
+
+  /* rearm timeout */
+  ne->timeout *= 2;
+  util_timeout_arm(&timeout_mgr, &ne->to, ne->timeout, TO_ND_REQ);
+}
+
+/* Send advertisement for the local address, to the all nodes multicast
+ * address if dst_ip is NULL. */
+static inline int advert_tx(const void *dst_mac, const ip6_addr_t *dst_ip,
+    int solicited)
+{
+  struct pkt_nd *p;
+  uint32_t new_tail;
+  uint64_t mc_mac = 0x010000003333ULL;
+  ip6_addr_t mc_ip = { .addr = { 0xff, 0x02, [15] = 0x01 } };
+
+  if (dst_ip == NULL) {
+    dst_mac = &mc_mac;
+    dst_ip = &mc_ip;
+  }
+
+  /* allocate tx buffer */
+  if (nicif_tx_alloc(sizeof(*p), (void **) &p, &new_tail) != 0) {
+    return -1;
+  }
+
+  nd_tx_fill(p, dst_mac, dst_ip, &local_ip6, ICMP6_TYPE_NA,
+      ND_NA_FLAG_OVERRIDE | (solicited ? ND_NA_FLAG_SOLICITED : 0),
+      ND_OPT_TGT_LLADDR);
+
+  nicif_tx_send(new_tail, 1);
+
+  return 0;
+}
+
+/* Send solicitation for target to its solicited-node multicast address */
+static inline int solicit_tx(const ip6_addr_t *target)
+{
+  struct pkt_nd *p;
+  uint32_t new_tail;
+  uint8_t mc_mac[ETH_ADDR_LEN] = { 0x33, 0x33, 0xff, target->addr[13],
+    target->addr[14], target->addr[15] };
+  ip6_addr_t mc_ip = { .addr = { 0xff, 0x02, [11] = 0x01, [12] = 0xff,
+    [13] = target->addr[13], [14] = target->addr[14],
+    [15] = target->addr[15] } };
+
+  /* allocate tx buffer */
+  if (nicif_tx_alloc(sizeof(*p), (void **) &p, &new_tail) != 0) {
+    return -1;
+  }
+
+  nd_tx_fill(p, mc_mac, &mc_ip, target, ICMP6_TYPE_NS, 0, ND_OPT_SRC_LLADDR);
+
+  nicif_tx_send(new_tail, 1);
+
+  return 0;
+}
+
+static inline void nd_tx_fill(struct pkt_nd *p, const void *dst_mac,
+    const ip6_addr_t *dst_ip, const ip6_addr_t *target, uint8_t type,
+    uint32_t flags, uint8_t opt_type)
+{
+  memcpy(&p->eth.src, &eth_addr, ETH_ADDR_LEN);
+  memcpy(&p->eth.dest, dst_mac, ETH_ADDR_LEN);
+  p->eth.type = t_beui16(ETH_TYPE_IPV6);
+
+  IP6H_VTCFL_SET(&p->ip6, 6, 0, 0);
+  p->ip6.len = t_beui16(sizeof(p->nd) + sizeof(p->opt));
+  p->ip6.next_hdr = IP_PROTO_ICMPV6;
+  p->ip6.hop_limit = ND_HOP_LIMIT;
+  p->ip6.src = local_ip6;
+  p->ip6.dest = *dst_ip;
+
+  p->nd.icmp.type = type;
+  p->nd.icmp.code = 0;
+  p->nd.icmp.chksum = 0;
+  p->nd.flags = t_beui32(flags);
+  p->nd.target = *target;
+
+  p->opt.type = opt_type;
+  p->opt.len = sizeof(p->opt) / 8;
+  memcpy(&p->opt.addr, &eth_addr, ETH_ADDR_LEN);
+
+  p->nd.icmp.chksum = rte_ipv6_udptcp_cksum((void *) &p->ip6, &p->nd);
+}
+
+/* find link-layer address option of type in message */
+static inline const struct nd_opt_lladdr *opt_lladdr(const struct nd_msg *nd,
+    uint16_t nd_len, uint8_t type)
+{
+  const uint8_t *opt = (const uint8_t *) (nd + 1);
+  const struct nd_opt_lladdr *ol;
+  uint16_t off = 0, opts_len = nd_len - sizeof(*nd), opt_len;
+
+  while (off + 2 <= opts_len) {
+    opt_len = opt[off + 1] * 8;
+    if (opt_len == 0 || off + opt_len > opts_len) {
+      return NULL;
+    }
+
+    ol = (const struct nd_opt_lladdr *) (opt + off);
+    if (ol->type == type && opt_len >= sizeof(*ol)) {
+      return ol;
+    }
+    off += opt_len;
+  }
+  return NULL;
+}
+
+static inline struct nd_entry *ne_lookup(const ip6_addr_t *ip)
+{
+  struct nd_entry *ne;
+
+  for (ne = nd_table; ne != NULL; ne = ne->next) {
+    if (memcmp(&ne->ip, ip, sizeof(*ip)) == 0) {
+      return ne;
+    }
+  }
+  return NULL;
+}
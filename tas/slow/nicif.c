@@ -32,13 +32,17 @@
 #include <packet_defs.h>
 #include <utils.h>
 #include <utils_timeout.h>
-#include <utils_sync.h>
 #include "internal.h"
+#include "flowht.h"
 
 #include <rte_config.h>
 #include <rte_hash_crc.h>
+#include <rte_ip.h>
+#include <rte_thash.h>
 
-#define PKTBUF_SIZE 1536
+/* kernel packet buffers fit a frame of the link MTU with ethernet and vlan
+ * header, rounded up to cache lines (1536 for 1500 byte MTU) */
+#define PKTBUF_SIZE ((config.ip_mtu + 18 + 63) & ~63U)
 
 struct nic_buffer {
   uint64_t addr;
@@ -59,12 +63,14 @@ static inline volatile struct flextcp_pl_ktx *ktx_try_alloc(uint32_t core,
     struct nic_buffer **buf, uint32_t *new_tail);
 static inline uint32_t flow_hash(ip_addr_t lip, beui16_t lp,
     ip_addr_t rip, beui16_t rp);
-static inline int flow_slot_alloc(uint32_t h, uint32_t *i, uint32_t *d);
-static inline int flow_slot_clear(uint32_t f_id, ip_addr_t lip, beui16_t lp,
-    ip_addr_t rip, beui16_t rp);
+static inline uint32_t flow_hash6(const struct flextcp_pl_flowip6 *ip6,
+    beui16_t lp, beui16_t rp);
 static void flow_id_alloc_init(void);
 static int flow_id_alloc(uint32_t *fid);
 static void flow_id_free(uint32_t flow_id);
+static void flow_hdr_init(struct flextcp_pl_flowhdr *fh, uint64_t mac_remote,
+    beui32_t lip, beui16_t lp, beui32_t rip, beui16_t rp,
+    const struct flextcp_pl_flowip6 *ip6, int ts_opt);
 
 struct flow_id_item flow_id_items[FLEXNIC_PL_FLOWST_NUM];
 struct flow_id_item *flow_id_freelist;
@@ -84,6 +90,8 @@ static uint32_t *txq_tail;
 
 int nicif_init(void)
 {
+  struct config_tenant_rate *tr;
+
   rte_hash_crc_init_alg();
 
   /* wait for fastpath to be ready */
@@ -105,6 +113,14 @@ int nicif_init(void)
     return -1;
   }
 
+  /* set configured tenant group rate limits */
+  for (tr = config.tenant_rates; tr != NULL; tr = tr->next) {
+    if (nicif_tenant_setrate(tr->tenant, tr->rate) != 0) {
+      fprintf(stderr, "nicif_init: setting tenant rate failed\n");
+      return -1;
+    }
+  }
+
   return 0;
 }
 
@@ -153,6 +169,7 @@ int nicif_appctx_add(uint16_t appid, uint32_t db, uint64_t *rxq_base,
     actx->tx_base = txq_base[i];
     actx->rx_avail = rxq_len;
     actx->evfd = evfd;
+    actx->tc = 0;
   }
 
   MEM_BARRIER();
@@ -171,19 +188,66 @@ int nicif_appctx_add(uint16_t appid, uint32_t db, uint64_t *rxq_base,
   return 0;
 }
 
+int nicif_app_setrate(uint16_t appid, uint16_t tenant, uint32_t rate)
+{
+  struct flextcp_pl_appst *ast;
+
+  if (appid >= FLEXNIC_PL_APPST_NUM || tenant >= FLEXNIC_PL_TENANT_NUM) {
+    fprintf(stderr, "nicif_app_setrate: app id (%u) or tenant (%u) too "
+        "high\n", appid, tenant);
+    return -1;
+  }
+
+  /* fast path picks up the new limit on the next transmission */
+  ast = &fp_state->appst[appid];
+  ast->tenant = tenant;
+  MEM_BARRIER();
+  ast->tx_rate = rate;
+  return 0;
+}
+
+int nicif_appctx_settc(uint32_t db, uint8_t tc)
+{
+  uint16_t i;
+
+  if (db >= FLEXNIC_PL_APPCTX_NUM || tc >= FLEXNIC_PL_TC_NUM) {
+    fprintf(stderr, "nicif_appctx_settc: context (%u) or traffic class (%u) "
+        "too high\n", db, tc);
+    return -1;
+  }
+
+  /* fast path picks up the new class on the next poll */
+  for (i = 0; i < tas_info->cores_num; i++) {
+    fp_state->appctx[i][db].tc = tc;
+  }
+  return 0;
+}
+
+int nicif_tenant_setrate(uint16_t tenant, uint32_t rate)
+{
+  if (tenant >= FLEXNIC_PL_TENANT_NUM) {
+    fprintf(stderr, "nicif_tenant_setrate: tenant too high (%u, max=%u)\n",
+        tenant, FLEXNIC_PL_TENANT_NUM);
+    return -1;
+  }
+
+  fp_state->tenants[tenant].tx_rate = rate;
+  return 0;
+}
+
 /** Register flow */
 int nicif_connection_add(uint32_t db, uint64_t mac_remote, uint32_t ip_local,
     uint16_t port_local, uint32_t ip_remote, uint16_t port_remote,
-    uint64_t rx_base, uint32_t rx_len, uint64_t tx_base, uint32_t tx_len,
+    const struct flextcp_pl_flowip6 *ip6, uint64_t rx_base, uint32_t rx_len, uint64_t tx_base, uint32_t tx_len,
     uint32_t remote_seq, uint32_t local_seq, uint64_t app_opaque,
-    uint32_t flags, uint32_t rate, uint32_t fn_core, uint16_t flow_group,
-    uint32_t *pf_id)
+    uint32_t flags, uint8_t rx_wscale, uint8_t tx_wscale, uint16_t mss,
+    uint32_t rate, uint32_t fn_core, uint16_t flow_group, uint32_t *pf_id)
 {
   struct flextcp_pl_flowst *fs;
   beui32_t lip = t_beui32(ip_local), rip = t_beui32(ip_remote);
   beui16_t lp = t_beui16(port_local), rp = t_beui16(port_remote);
-  uint32_t i, d, f_id, hash;
-  struct flextcp_pl_flowhte *hte = fp_state->flowht;
+  uint32_t b, slot, f_id, hash;
+  struct flextcp_pl_flowhtb *hte = fp_state->flowht;
 
   /* allocate flow id */
   if (flow_id_alloc(&f_id) != 0) {
@@ -191,28 +255,38 @@ int nicif_connection_add(uint32_t db, uint64_t mac_remote, uint32_t ip_local,
     return -1;
   }
 
+  /* IPv6 flows only carry addresses in the side table */
+  if (ip6 != NULL) {
+    lip = rip = t_beui32(0);
+  }
+
   /* calculate hash and find empty slot */
-  hash = flow_hash(lip, lp, rip, rp);
-  if (flow_slot_alloc(hash, &i, &d) != 0) {
+  hash = (ip6 != NULL ? flow_hash6(ip6, lp, rp) : flow_hash(lip, lp, rip, rp));
+  if (flow_slot_alloc(hash, &b, &slot) != 0) {
     flow_id_free(f_id);
     fprintf(stderr, "nicif_connection_add: allocating slot failed\n");
     return -1;
   }
-  assert(i < FLEXNIC_PL_FLOWHT_ENTRIES);
-  assert(d < FLEXNIC_PL_FLOWHT_NBSZ);
+  assert(b < FLEXNIC_PL_FLOWHT_BUCKETS);
+  assert(slot < FLEXNIC_PL_FLOWHT_SLOTS);
 
+  fs = &fp_state->flowst[f_id];
+  fs->flags = 0;
   if ((flags & NICIF_CONN_ECN) == NICIF_CONN_ECN) {
-    rx_base |= FLEXNIC_PL_FLOWST_ECN;
+    fs->flags |= FLEXNIC_PL_FLOWST_ECN;
+  }
+  if ((flags & NICIF_CONN_SACK) == NICIF_CONN_SACK) {
+    fs->flags |= FLEXNIC_PL_FLOWST_SACK;
   }
 
-  fs = &fp_state->flowst[f_id];
   fs->opaque = app_opaque;
-  fs->rx_base_sp = rx_base;
+  fs->rx_base = rx_base;
   fs->tx_base = tx_base;
   fs->rx_len = rx_len;
   fs->tx_len = tx_len;
   memcpy(&fs->remote_mac, &mac_remote, ETH_ADDR_LEN);
   fs->db_id = db;
+  fs->tc = fp_state->appctx[0][db].tc;
 
   fs->local_ip = lip;
   fs->remote_ip = rip;
@@ -220,13 +294,24 @@ int nicif_connection_add(uint32_t db, uint64_t mac_remote, uint32_t ip_local,
   fs->remote_port = rp;
 
   fs->flow_group = flow_group;
-  fs->lock = 0;
+  fs->ip6 = (ip6 != NULL);
+  if (ip6 != NULL) {
+    fp_state->flowip6[f_id] = *ip6;
+  }
   fs->bump_seq = 0;
 
   fs->rx_avail = rx_len;
   fs->rx_next_pos = 0;
   fs->rx_next_seq = remote_seq;
   fs->rx_remote_avail = rx_len; /* XXX */
+  fs->rx_wscale = rx_wscale;
+  fs->tx_wscale = tx_wscale;
+  fs->mss = mss;
+  fs->ts_opt = (flags & NICIF_CONN_TS) == NICIF_CONN_TS;
+  fs->rx_dupack_cnt = 0;
+#ifdef FLEXNIC_PL_OOO_RECV
+  memset(&fp_state->flowooo[f_id], 0, sizeof(fp_state->flowooo[f_id]));
+#endif
 
   fs->tx_sent = 0;
   fs->tx_next_pos = 0;
@@ -234,38 +319,65 @@ int nicif_connection_add(uint32_t db, uint64_t mac_remote, uint32_t ip_local,
   fs->tx_avail = 0;
   fs->tx_next_ts = 0;
   fs->tx_rate = rate;
-  fs->rtt_est = 0;
+  memset(&fp_state->flowstats[f_id], 0, sizeof(fp_state->flowstats[f_id]));
+
+  memset(&fp_state->flowsack[f_id], 0, sizeof(fp_state->flowsack[f_id]));
+  fp_state->flowsack[f_id].rtx_next = local_seq;
+  fp_state->flowsack[f_id].rtx_end = local_seq;
+  fp_state->flowrtt[f_id].valid = 0;
 
-  /* write to empty entry first */
+  flow_hdr_init(&fp_state->flowhdr[f_id], mac_remote, lip, lp, rip, rp, ip6,
+      fs->ts_opt);
+
+  /* write flow id to empty slot first, then publish with tag */
   MEM_BARRIER();
-  hte[i].flow_hash = hash;
+  hte[b].flow_ids[slot] = f_id;
   MEM_BARRIER();
-  hte[i].flow_id = FLEXNIC_PL_FLOWHTE_VALID |
-      (d << FLEXNIC_PL_FLOWHTE_POSSHIFT) | f_id;
+  hte[b].tags[slot] = FLEXNIC_PL_FLOWHT_TAG(hash);
 
   *pf_id = f_id;
   return 0;
 }
 
-int nicif_connection_disable(uint32_t f_id, uint32_t *tx_seq, uint32_t *rx_seq,
-    int *tx_closed, int *rx_closed)
+int nicif_connection_disable(uint32_t f_id, uint16_t flow_group,
+    uint32_t *tx_seq, uint32_t *rx_seq, int *tx_closed, int *rx_closed)
 {
   struct flextcp_pl_flowst *fs = &fp_state->flowst[f_id];
+  volatile struct flextcp_pl_ktx *ktx;
+  struct nic_buffer *buf;
+  uint32_t tail;
+  uint16_t core = fp_state->flow_group_steering[flow_group];
+  uint8_t flags;
 
-  util_spin_lock(&fs->lock);
+  /* only the core owning the flow modifies its state, so ask it to hand the
+   * flow over and wait for the result */
+  while ((ktx = ktx_try_alloc(core, &buf, &tail)) == NULL) {
+    notify_fastpath_core(core);
+  }
+  txq_tail[core] = tail;
 
-  *tx_seq = fs->tx_next_seq;
-  *rx_seq = fs->rx_next_seq;
-  fs->rx_base_sp |= FLEXNIC_PL_FLOWST_SLOWPATH;
+  ktx->msg.conndisable.flow_id = f_id;
+  MEM_BARRIER();
+  ktx->type = FLEXTCP_PL_KTX_CONNDISABLE;
+
+  notify_fastpath_core(core);
 
-  *rx_closed = !!(fs->rx_base_sp & FLEXNIC_PL_FLOWST_RXFIN);
-  *tx_closed = !!(fs->rx_base_sp & FLEXNIC_PL_FLOWST_TXFIN) &&
-      fs->tx_sent == 0;
+  while (ktx->type != 0);
+  MEM_BARRIER();
 
-  util_spin_unlock(&fs->lock);
+  *tx_seq = ktx->msg.conndisable.tx_seq;
+  *rx_seq = ktx->msg.conndisable.rx_seq;
+  flags = ktx->msg.conndisable.flags;
+  *rx_closed = !!(flags & FLEXTCP_PL_KTX_FLRXCLOSED);
+  *tx_closed = !!(flags & FLEXTCP_PL_KTX_FLTXCLOSED);
 
-  flow_slot_clear(f_id, fs->local_ip, fs->local_port, fs->remote_ip,
-      fs->remote_port);
+  if (fs->ip6) {
+    flow_slot_clear(f_id, flow_hash6(&fp_state->flowip6[f_id],
+          fs->local_port, fs->remote_port));
+  } else {
+    flow_slot_clear(f_id, flow_hash(fs->local_ip, fs->local_port,
+          fs->remote_ip, fs->remote_port));
+  }
   return 0;
 }
 
@@ -275,9 +387,25 @@ void nicif_connection_free(uint32_t f_id)
 }
 
 /** Move flow to new db */
-int nicif_connection_move(uint32_t dst_db, uint32_t f_id)
+int nicif_connection_move(uint32_t dst_db, uint32_t f_id, uint16_t flow_group)
 {
-  fp_state->flowst[f_id].db_id = dst_db;
+  volatile struct flextcp_pl_ktx *ktx;
+  struct nic_buffer *buf;
+  uint32_t tail;
+  uint16_t core = fp_state->flow_group_steering[flow_group];
+
+  if ((ktx = ktx_try_alloc(core, &buf, &tail)) == NULL) {
+    return -1;
+  }
+  txq_tail[core] = tail;
+
+  ktx->msg.connmove.flow_id = f_id;
+  ktx->msg.connmove.db_id = dst_db;
+  MEM_BARRIER();
+  ktx->type = FLEXTCP_PL_KTX_CONNMOVE;
+
+  notify_fastpath_core(core);
+
   return 0;
 }
 
@@ -285,20 +413,20 @@ int nicif_connection_move(uint32_t dst_db, uint32_t f_id)
 int nicif_connection_stats(uint32_t f_id,
     struct nicif_connection_stats *p_stats)
 {
-  struct flextcp_pl_flowst *fs;
+  struct flextcp_pl_flowstats *st;
 
   if (f_id >= FLEXNIC_PL_FLOWST_NUM) {
     fprintf(stderr, "nicif_connection_stats: bad flow id\n");
     return -1;
   }
 
-  fs = &fp_state->flowst[f_id];
-  p_stats->c_drops = fs->cnt_tx_drops;
-  p_stats->c_acks = fs->cnt_rx_acks;
-  p_stats->c_ackb = fs->cnt_rx_ack_bytes;
-  p_stats->c_ecnb = fs->cnt_rx_ecn_bytes;
-  p_stats->txp = fs->tx_sent != 0;
-  p_stats->rtt = fs->rtt_est;
+  st = &fp_state->flowstats[f_id];
+  p_stats->c_drops = st->cnt_tx_drops;
+  p_stats->c_acks = st->cnt_rx_acks;
+  p_stats->c_ackb = st->cnt_rx_ack_bytes;
+  p_stats->c_ecnb = st->cnt_rx_ecn_bytes;
+  p_stats->txp = st->txp;
+  p_stats->rtt = st->rtt_est;
 
   return 0;
 }
@@ -311,17 +439,65 @@ int nicif_connection_stats(uint32_t f_id,
  *
  * @return 0 on success, <0 else
  */
-int nicif_connection_setrate(uint32_t f_id, uint32_t rate)
+int nicif_connection_setrate(uint32_t f_id, uint16_t flow_group,
+    uint32_t rate)
 {
-  struct flextcp_pl_flowst *fs;
+  volatile struct flextcp_pl_ktx *ktx;
+  struct nic_buffer *buf;
+  uint32_t tail;
+  uint16_t core = fp_state->flow_group_steering[flow_group];
 
   if (f_id >= FLEXNIC_PL_FLOWST_NUM) {
-    fprintf(stderr, "nicif_connection_stats: bad flow id\n");
+    fprintf(stderr, "nicif_connection_setrate: bad flow id\n");
     return -1;
   }
 
-  fs = &fp_state->flowst[f_id];
-  fs->tx_rate = rate;
+  if ((ktx = ktx_try_alloc(core, &buf, &tail)) == NULL) {
+    return -1;
+  }
+  txq_tail[core] = tail;
+
+  ktx->msg.connsetrate.flow_id = f_id;
+  ktx->msg.connsetrate.rate = rate;
+  MEM_BARRIER();
+  ktx->type = FLEXTCP_PL_KTX_CONNSETRATE;
+
+  notify_fastpath_core(core);
+
+  return 0;
+}
+
+/**
+ * Set traffic class for flow.
+ *
+ * @param f_id  ID of flow
+ * @param tc    Traffic class, higher classes are served first
+ *
+ * @return 0 on success, <0 else
+ */
+int nicif_connection_settc(uint32_t f_id, uint16_t flow_group, uint8_t tc)
+{
+  volatile struct flextcp_pl_ktx *ktx;
+  struct nic_buffer *buf;
+  uint32_t tail;
+  uint16_t core = fp_state->flow_group_steering[flow_group];
+
+  if (f_id >= FLEXNIC_PL_FLOWST_NUM || tc >= FLEXNIC_PL_TC_NUM) {
+    fprintf(stderr, "nicif_connection_settc: bad flow id or traffic class\n");
+    return -1;
+  }
+
+  if ((ktx = ktx_try_alloc(core, &buf, &tail)) == NULL) {
+    return -1;
+  }
+  txq_tail[core] = tail;
+
+  ktx->msg.connsettc.flow_id = f_id;
+  ktx->msg.connsettc.tc = tc;
+  MEM_BARRIER();
+  ktx->type = FLEXTCP_PL_KTX_CONNSETTC;
+
+  notify_fastpath_core(core);
 
   return 0;
 }
@@ -533,6 +709,7 @@ static inline void process_packet(const void *buf, uint16_t len,
   const struct eth_hdr *eth = buf;
   const struct ip_hdr *ip = (struct ip_hdr *) (eth + 1);
   const struct tcp_hdr *tcp = (struct tcp_hdr *) (ip + 1);
+  const struct ip6_hdr *ip6 = (struct ip6_hdr *) (eth + 1);
   int to_kni = 1;
 
   if (f_beui16(eth->type) == ETH_TYPE_ARP) {
@@ -554,6 +731,22 @@ static inline void process_packet(const void *buf, uint16_t len,
         return;
       }
 
+      to_kni = !!tcp_packet(buf, len, fn_core, flow_group);
+    }
+  } else if (f_beui16(eth->type) == ETH_TYPE_IPV6 && config.ip6_enabled) {
+    if (len < sizeof(struct pkt_ip6)) {
+      fprintf(stderr, "process_packet: short ipv6 packet\n");
+      return;
+    }
+
+    if (ip6->next_hdr == IP_PROTO_ICMPV6) {
+      nd_packet(buf, len);
+    } else if (ip6->next_hdr == IP_PROTO_TCP) {
+      if (len < sizeof(struct pkt_tcp6)) {
+        fprintf(stderr, "process_packet: short tcp packet\n");
+        return;
+      }
+
       to_kni = !!tcp_packet(buf, len, fn_core, flow_group);
     }
   }
@@ -596,124 +789,106 @@ static inline uint32_t flow_hash(ip_addr_t lip, beui16_t lp,
     beui16_t rp;
   } __attribute__((packed)) hk =
       { .lip = lip, .rip = rip, .lp = lp, .rp = rp };
+  uint32_t tuple[3];
+
+  /* fast path looks up flows with the NIC's RSS hash for received packets */
+  if (config.fp_rss_flowhash) {
+    tuple[0] = f_beui32(rip);
+    tuple[1] = f_beui32(lip);
+    tuple[2] = ((uint32_t) f_beui16(rp) << 16) | f_beui16(lp);
+    return rte_softrss(tuple, 3, rss_key);
+  }
+
   MEM_BARRIER();
   return rte_hash_crc(&hk, sizeof(hk), 0);
 }
 
-static inline int flow_slot_alloc(uint32_t h, uint32_t *pi, uint32_t *pd)
+/* hash for IPv6 flows, has to match the fast path as well */
+static inline uint32_t flow_hash6(const struct flextcp_pl_flowip6 *ip6,
+    beui16_t lp, beui16_t rp)
 {
-  uint32_t j, i, l, k, d;
-  struct flextcp_pl_flowhte *hte = fp_state->flowht;
-
-  /* find slot */
-  j = h % FLEXNIC_PL_FLOWHT_ENTRIES;
-  l = (j + FLEXNIC_PL_FLOWHT_NBSZ) % FLEXNIC_PL_FLOWHT_ENTRIES;
-
-  /* look for empty slot */
-  d = 0;
-  for (i = j; i != l; i = (i + 1) % FLEXNIC_PL_FLOWHT_ENTRIES) {
-    if ((hte[i].flow_id & FLEXNIC_PL_FLOWHTE_VALID) == 0) {
-      *pi = i;
-      *pd = d;
-      return 0;
-    }
-    d++;
-  }
-
-  /* no free slot, try to clear up on */
-  k = (l + 4 * FLEXNIC_PL_FLOWHT_NBSZ) % FLEXNIC_PL_FLOWHT_ENTRIES;
-  /* looking for candidate empty slot to move back */
-  for (; i != k; i = (i + 1) % FLEXNIC_PL_FLOWHT_ENTRIES) {
-    if ((hte[i].flow_id & FLEXNIC_PL_FLOWHTE_VALID) == 0) {
-      break;
-    }
-  }
-
-  /* abort if no candidate slot found */
-  if (i == k) {
-    fprintf(stderr, "flow_slot_alloc: no empty slot found\n");
-    return -1;
-  }
-
-  /* move candidate backwards until in range for this insertion */
-  /* j < l -> (i < j || i >= l) */
-  /* j > l -> (i >= l && i < j) */
-  while ((j > l || (i < j || i >= l)) && (j < l || (i >= l && i < j))) {
-    k = i;
-
-    /* look for element to swap */
-    i = (k - FLEXNIC_PL_FLOWHT_NBSZ) % FLEXNIC_PL_FLOWHT_ENTRIES;
-    for (; i != k; i = (i + 1) % FLEXNIC_PL_FLOWHT_ENTRIES) {
-      assert((hte[i].flow_id & FLEXNIC_PL_FLOWHTE_VALID) != 0);
-
-      /* calculate how much further this element can be moved */
-      d = (hte[i].flow_id >> FLEXNIC_PL_FLOWHTE_POSSHIFT) &
-          (FLEXNIC_PL_FLOWHT_NBSZ - 1);
-      d = FLEXNIC_PL_FLOWHT_NBSZ - 1 - d;
-
-      /* check whether element can be moved */
-      if ((k - i) % FLEXNIC_PL_FLOWHT_ENTRIES <= d) {
-        break;
-      }
-    }
-
-    /* abort if none of the elements can be moved */
-    if (i == k) {
-      fprintf(stderr, "flow_slot_alloc: no element could be moved\n");
-      return -1;
+  struct {
+    ip6_addr_t lip;
+    ip6_addr_t rip;
+    beui16_t lp;
+    beui16_t rp;
+  } __attribute__((packed)) hk =
+      { .lip = ip6->local_ip, .rip = ip6->remote_ip, .lp = lp, .rp = rp };
+  uint32_t tuple[9];
+  beui32_t w;
+  unsigned i;
+
+  if (config.fp_rss_flowhash) {
+    for (i = 0; i < 4; i++) {
+      memcpy(&w, ip6->remote_ip.addr + 4 * i, sizeof(w));
+      tuple[i] = f_beui32(w);
+      memcpy(&w, ip6->local_ip.addr + 4 * i, sizeof(w));
+      tuple[4 + i] = f_beui32(w);
     }
-
-    /* move element up */
-    assert((hte[k].flow_id & FLEXNIC_PL_FLOWHTE_VALID) == 0);
-    d = (hte[i].flow_id >> FLEXNIC_PL_FLOWHTE_POSSHIFT) &
-        (FLEXNIC_PL_FLOWHT_NBSZ - 1);
-
-    /* write to empty entry first */
-    hte[k].flow_hash = hte[i].flow_hash;
-    MEM_BARRIER();
-    hte[k].flow_id = FLEXNIC_PL_FLOWHTE_VALID |
-        (d << FLEXNIC_PL_FLOWHTE_POSSHIFT) |
-        (((1 << FLEXNIC_PL_FLOWHTE_POSSHIFT) - 1) & hte[i].flow_id);
-    MEM_BARRIER();
-
-    /* empty original position */
-    hte[i].flow_id = 0;
-    MEM_BARRIER();
+    tuple[8] = ((uint32_t) f_beui16(rp) << 16) | f_beui16(lp);
+    return rte_softrss(tuple, 9, rss_key);
   }
 
-  *pi = i;
-  *pd = (i - j) % FLEXNIC_PL_FLOWHT_ENTRIES;
-  return 0;
+  return rte_hash_crc(&hk, sizeof(hk), 0);
 }
 
-static inline int flow_slot_clear(uint32_t f_id, ip_addr_t lip, beui16_t lp,
-    ip_addr_t rip, beui16_t rp)
+/** build header template for segments sent on the flow, IPv6 if `ip6` is
+ * not NULL */
+static void flow_hdr_init(struct flextcp_pl_flowhdr *fh, uint64_t mac_remote,
+    beui32_t lip, beui16_t lp, beui32_t rip, beui16_t rp,
+    const struct flextcp_pl_flowip6 *ip6, int ts_opt)
 {
-  uint32_t h, k, j, ffid, eh;
-  struct flextcp_pl_flowhte *e;
-
-  h = flow_hash(lip, lp, rip, rp);
-
-  for (j = 0; j < FLEXNIC_PL_FLOWHT_NBSZ; j++) {
-    k = (h + j) % FLEXNIC_PL_FLOWHT_ENTRIES;
-    e = &fp_state->flowht[k];
-
-    ffid = e->flow_id;
-    MEM_BARRIER();
-    eh = e->flow_hash;
-
-    if ((ffid & FLEXNIC_PL_FLOWHTE_VALID) == 0 || eh != h) {
-      continue;
-    }
-
-    if ((ffid & ((1 << FLEXNIC_PL_FLOWHTE_POSSHIFT) - 1)) == f_id) {
-      e->flow_id &= ~FLEXNIC_PL_FLOWHTE_VALID;
-      return 0;
-    }
+  struct pkt_tcp *p = (struct pkt_tcp *) fh->hdr;
+  struct pkt_tcp6 *p6 = (struct pkt_tcp6 *) fh->hdr;
+  struct tcp_hdr *th = (ip6 != NULL ? &p6->tcp : &p->tcp);
+  struct tcp_timestamp_opt *opt_ts = (struct tcp_timestamp_opt *) (th + 1);
+  uint8_t *pad = (uint8_t *) (opt_ts + 1);
+
+  memset(fh, 0, sizeof(*fh));
+
+  memcpy(&p->eth.dest, &mac_remote, ETH_ADDR_LEN);
+  memcpy(&p->eth.src, &eth_addr, ETH_ADDR_LEN);
+
+  if (ip6 != NULL) {
+    p6->eth.type = t_beui16(ETH_TYPE_IPV6);
+
+    IP6H_VTCFL_SET(&p6->ip6, 6, 0, 0);
+    p6->ip6.next_hdr = IP_PROTO_TCP;
+    p6->ip6.hop_limit = 0xff;
+    p6->ip6.src = ip6->local_ip;
+    p6->ip6.dest = ip6->remote_ip;
+  } else {
+    p->eth.type = t_beui16(ETH_TYPE_IP);
+
+    IPH_VHL_SET(&p->ip, 4, 5);
+    p->ip.id = t_beui16(3); /* TODO: not sure why we have 3 here */
+    p->ip.ttl = 0xff;
+    p->ip.proto = IP_PROTO_TCP;
+    p->ip.src = lip;
+    p->ip.dest = rip;
+  }
+
+  th->src = lp;
+  th->dest = rp;
+  if (ts_opt) {
+    TCPH_HDRLEN_FLAGS_SET(th, 5 + (FLEXNIC_PL_FLOWHDR_LEN -
+          sizeof(*p)) / 4, 0);
+
+    opt_ts->kind = TCP_OPT_TIMESTAMP;
+    opt_ts->length = sizeof(*opt_ts);
+    pad[0] = pad[1] = TCP_OPT_NO_OP;
+  } else {
+    TCPH_HDRLEN_FLAGS_SET(th, 5, 0);
+  }
+
+  /* checksums over the fields that do not change, with the segment flag the
+   * pseudo header sum excludes the length */
+  if (ip6 != NULL) {
+    th->chksum = rte_ipv6_phdr_cksum((void *) &p6->ip6, PKT_TX_TCP_SEG);
+  } else {
+    p->ip.chksum = rte_ipv4_cksum((void *) &p->ip);
+    th->chksum = rte_ipv4_phdr_cksum((void *) &p->ip, PKT_TX_TCP_SEG);
   }
-
-  fprintf(stderr, "flow_slot_clear: table entry not found\n");
-  return -1;
 }
 
 static void flow_id_alloc_init(void)
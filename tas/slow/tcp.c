@@ -38,7 +38,10 @@
 #include <utils_rng.h>
 #include "internal.h"
 
-#define TCP_MSS 1460
+/* MSS assumed if the peer does not send an MSS option (RFC 1122) */
+#define TCP_MSS_DEFAULT 536
+/* smallest MSS accepted from peers */
+#define TCP_MSS_MIN 88
 #define TCP_HTSIZE 4096
 
 #define PORT_MAX ((1u << 16) - 1)
@@ -70,18 +73,38 @@ struct backlog_slot {
 
 struct tcp_opts {
   struct tcp_mss_opt *mss;
+  struct tcp_wscale_opt *wscale;
+  struct tcp_sack_perm_opt *sack_perm;
   struct tcp_timestamp_opt *ts;
 };
 
+/* received segment, IPv4 or IPv6 without options or extension headers */
+struct tcp_seg {
+  const struct eth_hdr *eth;
+  const struct tcp_hdr *tcp;
+  /* IPv4 addresses, 0 for IPv6 */
+  uint32_t src_ip;
+  uint32_t dst_ip;
+  /* IPv6 addresses, NULL for IPv4 */
+  const ip6_addr_t *src_ip6;
+  const ip6_addr_t *dst_ip6;
+  /* TCP header and payload length */
+  uint16_t l4len;
+  /* length from ethernet header to end of payload */
+  uint16_t len;
+};
+
 static int conn_arp_done(struct connection *conn);
-static void conn_packet(struct connection *c, const struct pkt_tcp *p,
+static void conn_packet(struct connection *c, const struct tcp_seg *s,
     const struct tcp_opts *opts, uint32_t fn_core, uint16_t flow_group);
 static inline struct connection *conn_alloc(void);
 static inline void conn_free(struct connection *conn);
 static void conn_register(struct connection *conn);
 static void conn_unregister(struct connection *conn);
-static struct connection *conn_lookup(const struct pkt_tcp *p);
-static int conn_syn_sent_packet(struct connection *c, const struct pkt_tcp *p,
+static inline const struct flextcp_pl_flowip6 *conn_ip6(
+    const struct connection *conn);
+static struct connection *conn_lookup(const struct tcp_seg *s);
+static int conn_syn_sent_packet(struct connection *c, const struct tcp_seg *s,
     const struct tcp_opts *opts);
 static int conn_reg_synack(struct connection *c);
 static void conn_failed(struct connection *c, int status);
@@ -89,17 +112,25 @@ static void conn_timeout_arm(struct connection *c, int type);
 static void conn_timeout_disarm(struct connection *c);
 static void conn_close_timeout(struct connection *c);
 
-static struct listener *listener_lookup(const struct pkt_tcp *p);
-static void listener_packet(struct listener *l, const struct pkt_tcp *p,
+static struct listener *listener_lookup(const struct tcp_seg *s);
+static void listener_packet(struct listener *l, const struct tcp_seg *s,
     const struct tcp_opts *opts, uint32_t fn_core, uint16_t flow_group);
 static void listener_accept(struct listener *l);
 
 static inline uint16_t port_alloc(void);
 static inline int send_control(const struct connection *conn, uint16_t flags,
-    int ts_opt, uint32_t ts_echo, uint16_t mss_opt);
-static inline int send_reset(const struct pkt_tcp *p,
+    int ts_opt, uint32_t ts_echo, uint16_t mss_opt, int sack_perm_opt,
+    int wscale_opt);
+static inline uint8_t wscale_for(uint32_t len);
+static inline uint16_t mss_local(int ip6);
+static inline uint16_t conn_mss(const struct connection *c);
+static inline int send_reset(const struct tcp_seg *s,
     const struct tcp_opts *opts);
-static inline int parse_options(const struct pkt_tcp *p, uint16_t len,
+static inline int seg_parse(struct tcp_seg *s, const void *pkt,
+    uint16_t len);
+static inline int seg_same_flow(const struct tcp_seg *a,
+    const struct tcp_seg *b);
+static inline int parse_options(const struct tcp_seg *s,
     struct tcp_opts *opts);
 
 static uintptr_t ports[PORT_MAX + 1];
@@ -145,7 +176,8 @@ void tcp_poll(void)
 }
 
 int tcp_open(struct app_context *ctx, uint64_t opaque, uint32_t remote_ip,
-    uint16_t remote_port, uint32_t db_id, struct connection **pconn)
+    const ip6_addr_t *remote_ip6, uint16_t remote_port, uint32_t db_id,
+    struct connection **pconn)
 {
   int ret;
   struct connection *conn;
@@ -170,8 +202,17 @@ int tcp_open(struct app_context *ctx, uint64_t opaque, uint32_t remote_ip,
   conn->ctx = ctx;
   conn->opaque = opaque;
   conn->status = CONN_ARP_PENDING;
-  conn->remote_ip = remote_ip;
-  conn->local_ip = config.ip;
+  if (remote_ip6 != NULL) {
+    conn->ip6 = 1;
+    conn->remote_ip = 0;
+    conn->local_ip = 0;
+    memcpy(&conn->ip6_addrs.local_ip, config.ip6, IP6_ADDR_LEN);
+    conn->ip6_addrs.remote_ip = *remote_ip6;
+  } else {
+    conn->ip6 = 0;
+    conn->remote_ip = remote_ip;
+    conn->local_ip = config.ip;
+  }
   conn->remote_port = remote_port;
   conn->local_port = local_port;
   conn->local_seq = 0; /* TODO: assign random */
@@ -185,8 +226,12 @@ int tcp_open(struct app_context *ctx, uint64_t opaque, uint32_t remote_ip,
   conn->comp.status = 0;
 
 
-  /* resolve IP to mac */
-  ret = routing_resolve(&conn->comp, remote_ip, &conn->remote_mac);
+  /* resolve IP to mac, IPv6 peers have to be on-link */
+  if (conn->ip6) {
+    ret = nd_request(&conn->comp, remote_ip6, &conn->remote_mac);
+  } else {
+    ret = routing_resolve(&conn->comp, remote_ip, &conn->remote_mac);
+  }
   if (ret < 0) {
     fprintf(stderr, "tcp_open: nicif_arp failed\n");
     conn_free(conn);
@@ -352,38 +397,30 @@ int tcp_packet(const void *pkt, uint16_t len, uint32_t fn_core,
 {
   struct connection *c;
   struct listener *l;
-  const struct pkt_tcp *p = pkt;
+  struct tcp_seg s;
   struct tcp_opts opts;
   int ret = 0;
 
-  if (len < sizeof(*p)) {
-    fprintf(stderr, "tcp_packet: incomplete TCP receive (%u received, "
-        "%u expected)\n", len, (unsigned) sizeof(*p));
-    return -1;
-  }
-
-  if (f_beui32(p->ip.dest) != config.ip) {
-    fprintf(stderr, "tcp_packet: unexpected destination IP (%x received, "
-        "%x expected)\n", f_beui32(p->ip.dest), config.ip);
+  if (seg_parse(&s, pkt, len) != 0) {
     return -1;
   }
 
-  if (parse_options(p, len, &opts) != 0) {
+  if (parse_options(&s, &opts) != 0) {
     fprintf(stderr, "tcp_packet: parsing TCP options failed\n");
     return -1;
   }
 
-  if ((c = conn_lookup(p)) != NULL) {
-    conn_packet(c, p, &opts, fn_core, flow_group);
-  } else if ((l = listener_lookup(p)) != NULL) {
-    listener_packet(l, p, &opts, fn_core, flow_group);
+  if ((c = conn_lookup(&s)) != NULL) {
+    conn_packet(c, &s, &opts, fn_core, flow_group);
+  } else if ((l = listener_lookup(&s)) != NULL) {
+    listener_packet(l, &s, &opts, fn_core, flow_group);
   } else {
     ret = -1;
 
     /* send reset if the packet received wasn't a reset */
-    if (!(TCPH_FLAGS(&p->tcp) & TCP_RST) &&
+    if (!(TCPH_FLAGS(s.tcp) & TCP_RST) &&
         config.kni_name == NULL)
-      send_reset(p, &opts);
+      send_reset(&s, &opts);
   }
 
   return ret;
@@ -400,8 +437,8 @@ int tcp_close(struct connection *conn)
   }
 
   /* disable connection on fastpath */
-  if (nicif_connection_disable(conn->flow_id, &tx_seq, &rx_seq, &tx_c, &rx_c)
-      != 0)
+  if (nicif_connection_disable(conn->flow_id, conn->flow_group, &tx_seq,
+        &rx_seq, &tx_c, &rx_c) != 0)
   {
     fprintf(stderr, "tcp_close: nicif_connection_disable failed unexpected\n");
     return -1;
@@ -411,7 +448,7 @@ int tcp_close(struct connection *conn)
   conn->local_seq = tx_seq;
 
   if (!tx_c || !rx_c) {
-    send_control(conn, TCP_RST, 0, 0, 0);
+    send_control(conn, TCP_RST, 0, 0, 0, 0, -1);
   }
 
   cc_conn_remove(conn);
@@ -464,10 +501,11 @@ void tcp_timeout(struct timeout *to, enum timeout_type type)
   conn_timeout_arm(c, TO_TCP_HANDSHAKE);
 
   /* re-send SYN packet */
-  send_control(c, TCP_SYN | TCP_ECE | TCP_CWR, 1, 0, TCP_MSS);
+  send_control(c, TCP_SYN | TCP_ECE | TCP_CWR, 1, 0, mss_local(c->ip6), 1,
+      c->local_wscale);
 }
 
-static void conn_packet(struct connection *c, const struct pkt_tcp *p,
+static void conn_packet(struct connection *c, const struct tcp_seg *s,
     const struct tcp_opts *opts, uint32_t fn_core, uint16_t flow_group)
 {
   int ret;
@@ -477,18 +515,17 @@ static void conn_packet(struct connection *c, const struct pkt_tcp *p,
     /* hopefully a SYN-ACK received */
     c->fn_core = fn_core;
     c->flow_group = flow_group;
-    if ((ret = conn_syn_sent_packet(c, p, opts)) != 0) {
+    if ((ret = conn_syn_sent_packet(c, s, opts)) != 0) {
       conn_failed(c, ret);
     }
   } else if (c->status == CONN_OPEN &&
-      (TCPH_FLAGS(&p->tcp) & ~ecn_flags) == TCP_SYN)
+      (TCPH_FLAGS(s->tcp) & ~ecn_flags) == TCP_SYN)
   {
     /* handle re-transmitted SYN for dropped SYN-ACK */
     /* TODO: should only do this if we're still waiting for initial ACK,
      * otherwise we should send a challenge ACK */
-    if (opts->ts == NULL) {
-      fprintf(stderr, "conn_packet: re-transmitted SYN does not have TS "
-          "option\n");
+    if ((opts->ts != NULL) != ((c->flags & NICIF_CONN_TS) == NICIF_CONN_TS)) {
+      fprintf(stderr, "conn_packet: re-transmitted SYN changed TS option\n");
       conn_failed(c, -1);
       return;
     }
@@ -498,18 +535,22 @@ static void conn_packet(struct connection *c, const struct pkt_tcp *p,
       ecn_flags = TCP_ECE;
     }
 
-    send_control(c, TCP_SYN | TCP_ACK | ecn_flags, 1,
-        f_beui32(opts->ts->ts_val), TCP_MSS);
+    send_control(c, TCP_SYN | TCP_ACK | ecn_flags, opts->ts != NULL,
+        (opts->ts != NULL ? f_beui32(opts->ts->ts_val) : 0),
+        mss_local(c->ip6),
+        (c->flags & NICIF_CONN_SACK) == NICIF_CONN_SACK,
+        (c->remote_wscale >= 0 ? c->local_wscale : -1));
   } else if (c->status == CONN_OPEN &&
-      (TCPH_FLAGS(&p->tcp) & TCP_SYN) == TCP_SYN)
+      (TCPH_FLAGS(s->tcp) & TCP_SYN) == TCP_SYN)
   {
     /* silently ignore a re-transmited SYN_ACK */
   } else if (c->status == CONN_CLOSED &&
-      (TCPH_FLAGS(&p->tcp) & TCP_FIN) == TCP_FIN)
+      (TCPH_FLAGS(s->tcp) & TCP_FIN) == TCP_FIN)
   {
    /* silently ignore a FIN for an already closed connection: TODO figure out
     * why necessary*/
-    send_control(c, TCP_ACK, 1, 0, 0);
+    send_control(c, TCP_ACK, (c->flags & NICIF_CONN_TS) == NICIF_CONN_TS, 0,
+        0, 0, -1);
   } else {
     fprintf(stderr, "tcp_packet: unexpected connection state %u\n", c->status);
   }
@@ -527,41 +568,57 @@ static int conn_arp_done(struct connection *conn)
   conn_timeout_arm(conn, TO_TCP_HANDSHAKE);
 
   /* send SYN */
-  send_control(conn, TCP_SYN | TCP_ECE | TCP_CWR, 1, 0, TCP_MSS);
+  send_control(conn, TCP_SYN | TCP_ECE | TCP_CWR, 1, 0, mss_local(conn->ip6),
+      1, conn->local_wscale);
 
   CONN_DEBUG0(conn, "SYN SENT\n");
   return 0;
 }
 
-static int conn_syn_sent_packet(struct connection *c, const struct pkt_tcp *p,
+static int conn_syn_sent_packet(struct connection *c, const struct tcp_seg *s,
     const struct tcp_opts *opts)
 {
-  uint32_t ecn_flags = TCPH_FLAGS(&p->tcp) & (TCP_ECE | TCP_CWR);
+  uint32_t ecn_flags = TCPH_FLAGS(s->tcp) & (TCP_ECE | TCP_CWR);
 
   /* dis-arm timeout */
   conn_timeout_disarm(c);
 
-  if ((TCPH_FLAGS(&p->tcp) & (TCP_SYN | TCP_ACK)) != (TCP_SYN | TCP_ACK)) {
+  if ((TCPH_FLAGS(s->tcp) & (TCP_SYN | TCP_ACK)) != (TCP_SYN | TCP_ACK)) {
     fprintf(stderr, "conn_syn_sent_packet: unexpected flags %x\n",
-        TCPH_FLAGS(&p->tcp));
-    return -1;
-  }
-  if (opts->ts == NULL) {
-    fprintf(stderr, "conn_syn_sent_packet: no timestamp option received\n");
+        TCPH_FLAGS(s->tcp));
     return -1;
   }
-
   CONN_DEBUG0(c, "conn_syn_sent_packet: syn-ack received\n");
 
-  c->remote_seq = f_beui32(p->tcp.seqno) + 1;
-  c->local_seq = f_beui32(p->tcp.ackno);
-  c->syn_ts = f_beui32(opts->ts->ts_val);
+  c->remote_seq = f_beui32(s->tcp->seqno) + 1;
+  c->local_seq = f_beui32(s->tcp->ackno);
 
   /* enable ECN if SYN-ACK confirms */
   if (ecn_flags == TCP_ECE) {
     c->flags |= NICIF_CONN_ECN;
   }
 
+  /* enable SACK if SYN-ACK confirms */
+  if (opts->sack_perm != NULL) {
+    c->flags |= NICIF_CONN_SACK;
+  }
+
+  /* timestamps only if SYN-ACK confirms */
+  if (opts->ts != NULL) {
+    c->flags |= NICIF_CONN_TS;
+    c->syn_ts = f_beui32(opts->ts->ts_val);
+  }
+
+  /* window scaling only if SYN-ACK confirms */
+  if (opts->wscale != NULL) {
+    c->remote_wscale = MIN(opts->wscale->shift, TCP_WSCALE_MAX);
+  }
+
+  /* MSS from SYN-ACK, otherwise the default applies */
+  if (opts->mss != NULL) {
+    c->remote_mss = MAX(f_beui16(opts->mss->mss), TCP_MSS_MIN);
+  }
+
   cc_conn_init(c);
 
   c->comp.q = &conn_async_q;
@@ -569,9 +626,13 @@ static int conn_syn_sent_packet(struct connection *c, const struct pkt_tcp *p,
   c->comp.status = 0;
 
   if (nicif_connection_add(c->db_id, c->remote_mac, c->local_ip, c->local_port,
-        c->remote_ip, c->remote_port, c->rx_buf - (uint8_t *) tas_shm,
+        c->remote_ip, c->remote_port, conn_ip6(c),
+        c->rx_buf - (uint8_t *) tas_shm,
         c->rx_len, c->tx_buf - (uint8_t *) tas_shm, c->tx_len,
-        c->remote_seq, c->local_seq, c->opaque, c->flags, c->cc_rate,
+        c->remote_seq, c->local_seq, c->opaque, c->flags,
+        (c->remote_wscale >= 0 ? c->remote_wscale : 0),
+        (c->remote_wscale >= 0 ? c->local_wscale : 0), conn_mss(c),
+        cc_conn_rate(c),
         c->fn_core, c->flow_group, &c->flow_id)
       != 0)
   {
@@ -584,7 +645,8 @@ static int conn_syn_sent_packet(struct connection *c, const struct pkt_tcp *p,
   c->status = CONN_OPEN;
 
   /* send ACK */
-  send_control(c, TCP_ACK, 1, c->syn_ts, 0);
+  send_control(c, TCP_ACK, (c->flags & NICIF_CONN_TS) == NICIF_CONN_TS,
+      c->syn_ts, 0, 0, -1);
 
   CONN_DEBUG0(c, "conn_syn_sent_packet: ACK sent\n");
 
@@ -604,7 +666,11 @@ static int conn_reg_synack(struct connection *c)
   }
 
   /* send ACK */
-  send_control(c, TCP_SYN | TCP_ACK | ecn_flags, 1, c->syn_ts, TCP_MSS);
+  send_control(c, TCP_SYN | TCP_ACK | ecn_flags,
+      (c->flags & NICIF_CONN_TS) == NICIF_CONN_TS, c->syn_ts,
+      mss_local(c->ip6),
+      (c->flags & NICIF_CONN_SACK) == NICIF_CONN_SACK,
+      (c->remote_wscale >= 0 ? c->local_wscale : -1));
 
   appif_accept_conn(c, 0);
 
@@ -659,6 +725,12 @@ static inline struct connection *conn_alloc(void)
   conn->tx_buf = (uint8_t *) tas_shm + off_tx;
   conn->tx_len = config.tcp_txbuf_len;
   conn->to_armed = 0;
+  conn->ip6 = 0;
+  conn->remote_wscale = -1;
+  conn->local_wscale = wscale_for(conn->rx_len);
+  conn->remote_mss = TCP_MSS_DEFAULT;
+  conn->cc_rate_cap = 0;
+  conn->cc_rate_dirty = 0;
 
   return conn;
 }
@@ -677,12 +749,37 @@ static inline uint32_t conn_hash(uint32_t l_ip, uint32_t r_ip, uint16_t l_po,
       crc32c_sse42_u64(l_ip | (((uint64_t) r_ip) << 32), 0));
 }
 
+static inline uint32_t conn_hash6(const ip6_addr_t *l_ip,
+    const ip6_addr_t *r_ip, uint16_t l_po, uint16_t r_po)
+{
+  uint32_t h = conn_hash(0, 0, l_po, r_po);
+
+  h = rte_hash_crc(l_ip, sizeof(*l_ip), h);
+  return rte_hash_crc(r_ip, sizeof(*r_ip), h);
+}
+
+static inline uint32_t conn_ht_bucket(const struct connection *conn)
+{
+  if (conn->ip6) {
+    return conn_hash6(&conn->ip6_addrs.local_ip, &conn->ip6_addrs.remote_ip,
+        conn->local_port, conn->remote_port) % TCP_HTSIZE;
+  }
+  return conn_hash(conn->local_ip, conn->remote_ip, conn->local_port,
+      conn->remote_port) % TCP_HTSIZE;
+}
+
+/* IPv6 addresses for nicif_connection_add(), NULL for IPv4 connections */
+static inline const struct flextcp_pl_flowip6 *conn_ip6(
+    const struct connection *conn)
+{
+  return (conn->ip6 ? &conn->ip6_addrs : NULL);
+}
+
 static void conn_register(struct connection *conn)
 {
   uint32_t h;
 
-  h = conn_hash(conn->local_ip, conn->remote_ip, conn->local_port,
-      conn->remote_port) % TCP_HTSIZE;
+  h = conn_ht_bucket(conn);
 
   conn->ht_next = tcp_hashtable[h];
   tcp_hashtable[h] = conn;
@@ -693,8 +790,7 @@ static void conn_unregister(struct connection *conn)
   struct connection *cp = NULL;
   uint32_t h;
 
-  h = conn_hash(conn->local_ip, conn->remote_ip, conn->local_port,
-      conn->remote_port) % TCP_HTSIZE;
+  h = conn_ht_bucket(conn);
   if (tcp_hashtable[h] == conn) {
     tcp_hashtable[h] = conn->ht_next;
   } else {
@@ -709,18 +805,26 @@ static void conn_unregister(struct connection *conn)
   }
 }
 
-static struct connection *conn_lookup(const struct pkt_tcp *p)
+static struct connection *conn_lookup(const struct tcp_seg *s)
 {
   uint32_t h;
   struct connection *c;
+  int ip6 = (s->src_ip6 != NULL);
 
-  h = conn_hash(f_beui32(p->ip.dest), f_beui32(p->ip.src),
-      f_beui16(p->tcp.dest), f_beui16(p->tcp.src)) % TCP_HTSIZE;
+  if (ip6) {
+    h = conn_hash6(s->dst_ip6, s->src_ip6, f_beui16(s->tcp->dest),
+        f_beui16(s->tcp->src)) % TCP_HTSIZE;
+  } else {
+    h = conn_hash(s->dst_ip, s->src_ip, f_beui16(s->tcp->dest),
+        f_beui16(s->tcp->src)) % TCP_HTSIZE;
+  }
 
   for (c = tcp_hashtable[h]; c != NULL; c = c->ht_next) {
-    if (f_beui32(p->ip.src) == c->remote_ip &&
-        f_beui16(p->tcp.dest) == c->local_port &&
-        f_beui16(p->tcp.src) == c->remote_port)
+    if (c->ip6 == ip6 && s->src_ip == c->remote_ip &&
+        f_beui16(s->tcp->dest) == c->local_port &&
+        f_beui16(s->tcp->src) == c->remote_port &&
+        (!ip6 || memcmp(s->src_ip6, &c->ip6_addrs.remote_ip,
+                        sizeof(*s->src_ip6)) == 0))
     {
       return c;
     }
@@ -800,10 +904,10 @@ static inline uint32_t hash_64_to_32(uint64_t key)
   return (uint32_t) key;
 }
 
-static struct listener *listener_lookup(const struct pkt_tcp *p)
+static struct listener *listener_lookup(const struct tcp_seg *s)
 {
-  uint16_t local_port = f_beui16(p->tcp.dest);
-  uint32_t hash;
+  uint16_t local_port = f_beui16(s->tcp->dest);
+  uint32_t hash, src_ip;
   uint8_t type;
   struct listen_multi *lm;
 
@@ -814,8 +918,10 @@ static struct listener *listener_lookup(const struct pkt_tcp *p)
   } else if (type == PORT_TYPE_LMULTI) {
     /* multiple listener sockets, calculate hash */
     lm = (struct listen_multi *) (ports[local_port] & ~PORT_TYPE_MASK);
-    hash = hash_64_to_32(((uint64_t) f_beui32(p->ip.src) << 32) |
-        ((uint32_t) f_beui16(p->tcp.src) << 16) | local_port);
+    src_ip = (s->src_ip6 != NULL ?
+        rte_hash_crc(s->src_ip6, sizeof(*s->src_ip6), 0) : s->src_ip);
+    hash = hash_64_to_32(((uint64_t) src_ip << 32) |
+        ((uint32_t) f_beui16(s->tcp->src) << 16) | local_port);
     return lm->ls[hash % lm->num];
   } else {
     return NULL;
@@ -824,23 +930,23 @@ static struct listener *listener_lookup(const struct pkt_tcp *p)
   return (struct listener *) (ports[local_port] & ~PORT_TYPE_MASK);
 }
 
-static void listener_packet(struct listener *l, const struct pkt_tcp *p,
+static void listener_packet(struct listener *l, const struct tcp_seg *s,
     const struct tcp_opts *opts, uint32_t fn_core, uint16_t flow_group)
 {
   struct backlog_slot *bls;
   uint16_t len;
   uint32_t bp, n;
-  struct pkt_tcp *bl_p;
+  struct tcp_seg bl_s;
 
-  if ((TCPH_FLAGS(&p->tcp) & ~(TCP_ECE | TCP_CWR)) != TCP_SYN) {
+  if ((TCPH_FLAGS(s->tcp) & ~(TCP_ECE | TCP_CWR)) != TCP_SYN) {
     fprintf(stderr, "listener_packet: Not a SYN (flags %x)\n",
-            TCPH_FLAGS(&p->tcp));
-    send_reset(p, opts);
+            TCPH_FLAGS(s->tcp));
+    send_reset(s, opts);
     return;
   }
 
   /* make sure packet is not too long */
-  len = sizeof(p->eth) + f_beui16(p->ip.len);
+  len = s->len;
   if (len > sizeof(bls->buf)) {
     fprintf(stderr, "listener_packet: SYN larger than backlog buffer, "
         "dropping\n");
@@ -852,11 +958,8 @@ static void listener_packet(struct listener *l, const struct pkt_tcp *p,
       n++, bp = (bp + 1) % l->backlog_len)
   {
     bls = l->backlog_ptrs[bp];
-    bl_p = (struct pkt_tcp *) bls->buf;
-    if (f_beui32(p->ip.src) == f_beui32(bl_p->ip.src) &&
-        f_beui32(p->ip.dest) == f_beui32(bl_p->ip.dest) &&
-        f_beui16(p->tcp.src) == f_beui16(bl_p->tcp.src) &&
-        f_beui16(p->tcp.dest) == f_beui16(bl_p->tcp.dest))
+    if (seg_parse(&bl_s, bls->buf, bls->len) == 0 &&
+        seg_same_flow(s, &bl_s))
     {
       return;
     }
@@ -877,12 +980,12 @@ static void listener_packet(struct listener *l, const struct pkt_tcp *p,
   l->backlog_cores[bp] = fn_core;
   l->backlog_fgs[bp] = flow_group;
   bls = l->backlog_ptrs[bp];
-  memcpy(bls->buf, p, len);
+  memcpy(bls->buf, s->eth, len);
   bls->len = len;
 
   l->backlog_used++;
 
-  appif_listen_newconn(l, f_beui32(p->ip.src), f_beui16(p->tcp.src));
+  appif_listen_newconn(l, s->src_ip, s->src_ip6, f_beui16(s->tcp->src));
 
   /* check if there are pending accepts */
   if (l->wait_conns != NULL) {
@@ -894,7 +997,7 @@ static void listener_accept(struct listener *l)
 {
   struct connection *c = l->wait_conns;
   struct backlog_slot *bls;
-  const struct pkt_tcp *p;
+  struct tcp_seg s;
   struct tcp_opts opts;
   uint32_t ecn_flags, fn_core;
   uint16_t flow_group;
@@ -906,33 +1009,63 @@ static void listener_accept(struct listener *l)
   bls = l->backlog_ptrs[l->backlog_pos];
   fn_core = l->backlog_cores[l->backlog_pos];
   flow_group = l->backlog_fgs[l->backlog_pos];
-  p = (const struct pkt_tcp *) bls->buf;
-  ret = parse_options(p, bls->len, &opts);
-  if (ret != 0 || opts.ts == NULL) {
-    fprintf(stderr, "listener_packet: parsing options failed or no timestamp "
-        "option\n");
+  ret = seg_parse(&s, bls->buf, bls->len);
+  if (ret == 0) {
+    ret = parse_options(&s, &opts);
+  }
+  if (ret != 0) {
+    fprintf(stderr, "listener_packet: parsing options failed\n");
     goto out;
   }
 
   c->fn_core = fn_core;
   c->flow_group = flow_group;
   c->remote_mac = 0;
-  memcpy(&c->remote_mac, &p->eth.src, ETH_ADDR_LEN);
-  c->remote_ip = f_beui32(p->ip.src);
-  c->local_ip = config.ip;
-  c->remote_port = f_beui16(p->tcp.src);
+  memcpy(&c->remote_mac, &s.eth->src, ETH_ADDR_LEN);
+  if (s.src_ip6 != NULL) {
+    c->ip6 = 1;
+    c->remote_ip = 0;
+    c->local_ip = 0;
+    c->ip6_addrs.local_ip = *s.dst_ip6;
+    c->ip6_addrs.remote_ip = *s.src_ip6;
+  } else {
+    c->ip6 = 0;
+    c->remote_ip = s.src_ip;
+    c->local_ip = config.ip;
+  }
+  c->remote_port = f_beui16(s.tcp->src);
   c->local_port = l->port;
 
-  c->remote_seq = f_beui32(p->tcp.seqno) + 1;
+  c->remote_seq = f_beui32(s.tcp->seqno) + 1;
   c->local_seq = 1; /* TODO: generate random */
-  c->syn_ts = f_beui32(opts.ts->ts_val);
 
   /* check if ECN is offered */
-  ecn_flags = TCPH_FLAGS(&p->tcp) & (TCP_ECE | TCP_CWR);
+  ecn_flags = TCPH_FLAGS(s.tcp) & (TCP_ECE | TCP_CWR);
   if (ecn_flags == (TCP_ECE | TCP_CWR)) {
     c->flags |= NICIF_CONN_ECN;
   }
 
+  /* check if SACK is offered */
+  if (opts.sack_perm != NULL) {
+    c->flags |= NICIF_CONN_SACK;
+  }
+
+  /* check if timestamps are offered */
+  if (opts.ts != NULL) {
+    c->flags |= NICIF_CONN_TS;
+    c->syn_ts = f_beui32(opts.ts->ts_val);
+  }
+
+  /* check if window scaling is offered */
+  if (opts.wscale != NULL) {
+    c->remote_wscale = MIN(opts.wscale->shift, TCP_WSCALE_MAX);
+  }
+
+  /* MSS offered with SYN, otherwise the default applies */
+  if (opts.mss != NULL) {
+    c->remote_mss = MAX(f_beui16(opts.mss->mss), TCP_MSS_MIN);
+  }
+
   cc_conn_init(c);
 
   c->status = CONN_REG_SYNACK;
@@ -942,9 +1075,13 @@ static void listener_accept(struct listener *l)
   c->comp.status = 0;
 
   if (nicif_connection_add(c->db_id, c->remote_mac, c->local_ip, c->local_port,
-        c->remote_ip, c->remote_port, c->rx_buf - (uint8_t *) tas_shm,
+        c->remote_ip, c->remote_port, conn_ip6(c),
+        c->rx_buf - (uint8_t *) tas_shm,
         c->rx_len, c->tx_buf - (uint8_t *) tas_shm, c->tx_len,
-        c->remote_seq, c->local_seq + 1, c->opaque, c->flags, c->cc_rate,
+        c->remote_seq, c->local_seq + 1, c->opaque, c->flags,
+        (c->remote_wscale >= 0 ? c->remote_wscale : 0),
+        (c->remote_wscale >= 0 ? c->local_wscale : 0), conn_mss(c),
+        cc_conn_rate(c),
         c->fn_core, c->flow_group, &c->flow_id)
       != 0)
   {
@@ -965,126 +1102,268 @@ out:
 }
 
 static inline int send_control_raw(uint64_t remote_mac, uint32_t remote_ip,
-    uint16_t remote_port, uint16_t local_port, uint32_t local_seq,
-    uint32_t remote_seq, uint16_t flags, int ts_opt, uint32_t ts_echo,
-    uint16_t mss_opt)
+    const struct flextcp_pl_flowip6 *ip6, uint16_t remote_port,
+    uint16_t local_port, uint32_t local_seq, uint32_t remote_seq,
+    uint16_t flags, int ts_opt, uint32_t ts_echo, uint16_t mss_opt,
+    int sack_perm_opt, int wscale_opt)
 {
   uint32_t new_tail;
-  struct pkt_tcp *p;
+  uint8_t *buf, *opts;
+  struct eth_hdr *eth;
+  struct ip_hdr *iph;
+  struct ip6_hdr *ip6h;
+  struct tcp_hdr *th;
   struct tcp_mss_opt *opt_mss;
+  struct tcp_sack_perm_opt *opt_sack_perm;
   struct tcp_timestamp_opt *opt_ts;
+  struct tcp_wscale_opt *opt_wscale;
   uint8_t optlen;
-  uint16_t len, off_ts, off_mss;
+  uint16_t len, hdrs_len, off_ts, off_mss, off_sack_perm, off_wscale;
 
   /* calculate header length depending on options */
   optlen = 0;
   off_mss = optlen;
   optlen += (mss_opt ? sizeof(*opt_mss) : 0);
+  off_sack_perm = optlen;
+  optlen += (sack_perm_opt ? sizeof(*opt_sack_perm) : 0);
   off_ts = optlen;
   optlen += (ts_opt ? sizeof(*opt_ts) : 0);
+  /* window scale option is preceded by a NOP */
+  off_wscale = optlen + 1;
+  optlen += (wscale_opt >= 0 ? sizeof(*opt_wscale) + 1 : 0);
   optlen = (optlen + 3) & ~3;
-  len = sizeof(*p) + optlen;
+  hdrs_len = (ip6 != NULL ? sizeof(struct pkt_tcp6) : sizeof(struct pkt_tcp));
+  len = hdrs_len + optlen;
 
   /** allocate send buffer */
-  if (nicif_tx_alloc(len, (void **) &p, &new_tail) != 0) {
+  if (nicif_tx_alloc(len, (void **) &buf, &new_tail) != 0) {
     fprintf(stderr, "send_control failed\n");
     return -1;
   }
+  eth = (struct eth_hdr *) buf;
+  th = (struct tcp_hdr *) (buf + hdrs_len - sizeof(*th));
+  opts = (uint8_t *) (th + 1);
 
   /* fill ethernet header */
-  memcpy(&p->eth.dest, &remote_mac, ETH_ADDR_LEN);
-  memcpy(&p->eth.src, &eth_addr, ETH_ADDR_LEN);
-  p->eth.type = t_beui16(ETH_TYPE_IP);
-
-  /* fill ipv4 header */
-  IPH_VHL_SET(&p->ip, 4, 5);
-  p->ip._tos = 0;
-  p->ip.len = t_beui16(len - offsetof(struct pkt_tcp, ip));
-  p->ip.id = t_beui16(3); /* TODO: not sure why we have 3 here */
-  p->ip.offset = t_beui16(0);
-  p->ip.ttl = 0xff;
-  p->ip.proto = IP_PROTO_TCP;
-  p->ip.chksum = 0;
-  p->ip.src = t_beui32(config.ip);
-  p->ip.dest = t_beui32(remote_ip);
+  memcpy(&eth->dest, &remote_mac, ETH_ADDR_LEN);
+  memcpy(&eth->src, &eth_addr, ETH_ADDR_LEN);
+
+  if (ip6 != NULL) {
+    /* fill ipv6 header */
+    ip6h = (struct ip6_hdr *) (eth + 1);
+    eth->type = t_beui16(ETH_TYPE_IPV6);
+    IP6H_VTCFL_SET(ip6h, 6, 0, 0);
+    ip6h->len = t_beui16(len - hdrs_len + sizeof(*th));
+    ip6h->next_hdr = IP_PROTO_TCP;
+    ip6h->hop_limit = 0xff;
+    ip6h->src = ip6->local_ip;
+    ip6h->dest = ip6->remote_ip;
+  } else {
+    /* fill ipv4 header */
+    iph = (struct ip_hdr *) (eth + 1);
+    eth->type = t_beui16(ETH_TYPE_IP);
+    IPH_VHL_SET(iph, 4, 5);
+    iph->_tos = 0;
+    iph->len = t_beui16(len - sizeof(*eth));
+    iph->id = t_beui16(3); /* TODO: not sure why we have 3 here */
+    iph->offset = t_beui16(0);
+    iph->ttl = 0xff;
+    iph->proto = IP_PROTO_TCP;
+    iph->chksum = 0;
+    iph->src = t_beui32(config.ip);
+    iph->dest = t_beui32(remote_ip);
+  }
 
   /* fill tcp header */
-  p->tcp.src = t_beui16(local_port);
-  p->tcp.dest = t_beui16(remote_port);
-  p->tcp.seqno = t_beui32(local_seq);
-  p->tcp.ackno = t_beui32(remote_seq);
-  TCPH_HDRLEN_FLAGS_SET(&p->tcp, 5 + optlen / 4, flags);
-  p->tcp.wnd = t_beui16(11680); /* TODO */
-  p->tcp.chksum = 0;
-  p->tcp.urgp = t_beui16(0);
+  th->src = t_beui16(local_port);
+  th->dest = t_beui16(remote_port);
+  th->seqno = t_beui32(local_seq);
+  th->ackno = t_beui32(remote_seq);
+  TCPH_HDRLEN_FLAGS_SET(th, 5 + optlen / 4, flags);
+  th->wnd = t_beui16(11680); /* TODO */
+  th->chksum = 0;
+  th->urgp = t_beui16(0);
+
+  /* zero padding after options */
+  memset(opts, 0, optlen);
 
   /* if requested: add mss option */
   if (mss_opt) {
-    opt_mss = (struct tcp_mss_opt *) ((uint8_t *) (p + 1) + off_mss);
+    opt_mss = (struct tcp_mss_opt *) (opts + off_mss);
     opt_mss->kind = TCP_OPT_MSS;
     opt_mss->length = sizeof(*opt_mss);
     opt_mss->mss = t_beui16(mss_opt);
   }
 
+  /* if requested: add sack permitted option */
+  if (sack_perm_opt) {
+    opt_sack_perm = (struct tcp_sack_perm_opt *) (opts + off_sack_perm);
+    opt_sack_perm->kind = TCP_OPT_SACK_PERM;
+    opt_sack_perm->length = sizeof(*opt_sack_perm);
+  }
+
   /* if requested: add timestamp option */
   if (ts_opt) {
-    opt_ts = (struct tcp_timestamp_opt *) ((uint8_t *) (p + 1) + off_ts);
-    memset(opt_ts, 0, optlen);
+    opt_ts = (struct tcp_timestamp_opt *) (opts + off_ts);
     opt_ts->kind = TCP_OPT_TIMESTAMP;
     opt_ts->length = sizeof(*opt_ts);
     opt_ts->ts_val = t_beui32(0);
     opt_ts->ts_ecr = t_beui32(ts_echo);
   }
 
+  /* if requested: add window scale option */
+  if (wscale_opt >= 0) {
+    *(opts + off_wscale - 1) = TCP_OPT_NO_OP;
+    opt_wscale = (struct tcp_wscale_opt *) (opts + off_wscale);
+    opt_wscale->kind = TCP_OPT_WSCALE;
+    opt_wscale->length = sizeof(*opt_wscale);
+    opt_wscale->shift = wscale_opt;
+  }
+
   /* calculate header checksums */
-  p->ip.chksum = rte_ipv4_cksum((void *) &p->ip);
-  p->tcp.chksum = rte_ipv4_udptcp_cksum((void *) &p->ip, (void *) &p->tcp);
-  
+  if (ip6 != NULL) {
+    th->chksum = rte_ipv6_udptcp_cksum((void *) ip6h, (void *) th);
+  } else {
+    iph->chksum = rte_ipv4_cksum((void *) iph);
+    th->chksum = rte_ipv4_udptcp_cksum((void *) iph, (void *) th);
+  }
+
   /* send packet */
   nicif_tx_send(new_tail, 0);
   return 0;
 }
 
 static inline int send_control(const struct connection *conn, uint16_t flags,
-    int ts_opt, uint32_t ts_echo, uint16_t mss_opt)
+    int ts_opt, uint32_t ts_echo, uint16_t mss_opt, int sack_perm_opt,
+    int wscale_opt)
 {
-  return send_control_raw(conn->remote_mac, conn->remote_ip, conn->remote_port,
-      conn->local_port, conn->local_seq, conn->remote_seq, flags, ts_opt,
-      ts_echo, mss_opt);
+  return send_control_raw(conn->remote_mac, conn->remote_ip, conn_ip6(conn),
+      conn->remote_port, conn->local_port, conn->local_seq, conn->remote_seq,
+      flags, ts_opt, ts_echo, mss_opt, sack_perm_opt, wscale_opt);
 }
 
-static inline int send_reset(const struct pkt_tcp *p,
+static inline int send_reset(const struct tcp_seg *s,
     const struct tcp_opts *opts)
 {
   int ts_opt = 0;
   uint32_t ts_val;
   uint64_t remote_mac = 0;
+  struct flextcp_pl_flowip6 ip6;
 
   if (opts->ts != NULL) {
     ts_opt = 1;
     ts_val = f_beui32(opts->ts->ts_val);
   }
 
-  memcpy(&remote_mac, &p->eth.src, ETH_ADDR_LEN);
-  return send_control_raw(remote_mac, f_beui32(p->ip.src), f_beui16(p->tcp.src),
-      f_beui16(p->tcp.dest), f_beui32(p->tcp.ackno), f_beui32(p->tcp.seqno) + 1,
-      TCP_RST | TCP_ACK, ts_opt, ts_val, 0);
+  if (s->src_ip6 != NULL) {
+    ip6.local_ip = *s->dst_ip6;
+    ip6.remote_ip = *s->src_ip6;
+  }
+
+  memcpy(&remote_mac, &s->eth->src, ETH_ADDR_LEN);
+  return send_control_raw(remote_mac, s->src_ip,
+      (s->src_ip6 != NULL ? &ip6 : NULL), f_beui16(s->tcp->src),
+      f_beui16(s->tcp->dest), f_beui32(s->tcp->ackno),
+      f_beui32(s->tcp->seqno) + 1, TCP_RST | TCP_ACK, ts_opt, ts_val, 0, 0,
+      -1);
 }
 
-static inline int parse_options(const struct pkt_tcp *p, uint16_t len,
+/* Parse ethernet, IP, and TCP header of a received packet. Only packets to
+ * the local IPv4 or IPv6 address are accepted. */
+static inline int seg_parse(struct tcp_seg *s, const void *pkt, uint16_t len)
+{
+  const struct pkt_tcp *p = pkt;
+  const struct pkt_tcp6 *p6 = pkt;
+  uint16_t hdrs_len;
+
+  s->eth = &p->eth;
+  if (f_beui16(p->eth.type) == ETH_TYPE_IPV6) {
+    hdrs_len = offsetof(struct pkt_tcp6, tcp);
+    if (len < sizeof(*p6)) {
+      fprintf(stderr, "tcp_packet: incomplete TCP receive (%u received, "
+          "%u expected)\n", len, (unsigned) sizeof(*p6));
+      return -1;
+    }
+
+    if (!config.ip6_enabled ||
+        memcmp(&p6->ip6.dest, config.ip6, sizeof(p6->ip6.dest)) != 0)
+    {
+      fprintf(stderr, "tcp_packet: unexpected destination IPv6 address\n");
+      return -1;
+    }
+
+    s->tcp = &p6->tcp;
+    s->src_ip = s->dst_ip = 0;
+    s->src_ip6 = &p6->ip6.src;
+    s->dst_ip6 = &p6->ip6.dest;
+    s->l4len = f_beui16(p6->ip6.len);
+  } else {
+    hdrs_len = offsetof(struct pkt_tcp, tcp);
+    if (len < sizeof(*p) ||
+        f_beui16(p->ip.len) < sizeof(p->ip) + sizeof(p->tcp))
+    {
+      fprintf(stderr, "tcp_packet: incomplete TCP receive (%u received, "
+          "%u expected)\n", len, (unsigned) sizeof(*p));
+      return -1;
+    }
+
+    if (f_beui32(p->ip.dest) != config.ip) {
+      fprintf(stderr, "tcp_packet: unexpected destination IP (%x received, "
+          "%x expected)\n", f_beui32(p->ip.dest), config.ip);
+      return -1;
+    }
+
+    s->tcp = &p->tcp;
+    s->src_ip = f_beui32(p->ip.src);
+    s->dst_ip = f_beui32(p->ip.dest);
+    s->src_ip6 = s->dst_ip6 = NULL;
+    s->l4len = f_beui16(p->ip.len) - sizeof(p->ip);
+  }
+
+  if (s->l4len < sizeof(*s->tcp) || hdrs_len + s->l4len > len) {
+    fprintf(stderr, "tcp_packet: incomplete TCP receive (%u received, "
+        "%u expected)\n", len, hdrs_len + s->l4len);
+    return -1;
+  }
+  s->len = hdrs_len + s->l4len;
+
+  return 0;
+}
+
+/* check if two segments have the same addresses and ports */
+static inline int seg_same_flow(const struct tcp_seg *a,
+    const struct tcp_seg *b)
+{
+  if ((a->src_ip6 != NULL) != (b->src_ip6 != NULL) ||
+      a->src_ip != b->src_ip || a->dst_ip != b->dst_ip ||
+      a->tcp->src.x != b->tcp->src.x || a->tcp->dest.x != b->tcp->dest.x)
+  {
+    return 0;
+  }
+
+  return a->src_ip6 == NULL ||
+    (memcmp(a->src_ip6, b->src_ip6, sizeof(*a->src_ip6)) == 0 &&
+     memcmp(a->dst_ip6, b->dst_ip6, sizeof(*a->dst_ip6)) == 0);
+}
+
+static inline int parse_options(const struct tcp_seg *s,
     struct tcp_opts *opts)
 {
-  uint8_t *opt = (uint8_t *) (p + 1);
-  uint16_t opts_len = TCPH_HDRLEN(&p->tcp) * 4 - 20;
+  const struct tcp_hdr *th = s->tcp;
+  uint8_t *opt = (uint8_t *) (th + 1);
+  uint16_t opts_len = TCPH_HDRLEN(th) * 4 - 20;
   uint16_t off = 0;
   uint8_t opt_kind, opt_len, opt_avail;
 
   opts->ts = NULL;
   opts->mss = NULL;
+  opts->wscale = NULL;
+  opts->sack_perm = NULL;
 
   /* whole header not in buf */
-  if (TCPH_HDRLEN(&p->tcp) < 5 || opts_len > (len - sizeof(*p))) {
-    fprintf(stderr, "hdrlen=%u opts_len=%u len=%u so=%zu\n", TCPH_HDRLEN(&p->tcp), opts_len, len, sizeof(*p));
+  if (TCPH_HDRLEN(th) < 5 || opts_len > (s->l4len - sizeof(*th))) {
+    fprintf(stderr, "hdrlen=%u opts_len=%u l4len=%u\n", TCPH_HDRLEN(th),
+        opts_len, s->l4len);
     return -1;
   }
 
@@ -1110,6 +1389,23 @@ static inline int parse_options(const struct pkt_tcp *p, uint16_t len,
         }
 
         opts->mss = (struct tcp_mss_opt *) (opt + off);
+      } else if (opt_kind == TCP_OPT_WSCALE) {
+        if (opt_len != sizeof(struct tcp_wscale_opt)) {
+          fprintf(stderr, "parse_options: window scale option size wrong "
+              "(expect %zu got %u)\n", sizeof(struct tcp_wscale_opt), opt_len);
+          return -1;
+        }
+
+        opts->wscale = (struct tcp_wscale_opt *) (opt + off);
+      } else if (opt_kind == TCP_OPT_SACK_PERM) {
+        if (opt_len != sizeof(struct tcp_sack_perm_opt)) {
+          fprintf(stderr, "parse_options: sack permitted option size wrong "
+              "(expect %zu got %u)\n", sizeof(struct tcp_sack_perm_opt),
+              opt_len);
+          return -1;
+        }
+
+        opts->sack_perm = (struct tcp_sack_perm_opt *) (opt + off);
       } else if (opt_kind == TCP_OPT_TIMESTAMP) {
         if (opt_len != sizeof(struct tcp_timestamp_opt)) {
           fprintf(stderr, "parse_options: opt_len=%u so=%zu\n", opt_len, sizeof(struct tcp_timestamp_opt));
@@ -1124,3 +1420,34 @@ static inline int parse_options(const struct pkt_tcp *p, uint16_t len,
 
   return 0;
 }
+
+/* smallest window scale shift that allows advertising a buffer of `len` bytes
+ * in the 16-bit window field */
+static inline uint8_t wscale_for(uint32_t len)
+{
+  uint8_t shift = 0;
+
+  while (shift < TCP_WSCALE_MAX && (len >> shift) > 0xFFFF) {
+    shift++;
+  }
+  return shift;
+}
+
+/* MSS offered to peers, derived from the link MTU */
+static inline uint16_t mss_local(int ip6)
+{
+  return config.ip_mtu - (ip6 ? sizeof(struct ip6_hdr) : sizeof(struct ip_hdr))
+    - sizeof(struct tcp_hdr);
+}
+
+/* payload per segment for the fast path: the smaller of both MSS values,
+ * minus the timestamp option if the fast path adds it to every segment */
+static inline uint16_t conn_mss(const struct connection *c)
+{
+  uint16_t mss = MIN(mss_local(c->ip6), c->remote_mss);
+
+  if ((c->flags & NICIF_CONN_TS) == NICIF_CONN_TS) {
+    mss -= FLEXNIC_PL_FLOWHDR_LEN - sizeof(struct pkt_tcp);
+  }
+  return mss;
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2019 University of Washington, Max Planck Institute for
+ * Software Systems, and The University of Texas at Austin
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Micro benchmark for the fast path queue manager: compares cost per
+ * qman_set and per fired queue for the skiplist and the timing wheel with an
+ * increasing number of active rate limited queues.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rte_config.h>
+#include <rte_eal.h>
+
+#include <tas.h>
+#include <tas_memif.h>
+#include <utils.h>
+#include <utils_rng.h>
+#include "../tas/include/config.h"
+#include "../tas/fast/internal.h"
+
+#define BATCH 64
+#define CHUNK 1448
+#define OPS (4 * 1024 * 1024)
+
+struct configuration config;
+struct flextcp_pl_mem *fp_state;
+
+static const unsigned num_queues[] = { 1024, 16 * 1024, 128 * 1024 };
+
+static void bench(enum config_qman impl, const char *name, unsigned n)
+{
+  struct dataplane_context *ctx;
+  struct utils_rng rng;
+  unsigned i, q_ids[BATCH];
+  uint16_t q_bytes[BATCH];
+  uint64_t start, t_set, t_poll, fired = 0, polls = 0;
+  int ret;
+
+  config.fp_qman = impl;
+  if ((ctx = calloc(1, sizeof(*ctx))) == NULL ||
+      qman_thread_init(ctx) != 0)
+  {
+    fprintf(stderr, "bench: initializing qman failed\n");
+    abort();
+  }
+  utils_rng_init(&rng, n);
+
+  /* activate all queues with rates between 1 and 10 Gbps */
+  start = util_rdtsc();
+  for (i = 0; i < n; i++) {
+    qman_set(&ctx->qman, i, 1000000 + utils_rng_gen32(&rng) % 9000001,
+        1 << 30, CHUNK, QMAN_SET_RATE | QMAN_SET_MAXCHUNK | QMAN_ADD_AVAIL);
+  }
+  t_set = util_rdtsc() - start;
+
+  /* fire queues, each fire re-inserts the queue */
+  start = util_rdtsc();
+  while (fired < OPS) {
+    ret = qman_poll(&ctx->qman, BATCH, q_ids, q_bytes);
+    fired += ret;
+    polls++;
+  }
+  t_poll = util_rdtsc() - start;
+
+  printf("%-8s queues=%6u set=%6.1f ns/op poll=%6.1f ns/queue "
+      "(%.1f queues/poll)\n", name, n,
+      (double) qman_timestamp(t_set) * 1000 / n,
+      (double) qman_timestamp(t_poll) * 1000 / fired,
+      (double) fired / polls);
+
+  free(ctx->qman.queues);
+  free(ctx);
+}
+
+int main(int argc, char *argv[])
+{
+  char *eal_argv[] = { argv[0], "--no-huge", "--no-pci", "-l", "0", NULL };
+  unsigned i;
+
+  /* all queues belong to app 0 without rate limit */
+  if ((fp_state = calloc(1, sizeof(*fp_state))) == NULL) {
+    fprintf(stderr, "bench: allocating flow state failed\n");
+    return EXIT_FAILURE;
+  }
+
+  if (rte_eal_init(5, eal_argv) < 0) {
+    fprintf(stderr, "bench: rte_eal_init failed\n");
+    return EXIT_FAILURE;
+  }
+
+  for (i = 0; i < sizeof(num_queues) / sizeof(num_queues[0]); i++) {
+    if (num_queues[i] > FLEXNIC_NUM_QMQUEUES)
+      continue;
+    bench(CONFIG_QMAN_SKIPLIST, "skiplist", num_queues[i]);
+    bench(CONFIG_QMAN_WHEEL, "wheel", num_queues[i]);
+  }
+
+  return EXIT_SUCCESS;
+}
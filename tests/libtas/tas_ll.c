@@ -135,6 +135,78 @@ static void test_connect_fail(void *p)
   test_assert("ctxev_conn", evs[0].ev.conn_open.conn == &conn);
 }
 
+static void test_connect_ip6(void *p)
+{
+  struct flextcp_context ctx;
+  struct flextcp_connection conn;
+  struct kernel_appout *ao;
+  uint8_t ip6[16] = { 0xfd, 0x00, [15] = 0x02 };
+  int n;
+
+  if (flextcp_init() != 0)
+    test_error("flextcp_init failed");
+
+  test_randinit(&ctx, sizeof(ctx));
+  if (flextcp_context_create(&ctx) != 0)
+    test_error("flextcp_context_create failed");
+
+  /* initiate connect */
+  test_randinit(&conn, sizeof(conn));
+  if (flextcp_connection_open6(&ctx, &conn, ip6, TEST_PORT) != 0)
+    test_error("flextcp_connection_open6 failed");
+
+  /* check aout entry carries the IPv6 address */
+  n = harness_aout_peek(&ao, 0);
+  test_assert("conn open request on aout", n == 0 &&
+      ao->type == KERNEL_APPOUT_CONN_OPEN);
+  test_assert("conn open ip6 flag",
+      ao->data.conn_open.flags == KERNEL_APPOUT_OPEN_IP6);
+  test_assert("conn open ip6 address",
+      memcmp(ao->data.conn_open.remote_ip6, ip6, sizeof(ip6)) == 0 &&
+      ao->data.conn_open.remote_ip == 0 &&
+      ao->data.conn_open.remote_port == TEST_PORT);
+  test_assert("connection remote ip", conn.remote_ip == 0);
+  harness_aout_pop(0);
+}
+
+static void test_listen_newconn_ip6(void *p)
+{
+  struct flextcp_context ctx;
+  struct flextcp_listener listener;
+  struct flextcp_event evs[4];
+  struct kernel_appin ai;
+  uint8_t ip6[16] = { 0xfd, 0x00, [15] = 0x03 };
+  int num;
+  int n;
+
+  if (flextcp_init() != 0)
+    test_error("flextcp_init failed");
+
+  test_randinit(&ctx, sizeof(ctx));
+  if (flextcp_context_create(&ctx) != 0)
+    test_error("flextcp_context_create failed");
+
+  /* push ain entry for new connection from IPv6 peer */
+  memset(&ai, 0, sizeof(ai));
+  ai.type = KERNEL_APPIN_LISTEN_NEWCONN;
+  ai.data.listen_newconn.opaque = (uintptr_t) &listener;
+  ai.data.listen_newconn.remote_port = TEST_PORT;
+  ai.data.listen_newconn.flags = KERNEL_APPIN_NEWCONN_IP6;
+  memcpy(ai.data.listen_newconn.remote_ip6, ip6, sizeof(ip6));
+  n = harness_ain_push(0, &ai);
+  test_assert("harness_ain_push success", n == 0);
+
+  num = flextcp_context_poll(&ctx, 4, evs);
+  test_assert("success 1 event", num == 1);
+  test_assert("ctxev_type", evs[0].event_type == FLEXTCP_EV_LISTEN_NEWCONN);
+  test_assert("ctxev_listener",
+      evs[0].ev.listen_newconn.listener == &listener);
+  test_assert("ctxev_port", evs[0].ev.listen_newconn.remote_port == TEST_PORT);
+  test_assert("ctxev_ip6", evs[0].ev.listen_newconn.ip6 &&
+      evs[0].ev.listen_newconn.remote_ip == 0 &&
+      memcmp(evs[0].ev.listen_newconn.remote_ip6, ip6, sizeof(ip6)) == 0);
+}
+
 static void test_full_rxbuf(void *p)
 {
   struct flextcp_context ctx;
@@ -365,6 +437,12 @@ int main(int argc, char *argv[])
   if (test_subcase("connect fail", test_connect_fail, NULL))
     ret = 1;
 
+  if (test_subcase("connect ipv6", test_connect_ip6, NULL))
+    ret = 1;
+
+  if (test_subcase("listen newconn ipv6", test_listen_newconn_ip6, NULL))
+    ret = 1;
+
   if (test_subcase("full rxbuf", test_full_rxbuf, NULL))
     ret = 1;
 
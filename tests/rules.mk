@@ -20,13 +20,25 @@ TESTS_SOCKETS := \
   tests/usocket_conntx_large \
   tests/usocket_move \
 
+# micro benchmarks linking against fast path objects
+TESTS_BENCH := \
+  tests/bench_qman \
+
 # automated unittests
 TESTS_AUTO := \
   tests/libtas/tas_ll \
   tests/libtas/tas_sockets \
-  tests/tas_unit/fastpath
+  tests/tas_unit/fastpath \
+  tests/tas_unit/qman \
+  tests/tas_unit/cc
+
+# asynchronous copies against a stub dma device, needs dmadev headers
+ifneq ($(DPDK_DMA_PMDS),)
+TESTS_AUTO += tests/tas_unit/dma
+endif
 
-TESTS := $(TESTS_NONE) $(TESTS_LIBTAS) $(TESTS_SOCKETS) $(TESTS_AUTO)
+TESTS := $(TESTS_NONE) $(TESTS_LIBTAS) $(TESTS_SOCKETS) $(TESTS_BENCH) \
+  $(TESTS_AUTO)
 TEST_OBJS := $(addsuffix .o, $(TESTS)) \
   tests/testutils.o tests/libtas/harness.o
 
@@ -63,6 +75,27 @@ tests/tas_unit/fastpath: LDLIBS+= -lrte_eal
 tests/tas_unit/fastpath: tests/tas_unit/fastpath.o tests/testutils.o \
   tas/fast/fast_flows.o
 
+tests/tas_unit/qman: CPPFLAGS+= -Itas/include $(DPDK_CPPFLAGS)
+tests/tas_unit/qman: CFLAGS+= $(DPDK_CFLAGS)
+tests/tas_unit/qman: LDFLAGS+= $(DPDK_LDFLAGS)
+tests/tas_unit/qman: LDLIBS+= -lrte_eal
+tests/tas_unit/qman: tests/tas_unit/qman.o tests/testutils.o $(LIB_UTILS_OBJS)
+
+tests/tas_unit/dma: CPPFLAGS+= -Itas/include $(DPDK_CPPFLAGS)
+tests/tas_unit/dma: CFLAGS+= $(DPDK_CFLAGS)
+tests/tas_unit/dma: LDFLAGS+= $(DPDK_LDFLAGS)
+tests/tas_unit/dma: LDLIBS+= -lrte_eal
+tests/tas_unit/dma: tests/tas_unit/dma.o tests/testutils.o
+
+tests/tas_unit/cc: CPPFLAGS+= -Itas/include
+tests/tas_unit/cc: tests/tas_unit/cc.o tests/testutils.o tas/slow/cc.o
+
+tests/bench_qman: CPPFLAGS+= -Itas/include $(DPDK_CPPFLAGS)
+tests/bench_qman: CFLAGS+= $(DPDK_CFLAGS)
+tests/bench_qman: LDFLAGS+= $(DPDK_LDFLAGS)
+tests/bench_qman: LDLIBS+= -lrte_eal
+tests/bench_qman: tests/bench_qman.o tas/fast/qman.o $(LIB_UTILS_OBJS)
+
 # build tests
 tests: $(TESTS)
 
@@ -71,6 +104,9 @@ run-tests: $(TESTS_AUTO)
 	tests/libtas/tas_ll
 	tests/libtas/tas_sockets
 	tests/tas_unit/fastpath
+	tests/tas_unit/qman
+	tests/tas_unit/cc
+	$(if $(DPDK_DMA_PMDS),tests/tas_unit/dma)
 
 DEPS += $(TEST_OBJS:.o=.d)
 CLEAN += $(TEST_OBJS) $(TESTS)
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../testutils.h"
+
+#include <tas.h>
+#include "../../tas/include/config.h"
+#include "../../tas/slow/internal.h"
+
+struct configuration config;
+struct kernel_statistics kstats;
+uint32_t cur_ts = 0;
+
+/* fast path queue accepts rate updates unless full */
+static int ktx_full = 0;
+static unsigned setrate_calls = 0;
+static uint32_t setrate_rate = 0;
+
+int nicif_connection_stats(uint32_t f_id,
+    struct nicif_connection_stats *p_stats)
+{
+  memset(p_stats, 0, sizeof(*p_stats));
+  return 0;
+}
+
+int nicif_connection_setrate(uint32_t f_id, uint16_t flow_group,
+    uint32_t rate)
+{
+  if (ktx_full)
+    return -1;
+
+  setrate_calls++;
+  setrate_rate = rate;
+  return 0;
+}
+
+int nicif_connection_retransmit(uint32_t f_id, uint16_t core)
+{
+  return 0;
+}
+
+/* Test that the application's pacing cap limits the congestion rate, also if
+ * congestion control leaves the flow unlimited. */
+void test_rate_cap(void *arg)
+{
+  struct connection c;
+
+  memset(&c, 0, sizeof(c));
+  test_assert("no cap, unlimited", cc_conn_rate(&c) == 0);
+
+  c.cc_rate = 10000;
+  test_assert("no cap", cc_conn_rate(&c) == 10000);
+
+  c.cc_rate_cap = 5000;
+  test_assert("cap below rate", cc_conn_rate(&c) == 5000);
+
+  c.cc_rate_cap = 20000;
+  test_assert("cap above rate", cc_conn_rate(&c) == 10000);
+
+  c.cc_rate = 0;
+  test_assert("cap with unlimited rate", cc_conn_rate(&c) == 20000);
+}
+
+/* Test that rate updates the fast path queue had no room for are retried. */
+void test_rate_retry(void *arg)
+{
+  struct connection c;
+
+  config.cc_algorithm = CONFIG_CC_CONST_RATE;
+  config.cc_const_rate = 0;
+  config.cc_control_interval = 2;
+  config.tcp_rtt_init = 50;
+
+  memset(&c, 0, sizeof(c));
+  cc_conn_init(&c);
+  c.status = CONN_OPEN;
+
+  ktx_full = 1;
+  test_assert("cap with full queue", cc_conn_setcap(&c, 3000) == 0 &&
+      c.cc_rate_dirty && setrate_calls == 0);
+  test_assert("dirty connection due now", cc_next_ts(cur_ts) == 0);
+
+  ktx_full = 0;
+  cc_poll(cur_ts);
+  test_assert("cap applied on retry", !c.cc_rate_dirty &&
+      setrate_calls == 1 && setrate_rate == 3000);
+
+  ktx_full = 1;
+  cur_ts += 1000;
+  cc_poll(cur_ts);
+  test_assert("cc update with full queue", c.cc_rate_dirty &&
+      setrate_calls == 1);
+
+  ktx_full = 0;
+  cc_poll(cur_ts);
+  test_assert("cc update applied on retry", !c.cc_rate_dirty &&
+      setrate_calls == 2 && setrate_rate == 3000);
+
+  cc_conn_remove(&c);
+}
+
+int main(int argc, char *argv[])
+{
+  int ret = 0;
+
+  if (test_subcase("rate cap", test_rate_cap, NULL))
+    ret = 1;
+
+  if (test_subcase("rate update retry", test_rate_retry, NULL))
+    ret = 1;
+
+  return ret;
+}
@@ -0,0 +1,252 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../testutils.h"
+
+#include <rte_config.h>
+#include <rte_dmadev.h>
+
+#include <tas.h>
+#include <tas_memif.h>
+#include "../../tas/include/config.h"
+#include "../../tas/fast/internal.h"
+
+/* Asynchronous copies are tested against a stub dma device plugged into the
+ * dmadev fast path ops, it only copies when the test completes its jobs. */
+
+#define STUB_RING 2048
+
+struct stub_job {
+  void *dst;
+  const void *src;
+  uint32_t len;
+  enum rte_dma_status_code st;
+};
+
+struct stub_dev {
+  struct stub_job jobs[STUB_RING];
+  /** ring index of next job, of next job to report */
+  uint16_t tail;
+  uint16_t head;
+  /** jobs done by the device but not reported yet */
+  uint16_t ready;
+  /** jobs the device accepts at most */
+  uint16_t cap;
+  /** fail next job enqueued */
+  int fail_next;
+  unsigned submits;
+};
+
+struct configuration config;
+void *tas_shm = (void *) 0;
+__thread struct dma_engine dma_engine = { .dev = -1 };
+
+static struct stub_dev stub;
+static struct rte_dma_fp_object stub_objs[1];
+struct rte_dma_fp_object *rte_dma_fp_objs;
+
+static int stub_copy(void *dev_private, uint16_t vchan, rte_iova_t src,
+    rte_iova_t dst, uint32_t length, uint64_t flags)
+{
+  struct stub_dev *s = dev_private;
+  struct stub_job *j;
+
+  if ((uint16_t) (s->tail - s->head) >= s->cap)
+    return -ENOSPC;
+
+  j = &s->jobs[s->tail % STUB_RING];
+  j->dst = (void *) (uintptr_t) dst;
+  j->src = (const void *) (uintptr_t) src;
+  j->len = length;
+  j->st = (s->fail_next ? RTE_DMA_STATUS_ERROR_UNKNOWN :
+      RTE_DMA_STATUS_SUCCESSFUL);
+  s->fail_next = 0;
+  return s->tail++;
+}
+
+static int stub_submit(void *dev_private, uint16_t vchan)
+{
+  struct stub_dev *s = dev_private;
+  s->submits++;
+  return 0;
+}
+
+/* report successful jobs up to the first failed one */
+static uint16_t stub_completed(void *dev_private, uint16_t vchan,
+    const uint16_t nb_cpls, uint16_t *last_idx, bool *has_error)
+{
+  struct stub_dev *s = dev_private;
+  uint16_t n;
+
+  for (n = 0; n < nb_cpls && n < s->ready; n++) {
+    if (s->jobs[s->head % STUB_RING].st != RTE_DMA_STATUS_SUCCESSFUL) {
+      *has_error = true;
+      break;
+    }
+    s->head++;
+  }
+  s->ready -= n;
+  if (n > 0)
+    *last_idx = s->head - 1;
+  return n;
+}
+
+static uint16_t stub_completed_status(void *dev_private, uint16_t vchan,
+    const uint16_t nb_cpls, uint16_t *last_idx,
+    enum rte_dma_status_code *status)
+{
+  struct stub_dev *s = dev_private;
+  uint16_t n;
+
+  for (n = 0; n < nb_cpls && n < s->ready; n++)
+    status[n] = s->jobs[s->head++ % STUB_RING].st;
+  s->ready -= n;
+  if (n > 0)
+    *last_idx = s->head - 1;
+  return n;
+}
+
+/* device finishes the next `n` jobs, failed ones are not copied */
+static void stub_run(uint16_t n)
+{
+  struct stub_job *j;
+  uint16_t i;
+
+  for (i = 0; i < n; i++) {
+    j = &stub.jobs[(stub.head + stub.ready) % STUB_RING];
+    if (j->st == RTE_DMA_STATUS_SUCCESSFUL)
+      memcpy(j->dst, j->src, j->len);
+    stub.ready++;
+  }
+}
+
+static void stub_init(uint16_t cap)
+{
+  memset(&stub, 0, sizeof(stub));
+  stub.cap = cap;
+  stub_objs[0].dev_private = &stub;
+  stub_objs[0].copy = stub_copy;
+  stub_objs[0].submit = stub_submit;
+  stub_objs[0].completed = stub_completed;
+  stub_objs[0].completed_status = stub_completed_status;
+  rte_dma_fp_objs = stub_objs;
+
+  memset(&dma_engine, 0, sizeof(dma_engine));
+  dma_engine.dev = 0;
+  config.shm_len = UINT64_MAX;
+  config.fp_dmadev_min = 1;
+}
+
+static void buf_init(uint8_t *buf, size_t len, uint8_t seed)
+{
+  size_t i;
+  for (i = 0; i < len; i++)
+    buf[i] = seed + i * 7;
+}
+
+/* Test that work depending on a copy can go ahead once that copy completed,
+ * while later copies are still in flight. */
+void test_async_done(void *arg)
+{
+  uint8_t src[3][256], dst[3][256];
+  uint32_t m[3];
+  unsigned i;
+
+  stub_init(STUB_RING);
+  for (i = 0; i < 3; i++) {
+    buf_init(src[i], sizeof(src[i]), i);
+    memset(dst[i], 0, sizeof(dst[i]));
+    dma_write_async((uintptr_t) dst[i], sizeof(dst[i]), src[i]);
+    m[i] = dma_async_mark();
+  }
+
+  test_assert("copies in flight", dma_async_pending() == 3 &&
+      !dma_async_done(m[0]) && stub.submits == 1);
+
+  stub_run(1);
+  test_assert("first copy done", dma_async_done(m[0]) &&
+      memcmp(dst[0], src[0], sizeof(dst[0])) == 0);
+  test_assert("later copies in flight", !dma_async_done(m[1]) &&
+      !dma_async_done(m[2]) && dma_async_pending() == 2);
+
+  stub_run(2);
+  test_assert("all copies done", dma_async_done(m[2]) &&
+      dma_async_pending() == 0 &&
+      memcmp(dst[1], src[1], sizeof(dst[1])) == 0 &&
+      memcmp(dst[2], src[2], sizeof(dst[2])) == 0);
+}
+
+/* Test that failed copies are redone with the cpu. */
+void test_async_error(void *arg)
+{
+  uint8_t src[3][128], dst[3][128];
+  uint32_t m;
+  unsigned i;
+
+  stub_init(STUB_RING);
+  for (i = 0; i < 3; i++) {
+    buf_init(src[i], sizeof(src[i]), 10 + i);
+    memset(dst[i], 0, sizeof(dst[i]));
+    stub.fail_next = (i == 1);
+    dma_read_async((uintptr_t) src[i], sizeof(src[i]), dst[i]);
+  }
+  m = dma_async_mark();
+
+  stub_run(3);
+  test_assert("copies done after error", dma_async_done(m) &&
+      dma_async_pending() == 0);
+  test_assert("failed copy redone", memcmp(dst[1], src[1], sizeof(dst[1])) == 0);
+  test_assert("other copies done", memcmp(dst[0], src[0], sizeof(dst[0])) == 0 &&
+      memcmp(dst[2], src[2], sizeof(dst[2])) == 0);
+}
+
+/* Test that copies are done by the cpu right away while the device ring is
+ * full, and ring indices wrap. */
+void test_async_full(void *arg)
+{
+  uint8_t src[64], dst[64];
+  uint32_t m;
+  unsigned i;
+
+  stub_init(4);
+  buf_init(src, sizeof(src), 20);
+
+  /* wrap the 16 bit ring indices */
+  for (i = 0; i < 70000; i++) {
+    dma_write_async((uintptr_t) dst, sizeof(dst), src);
+    stub_run(1);
+  }
+  m = dma_async_mark();
+  test_assert("indices wrapped", dma_async_done(m) &&
+      dma_async_pending() == 0 && dma_engine.enq == 70000);
+
+  for (i = 0; i < 4; i++)
+    dma_write_async((uintptr_t) dst, sizeof(dst), src);
+  m = dma_async_mark();
+
+  memset(dst, 0, sizeof(dst));
+  dma_write_async((uintptr_t) dst, sizeof(dst), src);
+  test_assert("cpu copy with full ring", dma_async_mark() == m &&
+      memcmp(dst, src, sizeof(dst)) == 0);
+
+  stub_run(4);
+  test_assert("ring drained", dma_async_done(m) && dma_async_pending() == 0);
+}
+
+int main(int argc, char *argv[])
+{
+  int ret = 0;
+
+  if (test_subcase("dma async completion", test_async_done, NULL))
+    ret = 1;
+
+  if (test_subcase("dma async error fallback", test_async_error, NULL))
+    ret = 1;
+
+  if (test_subcase("dma async ring full", test_async_full, NULL))
+    ret = 1;
+
+  return ret;
+}
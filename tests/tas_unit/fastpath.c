@@ -14,6 +14,7 @@
 #include "../../tas/include/config.h"
 #include "../../tas/fast/internal.h"
 #include "../../tas/fast/fastemu.h"
+#include "../../tas/slow/flowht.h"
 
 #define TEST_IP   0x0a010203
 #define TEST_PORT 12345
@@ -28,6 +29,8 @@
   typedef struct rte_ether_addr macaddr_t;
 #endif
 macaddr_t eth_addr;
+uint8_t rss_key[TAS_RSS_KEY_LEN];
+int network_tso_hw = 0;
 
 void *tas_shm = (void *) 0;
 
@@ -64,7 +67,58 @@ void notify_fastpath_core(unsigned core)
   printf("notify_fastpath_core(%u)\n", core);
 }
 
+/* notifications are not held back without dma engines */
+void arx_cache_drain(struct dataplane_context *ctx)
+{
+  test_error("arx cache full");
+}
+
+uint32_t network_zc_reclaim(struct network_thread *t)
+{
+  return t->zc_tail;
+}
+
+/* drop the oldest deferred bump to make room, unless segments are stuck */
+static unsigned tx_zc_drains = 0;
+static int tx_zc_stuck = 0;
+int tx_zc_drain(struct dataplane_context *ctx)
+{
+  tx_zc_drains++;
+  if (tx_zc_stuck) {
+    return -1;
+  }
+  ctx->tx_zc_bump_first = (ctx->tx_zc_bump_first + 1) % TX_ZC_BUMPS;
+  ctx->tx_zc_bump_num--;
+  return 0;
+}
+
 /* initialize basic flow state */
+/* header template as created by the slow path in nicif_connection_add */
+static void flow_hdr_init(uint32_t fid)
+{
+  struct pkt_tcp *p = (struct pkt_tcp *) state_base.flowhdr[fid].hdr;
+  uint8_t *opt = (uint8_t *) (p + 1);
+
+  memset(&state_base.flowhdr[fid], 0, sizeof(state_base.flowhdr[fid]));
+  memset(&p->eth.dest, 0x22, ETH_ADDR_LEN);
+  memcpy(&p->eth.src, &eth_addr, ETH_ADDR_LEN);
+  p->eth.type = t_beui16(ETH_TYPE_IP);
+  IPH_VHL_SET(&p->ip, 4, 5);
+  p->ip.id = t_beui16(3);
+  p->ip.ttl = 0xff;
+  p->ip.proto = IP_PROTO_TCP;
+  p->ip.src = t_beui32(TEST_LIP);
+  p->ip.dest = t_beui32(TEST_IP);
+  p->tcp.src = t_beui16(TEST_LPORT);
+  p->tcp.dest = t_beui16(TEST_PORT);
+  TCPH_HDRLEN_FLAGS_SET(&p->tcp, 8, 0);
+  opt[0] = TCP_OPT_TIMESTAMP;
+  opt[1] = sizeof(struct tcp_timestamp_opt);
+  opt[10] = opt[11] = TCP_OPT_NO_OP;
+  p->ip.chksum = rte_ipv4_cksum((void *) &p->ip);
+  p->tcp.chksum = rte_ipv4_phdr_cksum((void *) &p->ip, PKT_TX_TCP_SEG);
+}
+
 static void flow_init(uint32_t fid, uint32_t rxlen, uint32_t txlen, uint64_t opaque)
 {
   struct flextcp_pl_flowst *fs = &state_base.flowst[fid];
@@ -74,7 +128,8 @@ static void flow_init(uint32_t fid, uint32_t rxlen, uint32_t txlen, uint64_t opa
       MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
 
   fs->opaque = opaque;
-  fs->rx_base_sp = (uintptr_t) rxbuf;
+  fs->rx_base = (uintptr_t) rxbuf;
+  fs->flags = 0;
   fs->tx_base = (uintptr_t) txbuf;
   fs->rx_len = rxlen;
   fs->tx_len = txlen;
@@ -84,17 +139,50 @@ static void flow_init(uint32_t fid, uint32_t rxlen, uint32_t txlen, uint64_t opa
   fs->remote_port = t_beui16(TEST_PORT);
   fs->rx_avail = rxlen;
   fs->rx_remote_avail = rxlen;
+  fs->mss = 1448;
+  fs->ts_opt = 1;
   fs->tx_rate = 10000;
-  fs->rtt_est = 18;
+  state_base.flowstats[fid].rtt_est = 18;
+  flow_hdr_init(fid);
+}
+
+/* ipv6 header template for flow, as created by nicif_connection_add */
+static void flow_hdr6_init(uint32_t fid)
+{
+  struct pkt_tcp6 *p = (struct pkt_tcp6 *) state_base.flowhdr[fid].hdr;
+  struct flextcp_pl_flowip6 *fa = &state_base.flowip6[fid];
+  uint8_t *opt = (uint8_t *) (p + 1);
+
+  memset(fa, 0, sizeof(*fa));
+  fa->local_ip.addr[0] = fa->remote_ip.addr[0] = 0xfd;
+  fa->local_ip.addr[15] = 1;
+  fa->remote_ip.addr[15] = 2;
+
+  memset(&state_base.flowhdr[fid], 0, sizeof(state_base.flowhdr[fid]));
+  memset(&p->eth.dest, 0x22, ETH_ADDR_LEN);
+  memcpy(&p->eth.src, &eth_addr, ETH_ADDR_LEN);
+  p->eth.type = t_beui16(ETH_TYPE_IPV6);
+  IP6H_VTCFL_SET(&p->ip6, 6, 0, 0);
+  p->ip6.next_hdr = IP_PROTO_TCP;
+  p->ip6.hop_limit = 0xff;
+  p->ip6.src = fa->local_ip;
+  p->ip6.dest = fa->remote_ip;
+  p->tcp.src = t_beui16(TEST_LPORT);
+  p->tcp.dest = t_beui16(TEST_PORT);
+  TCPH_HDRLEN_FLAGS_SET(&p->tcp, 8, 0);
+  opt[0] = TCP_OPT_TIMESTAMP;
+  opt[1] = sizeof(struct tcp_timestamp_opt);
+  opt[10] = opt[11] = TCP_OPT_NO_OP;
+  p->tcp.chksum = rte_ipv6_phdr_cksum((void *) &p->ip6, PKT_TX_TCP_SEG);
 }
 
-/* alloc dummy mbuf */
+/* alloc dummy mbuf, large enough for a full-sized segment */
 static struct rte_mbuf *mbuf_alloc(void)
 {
-  struct rte_mbuf *tmb = calloc(1, 2048);
+  struct rte_mbuf *tmb = calloc(1, 4096);
   tmb->data_off = 256;
   tmb->buf_addr = (uint8_t *) (tmb + 1) + tmb->data_off;
-  tmb->buf_len = 2048 - sizeof(*tmb);
+  tmb->buf_len = 4096 - sizeof(*tmb);
   return tmb;
 }
 
@@ -287,6 +375,1133 @@ void test_retransmit(void *arg)
       (QMAN_SET_RATE | QMAN_SET_MAXCHUNK | QMAN_ADD_AVAIL));
 }
 
+/* fill in headers for tcp packet with options but no payload */
+static struct pkt_tcp *pkt_init(struct rte_mbuf *tmb, const uint8_t *opts,
+    uint16_t optlen)
+{
+  struct pkt_tcp *p = network_buf_bufoff((struct network_buf_handle *) tmb);
+
+  memset(p, 0, sizeof(*p));
+  p->eth.type = t_beui16(ETH_TYPE_IP);
+  IPH_VHL_SET(&p->ip, 4, 5);
+  p->ip.proto = IP_PROTO_TCP;
+  p->ip.len = t_beui16(sizeof(p->ip) + sizeof(p->tcp) + optlen);
+  TCPH_HDRLEN_FLAGS_SET(&p->tcp, 5 + optlen / 4, TCP_ACK);
+  memcpy(p + 1, opts, optlen);
+  tmb->data_len = sizeof(*p) + optlen;
+  return p;
+}
+
+void test_parse_ts_layouts(void *arg)
+{
+  static const uint8_t opts_linux[12] = { 1, 1, 8, 10, 0, 0, 0, 1, 0, 0, 0, 2 };
+  static const uint8_t opts_tas[12] = { 8, 10, 0, 0, 0, 1, 0, 0, 0, 2, 0, 0 };
+  static const uint8_t opts_other[16] =
+    { 2, 4, 5, 180, 1, 8, 10, 0, 0, 0, 1, 0, 0, 0, 2, 0 };
+  struct dataplane_context ctx;
+  struct rte_mbuf *tmb = mbuf_alloc();
+  struct network_buf_handle *nbh = (struct network_buf_handle *) tmb;
+  struct tcp_opts to;
+  struct pkt_tcp *p;
+  void *fs;
+
+  memset(&ctx, 0, sizeof(ctx));
+
+  p = pkt_init(tmb, opts_linux, sizeof(opts_linux));
+  fs = &state_base.flowst[0];
+  fast_flows_packet_parse(&ctx, &nbh, &fs, &to, 1);
+  test_assert("nop nop ts accepted", fs != NULL);
+  test_assert("nop nop ts found", (uint8_t *) to.ts == (uint8_t *) (p + 1) + 2);
+  test_assert("nop nop ts value", f_beui32(to.ts->ts_val) == 1);
+
+  p = pkt_init(tmb, opts_tas, sizeof(opts_tas));
+  fs = &state_base.flowst[0];
+  fast_flows_packet_parse(&ctx, &nbh, &fs, &to, 1);
+  test_assert("ts padded accepted", fs != NULL);
+  test_assert("ts padded found", (uint8_t *) to.ts == (uint8_t *) (p + 1));
+  test_assert("ts padded echo", f_beui32(to.ts->ts_ecr) == 2);
+
+  p = pkt_init(tmb, opts_other, sizeof(opts_other));
+  fs = &state_base.flowst[0];
+  fast_flows_packet_parse(&ctx, &nbh, &fs, &to, 1);
+  test_assert("generic layout accepted", fs != NULL);
+  test_assert("generic layout ts found",
+      (uint8_t *) to.ts == (uint8_t *) (p + 1) + 5);
+
+  p = pkt_init(tmb, opts_linux, sizeof(opts_linux));
+  p->ip.proto = 17;
+  fs = &state_base.flowst[0];
+  fast_flows_packet_parse(&ctx, &nbh, &fs, &to, 1);
+  test_assert("non-tcp packet rejected", fs == NULL);
+
+  free(tmb);
+}
+
+/* build data segment with timestamp option for flow 0 */
+static struct network_buf_handle *seg_build(uint32_t seq, uint16_t len,
+    uint8_t fill, struct tcp_opts *to)
+{
+  static const uint8_t opts[12] = { 1, 1, 8, 10, 0, 0, 0, 1, 0, 0, 0, 0 };
+  struct rte_mbuf *tmb = mbuf_alloc();
+  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct pkt_tcp *p = pkt_init(tmb, opts, sizeof(opts));
+
+  p->ip.src = fs->remote_ip;
+  p->ip.dest = fs->local_ip;
+  p->tcp.src = fs->remote_port;
+  p->tcp.dest = fs->local_port;
+  p->tcp.seqno = t_beui32(seq);
+  p->tcp.ackno = t_beui32(fs->tx_next_seq);
+  p->tcp.wnd = t_beui16(1024);
+  p->ip.len = t_beui16(f_beui16(p->ip.len) + len);
+  memset((uint8_t *) (p + 1) + sizeof(opts), fill, len);
+  tmb->data_len += len;
+
+  to->ts = (struct tcp_timestamp_opt *) ((uint8_t *) (p + 1) + 2);
+  to->sack = NULL;
+  return (struct network_buf_handle *) tmb;
+}
+
+/* Test that packets with bad checksums are dropped in the parse stage, using
+ * the NIC's verdict where available and software verification otherwise. */
+void test_rx_xsum(void *arg)
+{
+  static const uint8_t opts[12] = { 1, 1, 8, 10, 0, 0, 0, 1, 0, 0, 0, 2 };
+  struct dataplane_context ctx;
+  struct rte_mbuf *tmb = mbuf_alloc();
+  struct network_buf_handle *nbh = (struct network_buf_handle *) tmb;
+  struct tcp_opts to;
+  struct pkt_tcp *p;
+  uint8_t *payload;
+  uint32_t drop;
+  void *fs;
+
+  memset(&ctx, 0, sizeof(ctx));
+  config.fp_rx_xsum = 1;
+
+  p = pkt_init(tmb, opts, sizeof(opts));
+  p->ip.src = t_beui32(TEST_IP);
+  p->ip.dest = t_beui32(TEST_LIP);
+  p->ip.ttl = 64;
+  p->tcp.src = t_beui16(TEST_PORT);
+  p->tcp.dest = t_beui16(TEST_LPORT);
+  p->ip.len = t_beui16(f_beui16(p->ip.len) + 101);
+  payload = (uint8_t *) (p + 1) + sizeof(opts);
+  memset(payload, 0x5a, 101);
+  tmb->data_len += 101;
+  p->ip.chksum = rte_ipv4_cksum((void *) &p->ip);
+  p->tcp.chksum = rte_ipv4_udptcp_cksum((void *) &p->ip, (void *) &p->tcp);
+
+  fs = &state_base.flowst[0];
+  drop = fast_flows_packet_parse(&ctx, &nbh, &fs, &to, 1);
+  test_assert("xsum software good", drop == 0 && fs != NULL);
+
+  payload[100] ^= 1;
+  fs = &state_base.flowst[0];
+  drop = fast_flows_packet_parse(&ctx, &nbh, &fs, &to, 1);
+  test_assert("xsum software bad payload", drop == 1 && fs == NULL &&
+      ctx.rx_xsum_drop == 1);
+
+  tmb->ol_flags = PKT_RX_IP_CKSUM_GOOD | PKT_RX_L4_CKSUM_GOOD;
+  fs = &state_base.flowst[0];
+  drop = fast_flows_packet_parse(&ctx, &nbh, &fs, &to, 1);
+  test_assert("xsum nic good", drop == 0 && fs != NULL);
+
+  payload[100] ^= 1;
+  tmb->ol_flags = PKT_RX_IP_CKSUM_GOOD | PKT_RX_L4_CKSUM_BAD;
+  fs = &state_base.flowst[0];
+  drop = fast_flows_packet_parse(&ctx, &nbh, &fs, &to, 1);
+  test_assert("xsum nic bad", drop == 1 && fs == NULL);
+
+  tmb->ol_flags = 0;
+  p->ip.ttl = 63;
+  fs = &state_base.flowst[0];
+  drop = fast_flows_packet_parse(&ctx, &nbh, &fs, &to, 1);
+  test_assert("xsum software bad ip header", drop == 1 && fs == NULL &&
+      ctx.rx_xsum_drop == 3);
+
+  config.fp_rx_xsum = 0;
+  free(tmb);
+}
+
+/* feed data segment with timestamp option to fast_flows_packet */
+static int rx_segment(struct dataplane_context *ctx, uint32_t seq,
+    uint16_t len, uint8_t fill)
+{
+  struct tcp_opts to;
+  struct network_buf_handle *nbh = seg_build(seq, len, fill, &to);
+
+  return fast_flows_packet(ctx, &nbh, 1, &state_base.flowst[0], &to, 0);
+}
+
+/* Test out of order segments arriving with multiple holes, which should be
+ * tracked as separate intervals and delivered once the holes are filled. */
+void test_rx_ooo_multi(void *arg)
+{
+  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct dataplane_context ctx;
+  uint8_t *rxbuf;
+  unsigned i;
+
+  /* buffers are mapped anywhere, tas_shm is 0 */
+  config.shm_len = UINT64_MAX;
+
+  memset(&ctx, 0, sizeof(ctx));
+  memset(fs, 0, sizeof(*fs));
+  memset(&state_base.flowooo[0], 0, sizeof(state_base.flowooo[0]));
+  flow_init(0, 1024, 1024, 123456);
+  rxbuf = (uint8_t *) (uintptr_t) fs->rx_base;
+
+  rx_segment(&ctx, 100, 100, 2);
+  rx_segment(&ctx, 300, 100, 4);
+  test_assert("ooo nothing delivered", fs->rx_next_seq == 0);
+  test_assert("ooo flagged", (fs->flags & FLEXNIC_PL_FLOWST_RXOOO) != 0);
+  test_assert("ooo first interval",
+      state_base.flowooo[0].iv[0].start == 100 &&
+      state_base.flowooo[0].iv[0].len == 100);
+  test_assert("ooo second interval",
+      state_base.flowooo[0].iv[1].start == 300 &&
+      state_base.flowooo[0].iv[1].len == 100);
+
+  rx_segment(&ctx, 200, 100, 3);
+  test_assert("ooo intervals merged",
+      state_base.flowooo[0].iv[0].start == 100 &&
+      state_base.flowooo[0].iv[0].len == 300 &&
+      state_base.flowooo[0].iv[1].len == 0);
+
+  rx_segment(&ctx, 0, 100, 1);
+  test_assert("ooo caught up", fs->rx_next_seq == 400);
+  test_assert("ooo rx avail", fs->rx_avail == 1024 - 400);
+  test_assert("ooo rx pos", fs->rx_next_pos == 400);
+  test_assert("ooo intervals cleared", state_base.flowooo[0].iv[0].len == 0 &&
+      (fs->flags & FLEXNIC_PL_FLOWST_RXOOO) == 0);
+  test_assert("ooo notification", ctx.arx_num == 1 &&
+      ctx.arx_cache[0].msg.connupdate.rx_bump == 400);
+
+  for (i = 0; i < 400 && rxbuf[i] == i / 100 + 1; i++);
+  test_assert("ooo data in order", i == 400);
+}
+
+/* feed duplicate ack with a single SACK block to fast_flows_packet */
+static int rx_sack(struct dataplane_context *ctx, uint32_t ack, uint32_t left,
+    uint32_t right)
+{
+  uint8_t opts[24] = { 1, 1, 8, 10, 0, 0, 0, 1, 0, 0, 0, 0, 1, 1, 5, 10 };
+  struct rte_mbuf *tmb = mbuf_alloc();
+  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct pkt_tcp *p;
+  struct network_buf_handle *nbh;
+  struct tcp_opts to;
+  beui32_t b;
+
+  b = t_beui32(left);
+  memcpy(opts + 16, &b, sizeof(b));
+  b = t_beui32(right);
+  memcpy(opts + 20, &b, sizeof(b));
+  p = pkt_init(tmb, opts, sizeof(opts));
+
+  p->ip.src = fs->remote_ip;
+  p->ip.dest = fs->local_ip;
+  p->tcp.src = fs->remote_port;
+  p->tcp.dest = fs->local_port;
+  p->tcp.seqno = t_beui32(fs->rx_next_seq);
+  p->tcp.ackno = t_beui32(ack);
+  p->tcp.wnd = t_beui16(4096);
+
+  if (tcp_parse_options(p, tmb->data_len, &to) != 0 || to.sack == NULL)
+    return -2;
+  nbh = (struct network_buf_handle *) tmb;
+  return fast_flows_packet(ctx, &nbh, 1, fs, &to, 0);
+}
+
+/* Test that ACKs carry SACK blocks for out of order data, and that SACK blocks
+ * received with duplicate acks only trigger retransmission of the holes. */
+void test_sack(void *arg)
+{
+  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct dataplane_context ctx;
+  struct rte_mbuf *tmb;
+  struct pkt_tcp *p;
+  struct tcp_sack_opt *sack;
+  unsigned i;
+
+  config.shm_len = UINT64_MAX;
+
+  memset(&ctx, 0, sizeof(ctx));
+  memset(fs, 0, sizeof(*fs));
+  memset(&state_base.flowooo[0], 0, sizeof(state_base.flowooo[0]));
+  memset(&state_base.flowsack[0], 0, sizeof(state_base.flowsack[0]));
+  flow_init(0, 4096, 4096, 123456);
+  fs->flags |= FLEXNIC_PL_FLOWST_SACK;
+
+  /* receiver: out of order segment is reported in ACK */
+  rx_segment(&ctx, 100, 100, 1);
+  test_assert("sack ack sent", ctx.tx_num == 1);
+  p = network_buf_bufoff(ctx.tx_handles[0]);
+  sack = (struct tcp_sack_opt *) ((uint8_t *) (p + 1) + 14);
+  test_assert("sack ack header length", TCPH_HDRLEN(&p->tcp) == 11);
+  test_assert("sack ack ip length",
+      f_beui16(p->ip.len) == sizeof(p->ip) + sizeof(p->tcp) + 24);
+  test_assert("sack option", sack->kind == TCP_OPT_SACK && sack->length == 10);
+  test_assert("sack block", f_beui32(sack->blocks[0].left) == 100 &&
+      f_beui32(sack->blocks[0].right) == 200);
+
+  /* sender: 3000 bytes in flight, second segment arrived */
+  memset(&ctx, 0, sizeof(ctx));
+  fs->tx_next_seq = 3001;
+  fs->tx_next_pos = 3000;
+  fs->tx_sent = 3000;
+  fs->tx_avail = 0;
+  state_base.flowsack[0].rtx_next = state_base.flowsack[0].rtx_end = 1;
+
+  qm_set_op.got_op = 0;
+  for (i = 0; i < 3; i++) {
+    rx_sack(&ctx, 1, 1001, 2001);
+  }
+  test_assert("sack nothing rewound", fs->tx_next_seq == 3001 &&
+      fs->tx_sent == 3000 && fs->tx_next_pos == 3000);
+  test_assert("sack retransmit armed",
+      (fs->flags & FLEXNIC_PL_FLOWST_SACKRTX) != 0);
+  test_assert("sack qman hole bytes", qm_set_op.got_op &&
+      qm_set_op.avail == 1000 && (qm_set_op.flags & QMAN_ADD_AVAIL) != 0);
+
+  tmb = mbuf_alloc();
+  test_assert("sack hole sent",
+      fast_flows_qman(&ctx, 0, (struct network_buf_handle *) tmb, 0) == 0);
+  p = network_buf_buf((struct network_buf_handle *) tmb);
+  test_assert("sack hole seq", f_beui32(p->tcp.seqno) == 1);
+  test_assert("sack hole len", f_beui16(p->ip.len) ==
+      sizeof(p->ip) + sizeof(p->tcp) + 12 + 1000);
+  test_assert("sack hole tx state unchanged", fs->tx_next_seq == 3001 &&
+      fs->tx_sent == 3000);
+
+  test_assert("sack no more holes",
+      fast_flows_qman(&ctx, 0, (struct network_buf_handle *) tmb, 0) != 0);
+  test_assert("sack retransmit done",
+      (fs->flags & FLEXNIC_PL_FLOWST_SACKRTX) == 0);
+  free(tmb);
+}
+
+/* Test that received windows are scaled up and advertised windows scaled
+ * down by the negotiated shifts. */
+void test_wscale(void *arg)
+{
+  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct dataplane_context ctx;
+  struct pkt_tcp *p;
+
+  config.shm_len = UINT64_MAX;
+
+  memset(&ctx, 0, sizeof(ctx));
+  memset(fs, 0, sizeof(*fs));
+  memset(&state_base.flowooo[0], 0, sizeof(state_base.flowooo[0]));
+  flow_init(0, 1 << 20, 1 << 20, 123456);
+  fs->rx_wscale = 7;
+  fs->tx_wscale = 5;
+
+  rx_segment(&ctx, 0, 100, 1);
+  test_assert("wscale remote window scaled",
+      fs->rx_remote_avail == (1024 << 7));
+  test_assert("wscale ack sent", ctx.tx_num == 1);
+  p = network_buf_bufoff(ctx.tx_handles[0]);
+  test_assert("wscale advertised window scaled",
+      f_beui16(p->tcp.wnd) == ((1 << 20) - 100) >> 5);
+}
+
+/* Test that ACKs for in-order segments are delayed until enough full
+ * segments arrived, or sent later from the pending ack table. */
+void test_delack(void *arg)
+{
+  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct dataplane_context ctx;
+  struct rte_mbuf *tmb;
+  struct pkt_tcp *p;
+
+  config.shm_len = UINT64_MAX;
+  config.fp_delack_segs = 2;
+
+  memset(&ctx, 0, sizeof(ctx));
+  memset(fs, 0, sizeof(*fs));
+  memset(&state_base.flowooo[0], 0, sizeof(state_base.flowooo[0]));
+  flow_init(0, 8192, 8192, 123456);
+
+  test_assert("delack first segment held", rx_segment(&ctx, 0, 1448, 1) == 0);
+  test_assert("delack pending", ctx.tx_num == 0 && ctx.ack_num == 1 &&
+      ctx.ack_flows[0] == 0 && ctx.ack_segs[0] == 1);
+
+  test_assert("delack second segment acked",
+      rx_segment(&ctx, 1448, 1448, 2) == 1);
+  test_assert("delack ack sent", ctx.tx_num == 1);
+  p = network_buf_bufoff(ctx.tx_handles[0]);
+  test_assert("delack ack covers both", f_beui32(p->tcp.ackno) == 2896);
+  test_assert("delack pending cleared", ctx.ack_flows[0] == -1U);
+
+  test_assert("delack small segment held",
+      rx_segment(&ctx, 2896, 100, 3) == 0);
+  test_assert("delack slot reused", ctx.ack_num == 1 &&
+      ctx.ack_flows[0] == 0);
+
+  tmb = mbuf_alloc();
+  test_assert("delack pending ack sent",
+      fast_flows_ack(&ctx, 0, (struct network_buf_handle *) tmb, 0) == 0);
+  p = network_buf_buf((struct network_buf_handle *) tmb);
+  test_assert("delack pending ack seq", f_beui32(p->tcp.ackno) == 2996 &&
+      f_beui16(p->ip.len) == sizeof(p->ip) + sizeof(p->tcp) + 12);
+  test_assert("delack pending cleared after send", ctx.ack_flows[0] == -1U);
+  test_assert("delack invalid slot skipped",
+      fast_flows_ack(&ctx, -1U, (struct network_buf_handle *) tmb, 0) != 0);
+  free(tmb);
+}
+
+/* Test that contiguous segments of a flow in a receive batch are grouped and
+ * processed as one, and that runs of pure acks collapse. */
+void test_gro(void *arg)
+{
+  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct dataplane_context ctx;
+  struct network_buf_handle *nbhs[6];
+  struct tcp_opts tos[6];
+  struct pkt_tcp *p;
+  void *fss[6];
+  uint8_t runs[6], *rxbuf;
+  uint32_t drop = 0, fwd = 0;
+  unsigned i;
+
+  config.shm_len = UINT64_MAX;
+  config.fp_gro = 1;
+
+  memset(&ctx, 0, sizeof(ctx));
+  memset(fs, 0, sizeof(*fs));
+  memset(&state_base.flowooo[0], 0, sizeof(state_base.flowooo[0]));
+  flow_init(0, 8192, 8192, 123456);
+  rxbuf = (uint8_t *) (uintptr_t) fs->rx_base;
+
+  /* three contiguous segments interleaved with a packet without flow state,
+   * followed by one that does not fit the run */
+  nbhs[0] = seg_build(0, 100, 1, &tos[0]);
+  nbhs[1] = seg_build(0, 10, 9, &tos[1]);
+  nbhs[2] = seg_build(100, 100, 2, &tos[2]);
+  nbhs[3] = seg_build(200, 100, 3, &tos[3]);
+  nbhs[4] = seg_build(1000, 100, 4, &tos[4]);
+  for (i = 0; i < 5; i++)
+    fss[i] = fs;
+  fss[1] = NULL;
+
+  fast_flows_packet_gro(&ctx, nbhs, fss, tos, runs, &drop, &fwd, 5);
+  test_assert("gro run length", runs[0] == 3 && runs[1] == 0 && runs[2] == 0);
+  test_assert("gro other packet after run", runs[3] == 1 && fss[3] == NULL);
+  test_assert("gro gap not merged", runs[4] == 1 && fss[4] == fs);
+  p = network_buf_bufoff(nbhs[2]);
+  test_assert("gro run order", f_beui32(p->tcp.seqno) == 200);
+
+  test_assert("gro run acked",
+      fast_flows_packet(&ctx, nbhs, runs[0], fs, &tos[2], 0) == 1);
+  test_assert("gro run delivered", fs->rx_next_seq == 300 &&
+      fs->rx_avail == 8192 - 300 && fs->rx_next_pos == 300);
+  test_assert("gro one notification", ctx.arx_num == 1 &&
+      ctx.arx_cache[0].msg.connupdate.rx_bump == 300);
+  test_assert("gro one ack", ctx.tx_num == 1 && ctx.tx_handles[0] == nbhs[2]);
+  p = network_buf_bufoff(ctx.tx_handles[0]);
+  test_assert("gro cumulative ack", f_beui32(p->tcp.ackno) == 300);
+  for (i = 0; i < 300 && rxbuf[i] == i / 100 + 1; i++);
+  test_assert("gro data in order", i == 300);
+
+  for (i = 0; i < 5; i++)
+    free(nbhs[i]);
+
+  /* pure acks advancing the cumulative ack collapse, duplicates do not */
+  for (i = 0; i < 4; i++) {
+    nbhs[i] = seg_build(300, 0, 0, &tos[i]);
+    fss[i] = fs;
+    p = network_buf_bufoff(nbhs[i]);
+    p->tcp.ackno = t_beui32(fs->tx_next_seq + (i < 3 ? i * 10 : 20));
+  }
+  fast_flows_packet_gro(&ctx, nbhs, fss, tos, runs, &drop, &fwd, 4);
+  test_assert("gro acks collapsed", runs[0] == 3 && runs[3] == 1);
+
+  for (i = 0; i < 4; i++)
+    free(nbhs[i]);
+
+  /* packet with bad checksum between two segments of a run, as marked by
+   * the parse stage, stays marked once the run is made contiguous */
+  nbhs[0] = seg_build(300, 100, 5, &tos[0]);
+  nbhs[1] = seg_build(0, 10, 9, &tos[1]);
+  nbhs[2] = seg_build(400, 100, 6, &tos[2]);
+  fss[0] = fss[2] = fs;
+  fss[1] = NULL;
+  drop = 1 << 1;
+  fast_flows_packet_gro(&ctx, nbhs, fss, tos, runs, &drop, &fwd, 3);
+  test_assert("gro run around dropped packet", runs[0] == 2 &&
+      fss[2] == NULL);
+  test_assert("gro drop bit follows packet", drop == 1 << 2 && fwd == 0);
+
+  for (i = 0; i < 3; i++)
+    free(nbhs[i]);
+
+  /* same for a packet handed to its owner core in between, which must not be
+   * processed or freed here */
+  nbhs[0] = seg_build(300, 100, 5, &tos[0]);
+  nbhs[1] = seg_build(0, 10, 9, &tos[1]);
+  nbhs[2] = seg_build(400, 100, 6, &tos[2]);
+  fss[0] = fss[2] = fs;
+  fss[1] = NULL;
+  drop = 0;
+  fwd = 1 << 1;
+  fast_flows_packet_gro(&ctx, nbhs, fss, tos, runs, &drop, &fwd, 3);
+  test_assert("gro run around forwarded packet", runs[0] == 2 &&
+      fss[2] == NULL);
+  test_assert("gro fwd bit follows packet", fwd == 1 << 2 && drop == 0);
+
+  for (i = 0; i < 3; i++)
+    free(nbhs[i]);
+}
+
+/* Test that streaming and prefetching copies produce the same result as plain
+ * copies for unaligned buffers and odd lengths. */
+void test_dma_copy(void *arg)
+{
+  static const uint16_t lens[] = { 1, 15, 16, 63, 64, 100, 1448, 1500 };
+  uint8_t src[2048], dst[2048], exp[2048];
+  unsigned i, off, l, ok = 1;
+
+  config.shm_len = UINT64_MAX;
+  config.fp_dma_stream_min = 1;
+  config.fp_dma_prefetch_min = 1;
+
+  for (i = 0; i < sizeof(src); i++)
+    src[i] = i * 7 + 3;
+
+  for (off = 0; off < 17; off++) {
+    for (l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+      memset(dst, 0, sizeof(dst));
+      memset(exp, 0, sizeof(exp));
+      memcpy(exp + off, src + 3, lens[l]);
+      dma_write((uintptr_t) (dst + off), lens[l], src + 3);
+      ok &= memcmp(dst, exp, sizeof(dst)) == 0;
+
+      memset(dst, 0, sizeof(dst));
+      dma_read((uintptr_t) (src + 3), lens[l], dst + off);
+      ok &= memcmp(dst, exp, sizeof(dst)) == 0;
+    }
+  }
+  test_assert("dma copies match", ok);
+}
+
+/* Test the qman chunk size for super-segments depending on the flow rate. */
+void test_tx_chunk(void *arg)
+{
+  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct dataplane_context ctx;
+  struct rte_mbuf *tmb = mbuf_alloc();
+  memset(&ctx, 0, sizeof(ctx));
+
+  flow_init(0, 1024, 1 << 20, 123456);
+  fs->rx_remote_avail = 1 << 20;
+  config.fp_tso_max = 65160;
+
+  /* 10 Mbps: less than a segment in 20us */
+  fast_flows_bump(&ctx, 0, 0, 0, 1024, 0, (struct network_buf_handle *) tmb, 0);
+  test_assert("slow flow single segment", qm_set_op.max_chunk == 1448);
+
+  /* 10 Gbps: 25000 bytes in 20us, rounded down to full segments */
+  fs->tx_rate = 10000000;
+  fast_flows_bump(&ctx, 0, 0, 0, 1024, 0, (struct network_buf_handle *) tmb, 0);
+  test_assert("fast flow chunk", qm_set_op.max_chunk == 17 * 1448);
+
+  /* unthrottled */
+  fs->tx_rate = 0;
+  fast_flows_bump(&ctx, 0, 0, 0, 1024, 0, (struct network_buf_handle *) tmb, 0);
+  test_assert("unthrottled flow chunk", qm_set_op.max_chunk == 45 * 1448);
+
+  /* jumbo frame flow: full segments of the flow's mss */
+  fs->mss = 8948;
+  fast_flows_bump(&ctx, 0, 0, 0, 1024, 0, (struct network_buf_handle *) tmb, 0);
+  test_assert("jumbo unthrottled chunk", qm_set_op.max_chunk == 7 * 8948);
+
+  fs->tx_rate = 10000000;
+  fast_flows_bump(&ctx, 0, 0, 0, 1024, 0, (struct network_buf_handle *) tmb, 0);
+  test_assert("jumbo fast flow chunk", qm_set_op.max_chunk == 2 * 8948);
+
+  /* small mss: software GSO splits into at most NETWORK_GSO_MAX_SEGS frames,
+   * the NIC splits larger super-segments */
+  fs->mss = 524;
+  fs->tx_rate = 0;
+  fast_flows_bump(&ctx, 0, 0, 0, 1024, 0, (struct network_buf_handle *) tmb, 0);
+  test_assert("small mss gso chunk",
+      qm_set_op.max_chunk == NETWORK_GSO_MAX_SEGS * 524);
+  network_tso_hw = 1;
+  fast_flows_bump(&ctx, 0, 0, 0, 1024, 0, (struct network_buf_handle *) tmb, 0);
+  test_assert("small mss tso chunk", qm_set_op.max_chunk == 124 * 524);
+  network_tso_hw = 0;
+  fs->mss = 8948;
+
+  /* disabled */
+  config.fp_tso_max = 0;
+  fast_flows_bump(&ctx, 0, 0, 0, 1024, 0, (struct network_buf_handle *) tmb, 0);
+  test_assert("jumbo disabled chunk", qm_set_op.max_chunk == 8948);
+
+  fs->mss = 1448;
+  fast_flows_bump(&ctx, 0, 0, 0, 1024, 0, (struct network_buf_handle *) tmb, 0);
+  test_assert("disabled chunk", qm_set_op.max_chunk == 1448);
+
+  free(tmb);
+}
+
+/* Test that segments built from the flow header template carry the flow's
+ * addresses and valid checksums, with and without checksum offload. */
+void test_tx_hdr_template(void *arg)
+{
+  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct dataplane_context ctx;
+  struct rte_mbuf *tmb = mbuf_alloc();
+  struct pkt_tcp *p = network_buf_buf((struct network_buf_handle *) tmb);
+  struct tcp_timestamp_opt *ts = (struct tcp_timestamp_opt *) (p + 1);
+  uint16_t l4len;
+  uint32_t sum;
+
+  config.shm_len = UINT64_MAX;
+  config.fp_tso_max = 0;
+
+  memset(&ctx, 0, sizeof(ctx));
+  memset(fs, 0, sizeof(*fs));
+  flow_init(0, 4096, 4096, 123456);
+  fs->flags |= FLEXNIC_PL_FLOWST_ECN;
+  fs->tx_next_seq = 1000;
+  fs->rx_next_seq = 2000;
+  fs->tx_avail = 100;
+  fs->tx_next_ts = 77;
+
+  /* software checksums */
+  config.fp_xsumoffload = 0;
+  test_assert("hdr segment sent",
+      fast_flows_qman(&ctx, 0, (struct network_buf_handle *) tmb, 0) == 0);
+  l4len = f_beui16(p->ip.len) - sizeof(p->ip);
+  test_assert("hdr addresses", f_beui32(p->ip.src) == TEST_LIP &&
+      f_beui32(p->ip.dest) == TEST_IP && f_beui16(p->tcp.src) == TEST_LPORT &&
+      f_beui16(p->tcp.dest) == TEST_PORT && p->eth.dest.addr[0] == 0x22);
+  test_assert("hdr fields", f_beui32(p->tcp.seqno) == 1000 &&
+      f_beui32(p->tcp.ackno) == 2000 && l4len == 32 + 100 &&
+      TCPH_FLAGS(&p->tcp) == (TCP_ACK | TCP_PSH) &&
+      IPH_ECN(&p->ip) == IP_ECN_ECT0);
+  test_assert("hdr timestamp", ts->kind == TCP_OPT_TIMESTAMP &&
+      f_beui32(ts->ts_ecr) == 77);
+  test_assert("hdr ip checksum",
+      rte_raw_cksum((void *) &p->ip, sizeof(p->ip)) == 0xffff);
+  sum = rte_ipv4_phdr_cksum((void *) &p->ip, 0) +
+    rte_raw_cksum((void *) &p->tcp, l4len);
+  sum = (sum & 0xffff) + (sum >> 16);
+  test_assert("hdr tcp checksum", sum == 0xffff);
+
+  /* payload wraps around the end of the tx buffer at an odd offset */
+  memset((uint8_t *) (uintptr_t) fs->tx_base, 0xa5, 4096);
+  ((uint8_t *) (uintptr_t) fs->tx_base)[4095] = 0x3c;
+  ((uint8_t *) (uintptr_t) fs->tx_base)[0] = 0x5e;
+  fs->tx_next_pos = 4096 - 51;
+  fs->tx_avail = 100;
+  test_assert("hdr wrapped segment sent",
+      fast_flows_qman(&ctx, 0, (struct network_buf_handle *) tmb, 0) == 0);
+  l4len = f_beui16(p->ip.len) - sizeof(p->ip);
+  sum = rte_ipv4_phdr_cksum((void *) &p->ip, 0) +
+    rte_raw_cksum((void *) &p->tcp, l4len);
+  sum = (sum & 0xffff) + (sum >> 16);
+  test_assert("hdr wrapped tcp checksum", sum == 0xffff);
+
+  /* offloaded: tcp checksum field holds pseudo header xsum with length */
+  config.fp_xsumoffload = 1;
+  fs->tx_avail = 100;
+  test_assert("hdr offload segment sent",
+      fast_flows_qman(&ctx, 0, (struct network_buf_handle *) tmb, 0) == 0);
+  test_assert("hdr offload ip checksum", p->ip.chksum == 0);
+  test_assert("hdr offload pseudo header xsum",
+      p->tcp.chksum == rte_ipv4_phdr_cksum((void *) &p->ip, 0));
+  config.fp_xsumoffload = 0;
+
+  free(tmb);
+}
+
+/* Test that flows without timestamps send segments without options and
+ * sample the rtt on one outstanding segment at a time. */
+void test_tx_no_ts(void *arg)
+{
+  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct flextcp_pl_flowrtt *rs = &state_base.flowrtt[0];
+  struct pkt_tcp *hdr = (struct pkt_tcp *) state_base.flowhdr[0].hdr;
+  struct dataplane_context ctx;
+  struct rte_mbuf *tmb = mbuf_alloc();
+  struct pkt_tcp *p = network_buf_buf((struct network_buf_handle *) tmb);
+  uint16_t l4len;
+
+  config.shm_len = UINT64_MAX;
+  config.fp_tso_max = 0;
+  config.fp_xsumoffload = 0;
+
+  memset(&ctx, 0, sizeof(ctx));
+  memset(fs, 0, sizeof(*fs));
+  flow_init(0, 4096, 4096, 123456);
+  fs->ts_opt = 0;
+  TCPH_HDRLEN_FLAGS_SET(&hdr->tcp, 5, 0);
+  memset(hdr + 1, 0, FLEXNIC_PL_FLOWHDR_LEN - sizeof(*hdr));
+  rs->valid = 0;
+  fs->tx_next_seq = 1000;
+  fs->rx_next_seq = 2000;
+  fs->tx_avail = 100;
+
+  test_assert("no ts segment sent",
+      fast_flows_qman(&ctx, 0, (struct network_buf_handle *) tmb, 5) == 0);
+  l4len = f_beui16(p->ip.len) - sizeof(p->ip);
+  test_assert("no ts header length", TCPH_HDRLEN(&p->tcp) == 5 &&
+      l4len == 20 + 100);
+  test_assert("no ts sample taken", rs->valid && rs->seq == 1100 &&
+      rs->ts == 5);
+
+  /* sample outstanding, next segment is not sampled */
+  fs->tx_avail = 100;
+  test_assert("no ts second segment sent",
+      fast_flows_qman(&ctx, 0, (struct network_buf_handle *) tmb, 9) == 0);
+  test_assert("no ts sample kept", rs->valid && rs->seq == 1100 &&
+      rs->ts == 5);
+
+  /* going back for retransmission discards the sample */
+  fast_flows_retransmit(&ctx, 0);
+  test_assert("no ts sample dropped on retransmit", !rs->valid);
+
+  free(tmb);
+}
+
+/* Test that the fused copy and checksum matches a copy and a separate
+ * checksum for all lengths and alignments. */
+void test_copy_xsum(void *arg)
+{
+  uint8_t src[1024 + 8], dst[1024 + 8];
+  unsigned i, off, len, ok_copy = 1, ok_sum = 1;
+
+  for (i = 0; i < sizeof(src); i++) {
+    src[i] = rand();
+  }
+
+  for (off = 0; off < 4; off++) {
+    for (len = 0; len <= 1024; len++) {
+      memset(dst, 0, sizeof(dst));
+      if (dma_xsum_fold(dma_copy_xsum(dst + off, src + off, len, 0)) !=
+          rte_raw_cksum(src + off, len))
+        ok_sum = 0;
+      if (memcmp(dst + off, src + off, len) != 0 || dst[off + len] != 0)
+        ok_copy = 0;
+    }
+  }
+  test_assert("copy xsum data copied", ok_copy);
+  test_assert("copy xsum sum matches", ok_sum);
+}
+
+/* feed pure ack to fast_flows_packet */
+static int rx_ack(struct dataplane_context *ctx, uint32_t ack)
+{
+  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct tcp_opts to;
+  struct network_buf_handle *nbh = seg_build(fs->rx_next_seq, 0, 0, &to);
+  struct pkt_tcp *p = network_buf_bufoff(nbh);
+
+  p->tcp.ackno = t_beui32(ack);
+  return fast_flows_packet(ctx, &nbh, 1, fs, &to, 0);
+}
+
+/* Test that acked tx buffer space is held back from the application while
+ * zero-copy segments of the flow are in flight, also on its previous owner
+ * core, and that a full deferred bump queue is drained, or the ack dropped if
+ * it stays full. */
+void test_tx_zc_defer(void *arg)
+{
+  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct dataplane_context ctx, ctx_old, *test_ctxs[2] = { &ctx_old, &ctx };
+  uint16_t i;
+
+  config.shm_len = UINT64_MAX;
+
+  memset(&ctx, 0, sizeof(ctx));
+  memset(fs, 0, sizeof(*fs));
+  flow_init(0, 4096, 16384, 123456);
+  fs->tx_next_seq = 8000;
+  fs->tx_next_pos = 8000;
+  fs->tx_sent = 8000;
+
+  /* nothing in flight: released right away */
+  rx_ack(&ctx, 1000);
+  test_assert("zc no segments released", ctx.arx_num == 1 &&
+      ctx.arx_cache[0].msg.connupdate.tx_bump == 1000 &&
+      ctx.tx_zc_bump_num == 0);
+
+  /* segments of other flows in flight: released right away */
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.net.zc_head = 5;
+  rx_ack(&ctx, 1200);
+  test_assert("zc other flow released", ctx.arx_num == 1 &&
+      ctx.tx_zc_bump_num == 0);
+
+  /* one segment of the flow in flight: deferred, merged for the same flow */
+  memset(&ctx, 0, sizeof(ctx));
+  fs->flags |= FLEXNIC_PL_FLOWST_TXZC;
+  fs->tx_zc_core = 0;
+  fs->tx_zc_head = 1;
+  ctx.net.zc_head = 1;
+  rx_ack(&ctx, 1500);
+  test_assert("zc deferred", ctx.arx_num == 0 && ctx.tx_zc_bump_num == 1 &&
+      ctx.tx_zc_bumps[0].tx_bump == 300 && ctx.tx_zc_bumps[0].zc_head == 1 &&
+      ctx.tx_zc_bumps[0].core == 0 && ctx.tx_zc_bumps[0].opaque == 123456);
+
+  fs->tx_zc_head = 2;
+  ctx.net.zc_head = 2;
+  rx_ack(&ctx, 2000);
+  test_assert("zc deferred merged", ctx.arx_num == 0 &&
+      ctx.tx_zc_bump_num == 1 && ctx.tx_zc_bumps[0].tx_bump == 800 &&
+      ctx.tx_zc_bumps[0].zc_head == 2);
+
+  /* all segments of the flow done: nothing references the space anymore */
+  ctx.net.zc_tail = 2;
+  rx_ack(&ctx, 2500);
+  test_assert("zc done released", ctx.arx_num == 1 &&
+      ctx.arx_cache[0].msg.connupdate.tx_bump == 500 &&
+      ctx.tx_zc_bump_num == 1);
+
+  /* flow moved to core 1 with segments still in flight on core 0: deferred
+   * on the old core's segments, no zero-copy until they completed */
+  ctxs = test_ctxs;
+  memset(&ctx, 0, sizeof(ctx));
+  memset(&ctx_old, 0, sizeof(ctx_old));
+  ctx.id = 1;
+  ctx_old.net.zc_head = 7;
+  ctx_old.net.zc_tail = 4;
+  fs->tx_zc_core = 0;
+  fs->tx_zc_head = 6;
+  test_assert("zc moved flow copies", !tx_zc_usable(&ctx, fs));
+  test_assert("zc moved flow deferred", tx_zc_defer(&ctx, fs, 100) == 0 &&
+      ctx.tx_zc_bump_num == 1 && ctx.tx_zc_bumps[0].core == 0 &&
+      ctx.tx_zc_bumps[0].zc_head == 6);
+
+  ctx_old.net.zc_tail = 6;
+  test_assert("zc moved flow done", tx_zc_usable(&ctx, fs) &&
+      tx_zc_defer(&ctx, fs, 100) == -1);
+  ctxs = NULL;
+
+  /* copy while the deferred bump queue fills up */
+  memset(&ctx, 0, sizeof(ctx));
+  fs->tx_zc_head = 1;
+  ctx.tx_zc_bump_num = TX_ZC_BUMPS / 2;
+  test_assert("zc queue filling copies", !tx_zc_usable(&ctx, fs));
+
+  /* full queue: merged with an earlier entry for the flow, otherwise
+   * drained, or the ack is dropped if segments are stuck */
+  ctx.net.zc_head = 1;
+  ctx.tx_zc_bump_first = 10;
+  ctx.tx_zc_bump_num = TX_ZC_BUMPS;
+  for (i = 0; i < TX_ZC_BUMPS; i++) {
+    ctx.tx_zc_bumps[i].opaque = 1000 + i;
+    ctx.tx_zc_bumps[i].db_id = fs->db_id;
+  }
+  ctx.tx_zc_bumps[20].opaque = fs->opaque;
+  tx_zc_drains = 0;
+  test_assert("zc full merged", tx_zc_room(&ctx, fs) == 0 &&
+      tx_zc_defer(&ctx, fs, 100) == 0 &&
+      ctx.tx_zc_bump_num == TX_ZC_BUMPS && tx_zc_drains == 0 &&
+      ctx.tx_zc_bumps[20].tx_bump == 100 &&
+      ctx.tx_zc_bumps[20].zc_head == 1);
+
+  ctx.tx_zc_bumps[20].opaque = 999;
+  tx_zc_stuck = 1;
+  fs->tx_sent = 1000;
+  test_assert("zc full stuck dropped", rx_ack(&ctx, fs->tx_next_seq - 500) == 0
+      && tx_zc_drains == 1 && ctx.rx_zc_drop == 1 && fs->tx_sent == 1000 &&
+      ctx.arx_num == 0 && ctx.tx_zc_bump_num == TX_ZC_BUMPS);
+
+  tx_zc_stuck = 0;
+  test_assert("zc full drained", tx_zc_room(&ctx, fs) == 0 &&
+      tx_zc_defer(&ctx, fs, 100) == 0 &&
+      tx_zc_drains == 2 && ctx.tx_zc_bump_num == TX_ZC_BUMPS &&
+      ctx.tx_zc_bumps[10].opaque == fs->opaque);
+}
+
+/* Test that ipv6 flows send segments from their template with valid
+ * checksums, and that received ipv6 segments are parsed, delivered, and
+ * acked with ipv6 headers. */
+void test_ip6(void *arg)
+{
+  static const uint8_t opts[12] = { 1, 1, 8, 10, 0, 0, 0, 1, 0, 0, 0, 0 };
+  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct flextcp_pl_flowip6 *fa = &state_base.flowip6[0];
+  struct dataplane_context ctx;
+  struct rte_mbuf *tmb = mbuf_alloc();
+  struct network_buf_handle *nbh = (struct network_buf_handle *) tmb;
+  struct pkt_tcp6 *p = network_buf_buf(nbh);
+  struct tcp_opts to;
+  uint8_t *payload;
+  uint16_t l4len;
+  uint32_t sum;
+  void *fsp;
+
+  config.shm_len = UINT64_MAX;
+  config.fp_tso_max = 0;
+  config.fp_xsumoffload = 0;
+  config.fp_delack_segs = 0;
+
+  memset(&ctx, 0, sizeof(ctx));
+  memset(fs, 0, sizeof(*fs));
+  memset(&state_base.flowooo[0], 0, sizeof(state_base.flowooo[0]));
+  flow_init(0, 4096, 4096, 123456);
+  flow_hdr6_init(0);
+  fs->ip6 = 1;
+  fs->local_ip = fs->remote_ip = t_beui32(0);
+  fs->tx_next_seq = 1000;
+  fs->tx_avail = 100;
+
+  test_assert("ip6 segment sent", fast_flows_qman(&ctx, 0, nbh, 0) == 0);
+  l4len = f_beui16(p->ip6.len);
+  test_assert("ip6 tx headers", f_beui16(p->eth.type) == ETH_TYPE_IPV6 &&
+      IP6H_V(&p->ip6) == 6 && p->ip6.next_hdr == IP_PROTO_TCP &&
+      !memcmp(&p->ip6.dest, &fa->remote_ip, sizeof(fa->remote_ip)) &&
+      f_beui16(p->tcp.dest) == TEST_PORT && l4len == 32 + 100 &&
+      f_beui32(p->tcp.seqno) == 1000);
+  sum = rte_ipv6_phdr_cksum((void *) &p->ip6, 0) +
+    rte_raw_cksum((void *) &p->tcp, l4len);
+  sum = (sum & 0xffff) + (sum >> 16);
+  test_assert("ip6 tx tcp checksum", sum == 0xffff);
+
+  /* data segment from the peer */
+  p = network_buf_bufoff(nbh);
+  memset(p, 0, sizeof(*p));
+  p->eth.type = t_beui16(ETH_TYPE_IPV6);
+  IP6H_VTCFL_SET(&p->ip6, 6, 0, 0);
+  p->ip6.next_hdr = IP_PROTO_TCP;
+  p->ip6.hop_limit = 64;
+  p->ip6.src = fa->remote_ip;
+  p->ip6.dest = fa->local_ip;
+  p->ip6.len = t_beui16(sizeof(p->tcp) + sizeof(opts) + 100);
+  p->tcp.src = t_beui16(TEST_PORT);
+  p->tcp.dest = t_beui16(TEST_LPORT);
+  p->tcp.seqno = t_beui32(0);
+  p->tcp.ackno = t_beui32(fs->tx_next_seq);
+  p->tcp.wnd = t_beui16(1024);
+  TCPH_HDRLEN_FLAGS_SET(&p->tcp, 8, TCP_ACK);
+  memcpy(p + 1, opts, sizeof(opts));
+  payload = (uint8_t *) (p + 1) + sizeof(opts);
+  memset(payload, 0x5a, 100);
+  p->tcp.chksum = rte_ipv6_udptcp_cksum((void *) &p->ip6, (void *) &p->tcp);
+  tmb->data_len = sizeof(*p) + sizeof(opts) + 100;
+
+  config.fp_rx_xsum = 1;
+  fsp = fs;
+  test_assert("ip6 rx parsed",
+      fast_flows_packet_parse(&ctx, &nbh, &fsp, &to, 1) == 0 && fsp == fs);
+  test_assert("ip6 rx ts found",
+      (uint8_t *) to.ts == (uint8_t *) (p + 1) + 2);
+
+  payload[99] ^= 1;
+  fsp = fs;
+  test_assert("ip6 rx bad checksum dropped",
+      fast_flows_packet_parse(&ctx, &nbh, &fsp, &to, 1) == 1 && fsp == NULL);
+  payload[99] ^= 1;
+  config.fp_rx_xsum = 0;
+
+  test_assert("ip6 rx delivered with ack",
+      fast_flows_packet(&ctx, &nbh, 1, fs, &to, 0) == 1);
+  test_assert("ip6 rx payload", fs->rx_next_seq == 100 &&
+      ((uint8_t *) (uintptr_t) fs->rx_base)[99] == 0x5a);
+  p = network_buf_bufoff(ctx.tx_handles[0]);
+  test_assert("ip6 ack headers", ctx.tx_num == 1 &&
+      f_beui16(p->eth.type) == ETH_TYPE_IPV6 &&
+      f_beui16(p->ip6.len) == sizeof(p->tcp) + 12 &&
+      f_beui32(p->tcp.ackno) == 100);
+
+  free(tmb);
+}
+
+void test_flow_owner(void *arg)
+{
+  struct flextcp_pl_flowst *fs = &state_base.flowst[0];
+  struct dataplane_context ctx;
+  struct rte_mbuf *tmb = mbuf_alloc();
+  struct network_buf_handle *nbh = (struct network_buf_handle *) tmb;
+  uint32_t tx_seq, rx_seq;
+  uint8_t flags;
+
+  memset(&ctx, 0, sizeof(ctx));
+  flow_init(0, 1024, 1024, 123456);
+  fs->tx_next_seq = 1000;
+  fs->rx_next_seq = 2000;
+
+  qm_set_op.got_op = 0;
+  fast_flows_setrate(&ctx, 0, 4321);
+  test_assert("setrate updates flow", fs->tx_rate == 4321);
+  test_assert("setrate updates qman", qm_set_op.got_op &&
+      qm_set_op.id == 0 && qm_set_op.rate == 4321 &&
+      qm_set_op.flags == QMAN_SET_RATE);
+
+  /* delayed ack for a flow group handed to another core is dropped */
+  state_base.flow_group_steering[fs->flow_group] = 1;
+  test_assert("no ack from non-owner",
+      fast_flows_ack(&ctx, 0, nbh, 0) == -1);
+  state_base.flow_group_steering[fs->flow_group] = 0;
+  test_assert("ack from owner", fast_flows_ack(&ctx, 0, nbh, 0) == 0);
+
+  /* fired queues of moved flows are collected for a batched handoff, and
+   * flows moved again stay armed here instead of being forwarded directly */
+  state_base.flow_group_steering[fs->flow_group] = 1;
+  qm_set_op.got_op = 0;
+  test_assert("no segment from non-owner",
+      fast_flows_qman(&ctx, 0, nbh, 0) == -1);
+  test_assert("moved flow collected for handoff", ctx.qman_fwd_num == 1 &&
+      ctx.qman_fwd_fss[0] == fs && !qm_set_op.got_op);
+  ctx.qman_fwd_num = 0;
+  test_assert("flow moved again", fast_flows_qman_fwd(&ctx, fs) == 0);
+  test_assert("flow moved again parked in qman", qm_set_op.got_op &&
+      qm_set_op.id == 0 && qm_set_op.rate == 0 && qm_set_op.avail == 1 &&
+      (qm_set_op.flags & QMAN_ADD_AVAIL) != 0);
+  state_base.flow_group_steering[fs->flow_group] = 0;
+
+  /* flow ids beyond 16 bits are parked and re-armed under their full id */
+  flow_init(70000, 1024, 1024, 654321);
+  state_base.flow_group_steering[state_base.flowst[70000].flow_group] = 1;
+  qm_set_op.got_op = 0;
+  fast_flows_qman_fwd(&ctx, &state_base.flowst[70000]);
+  test_assert("high flow id parked", qm_set_op.got_op &&
+      qm_set_op.id == 70000);
+  state_base.flow_group_steering[state_base.flowst[70000].flow_group] = 0;
+  qm_set_op.got_op = 0;
+  fast_flows_qman_fwd(&ctx, &state_base.flowst[70000]);
+  test_assert("high flow id re-armed", qm_set_op.got_op &&
+      qm_set_op.id == 70000 && (qm_set_op.flags & QMAN_SET_AVAIL) != 0);
+
+  fs->flags |= FLEXNIC_PL_FLOWST_RXFIN;
+  fast_flows_disable(&ctx, 0, &tx_seq, &rx_seq, &flags);
+  test_assert("disable sets slowpath",
+      (fs->flags & FLEXNIC_PL_FLOWST_SLOWPATH) != 0);
+  test_assert("disable seqs", tx_seq == 1000 && rx_seq == 2000);
+  test_assert("disable flags", flags == FLEXTCP_PL_KTX_FLRXCLOSED);
+  test_assert("no ack after disable", fast_flows_ack(&ctx, 0, nbh, 0) == -1);
+
+  free(tmb);
+}
+
+/* tag for entries of bucket b to have bucket alt as their other one */
+static uint16_t flowht_tag(uint32_t b, uint32_t alt)
+{
+  uint32_t t;
+
+  for (t = 1; t <= UINT16_MAX; t++) {
+    if (FLEXNIC_PL_FLOWHT_ALTBUCKET(b, t) == alt)
+      return t;
+  }
+  test_error("no tag for bucket found");
+  return 0;
+}
+
+/* add flow with hash h to the table, as nicif_connection_add does */
+static void flowht_add(uint32_t fid, uint32_t h)
+{
+  struct flextcp_pl_flowst *fs = &state_base.flowst[fid];
+  uint32_t b, s;
+
+  memset(fs, 0, sizeof(*fs));
+  fs->local_ip = t_beui32(TEST_LIP);
+  fs->remote_ip = t_beui32(TEST_IP);
+  fs->local_port = t_beui16(TEST_LPORT);
+  fs->remote_port = t_beui16(10000 + fid);
+
+  if (flow_slot_alloc(h, &b, &s) != 0)
+    test_error("flow_slot_alloc failed");
+  state_base.flowht[b].flow_ids[s] = fid;
+  state_base.flowht[b].tags[s] = FLEXNIC_PL_FLOWHT_TAG(h);
+}
+
+/* look up flow of a packet on flow fid, with hash h from the NIC */
+static struct flextcp_pl_flowst *flowht_lookup(uint32_t fid, uint32_t h)
+{
+  struct rte_mbuf *tmb = mbuf_alloc();
+  struct network_buf_handle *nbh = (struct network_buf_handle *) tmb;
+  struct pkt_tcp *p = pkt_init(tmb, NULL, 0);
+  struct dataplane_context ctx;
+  void *fs;
+
+  p->ip.src = t_beui32(TEST_IP);
+  p->ip.dest = t_beui32(TEST_LIP);
+  p->tcp.src = t_beui16(10000 + fid);
+  p->tcp.dest = t_beui16(TEST_LPORT);
+  tmb->ol_flags |= PKT_RX_RSS_HASH;
+  tmb->hash.rss = h;
+
+  memset(&ctx, 0, sizeof(ctx));
+  fast_flows_packet_fss(&ctx, &nbh, &fs, 1);
+  free(tmb);
+  return fs;
+}
+
+/* number of used slots in bucket b */
+static unsigned flowht_used(uint32_t b)
+{
+  unsigned s, n = 0;
+
+  for (s = 0; s < FLEXNIC_PL_FLOWHT_SLOTS; s++)
+    n += (state_base.flowht[b].tags[s] != 0);
+  return n;
+}
+
+/* Test that inserting a flow whose buckets are both full moves entries along
+ * a displacement chain, and that lookups find the moved flows as well as the
+ * new one. */
+void test_flowht_displace(void *arg)
+{
+  const uint32_t slots = FLEXNIC_PL_FLOWHT_SLOTS, fid_new = 3 * slots;
+  const uint16_t t_new = 0x1234;
+  uint32_t b0 = 100, b1, b2 = 200, b3 = 300;
+  uint32_t hashes[3 * FLEXNIC_PL_FLOWHT_SLOTS + 1];
+  uint32_t i, s, fid_moved;
+  int all_found = 1;
+
+  memset(state_base.flowht, 0, sizeof(state_base.flowht));
+  config.fp_rss_flowhash = 1;
+
+  b1 = FLEXNIC_PL_FLOWHT_ALTBUCKET(b0, t_new);
+  if (b1 == b2 || b1 == b3)
+    test_error("alternate bucket of new flow collides");
+
+  /* b2 full with entries that can move to the empty b3, both buckets of the
+   * new flow full with entries that can only move to b2 */
+  for (i = 0; i < slots; i++) {
+    hashes[i] = ((uint32_t) flowht_tag(b2, b3) << 16) | b2;
+    hashes[slots + i] = ((uint32_t) flowht_tag(b0, b2) << 16) | b0;
+    hashes[2 * slots + i] = ((uint32_t) flowht_tag(b1, b2) << 16) | b1;
+  }
+  hashes[fid_new] = ((uint32_t) t_new << 16) | b0;
+  for (i = 0; i < fid_new; i++)
+    flowht_add(i, hashes[i]);
+  test_assert("buckets full", flowht_used(b0) == slots &&
+      flowht_used(b1) == slots && flowht_used(b2) == slots &&
+      flowht_used(b3) == 0);
+
+  flowht_add(fid_new, hashes[fid_new]);
+  test_assert("chain moved one entry to b3", flowht_used(b0) == slots &&
+      flowht_used(b1) == slots && flowht_used(b2) == slots &&
+      flowht_used(b3) == 1);
+  test_assert("bucket versions even after moves",
+      state_base.flowht[b2].version == 4 && state_base.flowht[b3].version == 2
+      && (state_base.flowht[b0].version | state_base.flowht[b1].version) % 2
+      == 0);
+
+  for (s = 0; state_base.flowht[b3].tags[s] == 0; s++);
+  fid_moved = state_base.flowht[b3].flow_ids[s];
+  test_assert("moved flow found", fid_moved < slots &&
+      flowht_lookup(fid_moved, hashes[fid_moved]) ==
+      &state_base.flowst[fid_moved]);
+  test_assert("new flow found", flowht_lookup(fid_new, hashes[fid_new]) ==
+      &state_base.flowst[fid_new]);
+
+  for (i = 0; i < fid_new; i++) {
+    if (flowht_lookup(i, hashes[i]) != &state_base.flowst[i])
+      all_found = 0;
+  }
+  test_assert("all flows found", all_found);
+
+  config.fp_rss_flowhash = 0;
+}
+
 int main(int argc, char *argv[])
 {
   int ret = 0;
@@ -318,5 +1533,53 @@ int main(int argc, char *argv[])
   if (test_subcase("retransmit", test_retransmit, NULL))
     ret = 1;
 
+  if (test_subcase("parse timestamp layouts", test_parse_ts_layouts, NULL))
+    ret = 1;
+
+  if (test_subcase("rx checksum verification", test_rx_xsum, NULL))
+    ret = 1;
+
+  if (test_subcase("rx ooo multiple intervals", test_rx_ooo_multi, NULL))
+    ret = 1;
+
+  if (test_subcase("sack", test_sack, NULL))
+    ret = 1;
+
+  if (test_subcase("window scaling", test_wscale, NULL))
+    ret = 1;
+
+  if (test_subcase("delayed acks", test_delack, NULL))
+    ret = 1;
+
+  if (test_subcase("receive coalescing", test_gro, NULL))
+    ret = 1;
+
+  if (test_subcase("dma copy policies", test_dma_copy, NULL))
+    ret = 1;
+
+  if (test_subcase("tx super-segment chunks", test_tx_chunk, NULL))
+    ret = 1;
+
+  if (test_subcase("tx header template", test_tx_hdr_template, NULL))
+    ret = 1;
+
+  if (test_subcase("tx without timestamps", test_tx_no_ts, NULL))
+    ret = 1;
+
+  if (test_subcase("copy with checksum", test_copy_xsum, NULL))
+    ret = 1;
+
+  if (test_subcase("tx zero-copy deferred bumps", test_tx_zc_defer, NULL))
+    ret = 1;
+
+  if (test_subcase("ipv6 flow", test_ip6, NULL))
+    ret = 1;
+
+  if (test_subcase("flow owner requests", test_flow_owner, NULL))
+    ret = 1;
+
+  if (test_subcase("flow table displacement", test_flowht_displace, NULL))
+    ret = 1;
+
   return ret;
 }
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../testutils.h"
+
+/* the timing wheel is internal to the queue manager, test it directly */
+#include "../../tas/fast/qman.c"
+
+#define TICK (1U << QMAN_WHEEL_GRAN_SHIFT)
+
+struct configuration config;
+struct flextcp_pl_mem state_base;
+struct flextcp_pl_mem *fp_state = &state_base;
+
+static struct dataplane_context *ctx;
+
+static struct qman_thread *wheel_init(uint32_t ts)
+{
+  struct qman_thread *t;
+
+  config.fp_qman = CONFIG_QMAN_WHEEL;
+  if (ctx == NULL && (ctx = calloc(1, sizeof(*ctx))) == NULL)
+    test_error("allocating context failed");
+  free(ctx->qman.queues);
+  memset(ctx, 0, sizeof(*ctx));
+  if (qman_thread_init(ctx) != 0)
+    test_error("qman_thread_init failed");
+
+  t = &ctx->qman;
+  t->ts_virtual = t->ts_real = ts;
+  t->tcs[0].wheel_tick = wheel_tick(ts);
+  return t;
+}
+
+/* add rate limited queue with one chunk to send to the wheel at next_ts */
+static void wheel_add(struct qman_thread *t, uint32_t idx, uint32_t next_ts)
+{
+  struct queue *q = &t->queues[idx];
+
+  q->next_ts = next_ts;
+  q->rate = 1000000;
+  q->avail = 1;
+  q->max_chunk = 1448;
+  wheel_insert(t, &t->tcs[0], q, idx);
+  t->tcs[0].wheel_num++;
+  q->flags |= FLAG_INWHEEL;
+}
+
+static int wheel_slot_set(struct qman_thread *t, unsigned l, uint32_t tick)
+{
+  unsigned s = (tick >> (QMAN_WHEEL_BITS * l)) & WHEEL_SLOT_MASK;
+  return (t->tcs[0].wheel_bitmap[l][s / 64] >> (s % 64)) & 1;
+}
+
+static unsigned wheel_poll(struct qman_thread *t, uint32_t cur_ts,
+    unsigned num, unsigned *q_id)
+{
+  unsigned q_ids[4];
+  uint16_t q_bytes[4];
+  unsigned n;
+
+  n = poll_wheel(t, &t->tcs[0], cur_ts, num, q_ids, q_bytes);
+  if (n > 0 && q_id != NULL)
+    *q_id = q_ids[0];
+  return n;
+}
+
+/* Test that queues due before or in the current tick go into the current
+ * level 0 slot and fire right away. */
+void test_insert_past(void *arg)
+{
+  struct qman_thread *t = wheel_init(1000 * TICK);
+  unsigned id = -1;
+
+  wheel_add(t, 1, 990 * TICK);
+  test_assert("past queue in current slot", wheel_slot_set(t, 0, 1000) &&
+      !wheel_slot_set(t, 0, 990));
+  test_assert("past queue fires", wheel_poll(t, 1000 * TICK, 4, &id) == 1 &&
+      id == 1);
+
+  wheel_add(t, 2, 1000 * TICK + 5);
+  test_assert("current tick queue in current slot", wheel_slot_set(t, 0, 1000));
+  test_assert("current tick queue fires",
+      wheel_poll(t, 1000 * TICK + 5, 4, &id) == 1 && id == 2);
+}
+
+/* Test that queues in higher levels are moved down and fire on time. */
+void test_cascade(void *arg)
+{
+  struct qman_thread *t = wheel_init(0);
+  uint32_t t1 = 3 * QMAN_WHEEL_SLOTS + 5;
+  uint32_t t2 = 2 * QMAN_WHEEL_SLOTS * QMAN_WHEEL_SLOTS + 7;
+  unsigned id = -1;
+
+  wheel_add(t, 1, t1 * TICK);
+  wheel_add(t, 2, t2 * TICK);
+  test_assert("level 1 insert", wheel_slot_set(t, 1, t1));
+  test_assert("level 2 insert", wheel_slot_set(t, 2, t2));
+
+  test_assert("level 1 not early", wheel_poll(t, t1 * TICK - 1, 4, NULL) == 0);
+  test_assert("level 1 fires", wheel_poll(t, t1 * TICK, 4, &id) == 1 &&
+      id == 1);
+  test_assert("level 2 not early", wheel_poll(t, t2 * TICK - 1, 4, NULL) == 0);
+  test_assert("level 2 fires", wheel_poll(t, t2 * TICK, 4, &id) == 1 &&
+      id == 2);
+  test_assert("wheel empty", t->tcs[0].wheel_num == 0);
+}
+
+/* Test that a poll without budget, e.g. after higher classes, still advances
+ * virtual time up to the queues due. */
+void test_poll_nobudget(void *arg)
+{
+  struct qman_thread *t = wheel_init(0);
+  unsigned id = -1;
+
+  wheel_add(t, 1, 100 * TICK);
+
+  test_assert("no queue fired", wheel_poll(t, 50 * TICK, 0, NULL) == 0);
+  test_assert("virtual time caught up", t->ts_virtual == 50 * TICK &&
+      t->tcs[0].wheel_tick == 50);
+
+  test_assert("no queue fired", wheel_poll(t, 200 * TICK, 0, NULL) == 0);
+  test_assert("virtual time at due queue", t->ts_virtual == 100 * TICK &&
+      t->tcs[0].wheel_tick == 100);
+
+  test_assert("due queue fires", wheel_poll(t, 200 * TICK, 4, &id) == 1 &&
+      id == 1);
+}
+
+/* Test that an empty wheel jumps to the current time, and queues inserted at
+ * the virtual time afterwards fire right away. */
+void test_empty_resync(void *arg)
+{
+  struct qman_thread *t = wheel_init(0);
+  uint32_t now = 300000 * TICK;
+  unsigned id = -1;
+
+  test_assert("empty poll", wheel_poll(t, now, 4, NULL) == 0);
+  test_assert("resynced", t->ts_virtual == now &&
+      t->tcs[0].wheel_tick == wheel_tick(now));
+
+  wheel_add(t, 1, t->ts_virtual);
+  wheel_add(t, 2, t->ts_virtual + 300 * TICK);
+  test_assert("queue at virtual time fires", wheel_poll(t, now, 4, &id) == 1 &&
+      id == 1);
+  test_assert("later queue not early",
+      wheel_poll(t, now + 300 * TICK - 1, 4, NULL) == 0);
+  test_assert("later queue fires", wheel_poll(t, now + 300 * TICK, 4, &id) == 1
+      && id == 2);
+}
+
+int main(int argc, char *argv[])
+{
+  int ret = 0;
+
+  if (test_subcase("wheel insert in past", test_insert_past, NULL))
+    ret = 1;
+
+  if (test_subcase("wheel cascade", test_cascade, NULL))
+    ret = 1;
+
+  if (test_subcase("wheel poll without budget", test_poll_nobudget, NULL))
+    ret = 1;
+
+  if (test_subcase("wheel empty resync", test_empty_resync, NULL))
+    ret = 1;
+
+  return ret;
+}
@@ -1,6 +1,6 @@
 include mk/subdir_pre.mk
 
-tools := tracetool statetool scaletool
+tools := tracetool statetool scaletool ratetool
 execs := $(addprefix $(d)/, $(tools))
 TOOLS_OBJS := $(addsuffix .o,$(execs))
 
@@ -8,6 +8,7 @@ $(TOOLS_OBJS): CPPFLAGS += -Ilib/tas/include
 
 tools/statetool: tools/statetool.o lib/libtas.so
 tools/scaletool: tools/scaletool.o lib/libtas.so
+tools/ratetool: tools/ratetool.o lib/libtas.so
 
 DEPS += $(TOOLS_OBJS:.o=.d)
 CLEAN += $(TOOLS_OBJS) $(execs)
@@ -26,6 +26,7 @@
 #include <stdlib.h>
 #include <inttypes.h>
 #include <string.h>
+#include <arpa/inet.h>
 
 #include <tas_ll_connect.h>
 #include <tas_memif.h>
@@ -103,7 +104,9 @@ static int dump_appctx(uint16_t db_id)
 static int dump_flow(uint32_t flow_id)
 {
   struct flextcp_pl_flowst *fs;
+  struct flextcp_pl_flowstats *st;
   uint64_t mac = 0;
+  char lip6[INET6_ADDRSTRLEN], rip6[INET6_ADDRSTRLEN];
 
   if (flow_id >= FLEXNIC_PL_FLOWST_NUM) {
     fprintf(stderr, "dump_appctx: invalid doorbell id %u\n", flow_id);
@@ -111,6 +114,7 @@ static int dump_flow(uint32_t flow_id)
   }
 
   fs = &plm->flowst[flow_id];
+  st = &plm->flowstats[flow_id];
 
   /* skip flows without receive and transmit buffers */
   if (fs->rx_len == 0 && fs->tx_len == 0) {
@@ -121,6 +125,7 @@ static int dump_flow(uint32_t flow_id)
   printf("flow %u {\n"
          "  opaque=%016"PRIx64"\n"
          "  db_id=%03u\n"
+         "  tc=%u\n"
          "  flag_slowpath=%u\n"
          "  flag_ecn=%u\n"
          "  flag_txfin=%u\n"
@@ -134,13 +139,14 @@ static int dump_flow(uint32_t flow_id)
          "     remote_mac=%012"PRIx64"\n"
          "  }\n"
          "  rx {\n"
-         "            base=%016llx\n"
+         "            base=%016"PRIx64"\n"
          "             len=%08x\n"
          "           avail=%08x\n"
          "    remote_avail=%08x\n"
          "        next_pos=%08x\n"
          "        next_seq=%010u\n"
          "      dupack_cnt=%08x\n"
+         "       wnd_scale=%u\n"
 #ifdef FLEXNIC_PL_OOO_RECV
          "       ooo_start=%08x\n"
          "         ooo_len=%08x\n"
@@ -154,6 +160,8 @@ static int dump_flow(uint32_t flow_id)
          "        next_pos=%08x\n"
          "        next_seq=%010u\n"
          "         next_ts=%08x\n"
+         "       wnd_scale=%u\n"
+         "             mss=%u\n"
          "  }\n"
          "  cc {\n"
          "         tx_rate=%10u\n"
@@ -163,23 +171,33 @@ static int dump_flow(uint32_t flow_id)
          "    rx_ecn_bytes=%10u\n"
          "         rtt_est=%10u\n"
          "  }\n"
-         "}\n", flow_id, fs->opaque, fs->db_id,
-      !!(fs->rx_base_sp & FLEXNIC_PL_FLOWST_SLOWPATH),
-      !!(fs->rx_base_sp & FLEXNIC_PL_FLOWST_ECN),
-      !!(fs->rx_base_sp & FLEXNIC_PL_FLOWST_TXFIN),
-      !!(fs->rx_base_sp & FLEXNIC_PL_FLOWST_RXFIN),
+         "}\n", flow_id, fs->opaque, fs->db_id, fs->tc,
+      !!(fs->flags & FLEXNIC_PL_FLOWST_SLOWPATH),
+      !!(fs->flags & FLEXNIC_PL_FLOWST_ECN),
+      !!(fs->flags & FLEXNIC_PL_FLOWST_TXFIN),
+      !!(fs->flags & FLEXNIC_PL_FLOWST_RXFIN),
       fs->bump_seq,
       f_beui32(fs->local_ip), f_beui16(fs->local_port), f_beui32(fs->remote_ip),
       f_beui16(fs->remote_port), mac,
-      (fs->rx_base_sp & FLEXNIC_PL_FLOWST_RX_MASK), fs->rx_len, fs->rx_avail,
+      fs->rx_base, fs->rx_len, fs->rx_avail,
       fs->rx_remote_avail, fs->rx_next_pos, fs->rx_next_seq, fs->rx_dupack_cnt,
+      fs->rx_wscale,
 #ifdef FLEXNIC_PL_OOO_RECV
-      fs->rx_ooo_start, fs->rx_ooo_len,
+      plm->flowooo[flow_id].iv[0].start, plm->flowooo[flow_id].iv[0].len,
 #endif
       fs->tx_base, fs->tx_len, fs->tx_avail, fs->tx_sent, fs->tx_next_pos,
-      fs->tx_next_seq, fs->tx_next_ts,
-      fs->tx_rate, fs->cnt_tx_drops, fs->cnt_rx_acks, fs->cnt_rx_ack_bytes,
-      fs->cnt_rx_ecn_bytes, fs->rtt_est);
+      fs->tx_next_seq, fs->tx_next_ts, fs->tx_wscale, fs->mss,
+      fs->tx_rate, st->cnt_tx_drops, st->cnt_rx_acks, st->cnt_rx_ack_bytes,
+      st->cnt_rx_ecn_bytes, st->rtt_est);
+
+  if (fs->ip6) {
+    inet_ntop(AF_INET6, &plm->flowip6[flow_id].local_ip, lip6, sizeof(lip6));
+    inet_ntop(AF_INET6, &plm->flowip6[flow_id].remote_ip, rip6, sizeof(rip6));
+    printf("flow %u addr6 {\n"
+           "       local_ip=%s\n"
+           "      remote_ip=%s\n"
+           "}\n", flow_id, lip6, rip6);
+  }
 
   return 0;
 }